@@ -79,7 +79,7 @@ typedef struct ctf_link_sym
 /* Share all types thare are not in conflict.  The default.  */
 #define CTF_LINK_SHARE_UNCONFLICTED 0x0
 
-/* Share only types that are used by multiple inputs.  Not implemented yet.  */
+/* Share only types that are used by multiple inputs.  */
 #define CTF_LINK_SHARE_DUPLICATED 0x1
 
 /* Symbolic names for CTF sections.  */
@@ -112,6 +112,17 @@ typedef struct ctf_membinfo
   unsigned long ctm_offset;	/* Offset of member in bits.  */
 } ctf_membinfo_t;
 
+/* One entry in the flattened layout of a type returned by ctf_type_layout():
+   the type itself, or one of its members, recursively.  */
+
+typedef struct ctf_layout_ent
+{
+  const char *ctl_name;		/* Member name ("" for the type itself).  */
+  ctf_id_t ctl_type;		/* Type of member (not resolved).  */
+  unsigned long ctl_offset;	/* Offset of member in bits.  */
+  int ctl_depth;		/* Nesting depth (0 for the type itself).  */
+} ctf_layout_ent_t;
+
 typedef struct ctf_arinfo
 {
   ctf_id_t ctr_contents;	/* Type of array contents.  */
@@ -139,6 +150,24 @@ typedef struct ctf_snapshot_id
 
 #define	CTF_FUNC_VARARG	0x1	/* Function arguments end with varargs.  */
 
+/* Statistics returned by ctf_file_stats() and ctf_process_stats(), if libctf
+   was built with stats=yes.  Times are in nanoseconds.  Otherwise, the stats
+   are zeroed, ctf_file_stats() fails with ECTF_NOTSUP, and
+   ctf_process_stats() returns ECTF_NOTSUP.  */
+
+typedef struct ctf_stats
+{
+  uint64_t cst_hash_lookups;	/* Lookups in hash tables.  */
+  uint64_t cst_hash_probes;	/* Hash slots or chain entries examined.  */
+  uint64_t cst_hash_collisions;	/* Lookups that examined more than one.  */
+  uint64_t cst_bytes_decompressed; /* Bytes of CTF data decompressed.  */
+  uint64_t cst_init_types_ns;	/* Time spent indexing types on open.  */
+  uint64_t cst_serialize_ns;	/* Time spent in ctf_update().  */
+  uint64_t cst_link_ns;		/* Time spent in ctf_link().  */
+  uint64_t cst_add_type_conflicts; /* ctf_add_type() ECTF_CONFLICT failures.  */
+  uint64_t cst_str_atoms;	/* Strings added to string tables.  */
+} ctf_stats_t;
+
 /* Functions that return a ctf_id_t use the following value to indicate failure.
    ctf_errno() can be used to obtain an error code.  Functions that return
    a straight integral -1 also use ctf_errno().  */
@@ -243,6 +272,7 @@ typedef int ctf_archive_raw_member_f (const char *name, const void *content,
 				      size_t len, void *arg);
 typedef char *ctf_dump_decorate_f (ctf_sect_names_t sect,
 				   char *line, void *arg);
+typedef int ctf_dump_write_f (const char *buf, size_t len, void *arg);
 
 typedef struct ctf_dump_state ctf_dump_state_t;
 
@@ -282,6 +312,8 @@ extern ctf_file_t *ctf_arc_open_by_name_sections (const ctf_archive_t *,
 						  const ctf_sect_t *,
 						  const ctf_sect_t *,
 						  const char *, int *);
+extern int ctf_arc_set_cache_budget (ctf_archive_t *, size_t);
+extern int ctf_arc_prefetch (const ctf_archive_t *, const char *, int *);
 
 /* The next functions return or close real CTF files, or write out CTF archives,
    not opaque containers around either.  */
@@ -296,6 +328,7 @@ extern int ctf_arc_write (const char *, ctf_file_t **, size_t,
 			  const char **, size_t);
 extern int ctf_arc_write_fd (int, ctf_file_t **, size_t, const char **,
 			     size_t);
+extern int ctf_set_arc_hash (ctf_file_t *, int);
 
 extern const char *ctf_cuname (ctf_file_t *);
 extern int ctf_cuname_set (ctf_file_t *, const char *);
@@ -307,6 +340,7 @@ extern int ctf_type_ischild (ctf_file_t *, ctf_id_t);
 
 extern int ctf_import (ctf_file_t *, ctf_file_t *);
 extern int ctf_setmodel (ctf_file_t *, int);
+extern int ctf_set_concurrent (ctf_file_t *, int);
 extern int ctf_getmodel (ctf_file_t *);
 
 extern void ctf_setspecific (ctf_file_t *, void *);
@@ -320,14 +354,22 @@ extern int ctf_func_info (ctf_file_t *, unsigned long, ctf_funcinfo_t *);
 extern int ctf_func_args (ctf_file_t *, unsigned long, uint32_t, ctf_id_t *);
 extern int ctf_func_type_info (ctf_file_t *, ctf_id_t, ctf_funcinfo_t *);
 extern int ctf_func_type_args (ctf_file_t *, ctf_id_t, uint32_t, ctf_id_t *);
+extern int ctf_func_info_by_name (ctf_file_t *, const char *,
+				  ctf_funcinfo_t *);
+extern int ctf_func_args_by_name (ctf_file_t *, const char *, uint32_t,
+				  ctf_id_t *);
 
 extern ctf_id_t ctf_lookup_by_name (ctf_file_t *, const char *);
+extern int ctf_lookup_by_names (ctf_file_t *, const char **, size_t,
+				ctf_id_t *);
 extern ctf_id_t ctf_lookup_by_symbol (ctf_file_t *, unsigned long);
+extern ctf_id_t ctf_lookup_by_symbol_name (ctf_file_t *, const char *);
 extern ctf_id_t ctf_lookup_variable (ctf_file_t *, const char *);
 
 extern ctf_id_t ctf_type_resolve (ctf_file_t *, ctf_id_t);
 extern char *ctf_type_aname (ctf_file_t *, ctf_id_t);
 extern char *ctf_type_aname_raw (ctf_file_t *, ctf_id_t);
+extern const char *ctf_type_name_ref (ctf_file_t *, ctf_id_t);
 extern ssize_t ctf_type_lname (ctf_file_t *, ctf_id_t, char *, size_t);
 extern char *ctf_type_name (ctf_file_t *, ctf_id_t, char *, size_t);
 extern ssize_t ctf_type_size (ctf_file_t *, ctf_id_t);
@@ -337,6 +379,8 @@ extern ctf_id_t ctf_type_reference (ctf_file_t *, ctf_id_t);
 extern ctf_id_t ctf_type_pointer (ctf_file_t *, ctf_id_t);
 extern int ctf_type_encoding (ctf_file_t *, ctf_id_t, ctf_encoding_t *);
 extern int ctf_type_visit (ctf_file_t *, ctf_id_t, ctf_visit_f *, void *);
+extern const ctf_layout_ent_t *ctf_type_layout (ctf_file_t *, ctf_id_t,
+						size_t *);
 extern int ctf_type_cmp (ctf_file_t *, ctf_id_t, ctf_file_t *, ctf_id_t);
 extern int ctf_type_compat (ctf_file_t *, ctf_id_t, ctf_file_t *, ctf_id_t);
 
@@ -370,6 +414,9 @@ extern int ctf_archive_raw_iter (const ctf_archive_t *,
 extern char *ctf_dump (ctf_file_t *, ctf_dump_state_t **state,
 		       ctf_sect_names_t sect, ctf_dump_decorate_f *,
 		       void *arg);
+extern int ctf_dump_stream (ctf_file_t *, ctf_sect_names_t sect,
+			    const char *prefix, ctf_dump_write_f *,
+			    void *arg);
 
 extern ctf_id_t ctf_add_array (ctf_file_t *, uint32_t,
 			       const ctf_arinfo_t *);
@@ -416,11 +463,21 @@ extern int ctf_update (ctf_file_t *);
 extern ctf_snapshot_id_t ctf_snapshot (ctf_file_t *);
 extern int ctf_rollback (ctf_file_t *, ctf_snapshot_id_t);
 extern int ctf_discard (ctf_file_t *);
+extern int ctf_set_incremental (ctf_file_t *, int);
 extern int ctf_write (ctf_file_t *, int);
 extern int ctf_gzwrite (ctf_file_t *fp, gzFile fd);
 extern int ctf_compress_write (ctf_file_t * fp, int fd);
 extern unsigned char *ctf_write_mem (ctf_file_t *, size_t *, size_t threshold);
 
+/* Compressors for ctf_set_compressor().  zlib is always available: the others
+   only if libctf was built with them.  */
+
+#define CTF_COMPRESSOR_ZLIB 0
+#define CTF_COMPRESSOR_ZSTD CTF_F_ZSTD
+#define CTF_COMPRESSOR_LZ4 CTF_F_LZ4
+
+extern int ctf_set_compressor (ctf_file_t *, uint32_t);
+
 /* The ctf_link interfaces are not stable yet.  No guarantees!  */
 
 extern int ctf_link_add_ctf (ctf_file_t *, ctf_archive_t *, const char *);
@@ -444,9 +501,16 @@ typedef char *ctf_link_memb_name_changer_f (ctf_file_t *,
 					    const char *, void *);
 extern void ctf_link_set_memb_name_changer
   (ctf_file_t *, ctf_link_memb_name_changer_f *, void *);
+extern int ctf_link_set_threads (ctf_file_t *, unsigned int);
+extern int ctf_link_add_previous (ctf_file_t *, ctf_archive_t *);
+extern int ctf_link_set_memory_budget (ctf_file_t *, size_t);
 
 extern void ctf_setdebug (int debug);
 extern int ctf_getdebug (void);
+extern void ctf_set_open_threads (unsigned int);
+extern unsigned int ctf_get_open_threads (void);
+extern int ctf_file_stats (ctf_file_t *, ctf_stats_t *);
+extern int ctf_process_stats (ctf_stats_t *);
 
 #ifdef	__cplusplus
 }
@@ -51,10 +51,10 @@ extern "C"
    | header | labels | objects |   info   | index  |  index   |...
    +--------+--------+---------+----------+--------+----------+...
 
-   ...+----------+-------+--------+
-   ...| variable | data  | string |
-   ...|   info   | types | table  |
-      +----------+-------+--------+
+   ...+----------+-------+-------+--------+
+   ...| variable | data  | name  | string |
+   ...|   info   | types | index | table  |
+      +----------+-------+-------+--------+
 
    The file header stores a magic number and version information, encoding
    flags, and the byte offset of each of the sections relative to the end of the
@@ -95,6 +95,11 @@ extern "C"
    earlier nodes, but this is not required: nodes can point to later nodes,
    particularly structure and union members.
 
+   The optional name index records the hash tables libctf uses to look up types
+   by name, exactly as the writer laid them out, so that readers can use them
+   in place rather than rebuilding them on every open.  It is described below,
+   next to ctf_nameidx_t.
+
    Strings are recorded as a string table ID (0 or 1) and a byte offset into the
    string table.  String table 0 is the internal CTF string table.  String table
    1 is the external string table, which is the string table associated with the
@@ -171,6 +176,7 @@ typedef struct ctf_header
   uint32_t cth_typeoff;		/* Offset of type section.  */
   uint32_t cth_stroff;		/* Offset of string section.  */
   uint32_t cth_strlen;		/* Length of string section in bytes.  */
+  uint32_t cth_nameidxoff;	/* Offset of name index (not in v3).  */
 } ctf_header_t;
 
 #define cth_magic   cth_preamble.ctp_magic
@@ -197,9 +203,25 @@ typedef struct ctf_header
 #endif	/* !NO_COMPAT */
 
 #define CTF_VERSION_3 4
-#define CTF_VERSION CTF_VERSION_3 /* Current version.  */
+#define CTF_VERSION_4 5
+#define CTF_VERSION CTF_VERSION_4 /* Current version.  */
 
 #define CTF_F_COMPRESS	0x1	/* Data buffer is compressed by libctf.  */
+#define CTF_F_ZSTD	0x4	/* Compressed with zstd, not zlib.  */
+#define CTF_F_LZ4	0x8	/* Compressed with lz4 (frame format), not zlib.  */
+
+/* The compressor is named by at most one of these bits, alongside
+   CTF_F_COMPRESS: if none is set, a compressed data buffer is a zlib
+   stream.  */
+
+#define CTF_F_COMPRESSOR (CTF_F_ZSTD | CTF_F_LZ4)
+
+/* v4 is the same as v3 except for the name index.  v3 headers lack the
+   trailing cth_nameidxoff field: in them, the name index section is empty and
+   the type section ends at cth_stroff.  Dicts without a name index are still
+   written as v3, so that older readers can open them.  */
+
+#define CTF_HEADER_NONAMEIDX_SIZE (sizeof (ctf_header_t) - sizeof (uint32_t))
 
 typedef struct ctf_lblent
 {
@@ -213,6 +235,41 @@ typedef struct ctf_varent
   uint32_t ctv_type;		/* Index of type of this variable.  */
 } ctf_varent_t;
 
+/* The name index section, lying between the type section and the string table,
+   contains CTF_NAMEIDX_MAX hash tables, one after another, mapping names of
+   root-visible types to type IDs: one each for structs, unions, enums and
+   everything else.
+
+   Each table is a ctf_nameidx_t, followed by cni_nbuckets uint32_t bucket
+   heads, followed by cni_nelems ctf_nameidx_ent_t chain entries.  A bucket
+   head or cne_next value is the index of an entry in this table's chain, with
+   zero (an unused entry) terminating the chain: every cne_next is less than the
+   index of the entry containing it.  The bucket for a name is its
+   ctf_hash_string() value modulo cni_nbuckets (the DJB2 hash:
+   h = h * 33 + c, starting with h = 5381).
+
+   The name index can be empty, in which case readers build the hashes
+   themselves.  */
+
+#define CTF_NAMEIDX_STRUCT 0
+#define CTF_NAMEIDX_UNION 1
+#define CTF_NAMEIDX_ENUM 2
+#define CTF_NAMEIDX_NAMES 3
+#define CTF_NAMEIDX_MAX 4
+
+typedef struct ctf_nameidx
+{
+  uint32_t cni_nbuckets;	/* Number of bucket heads.  */
+  uint32_t cni_nelems;		/* Number of chain entries, including entry 0.  */
+} ctf_nameidx_t;
+
+typedef struct ctf_nameidx_ent
+{
+  uint32_t cne_name;		/* Reference to name in string table.  */
+  uint32_t cne_next;		/* Index of next entry in hash chain.  */
+  uint32_t cne_type;		/* Type ID.  */
+} ctf_nameidx_ent_t;
+
 /* In format v2, type sizes, measured in bytes, come in two flavours.  Nearly
    all of them fit into a (UINT_MAX - 1), and thus can be stored in the ctt_size
    member of a ctf_stype_t.  The maximum value for these sizes is CTF_MAX_SIZE.
@@ -572,10 +629,16 @@ typedef struct ctf_enum
    needed between ctfa_ctfs and the unnamed ctfa_archive_modent array
    that follows it).
 
+   Archives with the magic number CTFA_MAGIC_HASH have a name hash index right
+   after the ctfa_archive_modent array: see ctf_archive_hash_t.  Archives with
+   the older CTFA_MAGIC have none.  Older readers cannot open CTFA_MAGIC_HASH
+   archives, so libctf only writes them on request.
+
    This is *not* the same as the data structure returned by the ctf_arc_*()
    functions:  this is the low-level on-disk representation.  */
 
 #define CTFA_MAGIC 0x8b47f2a4d7623eeb	/* Random.  */
+#define CTFA_MAGIC_HASH 0x3d19c5e8a0b64f71 /* Random.  */
 struct ctf_archive
 {
   /* Magic number.  (In loaded files, overwritten with the file size
@@ -606,6 +669,24 @@ typedef struct ctf_archive_modent
   uint64_t ctf_offset;
 } ctf_archive_modent_t;
 
+/* The name hash index of CTFA_MAGIC_HASH archives follows the modent array.
+   It is a ctf_archive_hash_t, then ctfah_nslots of ctf_archive_hashent_t.  A
+   name whose 32-bit FNV-1a hash is H lies in the first slot at or after
+   H % ctfah_nslots, wrapping around, whose hash is H and whose modent names
+   it; a slot with a modent of zero ends the search.  The modent is the index
+   of the name's entry in the modent array, plus one.  */
+
+typedef struct ctf_archive_hash
+{
+  uint64_t ctfah_nslots;	/* Number of slots: a power of two.  */
+} ctf_archive_hash_t;
+
+typedef struct ctf_archive_hashent
+{
+  uint32_t hash;
+  uint32_t modent;
+} ctf_archive_hashent_t;
+
 #ifdef	__cplusplus
 }
 #endif
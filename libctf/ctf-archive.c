@@ -14,186 +14,407 @@
 #include "ctf-endian.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
 #endif
 
-static off_t arc_write_one_ctf (ctf_file_t * f, int fd, size_t threshold);
 static ctf_file_t *ctf_arc_open_by_offset (const struct ctf_archive *arc,
 					   const ctf_sect_t *symsect,
 					   const ctf_sect_t *strsect,
 					   size_t offset, int *errp);
 static int sort_modent_by_name (const void *one, const void *two, void *n);
-static void *arc_mmap_header (int fd, size_t headersz);
+static int arc_check_hash (const struct ctf_archive *arc, size_t size);
+static uint32_t arc_name_hash (const char *name);
+static ctf_file_t *ctf_arc_open_cached (ctf_archive_t *arc, const char *name,
+					int *errp);
+static void ctf_arc_flush_cache (ctf_archive_t *arc);
 static void *arc_mmap_file (int fd, size_t size);
-static int arc_mmap_writeout (int fd, void *header, size_t headersz,
-			      const char **errmsg);
 static int arc_mmap_unmap (void *header, size_t headersz, const char **errmsg);
+static void arc_mmap_prefetch (const struct ctf_archive *arc, size_t size,
+			       uint64_t offset);
+
+/* One member of an archive being written, serialized (and perhaps
+   compressed) into a buffer of its own.  */
+
+typedef struct arc_write_job
+{
+  ctf_file_t *awj_fp;		/* Dict to write.  */
+  unsigned char *awj_buf;	/* Its serialized form, once written.  */
+  size_t awj_size;		/* Size of awj_buf.  */
+  int awj_err;			/* ctf_errno value, if writing failed.  */
+} arc_write_job_t;
+
+/* Serialize the dict in JOB into its buffer, compressing it if it is larger
+   than THRESHOLD.  */
+
+static void
+arc_write_one_ctf (arc_write_job_t *job, size_t threshold)
+{
+  ctf_file_t *f = job->awj_fp;
+
+  if (ctf_serialize (f) < 0)
+    {
+      job->awj_err = ctf_errno (f);
+      return;
+    }
+
+  if ((job->awj_buf = ctf_write_mem (f, &job->awj_size,
+				     f->ctf_size > threshold
+				     ? 0 : (size_t) -1)) == NULL)
+    job->awj_err = ctf_errno (f);
+}
+
+#ifdef HAVE_PTHREAD_H
+#define ARC_WRITE_SEEN ((void *) 1)
+#define ARC_WRITE_SHARED ((void *) 2)
+
+typedef struct arc_write_pool
+{
+  arc_write_job_t *awp_jobs;
+  size_t awp_njobs;
+  size_t awp_threshold;
+  size_t awp_next;		/* Next job to do.  */
+  pthread_mutex_t awp_lock;	/* Protects awp_next.  */
+} arc_write_pool_t;
+
+/* Write members taken from the pool until there are none left.  */
+
+static void *
+arc_write_worker (void *arg)
+{
+  arc_write_pool_t *pool = (arc_write_pool_t *) arg;
+
+  for (;;)
+    {
+      arc_write_job_t *job = NULL;
+
+      pthread_mutex_lock (&pool->awp_lock);
+      if (pool->awp_next < pool->awp_njobs)
+	job = &pool->awp_jobs[pool->awp_next++];
+      pthread_mutex_unlock (&pool->awp_lock);
+
+      if (job == NULL)
+	break;
+
+      if (job->awj_err == 0)
+	arc_write_one_ctf (job, pool->awp_threshold);
+    }
+  return NULL;
+}
+#endif
+
+/* Serialize all the NJOBS members in JOBS into their buffers, using up to
+   NTHREADS threads.  Serializing a child reads its parent, so any member that
+   is the parent of another (or that appears more than once) is serialized
+   before the threads start; the others are independent of each other.  */
+
+static void
+arc_write_members (arc_write_job_t *jobs, size_t njobs, size_t threshold,
+		   unsigned int nthreads)
+{
+  size_t i;
+
+#ifdef HAVE_PTHREAD_H
+  if (nthreads > njobs)
+    nthreads = njobs;
+
+  if (nthreads > 1)
+    {
+      arc_write_pool_t pool;
+      pthread_t *threads;
+      unsigned int nstarted = 0;
+      ctf_dynhash_t *shared;
+
+      if ((shared = ctf_dynhash_create (ctf_hash_integer, ctf_hash_eq_integer,
+					NULL, NULL)) == NULL)
+	goto serial;
+
+      /* Map each member to SEEN, or to SHARED if it must be serialized up
+	 front.  */
+
+      for (i = 0; i < njobs; i++)
+	{
+	  ctf_file_t *fp = jobs[i].awj_fp;
+	  void *seen = ctf_dynhash_lookup (shared, fp);
+
+	  if ((fp->ctf_parent != NULL
+	       && ctf_dynhash_insert (shared, fp->ctf_parent,
+				      ARC_WRITE_SHARED) < 0)
+	      || ctf_dynhash_insert (shared, fp, seen ? ARC_WRITE_SHARED
+				     : ARC_WRITE_SEEN) < 0)
+	    {
+	      ctf_dynhash_destroy (shared);
+	      goto serial;
+	    }
+	}
+
+      for (i = 0; i < njobs; i++)
+	if (ctf_dynhash_lookup (shared, jobs[i].awj_fp) == ARC_WRITE_SHARED
+	    && ctf_serialize (jobs[i].awj_fp) < 0)
+	  jobs[i].awj_err = ctf_errno (jobs[i].awj_fp);
+      ctf_dynhash_destroy (shared);
+
+      pool.awp_jobs = jobs;
+      pool.awp_njobs = njobs;
+      pool.awp_threshold = threshold;
+      pool.awp_next = 0;
+
+      if ((threads = calloc (nthreads - 1, sizeof (pthread_t))) != NULL
+	  && pthread_mutex_init (&pool.awp_lock, NULL) == 0)
+	{
+	  /* This thread is a worker too.  If we cannot start as many threads
+	     as we would like, the ones we do start do all the work.  */
+
+	  for (nstarted = 0; nstarted < nthreads - 1; nstarted++)
+	    if (pthread_create (&threads[nstarted], NULL,
+				arc_write_worker, &pool) != 0)
+	      break;
+
+	  arc_write_worker (&pool);
+
+	  for (i = 0; i < nstarted; i++)
+	    pthread_join (threads[i], NULL);
+
+	  pthread_mutex_destroy (&pool.awp_lock);
+	  free (threads);
+	  return;
+	}
+      free (threads);
+    }
+ serial:
+#endif
+
+  for (i = 0; i < njobs; i++)
+    if (jobs[i].awj_err == 0)
+      arc_write_one_ctf (&jobs[i], threshold);
+}
 
 /* Write out a CTF archive to the start of the file referenced by the passed-in
-   fd.  The entries in CTF_FILES are referenced by name: the names are passed in
-   the names array, which must have CTF_FILES entries.
+   fd, using up to NTHREADS threads to serialize and compress the members.  The
+   entries in CTF_FILES are referenced by name: the names are passed in the
+   names array, which must have CTF_FILES entries.  The output does not depend
+   on the number of threads.
+
+   Archives with at least CTF_ARC_HASH_THRESH members get a name hash index,
+   after the modent array, if ctf_set_arc_hash() has been called on their
+   first member.
 
    Returns 0 on success, or an errno, or an ECTF_* value.  */
 int
-ctf_arc_write_fd (int fd, ctf_file_t **ctf_files, size_t ctf_file_cnt,
-		  const char **names, size_t threshold)
+ctf_arc_write_fd_internal (int fd, ctf_file_t **ctf_files, size_t ctf_file_cnt,
+			   const char **names, size_t threshold,
+			   unsigned int nthreads)
 {
   const char *errmsg;
-  struct ctf_archive *archdr;
+  struct ctf_archive *archdr = NULL;
+  arc_write_job_t *jobs = NULL;
   size_t i;
-  char dummy = 0;
   size_t headersz;
-  ssize_t namesz;
-  size_t ctf_startoffs;		/* Start of the section we are working over.  */
+  size_t namesz;
   char *nametbl = NULL;		/* The name table.  */
-  char *np;
-  off_t nameoffs;
+  uint64_t nslots = 0;
+  int hashed;
+  off_t off;
   struct ctf_archive_modent *modent;
+  int err = 0;
 
   ctf_dprintf ("Writing CTF archive with %lu files\n",
 	       (unsigned long) ctf_file_cnt);
 
-  /* Figure out the size of the mmap()ed header, including the
-     ctf_archive_modent array.  We assume that all of this needs no
-     padding: a likely assumption, given that it's all made up of
-     uint64_t's.  */
+  /* Figure out the size of the header, including the ctf_archive_modent
+     array and the name hash index, if any.  We assume that all of this needs
+     no padding: a likely assumption, given that it's all made up of
+     uint64_t's.  The hash index has at least twice as many slots as there are
+     members, so that probe sequences stay short.  */
+  hashed = ctf_file_cnt >= CTF_ARC_HASH_THRESH && ctf_file_cnt < UINT32_MAX
+    && (ctf_files[0]->ctf_flags & LCTF_ARC_HASH);
   headersz = sizeof (struct ctf_archive)
     + (ctf_file_cnt * sizeof (uint64_t) * 2);
-  ctf_dprintf ("headersz is %lu\n", (unsigned long) headersz);
 
-  /* From now on we work in two pieces: an mmap()ed region from zero up to the
-     headersz, and a region updated via write() starting after that, containing
-     all the tables.  Platforms that do not support mmap() just use write().  */
-  ctf_startoffs = headersz;
-  if (lseek (fd, ctf_startoffs - 1, SEEK_SET) < 0)
+  if (hashed)
     {
-      errmsg = "ctf_arc_write(): cannot extend file while writing: %s\n";
-      goto err;
-    }
-
-  if (write (fd, &dummy, 1) < 0)
-    {
-      errmsg = "ctf_arc_write(): cannot extend file while writing: %s\n";
-      goto err;
+      for (nslots = 1; nslots < ctf_file_cnt * 2; nslots <<= 1);
+      headersz += sizeof (ctf_archive_hash_t)
+	+ nslots * sizeof (ctf_archive_hashent_t);
     }
+  ctf_dprintf ("headersz is %lu\n", (unsigned long) headersz);
 
-  if ((archdr = arc_mmap_header (fd, headersz)) == NULL)
+  if ((archdr = calloc (1, headersz)) == NULL
+      || (jobs = calloc (ctf_file_cnt ? ctf_file_cnt : 1,
+			 sizeof (arc_write_job_t))) == NULL)
     {
-      errmsg = "ctf_arc_write(): Cannot mmap(): %s\n";
+      errmsg = "ctf_arc_write(): Cannot allocate header: %s\n";
+      err = errno;
       goto err;
     }
 
   /* Fill in everything we can, which is everything other than the name
      table offset.  */
-  archdr->ctfa_magic = htole64 (CTFA_MAGIC);
+  archdr->ctfa_magic = htole64 (hashed ? CTFA_MAGIC_HASH : CTFA_MAGIC);
   archdr->ctfa_nfiles = htole64 (ctf_file_cnt);
-  archdr->ctfa_ctfs = htole64 (ctf_startoffs);
+  archdr->ctfa_ctfs = htole64 (headersz);
 
   /* We could validate that all CTF files have the same data model, but
      since any reasonable construction process will be building things of
      only one bitness anyway, this is pretty pointless, so just use the
      model of the first CTF file for all of them.  (It *is* valid to
      create an empty archive: the value of ctfa_model is irrelevant in
-     this case, but we must be sure not to dereference uninitialized
-     memory.)  */
+     this case.)  */
 
   if (ctf_file_cnt > 0)
     archdr->ctfa_model = htole64 (ctf_getmodel (ctf_files[0]));
 
-  /* Now write out the CTFs: ctf_archive_modent array via the mapping,
-     ctfs via write().  The names themselves have not been written yet: we
-     track them in a local strtab until the time is right, and sort the
-     modents array after construction.
-
-    The name table is not sorted.  */
+  /* Serialize all the members into buffers of their own, perhaps in
+     parallel, and only then lay them out, in order, after the header.  Each
+     is preceded by its size as a uint64_t and aligned to 8 bytes.  The name
+     table follows them all.  It is not sorted: the modents array is, into
+     name order, once it is complete.  */
 
-  for (i = 0, namesz = 0; i < le64toh (archdr->ctfa_nfiles); i++)
-    namesz += strlen (names[i]) + 1;
+  for (i = 0, namesz = 0; i < ctf_file_cnt; i++)
+    {
+      jobs[i].awj_fp = ctf_files[i];
+      namesz += strlen (names[i]) + 1;
+    }
 
-  nametbl = malloc (namesz);
-  if (nametbl == NULL)
+  if ((nametbl = malloc (namesz ? namesz : 1)) == NULL)
     {
       errmsg = "Error writing named CTF to archive: %s\n";
-      goto err_unmap;
+      err = errno;
+      goto err;
     }
 
-  for (i = 0, namesz = 0,
-       modent = (ctf_archive_modent_t *) ((char *) archdr
-					  + sizeof (struct ctf_archive));
-       i < le64toh (archdr->ctfa_nfiles); i++)
-    {
-      off_t off;
+  arc_write_members (jobs, ctf_file_cnt, threshold, nthreads);
 
-      strcpy (&nametbl[namesz], names[i]);
+  for (i = 0, namesz = 0, off = headersz,
+	 modent = (ctf_archive_modent_t *) ((char *) archdr
+					    + sizeof (struct ctf_archive));
+       i < ctf_file_cnt; i++)
+    {
+      uint64_t ctfsz;
 
-      off = arc_write_one_ctf (ctf_files[i], fd, threshold);
-      if ((off < 0) && (off > -ECTF_BASE))
+      if (jobs[i].awj_err != 0)
 	{
-	  errmsg = "ctf_arc_write(): Cannot determine file "
-	    "position while writing to archive: %s";
-	  goto err_free;
+	  errmsg = "ctf_arc_write(): Cannot write CTF file to archive: %s\n";
+	  err = jobs[i].awj_err;
+	  goto err;
 	}
-      if (off < 0)
+
+      ctfsz = htole64 (sizeof (ctfsz) + jobs[i].awj_size);
+      if (ctf_pwrite (fd, &ctfsz, sizeof (ctfsz), off) < 0
+	  || ctf_pwrite (fd, jobs[i].awj_buf, jobs[i].awj_size,
+			 off + sizeof (ctfsz)) < 0)
 	{
 	  errmsg = "ctf_arc_write(): Cannot write CTF file to archive: %s\n";
-	  errno = off * -1;
-	  goto err_free;
+	  err = errno;
+	  goto err;
 	}
+      free (jobs[i].awj_buf);
+      jobs[i].awj_buf = NULL;
 
+      strcpy (&nametbl[namesz], names[i]);
       modent->name_offset = htole64 (namesz);
-      modent->ctf_offset = htole64 (off - ctf_startoffs);
+      modent->ctf_offset = htole64 (off - headersz);
       namesz += strlen (names[i]) + 1;
       modent++;
+
+      off = LCTF_ALIGN_OFFS (off + sizeof (ctfsz) + jobs[i].awj_size, 8);
     }
 
-  ctf_qsort_r ((ctf_archive_modent_t *) ((char *) archdr
-					 + sizeof (struct ctf_archive)),
-	       le64toh (archdr->ctfa_nfiles),
-	       sizeof (struct ctf_archive_modent), sort_modent_by_name,
-	       nametbl);
+  modent = (ctf_archive_modent_t *) ((char *) archdr
+				     + sizeof (struct ctf_archive));
+  ctf_qsort_r (modent, ctf_file_cnt, sizeof (struct ctf_archive_modent),
+	       sort_modent_by_name, nametbl);
 
-   /* Now the name table.  */
+  /* The hash index refers to modents by their index in the sorted array.  */
 
-  if ((nameoffs = lseek (fd, 0, SEEK_CUR)) < 0)
+  if (hashed)
     {
-      errmsg = "ctf_arc_write(): Cannot get current file position "
-	"in archive: %s\n";
-      goto err_free;
-    }
-  archdr->ctfa_names = htole64 (nameoffs);
-  np = nametbl;
-  while (namesz > 0)
-    {
-      ssize_t len;
-      if ((len = write (fd, np, namesz)) < 0)
+      ctf_archive_hash_t *hash = (ctf_archive_hash_t *) &modent[ctf_file_cnt];
+      ctf_archive_hashent_t *hashtbl = (ctf_archive_hashent_t *) (hash + 1);
+
+      hash->ctfah_nslots = htole64 (nslots);
+      for (i = 0; i < ctf_file_cnt; i++)
 	{
-	  errmsg = "ctf_arc_write(): Cannot write name table to archive: %s\n";
-	  goto err_free;
+	  uint32_t h = arc_name_hash (&nametbl[le64toh (modent[i].name_offset)]);
+	  uint64_t slot;
+
+	  for (slot = h & (nslots - 1); hashtbl[slot].modent != 0;
+	       slot = (slot + 1) & (nslots - 1));
+
+	  hashtbl[slot].hash = htole32 (h);
+	  hashtbl[slot].modent = htole32 (i + 1);
 	}
-      namesz -= len;
-      np += len;
     }
-  free (nametbl);
 
-  if (arc_mmap_writeout (fd, archdr, headersz, &errmsg) < 0)
-    goto err_unmap;
-  if (arc_mmap_unmap (archdr, headersz, &errmsg) < 0)
-    goto err;
-  return 0;
+  /* Now the name table, and finally the header.  */
+
+  archdr->ctfa_names = htole64 (off);
+  if (ctf_pwrite (fd, nametbl, namesz, off) < 0)
+    {
+      errmsg = "ctf_arc_write(): Cannot write name table to archive: %s\n";
+      err = errno;
+      goto err;
+    }
+
+  if (ctf_pwrite (fd, archdr, headersz, 0) < 0)
+    {
+      errmsg = "ctf_arc_write(): Cannot write header to archive: %s\n";
+      err = errno;
+      goto err;
+    }
 
-err_free:
   free (nametbl);
-err_unmap:
-  arc_mmap_unmap (archdr, headersz, NULL);
+  free (jobs);
+  free (archdr);
+  return 0;
+
 err:
-  ctf_dprintf (errmsg, errno < ECTF_BASE ? strerror (errno) :
-	       ctf_errmsg (errno));
-  return errno;
+  for (i = 0; jobs != NULL && i < ctf_file_cnt; i++)
+    free (jobs[i].awj_buf);
+  free (nametbl);
+  free (jobs);
+  free (archdr);
+  ctf_dprintf (errmsg, err < ECTF_BASE ? strerror (err) :
+	       ctf_errmsg (err));
+  return err;
+}
+
+/* Write out a CTF archive to the start of the file referenced by the passed-in
+   fd.  The entries in CTF_FILES are referenced by name: the names are passed in
+   the names array, which must have CTF_FILES entries.  Members are serialized
+   using as many threads as the first of them has been allowed by
+   ctf_link_set_threads().
+
+   Returns 0 on success, or an errno, or an ECTF_* value.  */
+int
+ctf_arc_write_fd (int fd, ctf_file_t **ctf_files, size_t ctf_file_cnt,
+		  const char **names, size_t threshold)
+{
+  return ctf_arc_write_fd_internal (fd, ctf_files, ctf_file_cnt, names,
+				    threshold, ctf_file_cnt > 0
+				    ? ctf_files[0]->ctf_link_threads : 1);
+}
+
+/* Turn the name hash index on or off for archives whose first member is FP,
+   when written by ctf_arc_write(), ctf_arc_write_fd() or ctf_link_write().  It
+   makes opening members by name faster in archives with many members, but
+   older readers cannot open archives that have one.  Off by default.  */
+int
+ctf_set_arc_hash (ctf_file_t *fp, int enable)
+{
+  if (enable)
+    fp->ctf_flags |= LCTF_ARC_HASH;
+  else
+    fp->ctf_flags &= ~LCTF_ARC_HASH;
+  return 0;
 }
 
 /* Write out a CTF archive.  The entries in CTF_FILES are referenced by name:
@@ -241,71 +462,6 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
   return err;
 }
 
-/* Write one CTF file out.  Return the file position of the written file (or
-   rather, of the file-size uint64_t that precedes it): negative return is a
-   negative errno or ctf_errno value.  On error, the file position may no longer
-   be at the end of the file.  */
-static off_t
-arc_write_one_ctf (ctf_file_t * f, int fd, size_t threshold)
-{
-  off_t off, end_off;
-  uint64_t ctfsz = 0;
-  char *ctfszp;
-  size_t ctfsz_len;
-  int (*writefn) (ctf_file_t * fp, int fd);
-
-  if (ctf_serialize (f) < 0)
-    return f->ctf_errno * -1;
-
-  if ((off = lseek (fd, 0, SEEK_CUR)) < 0)
-    return errno * -1;
-
-  if (f->ctf_size > threshold)
-    writefn = ctf_compress_write;
-  else
-    writefn = ctf_write;
-
-  /* This zero-write turns into the size in a moment. */
-  ctfsz_len = sizeof (ctfsz);
-  ctfszp = (char *) &ctfsz;
-  while (ctfsz_len > 0)
-    {
-      ssize_t writelen = write (fd, ctfszp, ctfsz_len);
-      if (writelen < 0)
-	return errno * -1;
-      ctfsz_len -= writelen;
-      ctfszp += writelen;
-    }
-
-  if (writefn (f, fd) != 0)
-    return f->ctf_errno * -1;
-
-  if ((end_off = lseek (fd, 0, SEEK_CUR)) < 0)
-    return errno * -1;
-  ctfsz = htole64 (end_off - off);
-
-  if ((lseek (fd, off, SEEK_SET)) < 0)
-    return errno * -1;
-
-  /* ... here.  */
-  ctfsz_len = sizeof (ctfsz);
-  ctfszp = (char *) &ctfsz;
-  while (ctfsz_len > 0)
-    {
-      ssize_t writelen = write (fd, ctfszp, ctfsz_len);
-      if (writelen < 0)
-	return errno * -1;
-      ctfsz_len -= writelen;
-      ctfszp += writelen;
-    }
-
-  end_off = LCTF_ALIGN_OFFS (end_off, 8);
-  if ((lseek (fd, end_off, SEEK_SET)) < 0)
-    return errno * -1;
-
-  return off;
-}
-
 /* qsort() function to sort the array of struct ctf_archive_modents into
    ascending name order.  */
 static int
@@ -331,14 +487,105 @@ search_modent_by_name (const void *key, const void *ent, void *arg)
   return strcmp (k, &search_nametbl[le64toh (v->name_offset)]);
 }
 
+/* Check that the name hash index of ARC, which is SIZE bytes long, lies
+   within it, if ARC has one, so that arc_find_modent() can use it.  */
+static int
+arc_check_hash (const struct ctf_archive *arc, size_t size)
+{
+  const ctf_archive_hash_t *hash;
+  uint64_t nfiles = le64toh (arc->ctfa_nfiles);
+  uint64_t nslots;
+  size_t off = sizeof (struct ctf_archive) + sizeof (ctf_archive_hash_t);
+
+  if (le64toh (arc->ctfa_magic) != CTFA_MAGIC_HASH)
+    return 0;
+
+  if (size < off
+      || nfiles > (size - off) / sizeof (struct ctf_archive_modent))
+    return -1;
+
+  off += nfiles * sizeof (struct ctf_archive_modent);
+  hash = (const ctf_archive_hash_t *) ((const char *) arc + off
+				       - sizeof (ctf_archive_hash_t));
+  nslots = le64toh (hash->ctfah_nslots);
+
+  if (nslots == 0 || (nslots & (nslots - 1)) != 0
+      || nslots > (size - off) / sizeof (ctf_archive_hashent_t))
+    return -1;
+
+  return 0;
+}
+
+/* The hash of a member name in the name hash index: 32-bit FNV-1a.  This is
+   part of the archive format, so must never change.  */
+static uint32_t
+arc_name_hash (const char *name)
+{
+  uint32_t h = 2166136261U;
+
+  for (; *name != '\0'; name++)
+    {
+      h ^= (unsigned char) *name;
+      h *= 16777619U;
+    }
+  return h;
+}
+
+/* Return the modent of the member of ARC named NAME, or NULL if none.  Use the
+   name hash index if there is one, so that only names with the same hash (in
+   practice, only the right one) are ever compared: otherwise, bisect the
+   modent array.  */
+static const ctf_archive_modent_t *
+arc_find_modent (const struct ctf_archive *arc, const char *name)
+{
+  const ctf_archive_modent_t *modent;
+  const char *nametbl = (const char *) arc + le64toh (arc->ctfa_names);
+  uint64_t nfiles = le64toh (arc->ctfa_nfiles);
+
+  modent = (const ctf_archive_modent_t *) ((const char *) arc
+					   + sizeof (struct ctf_archive));
+
+  if (le64toh (arc->ctfa_magic) == CTFA_MAGIC_HASH)
+    {
+      const ctf_archive_hash_t *hash;
+      const ctf_archive_hashent_t *hashtbl;
+      uint64_t nslots, slot, probes;
+      uint32_t h;
+
+      hash = (const ctf_archive_hash_t *) &modent[nfiles];
+      hashtbl = (const ctf_archive_hashent_t *) (hash + 1);
+      nslots = le64toh (hash->ctfah_nslots);
+      h = arc_name_hash (name);
+
+      for (slot = h & (nslots - 1), probes = 0; probes < nslots;
+	   slot = (slot + 1) & (nslots - 1), probes++)
+	{
+	  uint32_t m = le32toh (hashtbl[slot].modent);
+
+	  if (m == 0)
+	    break;
+
+	  if (le32toh (hashtbl[slot].hash) == h && m <= nfiles
+	      && strcmp (name, &nametbl[le64toh (modent[m - 1].name_offset)])
+	      == 0)
+	    return &modent[m - 1];
+	}
+      return NULL;
+    }
+
+  return bsearch_r (name, modent, nfiles, sizeof (struct ctf_archive_modent),
+		    search_modent_by_name, (void *) nametbl);
+}
+
 /* Make a new struct ctf_archive_internal wrapper for a ctf_archive or a
-   ctf_file.  Closes ARC and/or FP on error.  Arrange to free the SYMSECT or
-   STRSECT, as needed, on close.  */
+   ctf_file.  Closes ARC and/or FP on error.  ARC_SIZE is the size of the
+   mapping ARC is in, if we made it, or 0 if it belongs to the caller.  Arrange
+   to free the SYMSECT or STRSECT, as needed, on close.  */
 
 struct ctf_archive_internal *
 ctf_new_archive_internal (int is_archive, struct ctf_archive *arc,
-			  ctf_file_t *fp, const ctf_sect_t *symsect,
-			  const ctf_sect_t *strsect,
+			  size_t arc_size, ctf_file_t *fp,
+			  const ctf_sect_t *symsect, const ctf_sect_t *strsect,
 			  int *errp)
 {
   struct ctf_archive_internal *arci;
@@ -346,14 +593,18 @@ ctf_new_archive_internal (int is_archive, struct ctf_archive *arc,
   if ((arci = calloc (1, sizeof (struct ctf_archive_internal))) == NULL)
     {
       if (is_archive)
-	ctf_arc_close_internal (arc);
+	ctf_arc_close_internal (arc, arc_size);
       else
 	ctf_file_close (fp);
       return (ctf_set_open_errno (errp, errno));
     }
   arci->ctfi_is_archive = is_archive;
   if (is_archive)
-    arci->ctfi_archive = arc;
+    {
+      arci->ctfi_archive = arc;
+      arci->ctfi_archive_size = arc_size;
+      arci->ctfi_dicts_budget = CTF_ARC_CACHE_BUDGET;
+    }
   else
     arci->ctfi_file = fp;
 #ifndef BFD_ONLY
@@ -380,12 +631,19 @@ ctf_arc_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
   ctf_file_t *fp = NULL;
 
   if (ctfsect->cts_size > sizeof (uint64_t) &&
-      ((*(uint64_t *) ctfsect->cts_data) == CTFA_MAGIC))
+      CTF_ARC_MAGIC_P (le64toh (*(uint64_t *) ctfsect->cts_data)))
     {
       /* The archive is mmappable, so this operation is trivial.  */
 
       is_archive = 1;
       arc = (struct ctf_archive *) ctfsect->cts_data;
+
+      if (ctfsect->cts_size < sizeof (struct ctf_archive)
+	  || arc_check_hash (arc, ctfsect->cts_size) < 0)
+	{
+	  ctf_dprintf ("ctf_arc_bufopen(): corrupt archive header\n");
+	  return (ctf_set_open_errno (errp, ECTF_FMT));
+	}
     }
   else
     {
@@ -397,73 +655,81 @@ ctf_arc_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
 	  return NULL;
 	}
     }
-  return ctf_new_archive_internal (is_archive, arc, fp, symsect, strsect,
+  return ctf_new_archive_internal (is_archive, arc, 0, fp, symsect, strsect,
 				   errp);
 }
 
-/* Open a CTF archive.  Returns the archive, or NULL and an error in *err (if
-   not NULL).  */
+/* Open a CTF archive from the file FD, named FILENAME (used only for error
+   messages).  Returns the archive, setting *SIZEP to the size of its mapping,
+   or NULL and an error in *err (if not NULL).
+
+   The archive is mapped read-only, and all dicts opened from it that are
+   uncompressed, native-endian and of the current version point straight into
+   the mapping without ever being copied or written to, so that their pages
+   are shared with every other process that has the same archive open.  */
 struct ctf_archive *
-ctf_arc_open_internal (const char *filename, int *errp)
+ctf_arc_open_internal (int fd, const char *filename, size_t *sizep, int *errp)
 {
   const char *errmsg;
-  int fd;
   struct stat s;
   struct ctf_archive *arc;		/* (Actually the whole file.)  */
 
   libctf_init_debug();
-  if ((fd = open (filename, O_RDONLY)) < 0)
+  if (fstat (fd, &s) < 0)
     {
-      errmsg = "ctf_arc_open(): cannot open %s: %s\n";
+      errmsg = "ctf_arc_open(): cannot stat %s: %s\n";
       goto err;
     }
-  if (fstat (fd, &s) < 0)
+
+  if ((size_t) s.st_size < sizeof (struct ctf_archive))
     {
-      errmsg = "ctf_arc_open(): cannot stat %s: %s\n";
-      goto err_close;
+      errmsg = "ctf_arc_open(): %s is too short: %s\n";
+      errno = ECTF_FMT;
+      goto err;
     }
 
   if ((arc = arc_mmap_file (fd, s.st_size)) == NULL)
     {
       errmsg = "ctf_arc_open(): Cannot read in %s: %s\n";
-      goto err_close;
+      goto err;
     }
 
-  if (le64toh (arc->ctfa_magic) != CTFA_MAGIC)
+  if (!CTF_ARC_MAGIC_P (le64toh (arc->ctfa_magic)))
     {
-      errmsg = "ctf_arc_open(): Invalid magic number";
+      errmsg = "ctf_arc_open(): Invalid magic number in %s: %s\n";
       errno = ECTF_FMT;
       goto err_unmap;
     }
 
-  /* This horrible hack lets us know how much to unmap when the file is
-     closed.  (We no longer need the magic number, and the mapping
-     is private.)  */
-  arc->ctfa_magic = s.st_size;
-  close (fd);
+  if (arc_check_hash (arc, s.st_size) < 0)
+    {
+      errmsg = "ctf_arc_open(): Corrupt name hash index in %s: %s\n";
+      errno = ECTF_FMT;
+      goto err_unmap;
+    }
+
+  *sizep = s.st_size;
   return arc;
 
 err_unmap:
   arc_mmap_unmap (arc, s.st_size, NULL);
-err_close:
-  close (fd);
 err:
   if (errp)
     *errp = errno;
-  ctf_dprintf (errmsg, filename, errno < ECTF_BASE ? strerror (errno) :
-	       ctf_errmsg (errno));
+  ctf_dprintf (errmsg, filename ? filename : "(unknown file)",
+	       errno < ECTF_BASE ? strerror (errno) : ctf_errmsg (errno));
   return NULL;
 }
 
-/* Close an archive.  */
+/* Close an archive, unmapping it if SIZE is nonzero.  (Archives opened from
+   caller-provided buffers by ctf_arc_bufopen() have a SIZE of zero.)  */
 void
-ctf_arc_close_internal (struct ctf_archive *arc)
+ctf_arc_close_internal (struct ctf_archive *arc, size_t size)
 {
-  if (arc == NULL)
+  if (arc == NULL || size == 0)
     return;
 
-  /* See the comment in ctf_arc_open().  */
-  arc_mmap_unmap (arc, arc->ctfa_magic, NULL);
+  arc_mmap_unmap (arc, size, NULL);
 }
 
 /* Public entry point: close an archive, or CTF file.  */
@@ -474,7 +740,10 @@ ctf_arc_close (ctf_archive_t *arc)
     return;
 
   if (arc->ctfi_is_archive)
-    ctf_arc_close_internal (arc->ctfi_archive);
+    {
+      ctf_arc_flush_cache (arc);
+      ctf_arc_close_internal (arc->ctfi_archive, arc->ctfi_archive_size);
+    }
   else
     ctf_file_close (arc->ctfi_file);
   if (arc->ctfi_free_symsect)
@@ -493,21 +762,14 @@ ctf_arc_open_by_name_internal (const struct ctf_archive *arc,
 			       const ctf_sect_t *strsect,
 			       const char *name, int *errp)
 {
-  struct ctf_archive_modent *modent;
-  const char *search_nametbl;
+  const struct ctf_archive_modent *modent;
 
   if (name == NULL)
     name = _CTF_SECTION;		 /* The default name.  */
 
   ctf_dprintf ("ctf_arc_open_by_name(%s): opening\n", name);
 
-  modent = (ctf_archive_modent_t *) ((char *) arc
-				     + sizeof (struct ctf_archive));
-
-  search_nametbl = (const char *) arc + le64toh (arc->ctfa_names);
-  modent = bsearch_r (name, modent, le64toh (arc->ctfa_nfiles),
-		      sizeof (struct ctf_archive_modent),
-		      search_modent_by_name, (void *) search_nametbl);
+  modent = arc_find_modent (arc, name);
 
   /* This is actually a common case and normal operation: no error
      debug output.  */
@@ -554,13 +816,18 @@ ctf_arc_open_by_name_sections (const ctf_archive_t *arc,
   arc->ctfi_file->ctf_archive = (ctf_archive_t *) arc;
 
   /* Bump the refcount so that the user can ctf_file_close() it.  */
-  arc->ctfi_file->ctf_refcnt++;
+  ctf_file_ref (arc->ctfi_file);
   return arc->ctfi_file;
 }
 
 /* Return the ctf_file_t with the given name, or NULL if none, setting 'err' if
    non-NULL.  A name of NULL means to open the default file.
 
+   Dicts in archives are opened only once, on first use, and are then kept in
+   the archive's dict cache: if they are children of another dict in the same
+   archive, that dict is imported as their parent automatically.  The caller
+   must still ctf_file_close() the returned dict.
+
    Public entry point.  */
 ctf_file_t *
 ctf_arc_open_by_name (const ctf_archive_t *arc, const char *name, int *errp)
@@ -568,6 +835,9 @@ ctf_arc_open_by_name (const ctf_archive_t *arc, const char *name, int *errp)
   const ctf_sect_t *symsect = &arc->ctfi_symsect;
   const ctf_sect_t *strsect = &arc->ctfi_strsect;
 
+  if (arc->ctfi_is_archive)
+    return ctf_arc_open_cached ((ctf_archive_t *) arc, name, errp);
+
   if (symsect->cts_name == NULL)
     symsect = NULL;
   if (strsect->cts_name == NULL)
@@ -576,6 +846,238 @@ ctf_arc_open_by_name (const ctf_archive_t *arc, const char *name, int *errp)
   return ctf_arc_open_by_name_sections (arc, symsect, strsect, name, errp);
 }
 
+/* Estimate the memory use of an open archive member, not counting anything
+   still in the archive mapping.  */
+static size_t
+arc_dict_size (const ctf_file_t *fp)
+{
+  size_t size = sizeof (ctf_file_t) + sizeof (ctf_header_t);
+
+  if (fp->ctf_dynbase != NULL)
+    size += fp->ctf_size;			/* Decompressed or flipped.  */
+
+  size += (fp->ctf_typemax + 1) * sizeof (uint32_t) * 2; /* txlate, ptrtab.  */
+  size += fp->ctf_nsyms * sizeof (uint32_t);		 /* sxlate.  */
+
+  return size;
+}
+
+/* Evict the least recently used dicts from the archive's dict cache until it
+   is within its budget, never evicting KEEP.  Evicted dicts stay open if
+   anything else (a caller, or a child dict) still has a reference to them.  */
+static void
+ctf_arc_evict (ctf_archive_t *arc, const ctf_arc_cache_ent_t *keep)
+{
+  ctf_arc_cache_ent_t *ent, *prev;
+
+  for (ent = ctf_list_prev (&arc->ctfi_dicts_lru);
+       ent != NULL && arc->ctfi_dicts_size > arc->ctfi_dicts_budget;
+       ent = prev)
+    {
+      prev = ctf_list_prev (ent);
+
+      if (ent == keep)
+	continue;
+
+      ctf_dprintf ("ctf_arc_evict(): evicting %s\n", ent->cace_name);
+      ctf_list_delete (&arc->ctfi_dicts_lru, ent);
+      arc->ctfi_dicts_size -= ent->cace_size;
+      ctf_file_close (ent->cace_fp);
+      ctf_dynhash_remove (arc->ctfi_dicts, ent->cace_name);
+      free (ent);
+    }
+}
+
+/* Close every dict in the archive's dict cache.  */
+static void
+ctf_arc_flush_cache (ctf_archive_t *arc)
+{
+  size_t budget = arc->ctfi_dicts_budget;
+
+  arc->ctfi_dicts_budget = 0;
+  ctf_arc_evict (arc, NULL);
+  arc->ctfi_dicts_budget = budget;
+
+  ctf_dynhash_destroy (arc->ctfi_dicts);
+  arc->ctfi_dicts = NULL;
+}
+
+/* The members ctf_arc_open_cached() is in the middle of opening, innermost
+   first: a chain of parents that leads back to one of them is cyclic.  */
+
+typedef struct ctf_arc_opening
+{
+  const char *cao_name;
+  const struct ctf_arc_opening *cao_next;
+} ctf_arc_opening_t;
+
+/* Return the dict with the given name from the archive's dict cache, opening it
+   and adding it if need be.  The caller gets a new reference.  OPENING is the
+   chain of members whose parents are being opened in turn, which get no parent
+   imported automatically if the chain has come back round to them.  */
+static ctf_file_t *
+ctf_arc_open_cached_internal (ctf_archive_t *arc, const char *name,
+			      const ctf_arc_opening_t *opening, int *errp)
+{
+  const ctf_sect_t *symsect = &arc->ctfi_symsect;
+  const ctf_sect_t *strsect = &arc->ctfi_strsect;
+  ctf_arc_opening_t self;
+  const ctf_arc_opening_t *op;
+  ctf_arc_cache_ent_t *ent;
+  ctf_file_t *fp;
+  int err;
+
+  if (name == NULL)
+    name = _CTF_SECTION;
+  self.cao_name = name;
+  self.cao_next = opening;
+
+  if (arc->ctfi_dicts == NULL
+      && (arc->ctfi_dicts = ctf_dynhash_create (ctf_hash_string,
+						ctf_hash_eq_string,
+						free, NULL)) == NULL)
+    return (ctf_set_open_errno (errp, ENOMEM));
+
+  if ((ent = ctf_dynhash_lookup (arc->ctfi_dicts, name)) != NULL)
+    {
+      ctf_list_delete (&arc->ctfi_dicts_lru, ent);
+      ctf_list_prepend (&arc->ctfi_dicts_lru, ent);
+      ctf_file_ref (ent->cace_fp);
+      return ent->cace_fp;
+    }
+
+  if (symsect->cts_name == NULL)
+    symsect = NULL;
+  if (strsect->cts_name == NULL)
+    strsect = NULL;
+
+  if ((fp = ctf_arc_open_by_name_internal (arc->ctfi_archive, symsect,
+					   strsect, name, errp)) == NULL)
+    return NULL;				/* errno is set for us.  */
+  fp->ctf_archive = arc;
+
+  /* Import the parent automatically, if it is in this archive.  Failure is
+     not an error: the caller can still import some other parent.  */
+
+  if ((fp->ctf_flags & LCTF_CHILD) && fp->ctf_parent == NULL)
+    {
+      const char *parname = fp->ctf_parname ? fp->ctf_parname : _CTF_SECTION;
+      ctf_file_t *pfp;
+
+      for (op = &self; op != NULL; op = op->cao_next)
+	if (strcmp (parname, op->cao_name) == 0)
+	  {
+	    ctf_dprintf ("ctf_arc_open_cached(): not importing %s into %s: "
+			 "cyclic parent chain\n", parname, name);
+	    break;
+	  }
+
+      if (op == NULL
+	  && (pfp = ctf_arc_open_cached_internal (arc, parname, &self,
+						  &err)) != NULL)
+	{
+	  if (ctf_import (fp, pfp) < 0)
+	    ctf_dprintf ("ctf_arc_open_cached(): cannot import %s into %s: "
+			 "%s\n", parname, name, ctf_errmsg (ctf_errno (fp)));
+	  ctf_file_close (pfp);
+	}
+    }
+
+  if ((ent = malloc (sizeof (ctf_arc_cache_ent_t))) == NULL)
+    goto oom;
+
+  if ((ent->cace_name = strdup (name)) == NULL)
+    {
+      free (ent);
+      goto oom;
+    }
+
+  if (ctf_dynhash_insert (arc->ctfi_dicts, ent->cace_name, ent) < 0)
+    {
+      free (ent->cace_name);
+      free (ent);
+      goto oom;
+    }
+
+  ent->cace_fp = fp;
+  ent->cace_size = arc_dict_size (fp);
+  ctf_list_prepend (&arc->ctfi_dicts_lru, ent);
+  arc->ctfi_dicts_size += ent->cace_size;
+  ctf_arc_evict (arc, ent);
+
+  ctf_file_ref (fp);				/* The caller's reference.  */
+  return fp;
+
+ oom:
+  ctf_file_close (fp);
+  return (ctf_set_open_errno (errp, ENOMEM));
+}
+
+/* Return the dict with the given name from the archive's dict cache, opening it
+   and adding it if need be.  The caller gets a new reference.  */
+static ctf_file_t *
+ctf_arc_open_cached (ctf_archive_t *arc, const char *name, int *errp)
+{
+  return ctf_arc_open_cached_internal (arc, name, NULL, errp);
+}
+
+/* Set the memory budget of the dict cache of an archive, evicting dicts if it
+   is now over budget.  At least the most recently used dict is always kept.  A
+   budget of zero effectively disables the cache.
+
+   Public entry point.  */
+int
+ctf_arc_set_cache_budget (ctf_archive_t *arc, size_t budget)
+{
+  arc->ctfi_dicts_budget = budget;
+
+  if (arc->ctfi_is_archive)
+    ctf_arc_evict (arc, ctf_list_next (&arc->ctfi_dicts_lru));
+  return 0;
+}
+
+/* Hint that the member of ARC named NAME (NULL for the default member) is
+   about to be opened, so that the part of the archive it lives in can be read
+   in ahead of time, in the background.  Members already open in the dict cache
+   need nothing, nor do archives libctf did not map itself.  Returns 0, or -1
+   and sets *ERRP (if not NULL) to ECTF_ARNNAME if there is no such member.
+
+   Public entry point.  */
+int
+ctf_arc_prefetch (const ctf_archive_t *arc, const char *name, int *errp)
+{
+  const struct ctf_archive_modent *modent;
+
+  if (name == NULL)
+    name = _CTF_SECTION;
+
+  if (!arc->ctfi_is_archive)
+    {
+      if (strcmp (name, _CTF_SECTION) == 0)
+	return 0;
+
+      if (errp)
+	*errp = ECTF_ARNNAME;
+      return -1;
+    }
+
+  if ((modent = arc_find_modent (arc->ctfi_archive, name)) == NULL)
+    {
+      if (errp)
+	*errp = ECTF_ARNNAME;
+      return -1;
+    }
+
+  if (arc->ctfi_dicts != NULL
+      && ctf_dynhash_lookup (arc->ctfi_dicts, name) != NULL)
+    return 0;
+
+  arc_mmap_prefetch (arc->ctfi_archive, arc->ctfi_archive_size,
+		     le64toh (arc->ctfi_archive->ctfa_ctfs)
+		     + le64toh (modent->ctf_offset));
+  return 0;
+}
+
 /* Return the ctf_file_t at the given ctfa_ctfs-relative offset, or NULL if
    none, setting 'err' if non-NULL.  */
 static ctf_file_t *
@@ -648,12 +1150,11 @@ ctf_archive_raw_iter (const ctf_archive_t *arc,
 }
 
 /* Iterate over all CTF files in an archive.  We pass all CTF files in turn to
-   the specified callback function.  */
+   the specified callback function, opening them via the archive's dict
+   cache.  */
 static int
 ctf_archive_iter_internal (const ctf_archive_t *wrapper,
 			   const struct ctf_archive *arc,
-			   const ctf_sect_t *symsect,
-			   const ctf_sect_t *strsect,
 			   ctf_archive_member_f *func, void *data)
 {
   int rc;
@@ -671,11 +1172,10 @@ ctf_archive_iter_internal (const ctf_archive_t *wrapper,
       const char *name;
 
       name = &nametbl[le64toh (modent[i].name_offset)];
-      if ((f = ctf_arc_open_by_name_internal (arc, symsect, strsect,
-					      name, &rc)) == NULL)
+      if ((f = ctf_arc_open_cached ((ctf_archive_t *) wrapper, name,
+				    &rc)) == NULL)
 	return rc;
 
-      f->ctf_archive = (ctf_archive_t *) wrapper;
       if ((rc = func (f, name, data)) != 0)
 	{
 	  ctf_file_close (f);
@@ -693,78 +1193,60 @@ int
 ctf_archive_iter (const ctf_archive_t *arc, ctf_archive_member_f *func,
 		  void *data)
 {
-  const ctf_sect_t *symsect = &arc->ctfi_symsect;
-  const ctf_sect_t *strsect = &arc->ctfi_strsect;
-
-  if (symsect->cts_name == NULL)
-    symsect = NULL;
-  if (strsect->cts_name == NULL)
-    strsect = NULL;
-
   if (arc->ctfi_is_archive)
-    return ctf_archive_iter_internal (arc, arc->ctfi_archive, symsect, strsect,
-				      func, data);
+    return ctf_archive_iter_internal (arc, arc->ctfi_archive, func, data);
 
   return func (arc->ctfi_file, _CTF_SECTION, data);
 }
 
 #ifdef HAVE_MMAP
-/* Map the header in.  Only used on new, empty files.  */
-static void *arc_mmap_header (int fd, size_t headersz)
-{
-  void *hdr;
-  if ((hdr = mmap (NULL, headersz, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
-		   0)) == MAP_FAILED)
-    return NULL;
-  return hdr;
-}
-
-/* mmap() the whole file, for reading only.  (Map it writably, but privately: we
-   need to modify the region, but don't need anyone else to see the
-   modifications.)  */
+/* mmap() the whole file, for reading only.  Nothing ever writes to it, so its
+   pages stay shared with the page cache.  */
 static void *arc_mmap_file (int fd, size_t size)
 {
   void *arc;
-  if ((arc = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+  if ((arc = mmap (NULL, size, PROT_READ, MAP_PRIVATE,
 		   fd, 0)) == MAP_FAILED)
     return NULL;
   return arc;
 }
 
-/* Persist the header to disk.  */
-static int arc_mmap_writeout (int fd _libctf_unused_, void *header,
-			      size_t headersz, const char **errmsg)
-{
-    if (msync (header, headersz, MS_ASYNC) < 0)
-    {
-      if (errmsg)
-	*errmsg = "arc_mmap_writeout(): Cannot sync after writing to %s: %s\n";
-      return -1;
-    }
-    return 0;
-}
-
 /* Unmap the region.  */
 static int arc_mmap_unmap (void *header, size_t headersz, const char **errmsg)
 {
   if (munmap (header, headersz) < 0)
     {
       if (errmsg)
-	*errmsg = "arc_mmap_munmap(): Cannot unmap after writing to %s: %s\n";
+	*errmsg = "arc_mmap_munmap(): Cannot unmap %s: %s\n";
       return -1;
     }
     return 0;
 }
-#else
-/* Map the header in.  Only used on new, empty files.  */
-static void *arc_mmap_header (int fd _libctf_unused_, size_t headersz)
+
+/* Ask for the member at OFFSET in the mapping ARC, of SIZE bytes, to be read
+   in.  This is only a hint, so failure is ignored.  A SIZE of zero means the
+   mapping is the caller's, not ours.  */
+static void arc_mmap_prefetch (const struct ctf_archive *arc, size_t size,
+			       uint64_t offset)
 {
-  void *hdr;
-  if ((hdr = malloc (headersz)) == NULL)
-    return NULL;
-  return hdr;
-}
+  uint64_t start, end;
+  long pagesz;
 
+  if (size == 0 || offset + sizeof (uint64_t) > size
+      || (pagesz = sysconf (_SC_PAGESIZE)) <= 0)
+    return;
+
+  start = offset & ~((uint64_t) pagesz - 1);
+  end = offset + sizeof (uint64_t)
+    + le64toh (*(uint64_t *) ((char *) arc + offset));
+  if (end > size || end < offset)
+    end = size;
+
+  if (madvise ((char *) arc + start, end - start, MADV_WILLNEED) < 0)
+    ctf_dprintf ("arc_mmap_prefetch(): madvise failed: %s\n",
+		 strerror (errno));
+}
+#else
 /* Pull in the whole file, for reading only.  We assume the current file
    position is at the start of the file.  */
 static void *arc_mmap_file (int fd, size_t size)
@@ -782,44 +1264,6 @@ static void *arc_mmap_file (int fd, size_t size)
   return data;
 }
 
-/* Persist the header to disk.  */
-static int arc_mmap_writeout (int fd, void *header, size_t headersz,
-			      const char **errmsg)
-{
-  ssize_t len;
-  size_t acc = 0;
-  char *data = (char *) header;
-  ssize_t count = headersz;
-
-  if ((lseek (fd, 0, SEEK_SET)) < 0)
-    {
-      if (errmsg)
-	*errmsg = "arc_mmap_writeout(): Cannot seek while writing header to "
-	  "%s: %s\n";
-      return -1;
-    }
-
-  while (headersz > 0)
-    {
-      if ((len = write (fd, data, count)) < 0)
-	{
-	  if (errmsg)
-	    *errmsg = "arc_mmap_writeout(): Cannot write header to %s: %s\n";
-	  return len;
-	}
-      if (len == EINTR)
-	continue;
-
-      acc += len;
-      if (len == 0)				/* EOF.  */
-	break;
-
-      count -= len;
-      data += len;
-    }
-  return 0;
-}
-
 /* Unmap the region.  */
 static int arc_mmap_unmap (void *header, size_t headersz _libctf_unused_,
 			   const char **errmsg _libctf_unused_)
@@ -827,4 +1271,11 @@ static int arc_mmap_unmap (void *header, size_t headersz _libctf_unused_,
   free (header);
   return 0;
 }
+
+/* The whole file is already in memory.  */
+static void arc_mmap_prefetch (const struct ctf_archive *arc _libctf_unused_,
+			       size_t size _libctf_unused_,
+			       uint64_t offset _libctf_unused_)
+{
+}
 #endif
@@ -0,0 +1,420 @@
+/* CTF data compression and decompression.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+/* The data buffer of a compressed dict follows the header, and is compressed
+   by the compressor named by the CTF_F_COMPRESSOR bits of cth_flags: zlib if
+   none are set, otherwise zstd or lz4, if libctf was built with them.
+
+   Compressors never need a buffer as large as their output: they hand it to a
+   sink function a chunk at a time, so that it can be written straight to a
+   file.  Decompressors write straight into the (uncompressed-size) buffer
+   passed in.  */
+
+/* Compressors work in chunks this large.  */
+#define CTF_COMPRESS_CHUNK (64 * 1024)
+
+typedef struct ctf_compressor
+{
+  const char *cc_name;		/* Name, for debugging messages.  */
+  uint32_t cc_flag;		/* CTF_F_COMPRESSOR bits naming it.  */
+
+  /* Compress LEN bytes at SRC, passing the output to SINK.  Return 0, or a
+     positive error number.  */
+  int (*cc_compress) (const void *src, size_t len, ctf_compress_sink_f *sink,
+		      void *arg);
+
+  /* Decompress SRCLEN bytes at SRC into exactly DSTLEN bytes at DST.  Return 0
+     or a positive error number.  */
+  int (*cc_decompress) (void *dst, size_t dstlen, const void *src,
+			size_t srclen);
+} ctf_compressor_t;
+
+/* zlib.  Its interfaces take uInt lengths, so very large buffers are passed in
+   several pieces.  */
+
+static int
+zlib_compress (const void *src, size_t len, ctf_compress_sink_f *sink,
+	       void *arg)
+{
+  z_stream zs;
+  unsigned char *out;
+  size_t resid = len;
+  int flush;
+  int rc;
+  int err = 0;
+
+  if ((out = malloc (CTF_COMPRESS_CHUNK)) == NULL)
+    return ECTF_ZALLOC;
+
+  memset (&zs, 0, sizeof (z_stream));
+  if ((rc = deflateInit (&zs, Z_DEFAULT_COMPRESSION)) != Z_OK)
+    {
+      ctf_dprintf ("zlib deflate err: %s\n", zError (rc));
+      free (out);
+      return ECTF_COMPRESS;
+    }
+
+  zs.next_in = (Bytef *) src;
+  do
+    {
+      size_t have;
+
+      if (zs.avail_in == 0 && resid > 0)
+	{
+	  zs.avail_in = resid > UINT_MAX ? UINT_MAX : resid;
+	  resid -= zs.avail_in;
+	}
+      flush = resid == 0 ? Z_FINISH : Z_NO_FLUSH;
+
+      zs.next_out = out;
+      zs.avail_out = CTF_COMPRESS_CHUNK;
+      if ((rc = deflate (&zs, flush)) == Z_STREAM_ERROR)
+	{
+	  ctf_dprintf ("zlib deflate err: %s\n", zError (rc));
+	  err = ECTF_COMPRESS;
+	  break;
+	}
+
+      have = CTF_COMPRESS_CHUNK - zs.avail_out;
+      if (have > 0 && (err = sink (out, have, arg)) != 0)
+	break;
+    }
+  while (rc != Z_STREAM_END);
+
+  deflateEnd (&zs);
+  free (out);
+  return err;
+}
+
+static int
+zlib_decompress (void *dst, size_t dstlen, const void *src, size_t srclen)
+{
+  z_stream zs;
+  size_t inresid = srclen;
+  size_t outresid = dstlen;
+  int rc;
+
+  memset (&zs, 0, sizeof (z_stream));
+  if ((rc = inflateInit (&zs)) != Z_OK)
+    {
+      ctf_dprintf ("zlib inflate err: %s\n", zError (rc));
+      return ECTF_ZALLOC;
+    }
+
+  zs.next_in = (Bytef *) src;
+  zs.next_out = dst;
+  do
+    {
+      if (zs.avail_in == 0 && inresid > 0)
+	{
+	  zs.avail_in = inresid > UINT_MAX ? UINT_MAX : inresid;
+	  inresid -= zs.avail_in;
+	}
+      if (zs.avail_out == 0 && outresid > 0)
+	{
+	  zs.avail_out = outresid > UINT_MAX ? UINT_MAX : outresid;
+	  outresid -= zs.avail_out;
+	}
+      rc = inflate (&zs, Z_NO_FLUSH);
+    }
+  while (rc == Z_OK && (zs.avail_in > 0 || inresid > 0)
+	 && (zs.avail_out > 0 || outresid > 0));
+
+  inflateEnd (&zs);
+
+  if (rc != Z_STREAM_END)
+    {
+      ctf_dprintf ("zlib inflate err: %s\n", rc == Z_OK ? "truncated data"
+		   : zError (rc));
+      return ECTF_DECOMPRESS;
+    }
+
+  if (zs.avail_out > 0 || outresid > 0)
+    {
+      ctf_dprintf ("zlib inflate short -- got %lu of %lu bytes\n",
+		   (unsigned long) (dstlen - zs.avail_out - outresid),
+		   (unsigned long) dstlen);
+      return ECTF_CORRUPT;
+    }
+
+  return 0;
+}
+
+#ifdef HAVE_ZSTD
+static int
+zstd_compress (const void *src, size_t len, ctf_compress_sink_f *sink,
+	       void *arg)
+{
+  ZSTD_CCtx *cctx;
+  ZSTD_inBuffer in = { src, len, 0 };
+  ZSTD_outBuffer out;
+  size_t outsize = ZSTD_CStreamOutSize ();
+  size_t rc;
+  int err = 0;
+
+  if ((out.dst = malloc (outsize)) == NULL)
+    return ECTF_ZALLOC;
+
+  if ((cctx = ZSTD_createCCtx ()) == NULL)
+    {
+      free (out.dst);
+      return ECTF_ZALLOC;
+    }
+
+  ZSTD_CCtx_setPledgedSrcSize (cctx, len);
+  do
+    {
+      out.size = outsize;
+      out.pos = 0;
+      rc = ZSTD_compressStream2 (cctx, &out, &in, ZSTD_e_end);
+      if (ZSTD_isError (rc))
+	{
+	  ctf_dprintf ("zstd compression err: %s\n", ZSTD_getErrorName (rc));
+	  err = ECTF_COMPRESS;
+	  break;
+	}
+
+      if (out.pos > 0 && (err = sink (out.dst, out.pos, arg)) != 0)
+	break;
+    }
+  while (rc != 0);
+
+  ZSTD_freeCCtx (cctx);
+  free (out.dst);
+  return err;
+}
+
+static int
+zstd_decompress (void *dst, size_t dstlen, const void *src, size_t srclen)
+{
+  size_t rc;
+
+  rc = ZSTD_decompress (dst, dstlen, src, srclen);
+  if (ZSTD_isError (rc))
+    {
+      ctf_dprintf ("zstd decompression err: %s\n", ZSTD_getErrorName (rc));
+      return ECTF_DECOMPRESS;
+    }
+
+  if (rc != dstlen)
+    {
+      ctf_dprintf ("zstd decompression short -- got %lu of %lu bytes\n",
+		   (unsigned long) rc, (unsigned long) dstlen);
+      return ECTF_CORRUPT;
+    }
+
+  return 0;
+}
+#endif
+
+#ifdef HAVE_LZ4
+static int
+lz4_compress (const void *src, size_t len, ctf_compress_sink_f *sink,
+	      void *arg)
+{
+  LZ4F_cctx *cctx;
+  LZ4F_preferences_t prefs;
+  const char *in = src;
+  unsigned char *out;
+  size_t outsize;
+  size_t rc;
+  int err = 0;
+
+  memset (&prefs, 0, sizeof (LZ4F_preferences_t));
+  prefs.frameInfo.contentSize = len;
+  outsize = LZ4F_compressBound (CTF_COMPRESS_CHUNK, &prefs);
+
+  if ((out = malloc (outsize)) == NULL)
+    return ECTF_ZALLOC;
+
+  if (LZ4F_isError (LZ4F_createCompressionContext (&cctx, LZ4F_VERSION)))
+    {
+      free (out);
+      return ECTF_ZALLOC;
+    }
+
+  rc = LZ4F_compressBegin (cctx, out, outsize, &prefs);
+  if (!LZ4F_isError (rc))
+    err = sink (out, rc, arg);
+
+  while (err == 0 && !LZ4F_isError (rc) && len > 0)
+    {
+      size_t chunk = len > CTF_COMPRESS_CHUNK ? CTF_COMPRESS_CHUNK : len;
+
+      rc = LZ4F_compressUpdate (cctx, out, outsize, in, chunk, NULL);
+      if (!LZ4F_isError (rc) && rc > 0)
+	err = sink (out, rc, arg);
+      in += chunk;
+      len -= chunk;
+    }
+
+  if (err == 0 && !LZ4F_isError (rc))
+    {
+      rc = LZ4F_compressEnd (cctx, out, outsize, NULL);
+      if (!LZ4F_isError (rc) && rc > 0)
+	err = sink (out, rc, arg);
+    }
+
+  if (err == 0 && LZ4F_isError (rc))
+    {
+      ctf_dprintf ("lz4 compression err: %s\n", LZ4F_getErrorName (rc));
+      err = ECTF_COMPRESS;
+    }
+
+  LZ4F_freeCompressionContext (cctx);
+  free (out);
+  return err;
+}
+
+static int
+lz4_decompress (void *dst, size_t dstlen, const void *src, size_t srclen)
+{
+  LZ4F_dctx *dctx;
+  char *out = dst;
+  const char *in = src;
+  size_t rc;
+  int err = 0;
+
+  if (LZ4F_isError (LZ4F_createDecompressionContext (&dctx, LZ4F_VERSION)))
+    return ECTF_ZALLOC;
+
+  do
+    {
+      size_t outlen = dstlen - (out - (char *) dst);
+      size_t inlen = srclen - (in - (const char *) src);
+
+      rc = LZ4F_decompress (dctx, out, &outlen, in, &inlen, NULL);
+      if (LZ4F_isError (rc))
+	{
+	  ctf_dprintf ("lz4 decompression err: %s\n", LZ4F_getErrorName (rc));
+	  err = ECTF_DECOMPRESS;
+	  break;
+	}
+      out += outlen;
+      in += inlen;
+
+      /* No progress possible: truncated input, or too small an output.  */
+      if (rc != 0 && inlen == 0 && outlen == 0)
+	{
+	  err = ECTF_CORRUPT;
+	  break;
+	}
+    }
+  while (rc != 0);
+
+  LZ4F_freeDecompressionContext (dctx);
+
+  if (err == 0 && (size_t) (out - (char *) dst) != dstlen)
+    {
+      ctf_dprintf ("lz4 decompression short -- got %lu of %lu bytes\n",
+		   (unsigned long) (out - (char *) dst),
+		   (unsigned long) dstlen);
+      err = ECTF_CORRUPT;
+    }
+
+  return err;
+}
+#endif
+
+static const ctf_compressor_t compressors[] =
+  {
+    { "zlib", 0, zlib_compress, zlib_decompress },
+#ifdef HAVE_ZSTD
+    { "zstd", CTF_F_ZSTD, zstd_compress, zstd_decompress },
+#endif
+#ifdef HAVE_LZ4
+    { "lz4", CTF_F_LZ4, lz4_compress, lz4_decompress },
+#endif
+  };
+
+/* Find the compressor named by the CTF_F_COMPRESSOR bits in FLAGS, or
+   NULL if there is no such compressor in this libctf.  */
+static const ctf_compressor_t *
+ctf_compressor (uint32_t flags)
+{
+  size_t i;
+
+  flags &= CTF_F_COMPRESSOR;
+  for (i = 0; i < sizeof (compressors) / sizeof (compressors[0]); i++)
+    if (compressors[i].cc_flag == flags)
+      return &compressors[i];
+
+  return NULL;
+}
+
+/* Return 1 if the compressor named by FLAGS is available.  */
+int
+ctf_compressor_available (uint32_t flags)
+{
+  return ctf_compressor (flags) != NULL;
+}
+
+/* Compress LEN bytes at SRC with the compressor named by FLAGS, passing the
+   output to SINK a chunk at a time.  Errors are reported on FP.  */
+int
+ctf_compress_stream (ctf_file_t *fp, uint32_t flags, const void *src,
+		     size_t len, ctf_compress_sink_f *sink, void *arg)
+{
+  const ctf_compressor_t *cc;
+  int err;
+
+  if ((cc = ctf_compressor (flags)) == NULL)
+    return (ctf_set_errno (fp, ECTF_NOTSUP));
+
+  if ((err = cc->cc_compress (src, len, sink, arg)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  return 0;
+}
+
+/* Decompress SRCLEN bytes at SRC into exactly DSTLEN bytes at DST, with the
+   compressor named by FLAGS.  Return 0 or a positive error number.  */
+int
+ctf_decompress (uint32_t flags, void *dst, size_t dstlen, const void *src,
+		size_t srclen)
+{
+  const ctf_compressor_t *cc;
+
+  if ((cc = ctf_compressor (flags)) == NULL)
+    {
+      ctf_dprintf ("ctf_decompress: no compressor for flags 0x%x\n",
+		   flags & CTF_F_COMPRESSOR);
+      return ECTF_NOTSUP;
+    }
+
+  ctf_dprintf ("ctf_decompress: %s, %lu -> %lu bytes\n", cc->cc_name,
+	       (unsigned long) srclen, (unsigned long) dstlen);
+
+  return cc->cc_decompress (dst, dstlen, src, srclen);
+}
+
+/* Set the compressor used when FP is written out compressed: one of the
+   CTF_COMPRESSOR_* constants.  Dicts opened from compressed data default to
+   the compressor they were compressed with, and others to zlib.  */
+int
+ctf_set_compressor (ctf_file_t *fp, uint32_t compressor)
+{
+  if ((compressor & ~CTF_F_COMPRESSOR) != 0
+      || !ctf_compressor_available (compressor))
+    return (ctf_set_errno (fp, ECTF_NOTSUP));
+
+  fp->ctf_compressor = compressor;
+  return 0;
+}
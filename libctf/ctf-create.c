@@ -241,6 +241,169 @@ ctf_update (ctf_file_t *fp)
   return 0;
 }
 
+/* Turn incremental serialization of FP on or off.  In incremental mode, as
+   long as no type already serialized has been changed since, ctf_serialize()
+   keeps the serialized types and the string table as they are and appends only
+   the types added since the last serialization, and their new strings.
+
+   Incrementally-serialized dicts have an empty name index and a string table
+   that is only sorted in pieces: turning incremental mode off arranges for the
+   next serialization to be a full one again, so do that before the final
+   write.  */
+int
+ctf_set_incremental (ctf_file_t *fp, int enable)
+{
+  if (!(fp->ctf_flags & LCTF_RDWR))
+    return (ctf_set_errno (fp, ECTF_RDONLY));
+
+  if (enable)
+    fp->ctf_flags |= LCTF_INCREMENTAL;
+  else if (fp->ctf_flags & LCTF_INCREMENTAL)
+    fp->ctf_flags = (fp->ctf_flags & ~LCTF_INCREMENTAL) | LCTF_DIRTY;
+
+  return 0;
+}
+
+/* Note that DTD is about to change.  If it has already been serialized, the
+   next serialization cannot be incremental.  */
+static void
+ctf_dtd_changed (ctf_file_t *fp, const ctf_dtdef_t *dtd)
+{
+  if ((unsigned long) LCTF_TYPE_TO_INDEX (fp, dtd->dtd_type)
+      <= fp->ctf_inc_typemax)
+    fp->ctf_inc_typemax = 0;
+}
+
+typedef struct ctf_nameidx_arg
+{
+  ctf_file_t *fp;
+  ctf_nameidx_elem_t *elems;
+  size_t nelems;
+  size_t alloc;
+  int err;
+} ctf_nameidx_arg_t;
+
+/* Note one name in a writable name hash for the name index.  The dtd's name has
+   already been moved to the new string table.  */
+
+static void
+ctf_nameidx_collect (void *key, void *value, void *arg_)
+{
+  ctf_nameidx_arg_t *arg = (ctf_nameidx_arg_t *) arg_;
+  ctf_id_t type = (ctf_id_t) (uintptr_t) value;
+  ctf_dtdef_t *dtd;
+
+  if (arg->err != 0 || (dtd = ctf_dtd_lookup (arg->fp, type)) == NULL)
+    return;
+
+  if (arg->nelems >= arg->alloc)
+    {
+      size_t alloc = arg->alloc ? arg->alloc * 2 : 64;
+      ctf_nameidx_elem_t *elems;
+
+      if ((elems = realloc (arg->elems, alloc
+			    * sizeof (ctf_nameidx_elem_t))) == NULL)
+	{
+	  arg->err = ENOMEM;
+	  return;
+	}
+      arg->elems = elems;
+      arg->alloc = alloc;
+    }
+
+  arg->elems[arg->nelems].cnx_name = dtd->dtd_data.ctt_name;
+  arg->elems[arg->nelems].cnx_type = (uint32_t) type;
+  arg->elems[arg->nelems].cnx_hash = ctf_hash_string (key);
+  arg->nelems++;
+}
+
+/* Sort names for the name index into type ID order, the order a reader would
+   hash them in.  */
+
+static int
+ctf_nameidx_sort (const void *one_, const void *two_)
+{
+  const ctf_nameidx_elem_t *one = (const ctf_nameidx_elem_t *) one_;
+  const ctf_nameidx_elem_t *two = (const ctf_nameidx_elem_t *) two_;
+
+  if (one->cnx_type < two->cnx_type)
+    return -1;
+  else if (one->cnx_type > two->cnx_type)
+    return 1;
+  return 0;
+}
+
+/* Add a name index to the serialized CTF in *BUFP, of size *SIZEP, which must
+   be complete but for its (empty) name index section.  The name index is laid
+   out from the name hashes of FP itself, so it holds exactly the names lookups
+   in FP find.  *BUFP is reallocated, *SIZEP adjusted, and the header bumped to
+   CTF_VERSION_4.  If FP has no names at all, nothing is changed.  */
+
+static int
+ctf_serialize_nameidx (ctf_file_t *fp, unsigned char **bufp, size_t *sizep)
+{
+  ctf_names_t *tables[CTF_NAMEIDX_MAX] = { &fp->ctf_structs, &fp->ctf_unions,
+					   &fp->ctf_enums, &fp->ctf_names };
+  ctf_nameidx_arg_t args[CTF_NAMEIDX_MAX];
+  ctf_header_t *hdrp = (ctf_header_t *) *bufp;
+  unsigned char *newbuf, *t;
+  size_t idx_size = 0;
+  size_t nnames = 0;
+  size_t off = sizeof (ctf_header_t) + hdrp->cth_nameidxoff;
+  int err = 0;
+  int i;
+
+  assert (hdrp->cth_nameidxoff == hdrp->cth_stroff);
+
+  memset (args, 0, sizeof (args));
+  for (i = 0; i < CTF_NAMEIDX_MAX; i++)
+    {
+      args[i].fp = fp;
+      ctf_dynhash_iter (tables[i]->ctn_writable, ctf_nameidx_collect, &args[i]);
+      if ((err = args[i].err) != 0)
+	goto err;
+
+      if (args[i].nelems > 1)
+	qsort (args[i].elems, args[i].nelems, sizeof (ctf_nameidx_elem_t),
+	       ctf_nameidx_sort);
+      idx_size += ctf_nameidx_size (args[i].nelems);
+      nnames += args[i].nelems;
+    }
+
+  if (nnames == 0)
+    goto err;
+
+  if ((newbuf = malloc (*sizep + idx_size)) == NULL)
+    {
+      err = EAGAIN;
+      goto err;
+    }
+
+  memcpy (newbuf, *bufp, off);
+  for (i = 0, t = newbuf + off; i < CTF_NAMEIDX_MAX; i++)
+    {
+      ctf_nameidx_write (args[i].elems, args[i].nelems, t);
+      t += ctf_nameidx_size (args[i].nelems);
+    }
+  memcpy (t, *bufp + off, *sizep - off);
+
+  hdrp = (ctf_header_t *) newbuf;
+  hdrp->cth_version = CTF_VERSION_4;
+  hdrp->cth_stroff += idx_size;
+
+  free (*bufp);
+  *bufp = newbuf;
+  *sizep += idx_size;
+
+ err:
+  for (i = 0; i < CTF_NAMEIDX_MAX; i++)
+    free (args[i].elems);
+
+  if (err != 0)
+    return (ctf_set_errno (fp, err));
+  return 0;
+}
+
 /* If the specified CTF container is writable and has been modified, reload this
    container with the updated type definitions, ready for serialization.  In
    order to make this code and the rest of libctf as simple as possible, we
@@ -256,7 +419,7 @@ ctf_serialize (ctf_file_t *fp)
 {
   ctf_file_t ofp, *nfp;
   ctf_header_t hdr, *hdrp;
-  ctf_dtdef_t *dtd;
+  ctf_dtdef_t *dtd, *first_dtd;
   ctf_dvdef_t *dvd;
   ctf_varent_t *dvarents;
   ctf_strs_writable_t strtab;
@@ -265,7 +428,15 @@ ctf_serialize (ctf_file_t *fp)
   unsigned long i;
   size_t buf_size, type_size, nvars;
   unsigned char *buf, *newbuf;
+  const unsigned char *old_types = NULL;
+  size_t old_types_size = 0;
+  int incremental = 0;
   int err;
+  ctf_stat_timer (start);
+
+  /* Link outputs spilled by ctf_link() are already in serialized form.  */
+  if (fp->ctf_flags & LCTF_SPILLED)
+    return 0;
 
   if (!(fp->ctf_flags & LCTF_RDWR))
     return (ctf_set_errno (fp, ECTF_RDONLY));
@@ -274,19 +445,42 @@ ctf_serialize (ctf_file_t *fp)
   if (!(fp->ctf_flags & LCTF_DIRTY))
     return 0;
 
+  /* In incremental mode, if none of the types in the last serialization have
+     changed, keep them as they are in the existing buffer and only lay out the
+     types after them.  The dtd list is in type ID order, so those are found at
+     its end.  */
+
+  first_dtd = ctf_list_next (&fp->ctf_dtdefs);
+  if ((fp->ctf_flags & LCTF_INCREMENTAL) && fp->ctf_inc_typemax > 0)
+    {
+      for (dtd = ctf_list_prev (&fp->ctf_dtdefs); dtd != NULL
+	     && ((unsigned long) LCTF_TYPE_TO_INDEX (fp, dtd->dtd_type)
+		 > fp->ctf_inc_typemax); dtd = ctf_list_prev (dtd));
+
+      if (dtd != NULL)
+	{
+	  first_dtd = ctf_list_next (dtd);
+	  old_types = fp->ctf_buf + fp->ctf_header->cth_typeoff;
+	  old_types_size = fp->ctf_header->cth_nameidxoff
+	    - fp->ctf_header->cth_typeoff;
+	  incremental = 1;
+	}
+    }
+
   /* Fill in an initial CTF header.  We will leave the label, object,
      and function sections empty and only output a header, type section,
      and string table.  The type section begins at a 4-byte aligned
-     boundary past the CTF header itself (at relative offset zero).  */
+     boundary past the CTF header itself (at relative offset zero).  The
+     dict is only written as CTF_VERSION_4 if it gets a name index.  */
 
   memset (&hdr, 0, sizeof (hdr));
   hdr.cth_magic = CTF_MAGIC;
-  hdr.cth_version = CTF_VERSION;
+  hdr.cth_version = CTF_VERSION_3;
 
   /* Iterate through the dynamic type definition list and compute the
      size of the CTF type section we will need to generate.  */
 
-  for (type_size = 0, dtd = ctf_list_next (&fp->ctf_dtdefs);
+  for (type_size = old_types_size, dtd = first_dtd;
        dtd != NULL; dtd = ctf_list_next (dtd))
     {
       uint32_t kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
@@ -337,6 +531,7 @@ ctf_serialize (ctf_file_t *fp)
 
   hdr.cth_typeoff = hdr.cth_varoff + (nvars * sizeof (ctf_varent_t));
   hdr.cth_stroff = hdr.cth_typeoff + type_size;
+  hdr.cth_nameidxoff = hdr.cth_stroff;
   hdr.cth_strlen = 0;
 
   buf_size = sizeof (ctf_header_t) + hdr.cth_stroff + hdr.cth_strlen;
@@ -373,10 +568,14 @@ ctf_serialize (ctf_file_t *fp)
 
   /* We now take a final lap through the dynamic type definition list and copy
      the appropriate type records to the output buffer, noting down the
-     strings as we go.  */
+     strings as we go.  Types kept from an earlier serialization need no
+     strings noting down: the strings they refer to keep their offsets.  */
 
-  for (dtd = ctf_list_next (&fp->ctf_dtdefs);
-       dtd != NULL; dtd = ctf_list_next (dtd))
+  if (old_types_size > 0)
+    memcpy (t, old_types, old_types_size);
+  t += old_types_size;
+
+  for (dtd = first_dtd; dtd != NULL; dtd = ctf_list_next (dtd))
     {
       uint32_t kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
       uint32_t vlen = LCTF_INFO_VLEN (fp, dtd->dtd_data.ctt_info);
@@ -394,9 +593,15 @@ ctf_serialize (ctf_file_t *fp)
 
       memcpy (t, &dtd->dtd_data, len);
       copied = (ctf_stype_t *) t;  /* name is at the start: constant offset.  */
+
+      /* The dtd's own name offset must move with the strtab too, or it will
+	 be wrong once the next serialization lays the strtab out anew.  */
       if (copied->ctt_name
 	  && (name = ctf_strraw (fp, copied->ctt_name)) != NULL)
-	ctf_str_add_ref (fp, name, &copied->ctt_name);
+	{
+	  ctf_str_add_ref (fp, name, &copied->ctt_name);
+	  ctf_str_add_ref (fp, name, &dtd->dtd_data.ctt_name);
+	}
       t += len;
 
       switch (kind)
@@ -465,7 +670,10 @@ ctf_serialize (ctf_file_t *fp)
   /* Construct the final string table and fill out all the string refs with the
      final offsets.  Then purge the refs list, because we're about to move this
      strtab onto the end of the buf, invalidating all the offsets.  */
-  strtab = ctf_str_write_strtab (fp);
+  if (incremental)
+    strtab = ctf_str_append_strtab (fp);
+  else
+    strtab = ctf_str_write_strtab (fp);
   ctf_str_purge_refs (fp);
 
   if (strtab.cts_strs == NULL)
@@ -493,6 +701,27 @@ ctf_serialize (ctf_file_t *fp)
   buf_size += hdrp->cth_strlen;
   free (strtab.cts_strs);
 
+  /* Now the types and strings are final, we can lay out the name index.
+     Incremental serializations leave it empty, since building it means
+     opening every type.  */
+
+  if (!incremental && ctf_serialize_nameidx (fp, &buf, &buf_size) < 0)
+    {
+      free (buf);
+      return -1;				/* errno is set for us.  */
+    }
+
+  /* Without a name index, this is a v3 dict, which existing readers can
+     open: drop the cth_nameidxoff from its header.  */
+
+  hdrp = (ctf_header_t *) buf;
+  if (hdrp->cth_version == CTF_VERSION_3)
+    {
+      memmove (buf + CTF_HEADER_NONAMEIDX_SIZE, buf + sizeof (ctf_header_t),
+	       buf_size - sizeof (ctf_header_t));
+      buf_size -= sizeof (ctf_header_t) - CTF_HEADER_NONAMEIDX_SIZE;
+    }
+
   /* Finally, we are ready to ctf_simple_open() the new container.  If this
      is successful, we then switch nfp and fp and free the old container.  */
 
@@ -515,13 +744,17 @@ ctf_serialize (ctf_file_t *fp)
   nfp->ctf_dtdefs = fp->ctf_dtdefs;
   nfp->ctf_dvhash = fp->ctf_dvhash;
   nfp->ctf_dvdefs = fp->ctf_dvdefs;
+  nfp->ctf_arena = fp->ctf_arena;
+  nfp->ctf_typemax = fp->ctf_typemax;
   nfp->ctf_dtoldid = fp->ctf_dtoldid;
+  nfp->ctf_inc_typemax = fp->ctf_typemax;
   nfp->ctf_add_processing = fp->ctf_add_processing;
   nfp->ctf_snapshots = fp->ctf_snapshots + 1;
   nfp->ctf_specific = fp->ctf_specific;
   nfp->ctf_ptrtab = fp->ctf_ptrtab;
   nfp->ctf_ptrtab_len = fp->ctf_ptrtab_len;
   nfp->ctf_link_inputs = fp->ctf_link_inputs;
+  nfp->ctf_link_prev = fp->ctf_link_prev;
   nfp->ctf_link_outputs = fp->ctf_link_outputs;
   nfp->ctf_str_prov_offset = fp->ctf_str_prov_offset;
   nfp->ctf_syn_ext_strtab = fp->ctf_syn_ext_strtab;
@@ -529,6 +762,10 @@ ctf_serialize (ctf_file_t *fp)
   nfp->ctf_link_type_mapping = fp->ctf_link_type_mapping;
   nfp->ctf_link_memb_name_changer = fp->ctf_link_memb_name_changer;
   nfp->ctf_link_memb_name_changer_arg = fp->ctf_link_memb_name_changer_arg;
+  nfp->ctf_link_threads = fp->ctf_link_threads;
+  nfp->ctf_link_budget = fp->ctf_link_budget;
+  nfp->ctf_compressor = fp->ctf_compressor;
+  nfp->ctf_stats = fp->ctf_stats;
 
   nfp->ctf_snapshot_lu = fp->ctf_snapshots;
 
@@ -548,6 +785,7 @@ ctf_serialize (ctf_file_t *fp)
   fp->ctf_add_processing = NULL;
   fp->ctf_ptrtab = NULL;
   fp->ctf_link_inputs = NULL;
+  fp->ctf_link_prev = NULL;
   fp->ctf_link_outputs = NULL;
   fp->ctf_syn_ext_strtab = NULL;
   fp->ctf_link_cu_mapping = NULL;
@@ -555,6 +793,7 @@ ctf_serialize (ctf_file_t *fp)
 
   fp->ctf_dvhash = NULL;
   memset (&fp->ctf_dvdefs, 0, sizeof (ctf_list_t));
+  memset (&fp->ctf_arena, 0, sizeof (ctf_arena_t));
   memset (fp->ctf_lookups, 0, sizeof (fp->ctf_lookups));
   fp->ctf_structs.ctn_writable = NULL;
   fp->ctf_unions.ctn_writable = NULL;
@@ -568,6 +807,7 @@ ctf_serialize (ctf_file_t *fp)
   nfp->ctf_refcnt = 1;		/* Force nfp to be freed.  */
   ctf_file_close (nfp);
 
+  ctf_stat_file_time (fp, cst_serialize_ns, start);
   return 0;
 }
 
@@ -627,13 +867,16 @@ ctf_dtd_delete (ctf_file_t *fp, ctf_dtdef_t *dtd)
 	   dmd != NULL; dmd = nmd)
 	{
 	  if (dmd->dmd_name != NULL)
-	      free (dmd->dmd_name);
+	    ctf_arena_release (&fp->ctf_arena, dmd->dmd_name,
+			       strlen (dmd->dmd_name) + 1);
 	  nmd = ctf_list_next (dmd);
-	  free (dmd);
+	  ctf_arena_release (&fp->ctf_arena, dmd, sizeof (ctf_dmdef_t));
 	}
       break;
     case CTF_K_FUNCTION:
-      free (dtd->dtd_u.dtu_argv);
+      ctf_arena_release (&fp->ctf_arena, dtd->dtd_u.dtu_argv,
+			 sizeof (ctf_id_t)
+			 * LCTF_INFO_VLEN (fp, dtd->dtd_data.ctt_info));
       break;
     case CTF_K_FORWARD:
       name_kind = dtd->dtd_data.ctt_type;
@@ -650,7 +893,7 @@ ctf_dtd_delete (ctf_file_t *fp, ctf_dtdef_t *dtd)
     }
 
   ctf_list_delete (&fp->ctf_dtdefs, dtd);
-  free (dtd);
+  ctf_arena_release (&fp->ctf_arena, dtd, sizeof (ctf_dtdef_t));
 }
 
 ctf_dtdef_t *
@@ -690,10 +933,11 @@ void
 ctf_dvd_delete (ctf_file_t *fp, ctf_dvdef_t *dvd)
 {
   ctf_dynhash_remove (fp->ctf_dvhash, dvd->dvd_name);
-  free (dvd->dvd_name);
+  ctf_arena_release (&fp->ctf_arena, dvd->dvd_name,
+		     strlen (dvd->dvd_name) + 1);
 
   ctf_list_delete (&fp->ctf_dvdefs, dvd);
-  free (dvd);
+  ctf_arena_release (&fp->ctf_arena, dvd, sizeof (ctf_dvdef_t));
 }
 
 ctf_dvdef_t *
@@ -788,6 +1032,9 @@ ctf_rollback (ctf_file_t *fp, ctf_snapshot_id_t id)
   if (fp->ctf_snapshots == fp->ctf_snapshot_lu)
     fp->ctf_flags &= ~LCTF_DIRTY;
 
+  /* Anything cached while the dict was last clean may be out of date.  */
+  ctf_type_cache_flush (fp);
+
   return 0;
 }
 
@@ -798,6 +1045,8 @@ ctf_add_generic (ctf_file_t *fp, uint32_t flag, const char *name, int kind,
   ctf_dtdef_t *dtd;
   ctf_id_t type;
 
+  *rp = NULL;
+
   if (flag != CTF_ADD_NONROOT && flag != CTF_ADD_ROOT)
     return (ctf_set_errno (fp, EINVAL));
 
@@ -814,7 +1063,7 @@ ctf_add_generic (ctf_file_t *fp, uint32_t flag, const char *name, int kind,
   if (ctf_grow_ptrtab (fp) < 0)
       return CTF_ERR;		/* errno is set for us. */
 
-  if ((dtd = malloc (sizeof (ctf_dtdef_t))) == NULL)
+  if ((dtd = ctf_arena_alloc (&fp->ctf_arena, sizeof (ctf_dtdef_t))) == NULL)
     return (ctf_set_errno (fp, EAGAIN));
 
   type = ++fp->ctf_typemax;
@@ -826,13 +1075,13 @@ ctf_add_generic (ctf_file_t *fp, uint32_t flag, const char *name, int kind,
 
   if (dtd->dtd_data.ctt_name == 0 && name != NULL && name[0] != '\0')
     {
-      free (dtd);
+      ctf_arena_release (&fp->ctf_arena, dtd, sizeof (ctf_dtdef_t));
       return (ctf_set_errno (fp, EAGAIN));
     }
 
   if (ctf_dtd_insert (fp, dtd, flag, kind) < 0)
     {
-      free (dtd);
+      ctf_arena_release (&fp->ctf_arena, dtd, sizeof (ctf_dtdef_t));
       return CTF_ERR;			/* errno is set for us.  */
     }
   fp->ctf_flags |= LCTF_DIRTY;
@@ -1027,6 +1276,7 @@ ctf_set_array (ctf_file_t *fp, ctf_id_t type, const ctf_arinfo_t *arp)
       || LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info) != CTF_K_ARRAY)
     return (ctf_set_errno (fp, ECTF_BADID));
 
+  ctf_dtd_changed (fp, dtd);
   fp->ctf_flags |= LCTF_DIRTY;
   dtd->dtd_u.dtu_arr = *arp;
 
@@ -1065,13 +1315,14 @@ ctf_add_function (ctf_file_t *fp, uint32_t flag,
   if (vlen > CTF_MAX_VLEN)
     return (ctf_set_errno (fp, EOVERFLOW));
 
-  if (vlen != 0 && (vdat = malloc (sizeof (ctf_id_t) * vlen)) == NULL)
+  if (vlen != 0 && (vdat = ctf_arena_alloc (&fp->ctf_arena,
+					     sizeof (ctf_id_t) * vlen)) == NULL)
     return (ctf_set_errno (fp, EAGAIN));
 
   if ((type = ctf_add_generic (fp, flag, NULL, CTF_K_FUNCTION,
 			       &dtd)) == CTF_ERR)
     {
-      free (vdat);
+      ctf_arena_release (&fp->ctf_arena, vdat, sizeof (ctf_id_t) * vlen);
       return CTF_ERR;		   /* errno is set for us.  */
     }
 
@@ -1103,6 +1354,7 @@ ctf_add_struct_sized (ctf_file_t *fp, uint32_t flag, const char *name,
 				    &dtd)) == CTF_ERR)
     return CTF_ERR;		/* errno is set for us.  */
 
+  ctf_dtd_changed (fp, dtd);
   dtd->dtd_data.ctt_info = CTF_TYPE_INFO (CTF_K_STRUCT, flag, 0);
 
   if (size > CTF_MAX_SIZE)
@@ -1140,6 +1392,7 @@ ctf_add_union_sized (ctf_file_t *fp, uint32_t flag, const char *name,
 				    &dtd)) == CTF_ERR)
     return CTF_ERR;		/* errno is set for us */
 
+  ctf_dtd_changed (fp, dtd);
   dtd->dtd_data.ctt_info = CTF_TYPE_INFO (CTF_K_UNION, flag, 0);
 
   if (size > CTF_MAX_SIZE)
@@ -1176,6 +1429,7 @@ ctf_add_enum (ctf_file_t *fp, uint32_t flag, const char *name)
 				    &dtd)) == CTF_ERR)
     return CTF_ERR;		/* errno is set for us.  */
 
+  ctf_dtd_changed (fp, dtd);
   dtd->dtd_data.ctt_info = CTF_TYPE_INFO (CTF_K_ENUM, flag, 0);
   dtd->dtd_data.ctt_size = fp->ctf_dmodel->ctd_int;
 
@@ -1316,12 +1570,12 @@ ctf_add_enumerator (ctf_file_t *fp, ctf_id_t enid, const char *name,
 	return (ctf_set_errno (fp, ECTF_DUPLICATE));
     }
 
-  if ((dmd = malloc (sizeof (ctf_dmdef_t))) == NULL)
+  if ((dmd = ctf_arena_alloc (&fp->ctf_arena, sizeof (ctf_dmdef_t))) == NULL)
     return (ctf_set_errno (fp, EAGAIN));
 
-  if ((s = strdup (name)) == NULL)
+  if ((s = ctf_arena_strdup (&fp->ctf_arena, name)) == NULL)
     {
-      free (dmd);
+      ctf_arena_release (&fp->ctf_arena, dmd, sizeof (ctf_dmdef_t));
       return (ctf_set_errno (fp, EAGAIN));
     }
 
@@ -1330,6 +1584,7 @@ ctf_add_enumerator (ctf_file_t *fp, ctf_id_t enid, const char *name,
   dmd->dmd_offset = 0;
   dmd->dmd_value = value;
 
+  ctf_dtd_changed (fp, dtd);
   dtd->dtd_data.ctt_info = CTF_TYPE_INFO (kind, root, vlen + 1);
   ctf_list_append (&dtd->dtd_u.dtu_members, dmd);
 
@@ -1379,12 +1634,12 @@ ctf_add_member_offset (ctf_file_t *fp, ctf_id_t souid, const char *name,
       (malign = ctf_type_align (fp, type)) < 0)
     return -1;			/* errno is set for us.  */
 
-  if ((dmd = malloc (sizeof (ctf_dmdef_t))) == NULL)
+  if ((dmd = ctf_arena_alloc (&fp->ctf_arena, sizeof (ctf_dmdef_t))) == NULL)
     return (ctf_set_errno (fp, EAGAIN));
 
-  if (name != NULL && (s = strdup (name)) == NULL)
+  if (name != NULL && (s = ctf_arena_strdup (&fp->ctf_arena, name)) == NULL)
     {
-      free (dmd);
+      ctf_arena_release (&fp->ctf_arena, dmd, sizeof (ctf_dmdef_t));
       return (ctf_set_errno (fp, EAGAIN));
     }
 
@@ -1449,6 +1704,7 @@ ctf_add_member_offset (ctf_file_t *fp, ctf_id_t souid, const char *name,
   else
     dtd->dtd_data.ctt_size = (uint32_t) ssize;
 
+  ctf_dtd_changed (fp, dtd);
   dtd->dtd_data.ctt_info = CTF_TYPE_INFO (kind, root, vlen + 1);
   ctf_list_append (&dtd->dtd_u.dtu_members, dmd);
 
@@ -1501,12 +1757,13 @@ ctf_add_variable (ctf_file_t *fp, const char *name, ctf_id_t ref)
       && (ctf_errno (fp) == ECTF_NONREPRESENTABLE))
     return -1;
 
-  if ((dvd = malloc (sizeof (ctf_dvdef_t))) == NULL)
+  if ((dvd = ctf_arena_alloc (&fp->ctf_arena, sizeof (ctf_dvdef_t))) == NULL)
     return (ctf_set_errno (fp, EAGAIN));
 
-  if (name != NULL && (dvd->dvd_name = strdup (name)) == NULL)
+  if (name != NULL
+      && (dvd->dvd_name = ctf_arena_strdup (&fp->ctf_arena, name)) == NULL)
     {
-      free (dvd);
+      ctf_arena_release (&fp->ctf_arena, dvd, sizeof (ctf_dvdef_t));
       return (ctf_set_errno (fp, EAGAIN));
     }
   dvd->dvd_type = ref;
@@ -1514,8 +1771,9 @@ ctf_add_variable (ctf_file_t *fp, const char *name, ctf_id_t ref)
 
   if (ctf_dvd_insert (fp, dvd) < 0)
     {
-      free (dvd->dvd_name);
-      free (dvd);
+      ctf_arena_release (&fp->ctf_arena, dvd->dvd_name,
+			 strlen (dvd->dvd_name) + 1);
+      ctf_arena_release (&fp->ctf_arena, dvd, sizeof (ctf_dvdef_t));
       return -1;			/* errno is set for us.  */
     }
 
@@ -1579,15 +1837,16 @@ static int
 membadd (const char *name, ctf_id_t type, unsigned long offset, void *arg)
 {
   ctf_bundle_t *ctb = arg;
+  ctf_arena_t *arena = &ctb->ctb_file->ctf_arena;
   ctf_dmdef_t *dmd;
   char *s = NULL;
 
-  if ((dmd = malloc (sizeof (ctf_dmdef_t))) == NULL)
+  if ((dmd = ctf_arena_alloc (arena, sizeof (ctf_dmdef_t))) == NULL)
     return (ctf_set_errno (ctb->ctb_file, EAGAIN));
 
-  if (name != NULL && (s = strdup (name)) == NULL)
+  if (name != NULL && (s = ctf_arena_strdup (arena, name)) == NULL)
     {
-      free (dmd);
+      ctf_arena_release (arena, dmd, sizeof (ctf_dmdef_t));
       return (ctf_set_errno (ctb->ctb_file, EAGAIN));
     }
 
@@ -1667,7 +1926,7 @@ ctf_add_type_internal (ctf_file_t *dst_fp, ctf_file_t *src_fp, ctf_id_t src_type
 	  if (kind == CTF_K_STRUCT || kind == CTF_K_UNION
 	      || kind == CTF_K_ENUM)
 	    {
-	      if ((dst_tp = ctf_lookup_by_id (&tmp_fp, dst_type)) != NULL)
+	      if ((dst_tp = ctf_lookup_by_id (&tmp_fp, tmp)) != NULL)
 		if (vlen == LCTF_INFO_VLEN (tmp_fp, dst_tp->ctt_info))
 		  return tmp;
 	    }
@@ -2076,6 +2335,9 @@ ctf_add_type (ctf_file_t *dst_fp, ctf_file_t *src_fp, ctf_id_t src_type)
   id = ctf_add_type_internal (dst_fp, src_fp, src_type, src_fp);
   ctf_dynhash_empty (src_fp->ctf_add_processing);
 
+  if (id == CTF_ERR && ctf_errno (dst_fp) == ECTF_CONFLICT)
+    ctf_stat_file_add (dst_fp, cst_add_type_conflicts, 1);
+
   return id;
 }
 
@@ -2087,7 +2349,7 @@ ctf_gzwrite (ctf_file_t *fp, gzFile fd)
   ssize_t resid;
   ssize_t len;
 
-  resid = sizeof (ctf_header_t);
+  resid = LCTF_HEADER_SIZE (fp->ctf_header);
   buf = (unsigned char *) fp->ctf_header;
   while (resid != 0)
     {
@@ -2110,65 +2372,77 @@ ctf_gzwrite (ctf_file_t *fp, gzFile fd)
   return 0;
 }
 
+/* A ctf_compress_sink_f that writes to the file descriptor pointed to by
+   ARG.  */
+static int
+ctf_write_fd_sink (const void *buf, size_t len, void *arg)
+{
+  int fd = *(int *) arg;
+  const unsigned char *bp = buf;
+  ssize_t written;
+
+  while (len > 0)
+    {
+      if ((written = write (fd, bp, len)) < 0)
+	return errno;
+      len -= written;
+      bp += written;
+    }
+  return 0;
+}
+
 /* Compress the specified CTF data stream and write it to the specified file
-   descriptor.  */
+   descriptor.  The compressed data is written as it is produced, so no buffer
+   of its full size is ever needed.  */
 int
 ctf_compress_write (ctf_file_t *fp, int fd)
 {
-  unsigned char *buf;
-  unsigned char *bp;
   ctf_header_t h;
-  ctf_header_t *hp = &h;
-  ssize_t header_len = sizeof (ctf_header_t);
-  ssize_t compress_len;
-  ssize_t len;
-  int rc;
-  int err = 0;
+  int err;
 
   if (ctf_serialize (fp) < 0)
     return -1;					/* errno is set for us.  */
 
-  memcpy (hp, fp->ctf_header, header_len);
-  hp->cth_flags |= CTF_F_COMPRESS;
-  compress_len = compressBound (fp->ctf_size);
+  memcpy (&h, fp->ctf_header, sizeof (ctf_header_t));
+  h.cth_flags |= CTF_F_COMPRESS | fp->ctf_compressor;
 
-  if ((buf = malloc (compress_len)) == NULL)
-    return (ctf_set_errno (fp, ECTF_ZALLOC));
+  if ((err = ctf_write_fd_sink (&h, LCTF_HEADER_SIZE (&h), &fd)) != 0)
+    return (ctf_set_errno (fp, err));
 
-  if ((rc = compress (buf, (uLongf *) &compress_len,
-		      fp->ctf_buf, fp->ctf_size)) != Z_OK)
-    {
-      ctf_dprintf ("zlib deflate err: %s\n", zError (rc));
-      err = ctf_set_errno (fp, ECTF_COMPRESS);
-      goto ret;
-    }
+  return ctf_compress_stream (fp, fp->ctf_compressor, fp->ctf_buf,
+			      fp->ctf_size, ctf_write_fd_sink, &fd);
+}
 
-  while (header_len > 0)
-    {
-      if ((len = write (fd, hp, header_len)) < 0)
-	{
-	  err = ctf_set_errno (fp, errno);
-	  goto ret;
-	}
-      header_len -= len;
-      hp += len;
-    }
+typedef struct ctf_write_mem_arg
+{
+  unsigned char *buf;
+  size_t size;
+  size_t alloc;
+} ctf_write_mem_arg_t;
+
+/* A ctf_compress_sink_f that appends to the growing buffer in the
+   ctf_write_mem_arg_t pointed to by ARG.  */
+static int
+ctf_write_mem_sink (const void *buf, size_t len, void *arg_)
+{
+  ctf_write_mem_arg_t *arg = (ctf_write_mem_arg_t *) arg_;
 
-  bp = buf;
-  while (compress_len > 0)
+  if (arg->size + len > arg->alloc)
     {
-      if ((len = write (fd, bp, compress_len)) < 0)
-	{
-	  err = ctf_set_errno (fp, errno);
-	  goto ret;
-	}
-      compress_len -= len;
-      bp += len;
+      size_t alloc = arg->alloc * 2;
+      unsigned char *nbuf;
+
+      if (alloc < arg->size + len)
+	alloc = arg->size + len;
+      if ((nbuf = realloc (arg->buf, alloc)) == NULL)
+	return ENOMEM;
+      arg->buf = nbuf;
+      arg->alloc = alloc;
     }
 
-ret:
-  free (buf);
-  return err;
+  memcpy (arg->buf + arg->size, buf, len);
+  arg->size += len;
+  return 0;
 }
 
 /* Optionally compress the specified CTF data stream and return it as a new
@@ -2176,51 +2450,55 @@ ret:
 unsigned char *
 ctf_write_mem (ctf_file_t *fp, size_t *size, size_t threshold)
 {
-  unsigned char *buf;
-  unsigned char *bp;
+  ctf_write_mem_arg_t arg;
   ctf_header_t *hp;
-  ssize_t header_len = sizeof (ctf_header_t);
-  ssize_t compress_len;
-  int rc;
+  int compressing;
 
   if (ctf_serialize (fp) < 0)
     return NULL;				/* errno is set for us.  */
 
-  compress_len = compressBound (fp->ctf_size);
-  if (fp->ctf_size < threshold)
-    compress_len = fp->ctf_size;
-  if ((buf = malloc (compress_len
-		     + sizeof (struct ctf_header))) == NULL)
+  /* When compressing, start with a guess at the compressed size, and let the
+     sink grow it as needed rather than allocating a compressBound()-sized
+     buffer up front.  */
+
+  compressing = fp->ctf_size >= threshold;
+  arg.size = LCTF_HEADER_SIZE (fp->ctf_header);
+  arg.alloc = arg.size + (compressing ? fp->ctf_size / 4 : fp->ctf_size);
+
+  if ((arg.buf = malloc (arg.alloc)) == NULL)
     {
       ctf_set_errno (fp, ENOMEM);
       return NULL;
     }
 
-  hp = (ctf_header_t *) buf;
-  memcpy (hp, fp->ctf_header, header_len);
-  bp = buf + sizeof (struct ctf_header);
-  *size = sizeof (struct ctf_header);
+  hp = (ctf_header_t *) arg.buf;
+  memcpy (hp, fp->ctf_header, arg.size);
 
-  if (fp->ctf_size < threshold)
+  if (!compressing)
     {
-      hp->cth_flags &= ~CTF_F_COMPRESS;
-      memcpy (bp, fp->ctf_buf, fp->ctf_size);
-      *size += fp->ctf_size;
+      hp->cth_flags &= ~(CTF_F_COMPRESS | CTF_F_COMPRESSOR);
+      memcpy (arg.buf + arg.size, fp->ctf_buf, fp->ctf_size);
+      arg.size += fp->ctf_size;
     }
   else
     {
-      hp->cth_flags |= CTF_F_COMPRESS;
-      if ((rc = compress (bp, (uLongf *) &compress_len,
-			  fp->ctf_buf, fp->ctf_size)) != Z_OK)
+      unsigned char *buf;
+
+      hp->cth_flags |= CTF_F_COMPRESS | fp->ctf_compressor;
+      if (ctf_compress_stream (fp, fp->ctf_compressor, fp->ctf_buf,
+			       fp->ctf_size, ctf_write_mem_sink, &arg) < 0)
 	{
-	  ctf_dprintf ("zlib deflate err: %s\n", zError (rc));
-	  ctf_set_errno (fp, ECTF_COMPRESS);
-	  free (buf);
-	  return NULL;
+	  free (arg.buf);
+	  return NULL;				/* errno is set for us.  */
 	}
-      *size += compress_len;
+
+      /* Give back the slack, if any.  */
+      if ((buf = realloc (arg.buf, arg.size)) != NULL)
+	arg.buf = buf;
     }
-  return buf;
+
+  *size = arg.size;
+  return arg.buf;
 }
 
 /* Write the uncompressed CTF data stream to the specified file descriptor.  */
@@ -2234,7 +2512,7 @@ ctf_write (ctf_file_t *fp, int fd)
   if (ctf_serialize (fp) < 0)
     return -1;					/* errno is set for us.  */
 
-  resid = sizeof (ctf_header_t);
+  resid = LCTF_HEADER_SIZE (fp->ctf_header);
   buf = (unsigned char *) fp->ctf_header;
   while (resid != 0)
     {
@@ -0,0 +1,1866 @@
+/* CTF type deduplication.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <limits.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* The deduplicator implements CTF_LINK_SHARE_DUPLICATED linking.  Rather than
+   feeding every input type through ctf_add_type(), which looks each one up by
+   name in the output and compares it member-by-member with whatever it finds
+   there, we proceed in three phases:
+
+   1. Hashing.  Every type in every input is given a hash computed from its
+      kind, name, encoding, size, members and the hashes of the types it
+      references: structurally identical types have equal hashes, whichever
+      input they appear in.  Named structures, unions and forwards are hashed
+      by name alone when they are referenced from other types: since every
+      cycle in a C type graph passes through a tagged structure or union, this
+      makes the hash well-defined, and lets a forward and a full definition of
+      the same structure hash identically when pointed to.  Types with equal
+      hashes are then interned as one distinct type, once they have been
+      compared to make sure that the hashes did not merely collide.  As types
+      are interned we count the distinct inputs each appears in, and note which
+      distinct types are attached to each root-visible name: a name with more
+      than one is conflicted.
+
+   2. Placement.  A type goes into the shared parent if it appears in more than
+      one input, its name (if any) is not conflicted, and every type it needs
+      to be complete is also going into the parent.  Pointers to tagged types
+      that are not going into the parent point to forwards there instead.
+      Everything else goes into the per-CU child dict of the input it came from.
+      The exception is inputs marked as shared (in an incremental link, the
+      shared dict of the previous link), all of whose types go into the parent
+      whatever the other inputs contain.
+
+   3. Emission.  We walk every input in order, emitting each type into its
+      placement exactly once per output dict (the first time that distinct
+      type is seen there), recursively emitting whatever it references first.
+      There are no name lookups.
+
+   The output is deterministic: it depends only on the order of the inputs and
+   the order of the types within them.  */
+
+/* Hash values: 64-bit FNV-1a.  */
+
+typedef uint64_t ctf_dedup_hval_t;
+
+#define CTF_DEDUP_HVAL_INIT 0xcbf29ce484222325ULL
+#define CTF_DEDUP_HVAL_PRIME 0x100000001b3ULL
+
+/* Edge classes: the ways in which one type can depend on another.  */
+
+enum
+  {
+   CTF_DEDUP_EDGE_NONE,		     /* No type (type 0).  */
+   CTF_DEDUP_EDGE_FULL,		     /* Depends on the full type.  */
+   CTF_DEDUP_EDGE_NAMED,	     /* Depends on a complete tagged type.  */
+   CTF_DEDUP_EDGE_NAMED_PTR	     /* Only points to a tagged type.  */
+  };
+
+/* Type placements.  */
+
+enum
+  {
+   CTF_DEDUP_UNPLACED,		     /* Not yet computed.  */
+   CTF_DEDUP_PLACING,		     /* Being computed right now.  */
+   CTF_DEDUP_PARENT,		     /* Goes into the shared parent.  */
+   CTF_DEDUP_CU			     /* Goes into a per-CU child.  */
+  };
+
+typedef struct ctf_dedup_type ctf_dedup_type_t;
+
+/* A name, in one of the four C namespaces.  */
+
+typedef struct ctf_dedup_name
+{
+  const char *cdn_name;		     /* Name (hash key).  */
+  ctf_dedup_type_t *cdn_def;	     /* First root-visible definition.  */
+  int cdn_kind;			     /* Kind of namespace.  */
+  int cdn_conflicted;		     /* More than one distinct definition.  */
+} ctf_dedup_name_t;
+
+/* One dependency of a type.  */
+
+typedef struct ctf_dedup_edge
+{
+  int cde_class;		     /* CTF_DEDUP_EDGE_*.  */
+  union
+  {
+    ctf_dedup_type_t *cde_type;	     /* For CTF_DEDUP_EDGE_FULL.  */
+    ctf_dedup_name_t *cde_name;	     /* For CTF_DEDUP_EDGE_NAMED*.  */
+  } cde_u;
+} ctf_dedup_edge_t;
+
+/* One distinct type, shared by every input type identical to it.  Identical
+   types always have the same hash; the rare distinct types that have the same
+   hash anyway are chained together.  */
+
+struct ctf_dedup_type
+{
+  ctf_dedup_hval_t cdt_hval;	     /* Hash value (hash key).  */
+  ctf_dedup_type_t *cdt_next;	     /* Next distinct type with this hash.  */
+  ctf_file_t *cdt_fp;		     /* Dict of first type like this.  */
+  ctf_id_t cdt_type;		     /* First type like this.  */
+  ctf_dedup_name_t *cdt_name;	     /* Root-visible name, if any.  */
+  uint32_t cdt_ninputs;		     /* Number of inputs citing this type.  */
+  uint32_t cdt_last_input;	     /* Last input counted, plus one.  */
+  int cdt_placement;		     /* CTF_DEDUP_* placement.  */
+  int cdt_shared;		     /* Forced into the parent by a shared
+					input.  */
+  uint32_t cdt_nedges;		     /* Number of dependencies.  */
+  ctf_dedup_edge_t *cdt_edges;	     /* Dependencies.  */
+};
+
+/* A dependency of an input type, as found while hashing it.  */
+
+typedef struct ctf_dedup_ref
+{
+  int cdr_class;		     /* CTF_DEDUP_EDGE_*.  */
+  int cdr_kind;			     /* Tag kind, for named edges.  */
+  const char *cdr_name;		     /* Tag name, for named edges.  */
+  ctf_file_t *cdr_fp;		     /* Dict of the type, for full edges.  */
+  ctf_id_t cdr_type;		     /* The type, for full edges.  */
+} ctf_dedup_ref_t;
+
+/* Hashing states.  */
+
+enum
+  {
+   CTF_DEDUP_UNHASHED,
+   CTF_DEDUP_HASHING,
+   CTF_DEDUP_HASHED,
+   CTF_DEDUP_FAILED
+  };
+
+/* One input type, once hashed.  */
+
+typedef struct ctf_dedup_hashed
+{
+  ctf_dedup_hval_t cdh_hval;	     /* Hash value.  */
+  ctf_dedup_ref_t *cdh_refs;	     /* Dependencies.  */
+  uint32_t cdh_nrefs;		     /* Number of dependencies.  */
+  int cdh_state;		     /* CTF_DEDUP_* hashing state.  */
+  int cdh_err;			     /* Error, if hashing failed.  */
+} ctf_dedup_hashed_t;
+
+/* Per-input state.  */
+
+typedef struct ctf_dedup_input
+{
+  ctf_link_input_t *cdi_input;	     /* The link input.  */
+  ctf_dedup_hashed_t *cdi_hashed;    /* Hashed types, by type index.  */
+  ctf_dedup_type_t **cdi_types;	     /* Interned types, by type index.  */
+  ctf_file_t *cdi_output;	     /* Per-CU output, if created.  */
+  uint32_t cdi_num;		     /* Input number.  */
+  int cdi_child;		     /* Child of another input?  */
+  int cdi_err;			     /* Error while hashing.  */
+} ctf_dedup_input_t;
+
+/* Namespaces.  */
+
+enum
+  {
+   CTF_DEDUP_NS_STRUCT,
+   CTF_DEDUP_NS_UNION,
+   CTF_DEDUP_NS_ENUM,
+   CTF_DEDUP_NS_ORDINARY,
+   CTF_DEDUP_NS_MAX
+  };
+
+/* The state of a single deduplication.  */
+
+typedef struct ctf_dedup
+{
+  ctf_file_t *cd_output;	     /* Shared output dict.  */
+  ctf_dedup_input_t *cd_inputs;	     /* Inputs, in link order.  */
+  uint32_t cd_ninputs;		     /* Number of inputs.  */
+  uint32_t cd_nthreads;		     /* Maximum number of hashing threads.  */
+  ctf_dynhash_t *cd_input_by_fp;     /* Maps input dicts to inputs.  */
+  ctf_dynhash_t *cd_types;	     /* Maps hvals to ctf_dedup_type_t
+					chains.  */
+  ctf_dynhash_t *cd_names[CTF_DEDUP_NS_MAX]; /* Maps names to ctf_dedup_name_t. */
+  ctf_dynhash_t *cd_emitted;	     /* Maps output dicts to hashes of
+					ctf_dedup_type_t -> emitted type.  */
+} ctf_dedup_t;
+
+typedef struct ctf_dedup_hash_state
+{
+  ctf_dedup_t *d;
+  ctf_dedup_input_t *in;
+  ctf_file_t *fp;
+  int kind;
+  ctf_dedup_hval_t hval;
+  ctf_dedup_ref_t *refs;
+  uint32_t nrefs;
+  uint32_t maxrefs;
+} ctf_dedup_hash_state_t;
+
+typedef struct ctf_dedup_emit_state
+{
+  ctf_dedup_t *d;
+  ctf_file_t *fp;
+  ctf_file_t *target;
+  ctf_id_t dst_type;
+} ctf_dedup_emit_state_t;
+
+static int ctf_dedup_hash_type (ctf_dedup_t *, ctf_dedup_input_t *,
+				ctf_file_t *, ctf_id_t, ctf_dedup_hval_t *);
+static int ctf_dedup_placement (ctf_dedup_type_t *);
+static ctf_id_t ctf_dedup_emit_type (ctf_dedup_t *, ctf_file_t *, ctf_id_t,
+				     ctf_file_t *);
+
+/* Hashing.  */
+
+static void
+ctf_dedup_mix (ctf_dedup_hval_t *hval, const void *buf, size_t len)
+{
+  const unsigned char *p = buf;
+  ctf_dedup_hval_t h = *hval;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      h ^= p[i];
+      h *= CTF_DEDUP_HVAL_PRIME;
+    }
+  *hval = h;
+}
+
+/* Mix in an integer in a fixed byte order, so that hashes do not depend on the
+   endianness of the host.  */
+
+static void
+ctf_dedup_mix_int (ctf_dedup_hval_t *hval, uint64_t val)
+{
+  unsigned char buf[sizeof (uint64_t)];
+  size_t i;
+
+  for (i = 0; i < sizeof (uint64_t); i++)
+    buf[i] = (val >> (i * CHAR_BIT)) & 0xff;
+
+  ctf_dedup_mix (hval, buf, sizeof (buf));
+}
+
+/* Mix in a string, including its terminating NUL, so that adjacent strings
+   cannot run into each other.  */
+
+static void
+ctf_dedup_mix_str (ctf_dedup_hval_t *hval, const char *str)
+{
+  if (str == NULL)
+    str = "";
+
+  ctf_dedup_mix (hval, str, strlen (str) + 1);
+}
+
+static int
+ctf_dedup_ns (int kind)
+{
+  switch (kind)
+    {
+    case CTF_K_STRUCT:
+      return CTF_DEDUP_NS_STRUCT;
+    case CTF_K_UNION:
+      return CTF_DEDUP_NS_UNION;
+    case CTF_K_ENUM:
+      return CTF_DEDUP_NS_ENUM;
+    default:
+      return CTF_DEDUP_NS_ORDINARY;
+    }
+}
+
+/* The hash of a reference to a tagged type by name alone.  */
+
+static ctf_dedup_hval_t
+ctf_dedup_name_hval (int kind, const char *name)
+{
+  ctf_dedup_hval_t hval = CTF_DEDUP_HVAL_INIT;
+
+  ctf_dedup_mix_str (&hval, "tag");
+  ctf_dedup_mix_int (&hval, ctf_dedup_ns (kind));
+  ctf_dedup_mix_str (&hval, name);
+  return hval;
+}
+
+/* Look up a name, creating it if need be.  The name is not copied: it points
+   into the string table of some input dict, which lives as long as we do.  */
+
+static ctf_dedup_name_t *
+ctf_dedup_name (ctf_dedup_t *d, int kind, const char *name)
+{
+  ctf_dynhash_t *h = d->cd_names[ctf_dedup_ns (kind)];
+  ctf_dedup_name_t *nm;
+
+  if ((nm = ctf_dynhash_lookup (h, name)) != NULL)
+    return nm;
+
+  if ((nm = calloc (1, sizeof (ctf_dedup_name_t))) == NULL)
+    {
+      ctf_set_errno (d->cd_output, ENOMEM);
+      return NULL;
+    }
+  nm->cdn_name = name;
+  nm->cdn_kind = kind;
+
+  if (ctf_dynhash_insert (h, (char *) name, nm) < 0)
+    {
+      free (nm);
+      ctf_set_errno (d->cd_output, ENOMEM);
+      return NULL;
+    }
+  return nm;
+}
+
+/* Find the input state for the dict containing TYPE.  *FP is updated to point
+   to the dict that actually contains TYPE.  */
+
+static ctf_dedup_input_t *
+ctf_dedup_lookup_input (ctf_dedup_t *d, ctf_file_t **fp, ctf_id_t type,
+			const ctf_type_t **tpp, int *errp)
+{
+  ctf_file_t *ofp = *fp;
+  ctf_dedup_input_t *in;
+  const ctf_type_t *tp;
+
+  if ((tp = ctf_lookup_by_id (fp, type)) == NULL)
+    {
+      *errp = ctf_errno (ofp);
+      return NULL;
+    }
+
+  if ((in = ctf_dynhash_lookup (d->cd_input_by_fp, *fp)) == NULL)
+    {
+      ctf_dprintf ("Type %lx is in a dict that is not a link input.\n", type);
+      *errp = ECTF_INTERNAL;
+      return NULL;
+    }
+
+  if (tpp)
+    *tpp = tp;
+  return in;
+}
+
+/* Hashing runs on many inputs at once, one thread per input, so it touches
+   nothing but the input being hashed (and, read-only, the already-hashed input
+   that is its parent, if any): errors go into the input, not the output.  */
+
+static int
+ctf_dedup_hash_err (ctf_dedup_input_t *self, int err)
+{
+  self->cdi_err = err;
+  return -1;
+}
+
+/* Hash in a reference to the type REF, and note it as a dependency.  */
+
+static int
+ctf_dedup_hash_ref (ctf_dedup_hash_state_t *s, ctf_id_t ref)
+{
+  ctf_dedup_ref_t *r = &s->refs[s->nrefs];
+  ctf_file_t *rfp = s->fp;
+  const ctf_type_t *tp;
+  ctf_dedup_hval_t hval;
+  const char *name;
+  int kind;
+
+  if (s->nrefs++ >= s->maxrefs)
+    {
+      ctf_dprintf ("Type references more types than its kind allows.\n");
+      return (ctf_dedup_hash_err (s->in, ECTF_CORRUPT));
+    }
+
+  r->cdr_class = CTF_DEDUP_EDGE_NONE;
+  if (ref == 0)
+    {
+      ctf_dedup_mix_int (&s->hval, 0);
+      return 0;
+    }
+
+  if ((tp = ctf_lookup_by_id (&rfp, ref)) == NULL)
+    return (ctf_dedup_hash_err (s->in, ctf_errno (s->fp)));
+
+  kind = LCTF_INFO_KIND (rfp, tp->ctt_info);
+  name = ctf_strraw (rfp, tp->ctt_name);
+
+  if (name != NULL && name[0] != '\0'
+      && (kind == CTF_K_STRUCT || kind == CTF_K_UNION
+	  || kind == CTF_K_FORWARD))
+    {
+      if (kind == CTF_K_FORWARD)
+	kind = tp->ctt_type;
+
+      ctf_dedup_mix_int (&s->hval, ctf_dedup_name_hval (kind, name));
+
+      if (s->kind == CTF_K_POINTER)
+	r->cdr_class = CTF_DEDUP_EDGE_NAMED_PTR;
+      else
+	r->cdr_class = CTF_DEDUP_EDGE_NAMED;
+      r->cdr_kind = kind;
+      r->cdr_name = name;
+      return 0;
+    }
+
+  if (ctf_dedup_hash_type (s->d, s->in, rfp, ref, &hval) < 0)
+    return -1;					/* errno is set for us.  */
+
+  ctf_dedup_mix_int (&s->hval, hval);
+  r->cdr_class = CTF_DEDUP_EDGE_FULL;
+  r->cdr_fp = rfp;
+  r->cdr_type = ref;
+  return 0;
+}
+
+static int
+ctf_dedup_hash_member (const char *name, ctf_id_t membtype,
+		       unsigned long offset, void *arg)
+{
+  ctf_dedup_hash_state_t *s = (ctf_dedup_hash_state_t *) arg;
+
+  ctf_dedup_mix_str (&s->hval, name);
+  ctf_dedup_mix_int (&s->hval, offset);
+  return ctf_dedup_hash_ref (s, membtype);
+}
+
+static int
+ctf_dedup_hash_enumerator (const char *name, int value, void *arg)
+{
+  ctf_dedup_hash_state_t *s = (ctf_dedup_hash_state_t *) arg;
+
+  ctf_dedup_mix_str (&s->hval, name);
+  ctf_dedup_mix_int (&s->hval, (uint64_t) (int64_t) value);
+  return 0;
+}
+
+/* Compute the hash of a single type in the input SELF, recursively hashing
+   everything it references that is not a tagged type.  Hashes are memoized per
+   input type.  */
+
+static int
+ctf_dedup_hash_type (ctf_dedup_t *d, ctf_dedup_input_t *self, ctf_file_t *fp,
+		     ctf_id_t type, ctf_dedup_hval_t *hvalp)
+{
+  ctf_dedup_hash_state_t s;
+  ctf_dedup_hashed_t *h;
+  ctf_dedup_input_t *in;
+  const ctf_type_t *tp;
+  ctf_encoding_t ep;
+  ctf_arinfo_t ar;
+  ctf_funcinfo_t fi;
+  ctf_id_t *args = NULL;
+  const char *name;
+  uint32_t i;
+  int isroot, err;
+
+  if ((in = ctf_dedup_lookup_input (d, &fp, type, &tp, &err)) == NULL)
+    return (ctf_dedup_hash_err (self, err));
+
+  h = &in->cdi_hashed[LCTF_TYPE_TO_INDEX (fp, type)];
+  switch (h->cdh_state)
+    {
+    case CTF_DEDUP_HASHED:
+      *hvalp = h->cdh_hval;
+      return 0;
+    case CTF_DEDUP_FAILED:
+      return (ctf_dedup_hash_err (self, h->cdh_err));
+    case CTF_DEDUP_HASHING:
+      /* Cycles not passing through a tagged type cannot arise from C: the
+	 input is corrupt.  */
+      ctf_dprintf ("Type %lx in input %s is part of an untagged cycle.\n",
+		   type, in->cdi_input->clin_filename);
+      return (ctf_dedup_hash_err (self, ECTF_CORRUPT));
+    }
+
+  /* Parents are completely hashed before their children, so there is nothing
+     left to do in any other input.  */
+  if (in != self)
+    return (ctf_dedup_hash_err (self, ECTF_INTERNAL));
+
+  memset (&s, 0, sizeof (ctf_dedup_hash_state_t));
+  s.d = d;
+  s.in = self;
+  s.fp = fp;
+  s.kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+  s.hval = CTF_DEDUP_HVAL_INIT;
+  isroot = LCTF_INFO_ISROOT (fp, tp->ctt_info);
+  name = ctf_strraw (fp, tp->ctt_name);
+
+  ctf_dedup_mix_int (&s.hval, s.kind);
+  ctf_dedup_mix_int (&s.hval, isroot);
+  ctf_dedup_mix_str (&s.hval, name);
+
+  switch (s.kind)
+    {
+    case CTF_K_POINTER:
+    case CTF_K_TYPEDEF:
+    case CTF_K_VOLATILE:
+    case CTF_K_CONST:
+    case CTF_K_RESTRICT:
+    case CTF_K_SLICE:
+      s.maxrefs = 1;
+      break;
+    case CTF_K_ARRAY:
+      s.maxrefs = 2;
+      break;
+    case CTF_K_FUNCTION:
+      if (ctf_func_type_info (fp, type, &fi) < 0)
+	goto err_fp;
+      s.maxrefs = fi.ctc_argc + 1;
+      break;
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+      s.maxrefs = LCTF_INFO_VLEN (fp, tp->ctt_info);
+      break;
+    }
+
+  if (s.maxrefs > 0
+      && (s.refs = calloc (s.maxrefs, sizeof (ctf_dedup_ref_t))) == NULL)
+    {
+      ctf_dedup_hash_err (self, ENOMEM);
+      goto err;
+    }
+
+  h->cdh_state = CTF_DEDUP_HASHING;
+
+  switch (s.kind)
+    {
+    case CTF_K_UNKNOWN:
+      break;
+    case CTF_K_INTEGER:
+    case CTF_K_FLOAT:
+    case CTF_K_SLICE:
+      if (ctf_type_encoding (fp, type, &ep) < 0)
+	goto err_fp;
+      ctf_dedup_mix_int (&s.hval, ep.cte_format);
+      ctf_dedup_mix_int (&s.hval, ep.cte_offset);
+      ctf_dedup_mix_int (&s.hval, ep.cte_bits);
+      if (s.kind == CTF_K_SLICE
+	  && ctf_dedup_hash_ref (&s, ctf_type_reference (fp, type)) < 0)
+	goto err;
+      break;
+    case CTF_K_POINTER:
+    case CTF_K_TYPEDEF:
+    case CTF_K_VOLATILE:
+    case CTF_K_CONST:
+    case CTF_K_RESTRICT:
+      if (ctf_dedup_hash_ref (&s, tp->ctt_type) < 0)
+	goto err;
+      break;
+    case CTF_K_ARRAY:
+      if (ctf_array_info (fp, type, &ar) < 0)
+	goto err_fp;
+      ctf_dedup_mix_int (&s.hval, ar.ctr_nelems);
+      if (ctf_dedup_hash_ref (&s, ar.ctr_contents) < 0
+	  || ctf_dedup_hash_ref (&s, ar.ctr_index) < 0)
+	goto err;
+      break;
+    case CTF_K_FUNCTION:
+      ctf_dedup_mix_int (&s.hval, fi.ctc_argc);
+      ctf_dedup_mix_int (&s.hval, fi.ctc_flags);
+      if (ctf_dedup_hash_ref (&s, fi.ctc_return) < 0)
+	goto err;
+
+      if (fi.ctc_argc > 0)
+	{
+	  if ((args = calloc (fi.ctc_argc, sizeof (ctf_id_t))) == NULL)
+	    {
+	      ctf_dedup_hash_err (self, ENOMEM);
+	      goto err;
+	    }
+	  if (ctf_func_type_args (fp, type, fi.ctc_argc, args) < 0)
+	    goto err_fp;
+	}
+      for (i = 0; i < fi.ctc_argc; i++)
+	if (ctf_dedup_hash_ref (&s, args[i]) < 0)
+	  goto err;
+      break;
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+      ctf_dedup_mix_int (&s.hval, ctf_type_size (fp, type));
+      ctf_dedup_mix_int (&s.hval, s.maxrefs);
+      if (ctf_member_iter (fp, type, ctf_dedup_hash_member, &s) != 0)
+	{
+	  if (self->cdi_err == 0)
+	    goto err_fp;
+	  goto err;
+	}
+      break;
+    case CTF_K_ENUM:
+      ctf_dedup_mix_int (&s.hval, LCTF_INFO_VLEN (fp, tp->ctt_info));
+      if (ctf_enum_iter (fp, type, ctf_dedup_hash_enumerator, &s) != 0)
+	goto err_fp;
+      break;
+    case CTF_K_FORWARD:
+      ctf_dedup_mix_int (&s.hval, ctf_dedup_ns (tp->ctt_type));
+      break;
+    default:
+      ctf_dprintf ("Type %lx in input %s has unknown kind %i.\n", type,
+		   in->cdi_input->clin_filename, s.kind);
+      ctf_dedup_hash_err (self, ECTF_CORRUPT);
+      goto err;
+    }
+
+  free (args);
+  h->cdh_hval = s.hval;
+  h->cdh_refs = s.refs;
+  h->cdh_nrefs = s.nrefs;
+  h->cdh_state = CTF_DEDUP_HASHED;
+  *hvalp = s.hval;
+  return 0;
+
+ err_fp:
+  ctf_dedup_hash_err (self, ctf_errno (fp));
+ err:
+  free (args);
+  free (s.refs);
+  h->cdh_state = CTF_DEDUP_FAILED;
+  h->cdh_err = self->cdi_err;
+  return -1;
+}
+
+typedef struct ctf_dedup_input_arg
+{
+  ctf_dedup_t *d;
+  ctf_dedup_input_t *in;
+} ctf_dedup_input_arg_t;
+
+/* Hash one type in an input.  Failure to hash a single type is not fatal: it
+   is reported and skipped, along with everything that depends on it, when the
+   hashes are interned.  */
+
+static int
+ctf_dedup_hash_input_type (ctf_id_t type, int flag _libctf_unused_,
+			   void *arg_)
+{
+  ctf_dedup_input_arg_t *arg = (ctf_dedup_input_arg_t *) arg_;
+  ctf_dedup_hval_t hval;
+
+  if (ctf_dedup_hash_type (arg->d, arg->in, arg->in->cdi_input->clin_fp,
+			   type, &hval) < 0)
+    {
+      if (arg->in->cdi_err == ENOMEM)
+	return -1;
+      arg->in->cdi_err = 0;
+    }
+  return 0;
+}
+
+static void
+ctf_dedup_hash_input (ctf_dedup_t *d, ctf_dedup_input_t *in)
+{
+  ctf_dedup_input_arg_t arg;
+  ctf_file_t *fp = in->cdi_input->clin_fp;
+
+  arg.d = d;
+  arg.in = in;
+  if (ctf_type_iter_all (fp, ctf_dedup_hash_input_type, &arg) != 0
+      && in->cdi_err == 0)
+    in->cdi_err = ctf_errno (fp);
+}
+
+#ifdef HAVE_PTHREAD_H
+typedef struct ctf_dedup_pool
+{
+  ctf_dedup_t *cdp_d;
+  int cdp_child;		     /* Hashing children, not parents?  */
+  uint32_t cdp_next;		     /* Next input to consider.  */
+  pthread_mutex_t cdp_lock;	     /* Protects cdp_next.  */
+} ctf_dedup_pool_t;
+
+/* Hash inputs taken from the pool until there are none left.  */
+
+static void *
+ctf_dedup_hash_worker (void *arg)
+{
+  ctf_dedup_pool_t *pool = (ctf_dedup_pool_t *) arg;
+  ctf_dedup_t *d = pool->cdp_d;
+
+  for (;;)
+    {
+      ctf_dedup_input_t *in = NULL;
+
+      pthread_mutex_lock (&pool->cdp_lock);
+      while (pool->cdp_next < d->cd_ninputs && in == NULL)
+	{
+	  in = &d->cd_inputs[pool->cdp_next++];
+	  if (in->cdi_child != pool->cdp_child)
+	    in = NULL;
+	}
+      pthread_mutex_unlock (&pool->cdp_lock);
+
+      if (in == NULL)
+	break;
+
+      ctf_dedup_hash_input (d, in);
+    }
+  return NULL;
+}
+#endif
+
+/* Hash all the inputs that are (or are not) children of other inputs, using
+   up to cd_nthreads threads.  The result does not depend on the number of
+   threads.  */
+
+static void
+ctf_dedup_hash_inputs (ctf_dedup_t *d, int child)
+{
+  uint32_t i;
+
+#ifdef HAVE_PTHREAD_H
+  uint32_t nthreads = 0;
+
+  for (i = 0; i < d->cd_ninputs; i++)
+    if (d->cd_inputs[i].cdi_child == child)
+      nthreads++;
+
+  if (nthreads > d->cd_nthreads)
+    nthreads = d->cd_nthreads;
+
+  if (nthreads > 1)
+    {
+      ctf_dedup_pool_t pool;
+      pthread_t *threads;
+      uint32_t nstarted = 0;
+
+      pool.cdp_d = d;
+      pool.cdp_child = child;
+      pool.cdp_next = 0;
+
+      if ((threads = calloc (nthreads - 1, sizeof (pthread_t))) != NULL
+	  && pthread_mutex_init (&pool.cdp_lock, NULL) == 0)
+	{
+	  /* This thread is a worker too.  If we cannot start as many threads
+	     as we would like, the ones we do start do all the work.  */
+
+	  for (nstarted = 0; nstarted < nthreads - 1; nstarted++)
+	    if (pthread_create (&threads[nstarted], NULL,
+				ctf_dedup_hash_worker, &pool) != 0)
+	      break;
+
+	  ctf_dedup_hash_worker (&pool);
+
+	  for (i = 0; i < nstarted; i++)
+	    pthread_join (threads[i], NULL);
+
+	  pthread_mutex_destroy (&pool.cdp_lock);
+	  free (threads);
+	  return;
+	}
+      free (threads);
+    }
+#endif
+
+  for (i = 0; i < d->cd_ninputs; i++)
+    if (d->cd_inputs[i].cdi_child == child)
+      ctf_dedup_hash_input (d, &d->cd_inputs[i]);
+}
+
+/* Interning.  */
+
+/* A member or enumerator of a type, for comparison with another's.  */
+
+typedef struct ctf_dedup_memb
+{
+  const char *cdm_name;		     /* Name.  */
+  long cdm_val;			     /* Offset or value.  */
+} ctf_dedup_memb_t;
+
+typedef struct ctf_dedup_memb_state
+{
+  ctf_dedup_memb_t *membs;
+  uint32_t n;
+  uint32_t max;
+} ctf_dedup_memb_state_t;
+
+static int
+ctf_dedup_streq (const char *one, const char *two)
+{
+  return strcmp (one ? one : "", two ? two : "") == 0;
+}
+
+static int
+ctf_dedup_collect_memb (ctf_dedup_memb_state_t *s, const char *name, long val)
+{
+  if (s->n >= s->max)
+    return 1;
+  s->membs[s->n].cdm_name = name;
+  s->membs[s->n++].cdm_val = val;
+  return 0;
+}
+
+static int
+ctf_dedup_compare_memb (ctf_dedup_memb_state_t *s, const char *name, long val)
+{
+  if (s->n >= s->max || s->membs[s->n].cdm_val != val
+      || !ctf_dedup_streq (s->membs[s->n].cdm_name, name))
+    return 1;
+  s->n++;
+  return 0;
+}
+
+static int
+ctf_dedup_collect_member (const char *name, ctf_id_t membtype _libctf_unused_,
+			  unsigned long offset, void *arg)
+{
+  return ctf_dedup_collect_memb (arg, name, (long) offset);
+}
+
+static int
+ctf_dedup_compare_member (const char *name, ctf_id_t membtype _libctf_unused_,
+			  unsigned long offset, void *arg)
+{
+  return ctf_dedup_compare_memb (arg, name, (long) offset);
+}
+
+static int
+ctf_dedup_collect_enumerator (const char *name, int value, void *arg)
+{
+  return ctf_dedup_collect_memb (arg, name, value);
+}
+
+static int
+ctf_dedup_compare_enumerator (const char *name, int value, void *arg)
+{
+  return ctf_dedup_compare_memb (arg, name, value);
+}
+
+/* Compare the members (if ENUM is zero) or enumerators of two types with VLEN
+   of them each.  Return 1 if they are the same, 0 if not, or -1 on error.  */
+
+static int
+ctf_dedup_same_membs (ctf_file_t *afp, ctf_id_t a, ctf_file_t *bfp,
+		      ctf_id_t b, uint32_t vlen, int is_enum)
+{
+  ctf_dedup_memb_state_t s;
+  int same;
+
+  if (vlen == 0)
+    return 1;
+
+  if ((s.membs = calloc (vlen, sizeof (ctf_dedup_memb_t))) == NULL)
+    return -1;
+  s.n = 0;
+  s.max = vlen;
+
+  if (is_enum)
+    same = ctf_enum_iter (afp, a, ctf_dedup_collect_enumerator, &s) == 0
+      && s.n == vlen;
+  else
+    same = ctf_member_iter (afp, a, ctf_dedup_collect_member, &s) == 0
+      && s.n == vlen;
+
+  s.n = 0;
+  if (same && is_enum)
+    same = ctf_enum_iter (bfp, b, ctf_dedup_compare_enumerator, &s) == 0
+      && s.n == vlen;
+  else if (same)
+    same = ctf_member_iter (bfp, b, ctf_dedup_compare_member, &s) == 0
+      && s.n == vlen;
+
+  free (s.membs);
+  return same;
+}
+
+/* Compare two hashed types in everything their hashes are computed from but
+   the types they reference.  Return 1 if they are the same, 0 if not, or -1 on
+   error.  */
+
+static int
+ctf_dedup_same_type (ctf_file_t *afp, ctf_id_t a, ctf_file_t *bfp, ctf_id_t b)
+{
+  const ctf_type_t *atp, *btp;
+  ctf_encoding_t aep, bep;
+  ctf_arinfo_t aar, bar;
+  ctf_funcinfo_t afi, bfi;
+  uint32_t vlen;
+  int kind;
+
+  if ((atp = ctf_lookup_by_id (&afp, a)) == NULL
+      || (btp = ctf_lookup_by_id (&bfp, b)) == NULL)
+    return 0;
+
+  kind = LCTF_INFO_KIND (afp, atp->ctt_info);
+  vlen = LCTF_INFO_VLEN (afp, atp->ctt_info);
+
+  if (kind != LCTF_INFO_KIND (bfp, btp->ctt_info)
+      || vlen != LCTF_INFO_VLEN (bfp, btp->ctt_info)
+      || LCTF_INFO_ISROOT (afp, atp->ctt_info)
+	 != LCTF_INFO_ISROOT (bfp, btp->ctt_info)
+      || !ctf_dedup_streq (ctf_strraw (afp, atp->ctt_name),
+			   ctf_strraw (bfp, btp->ctt_name)))
+    return 0;
+
+  switch (kind)
+    {
+    case CTF_K_INTEGER:
+    case CTF_K_FLOAT:
+    case CTF_K_SLICE:
+      if (ctf_type_encoding (afp, a, &aep) < 0
+	  || ctf_type_encoding (bfp, b, &bep) < 0)
+	return 0;
+      return (aep.cte_format == bep.cte_format
+	      && aep.cte_offset == bep.cte_offset
+	      && aep.cte_bits == bep.cte_bits);
+    case CTF_K_ARRAY:
+      if (ctf_array_info (afp, a, &aar) < 0
+	  || ctf_array_info (bfp, b, &bar) < 0)
+	return 0;
+      return aar.ctr_nelems == bar.ctr_nelems;
+    case CTF_K_FUNCTION:
+      if (ctf_func_type_info (afp, a, &afi) < 0
+	  || ctf_func_type_info (bfp, b, &bfi) < 0)
+	return 0;
+      return afi.ctc_argc == bfi.ctc_argc && afi.ctc_flags == bfi.ctc_flags;
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+      if (ctf_type_size (afp, a) != ctf_type_size (bfp, b))
+	return 0;
+      return ctf_dedup_same_membs (afp, a, bfp, b, vlen, 0);
+    case CTF_K_ENUM:
+      return ctf_dedup_same_membs (afp, a, bfp, b, vlen, 1);
+    case CTF_K_FORWARD:
+      return ctf_dedup_ns (atp->ctt_type) == ctf_dedup_ns (btp->ctt_type);
+    default:
+      return 1;
+    }
+}
+
+/* Return 1 if the hashed type TYPE in FP, whose dependencies have been
+   interned as EDGES, is an instance of the distinct type REC, 0 if it is not,
+   or -1 on error.  */
+
+static int
+ctf_dedup_same (ctf_dedup_t *d, const ctf_dedup_type_t *rec, ctf_file_t *fp,
+		ctf_id_t type, const ctf_dedup_edge_t *edges, uint32_t nedges)
+{
+  uint32_t i;
+  int same;
+
+  if (rec->cdt_nedges != nedges)
+    return 0;
+
+  for (i = 0; i < nedges; i++)
+    {
+      if (rec->cdt_edges[i].cde_class != edges[i].cde_class)
+	return 0;
+
+      switch (edges[i].cde_class)
+	{
+	case CTF_DEDUP_EDGE_FULL:
+	  if (rec->cdt_edges[i].cde_u.cde_type != edges[i].cde_u.cde_type)
+	    return 0;
+	  break;
+	case CTF_DEDUP_EDGE_NAMED:
+	case CTF_DEDUP_EDGE_NAMED_PTR:
+	  if (rec->cdt_edges[i].cde_u.cde_name != edges[i].cde_u.cde_name)
+	    return 0;
+	  break;
+	}
+    }
+
+  if ((same = ctf_dedup_same_type (rec->cdt_fp, rec->cdt_type, fp,
+				   type)) < 0)
+    ctf_set_errno (d->cd_output, ENOMEM);
+  return same;
+}
+
+/* Return the distinct type the hashed type TYPE in FP is an instance of,
+   creating it if need be, with TYPE as its representative.  Everything TYPE
+   depends on is interned first.  A type with the same hash as an existing
+   distinct type is still compared with it, so that a hash collision cannot
+   merge two different types.  */
+
+static ctf_dedup_type_t *
+ctf_dedup_intern (ctf_dedup_t *d, ctf_file_t *fp, ctf_id_t type)
+{
+  ctf_dedup_input_t *in;
+  ctf_dedup_hashed_t *h;
+  ctf_dedup_type_t *head, *rec;
+  ctf_dedup_edge_t *edges = NULL;
+  uint32_t idx, i;
+  int err, same = 0;
+
+  if ((in = ctf_dedup_lookup_input (d, &fp, type, NULL, &err)) == NULL)
+    {
+      ctf_set_errno (d->cd_output, err);
+      return NULL;
+    }
+
+  idx = LCTF_TYPE_TO_INDEX (fp, type);
+  if (in->cdi_types[idx] != NULL)
+    return in->cdi_types[idx];
+
+  /* Everything a successfully-hashed type depends on hashed successfully
+     too.  */
+
+  h = &in->cdi_hashed[idx];
+  if (h->cdh_state != CTF_DEDUP_HASHED)
+    {
+      ctf_set_errno (d->cd_output, ECTF_INTERNAL);
+      return NULL;
+    }
+
+  if (h->cdh_nrefs > 0
+      && (edges = calloc (h->cdh_nrefs, sizeof (ctf_dedup_edge_t))) == NULL)
+    {
+      ctf_set_errno (d->cd_output, ENOMEM);
+      return NULL;
+    }
+
+  for (i = 0; i < h->cdh_nrefs; i++)
+    {
+      const ctf_dedup_ref_t *r = &h->cdh_refs[i];
+
+      edges[i].cde_class = r->cdr_class;
+      switch (r->cdr_class)
+	{
+	case CTF_DEDUP_EDGE_FULL:
+	  edges[i].cde_u.cde_type = ctf_dedup_intern (d, r->cdr_fp,
+						      r->cdr_type);
+	  if (edges[i].cde_u.cde_type == NULL)
+	    goto err;
+	  break;
+	case CTF_DEDUP_EDGE_NAMED:
+	case CTF_DEDUP_EDGE_NAMED_PTR:
+	  edges[i].cde_u.cde_name = ctf_dedup_name (d, r->cdr_kind,
+						    r->cdr_name);
+	  if (edges[i].cde_u.cde_name == NULL)
+	    goto err;
+	  break;
+	}
+    }
+
+  head = ctf_dynhash_lookup (d->cd_types, &h->cdh_hval);
+  for (rec = head; rec != NULL; rec = rec->cdt_next)
+    if ((same = ctf_dedup_same (d, rec, fp, type, edges, h->cdh_nrefs)) != 0)
+      break;
+
+  if (same < 0)
+    goto err;					/* errno is set for us.  */
+
+  if (rec != NULL)
+    {
+      free (edges);
+      in->cdi_types[idx] = rec;
+      return rec;
+    }
+
+  if (head != NULL)
+    ctf_dprintf ("Hash collision on type %lx in input %s: not merged.\n",
+		 type, in->cdi_input->clin_filename);
+
+  if ((rec = calloc (1, sizeof (ctf_dedup_type_t))) == NULL)
+    {
+      ctf_set_errno (d->cd_output, ENOMEM);
+      goto err;
+    }
+  rec->cdt_hval = h->cdh_hval;
+  rec->cdt_fp = fp;
+  rec->cdt_type = type;
+  rec->cdt_edges = edges;
+  rec->cdt_nedges = h->cdh_nrefs;
+
+  if (head != NULL)
+    {
+      rec->cdt_next = head->cdt_next;
+      head->cdt_next = rec;
+    }
+  else if (ctf_dynhash_insert (d->cd_types, &rec->cdt_hval, rec) < 0)
+    {
+      free (rec);
+      ctf_set_errno (d->cd_output, ENOMEM);
+      goto err;
+    }
+
+  in->cdi_types[idx] = rec;
+  return rec;
+
+ err:
+  free (edges);
+  return NULL;
+}
+
+/* Intern one hashed type in an input, count the inputs citing it, and note it
+   as a definition of its name.  */
+
+static int
+ctf_dedup_count_type (ctf_id_t type, int flag, void *arg_)
+{
+  ctf_dedup_input_arg_t *arg = (ctf_dedup_input_arg_t *) arg_;
+  ctf_dedup_t *d = arg->d;
+  ctf_dedup_input_t *in = arg->in;
+  ctf_file_t *fp = in->cdi_input->clin_fp;
+  uint32_t idx = LCTF_TYPE_TO_INDEX (fp, type);
+  ctf_dedup_hashed_t *h = &in->cdi_hashed[idx];
+  ctf_dedup_type_t *rec;
+  const ctf_type_t *tp;
+  const char *name;
+  int kind;
+
+  if (h->cdh_state != CTF_DEDUP_HASHED)
+    {
+      ctf_dprintf ("Cannot hash type %lx in input file %s, CU %s: %s: "
+		   "skipped.\n", type, in->cdi_input->clin_filename,
+		   in->cdi_input->clin_cuname, ctf_errmsg (h->cdh_err));
+      return 0;
+    }
+
+  if ((rec = ctf_dedup_intern (d, fp, type)) == NULL)
+    return -1;					/* errno is set for us.  */
+
+  if (in->cdi_input->clin_shared)
+    {
+      rec->cdt_placement = CTF_DEDUP_PARENT;
+      rec->cdt_shared = 1;
+    }
+
+  if (rec->cdt_last_input != in->cdi_num + 1)
+    {
+      rec->cdt_ninputs++;
+      rec->cdt_last_input = in->cdi_num + 1;
+    }
+
+  if (flag != CTF_ADD_ROOT)
+    return 0;
+
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
+    return 0;
+
+  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+  name = ctf_strraw (fp, tp->ctt_name);
+
+  if (kind != CTF_K_FORWARD && name != NULL && name[0] != '\0')
+    {
+      ctf_dedup_name_t *nm;
+
+      if ((nm = ctf_dedup_name (d, kind, name)) == NULL)
+	return -1;				/* errno is set for us.  */
+
+      rec->cdt_name = nm;
+      if (nm->cdn_def == NULL)
+	nm->cdn_def = rec;
+      else if (nm->cdn_def != rec)
+	nm->cdn_conflicted = 1;
+    }
+
+  return 0;
+}
+
+/* Placement.  */
+
+/* Return nonzero if every type REC needs to be complete (but does not merely
+   point to) is going into the shared parent.  */
+
+static int
+ctf_dedup_deps_in_parent (ctf_dedup_type_t *rec)
+{
+  uint32_t i;
+
+  for (i = 0; i < rec->cdt_nedges; i++)
+    {
+      ctf_dedup_edge_t *edge = &rec->cdt_edges[i];
+      ctf_dedup_name_t *nm;
+
+      switch (edge->cde_class)
+	{
+	case CTF_DEDUP_EDGE_FULL:
+	  if (ctf_dedup_placement (edge->cde_u.cde_type) != CTF_DEDUP_PARENT)
+	    return 0;
+	  break;
+	case CTF_DEDUP_EDGE_NAMED:
+	  nm = edge->cde_u.cde_name;
+	  if (nm->cdn_conflicted
+	      || (nm->cdn_def != NULL
+		  && ctf_dedup_placement (nm->cdn_def) != CTF_DEDUP_PARENT))
+	    return 0;
+	  break;
+	default:
+	  break;
+	}
+    }
+  return 1;
+}
+
+/* Determine whether a type can go into the shared parent.  Cycles (which always
+   go through tagged types) are optimistically assumed to be shareable while
+   they are being placed: if some member of the cycle turns out not to be, the
+   types placed in the parent on the strength of that assumption are moved out
+   again by ctf_dedup_recheck().  */
+
+static int
+ctf_dedup_placement (ctf_dedup_type_t *rec)
+{
+  if (rec->cdt_placement == CTF_DEDUP_PLACING)
+    return CTF_DEDUP_PARENT;
+
+  if (rec->cdt_placement != CTF_DEDUP_UNPLACED)
+    return rec->cdt_placement;
+
+  if (rec->cdt_ninputs < 2
+      || (rec->cdt_name != NULL && rec->cdt_name->cdn_conflicted))
+    {
+      rec->cdt_placement = CTF_DEDUP_CU;
+      return rec->cdt_placement;
+    }
+
+  rec->cdt_placement = CTF_DEDUP_PLACING;
+
+  if (ctf_dedup_deps_in_parent (rec))
+    rec->cdt_placement = CTF_DEDUP_PARENT;
+  else
+    rec->cdt_placement = CTF_DEDUP_CU;
+  return rec->cdt_placement;
+}
+
+static void
+ctf_dedup_place (void *key _libctf_unused_, void *value,
+		 void *arg _libctf_unused_)
+{
+  ctf_dedup_type_t *rec;
+
+  for (rec = (ctf_dedup_type_t *) value; rec != NULL; rec = rec->cdt_next)
+    ctf_dedup_placement (rec);
+}
+
+/* Move a type placed in the parent back out to its CU, if something it needs
+   has turned out not to be going into the parent after all.  (Types from shared
+   inputs stay where they are.)  */
+
+static void
+ctf_dedup_recheck (void *key _libctf_unused_, void *value, void *arg)
+{
+  int *changed = (int *) arg;
+  ctf_dedup_type_t *rec;
+
+  for (rec = (ctf_dedup_type_t *) value; rec != NULL; rec = rec->cdt_next)
+    if (rec->cdt_placement == CTF_DEDUP_PARENT && !rec->cdt_shared
+	&& !ctf_dedup_deps_in_parent (rec))
+      {
+	rec->cdt_placement = CTF_DEDUP_CU;
+	*changed = 1;
+      }
+}
+
+/* Place every type, then move types out of the parent until everything that
+   is left there has everything it needs there too.  The result does not
+   depend on the order in which types are placed.  */
+
+static void
+ctf_dedup_place_all (ctf_dedup_t *d)
+{
+  int changed;
+
+  ctf_dynhash_iter (d->cd_types, ctf_dedup_place, NULL);
+
+  do
+    {
+      changed = 0;
+      ctf_dynhash_iter (d->cd_types, ctf_dedup_recheck, &changed);
+    }
+  while (changed);
+}
+
+/* Emission.  */
+
+static void
+ctf_dedup_emitted_destroy (void *h)
+{
+  ctf_dynhash_destroy ((ctf_dynhash_t *) h);
+}
+
+/* Return the hash of types already emitted into TARGET, creating it if need
+   be.  */
+
+static ctf_dynhash_t *
+ctf_dedup_emitted (ctf_dedup_t *d, ctf_file_t *target)
+{
+  ctf_dynhash_t *emitted;
+
+  if ((emitted = ctf_dynhash_lookup (d->cd_emitted, target)) != NULL)
+    return emitted;
+
+  if ((emitted = ctf_dynhash_create (ctf_hash_integer, ctf_hash_eq_integer,
+				     NULL, NULL)) == NULL)
+    {
+      ctf_set_errno (d->cd_output, ENOMEM);
+      return NULL;
+    }
+
+  if (ctf_dynhash_insert (d->cd_emitted, target, emitted) < 0)
+    {
+      ctf_dynhash_destroy (emitted);
+      ctf_set_errno (d->cd_output, ENOMEM);
+      return NULL;
+    }
+  return emitted;
+}
+
+/* Return the ID of a type already emitted, or 0 if none.  Emitting the types a
+   type references can emit the type itself, if it is part of a cycle through a
+   tagged type, so this must be checked again after emitting them.  */
+
+static ctf_id_t
+ctf_dedup_emitted_id (ctf_dynhash_t *emitted, ctf_dedup_type_t *rec)
+{
+  return (ctf_id_t) (uintptr_t) ctf_dynhash_lookup (emitted, rec);
+}
+
+/* Return the per-CU output for an input, creating it if need be.  */
+
+static ctf_file_t *
+ctf_dedup_cu_output (ctf_dedup_t *d, ctf_dedup_input_t *in)
+{
+  if (in->cdi_output == NULL)
+    in->cdi_output = ctf_create_per_cu (d->cd_output,
+					in->cdi_input->clin_filename,
+					in->cdi_input->clin_cuname);
+  return in->cdi_output;
+}
+
+/* Emit a reference to a tagged type into TARGET, by name: the shared definition
+   if there is one, otherwise a forward.  */
+
+static ctf_id_t
+ctf_dedup_emit_forward (ctf_dedup_t *d, ctf_file_t *target, uint32_t flag,
+			int kind, const char *name)
+{
+  ctf_dedup_name_t *nm;
+  ctf_dedup_type_t *def;
+  ctf_id_t id;
+
+  nm = ctf_dynhash_lookup (d->cd_names[ctf_dedup_ns (kind)], name);
+
+  if (nm != NULL && !nm->cdn_conflicted && (def = nm->cdn_def) != NULL
+      && ctf_dedup_placement (def) == CTF_DEDUP_PARENT)
+    return ctf_dedup_emit_type (d, def->cdt_fp, def->cdt_type, d->cd_output);
+
+  if ((id = ctf_add_forward (target, flag, name, kind)) == CTF_ERR)
+    return (ctf_set_errno (d->cd_output, ctf_errno (target)));
+  return id;
+}
+
+/* Emit a type referenced from a type being emitted into TARGET, returning its
+   ID in the output.  */
+
+static ctf_id_t
+ctf_dedup_emit_ref (ctf_dedup_t *d, ctf_file_t *fp, ctf_id_t ref,
+		    ctf_file_t *target)
+{
+  ctf_dedup_input_t *in;
+  ctf_dedup_type_t *rec;
+  const ctf_type_t *tp;
+  const char *name;
+  int kind, err;
+
+  if (ref == 0)
+    return (ctf_set_errno (d->cd_output, ECTF_NONREPRESENTABLE));
+
+  if ((in = ctf_dedup_lookup_input (d, &fp, ref, &tp, &err)) == NULL)
+    return (ctf_set_errno (d->cd_output, err));
+
+  if ((rec = in->cdi_types[LCTF_TYPE_TO_INDEX (fp, ref)]) == NULL)
+    return (ctf_set_errno (d->cd_output, ECTF_CORRUPT));
+
+  if (ctf_dedup_placement (rec) == CTF_DEDUP_PARENT)
+    return ctf_dedup_emit_type (d, fp, ref, d->cd_output);
+
+  if (target != d->cd_output)
+    return ctf_dedup_emit_type (d, fp, ref, target);
+
+  /* A shared type referencing an unshared one.  Tagged types are referenced by
+     name; anything else can only be a dependency of a pointer to a tagged type
+     that has been forced into the parent, and is emitted there too, but hidden
+     from view.  */
+
+  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+  name = ctf_strraw (fp, tp->ctt_name);
+
+  if (name != NULL && name[0] != '\0'
+      && (kind == CTF_K_STRUCT || kind == CTF_K_UNION
+	  || kind == CTF_K_FORWARD))
+    {
+      if (kind == CTF_K_FORWARD)
+	kind = tp->ctt_type;
+      return ctf_dedup_emit_forward (d, target, CTF_ADD_ROOT, kind, name);
+    }
+
+  return ctf_dedup_emit_type (d, fp, ref, target);
+}
+
+static int
+ctf_dedup_emit_member (const char *name, ctf_id_t membtype,
+		       unsigned long offset, void *arg)
+{
+  ctf_dedup_emit_state_t *s = (ctf_dedup_emit_state_t *) arg;
+  ctf_dedup_t *d = s->d;
+  ctf_id_t dst_membtype;
+
+  if ((dst_membtype = ctf_dedup_emit_ref (d, s->fp, membtype,
+					  s->target)) == CTF_ERR)
+    {
+      int err = ctf_errno (d->cd_output);
+
+      if (err == ENOMEM)
+	return -1;
+      if (err != ECTF_NONREPRESENTABLE)
+	ctf_dprintf ("Cannot link type of member %s: %s: skipped.\n",
+		     name, ctf_errmsg (err));
+      ctf_set_errno (d->cd_output, 0);
+      return 0;
+    }
+
+  if (name != NULL && name[0] == '\0')
+    name = NULL;
+
+  if (ctf_add_member_offset (s->target, s->dst_type, name, dst_membtype,
+			     offset) < 0)
+    return (ctf_set_errno (d->cd_output, ctf_errno (s->target)));
+
+  return 0;
+}
+
+static int
+ctf_dedup_emit_enumerator (const char *name, int value, void *arg)
+{
+  ctf_dedup_emit_state_t *s = (ctf_dedup_emit_state_t *) arg;
+
+  if (ctf_add_enumerator (s->target, s->dst_type, name, value) < 0)
+    return (ctf_set_errno (s->d->cd_output, ctf_errno (s->target)));
+  return 0;
+}
+
+/* Emit a type into TARGET, if a type with the same hash has not already been
+   emitted there, and return its ID in the output.  */
+
+static ctf_id_t
+ctf_dedup_emit_type (ctf_dedup_t *d, ctf_file_t *fp, ctf_id_t type,
+		     ctf_file_t *target)
+{
+  ctf_dedup_emit_state_t s;
+  ctf_dedup_input_t *in;
+  ctf_dedup_type_t *rec;
+  ctf_dynhash_t *emitted;
+  const ctf_type_t *tp;
+  ctf_encoding_t ep;
+  ctf_arinfo_t ar;
+  ctf_funcinfo_t fi;
+  ctf_id_t *args = NULL;
+  ctf_id_t ref, id = CTF_ERR;
+  const char *name;
+  uint32_t flag, i;
+  int kind, err;
+
+  if ((in = ctf_dedup_lookup_input (d, &fp, type, &tp, &err)) == NULL)
+    return (ctf_set_errno (d->cd_output, err));
+
+  if ((rec = in->cdi_types[LCTF_TYPE_TO_INDEX (fp, type)]) == NULL)
+    return (ctf_set_errno (d->cd_output, ECTF_CORRUPT));
+
+  if ((emitted = ctf_dedup_emitted (d, target)) == NULL)
+    return CTF_ERR;				/* errno is set for us.  */
+
+  if ((id = ctf_dedup_emitted_id (emitted, rec)) != 0)
+    return id;
+
+  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+  flag = LCTF_INFO_ISROOT (fp, tp->ctt_info) ? CTF_ADD_ROOT : CTF_ADD_NONROOT;
+  name = ctf_strraw (fp, tp->ctt_name);
+  if (name != NULL && name[0] == '\0')
+    name = NULL;
+
+  /* Types forced into the parent by their referrers are not visible there; nor
+     are types whose name is already taken by a different definition (which can
+     happen if one CU defines the same name more than once).  */
+
+  if (target == d->cd_output && ctf_dedup_placement (rec) != CTF_DEDUP_PARENT)
+    flag = CTF_ADD_NONROOT;
+
+  if (flag == CTF_ADD_ROOT && name != NULL && kind != CTF_K_FORWARD)
+    {
+      ctf_id_t existing;
+
+      if ((existing = ctf_lookup_by_rawname (target, kind, name)) != 0
+	  && ctf_type_kind_unsliced (target, existing) != CTF_K_FORWARD)
+	flag = CTF_ADD_NONROOT;
+    }
+
+  switch (kind)
+    {
+    case CTF_K_INTEGER:
+    case CTF_K_FLOAT:
+      if (ctf_type_encoding (fp, type, &ep) < 0)
+	return (ctf_set_errno (d->cd_output, ctf_errno (fp)));
+      if (kind == CTF_K_INTEGER)
+	id = ctf_add_integer (target, flag, name, &ep);
+      else
+	id = ctf_add_float (target, flag, name, &ep);
+      break;
+    case CTF_K_SLICE:
+      if (ctf_type_encoding (fp, type, &ep) < 0)
+	return (ctf_set_errno (d->cd_output, ctf_errno (fp)));
+      if ((ref = ctf_dedup_emit_ref (d, fp, ctf_type_reference (fp, type),
+				     target)) == CTF_ERR)
+	return CTF_ERR;				/* errno is set for us.  */
+      if ((id = ctf_dedup_emitted_id (emitted, rec)) != 0)
+	return id;
+      id = ctf_add_slice (target, flag, ref, &ep);
+      break;
+    case CTF_K_POINTER:
+    case CTF_K_VOLATILE:
+    case CTF_K_CONST:
+    case CTF_K_RESTRICT:
+    case CTF_K_TYPEDEF:
+      if ((ref = ctf_dedup_emit_ref (d, fp, tp->ctt_type, target)) == CTF_ERR)
+	return CTF_ERR;				/* errno is set for us.  */
+
+      if ((id = ctf_dedup_emitted_id (emitted, rec)) != 0)
+	return id;
+
+      switch (kind)
+	{
+	case CTF_K_POINTER:
+	  id = ctf_add_pointer (target, flag, ref);
+	  break;
+	case CTF_K_VOLATILE:
+	  id = ctf_add_volatile (target, flag, ref);
+	  break;
+	case CTF_K_CONST:
+	  id = ctf_add_const (target, flag, ref);
+	  break;
+	case CTF_K_RESTRICT:
+	  id = ctf_add_restrict (target, flag, ref);
+	  break;
+	case CTF_K_TYPEDEF:
+	  id = ctf_add_typedef (target, flag, name, ref);
+	  break;
+	}
+      break;
+    case CTF_K_ARRAY:
+      if (ctf_array_info (fp, type, &ar) < 0)
+	return (ctf_set_errno (d->cd_output, ctf_errno (fp)));
+      if ((ar.ctr_contents = ctf_dedup_emit_ref (d, fp, ar.ctr_contents,
+						 target)) == CTF_ERR
+	  || (ar.ctr_index = ctf_dedup_emit_ref (d, fp, ar.ctr_index,
+						 target)) == CTF_ERR)
+	return CTF_ERR;				/* errno is set for us.  */
+      if ((id = ctf_dedup_emitted_id (emitted, rec)) != 0)
+	return id;
+      id = ctf_add_array (target, flag, &ar);
+      break;
+    case CTF_K_FUNCTION:
+      if (ctf_func_type_info (fp, type, &fi) < 0)
+	return (ctf_set_errno (d->cd_output, ctf_errno (fp)));
+
+      if (fi.ctc_argc > 0)
+	{
+	  if ((args = calloc (fi.ctc_argc, sizeof (ctf_id_t))) == NULL)
+	    return (ctf_set_errno (d->cd_output, ENOMEM));
+	  if (ctf_func_type_args (fp, type, fi.ctc_argc, args) < 0)
+	    {
+	      ctf_set_errno (d->cd_output, ctf_errno (fp));
+	      goto err;
+	    }
+	}
+
+      if ((fi.ctc_return = ctf_dedup_emit_ref (d, fp, fi.ctc_return,
+					       target)) == CTF_ERR)
+	goto err;
+      for (i = 0; i < fi.ctc_argc; i++)
+	if ((args[i] = ctf_dedup_emit_ref (d, fp, args[i], target)) == CTF_ERR)
+	  goto err;
+
+      if ((id = ctf_dedup_emitted_id (emitted, rec)) == 0)
+	id = ctf_add_function (target, flag, &fi, args);
+      else
+	{
+	  free (args);
+	  return id;
+	}
+      free (args);
+      args = NULL;
+      break;
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+      if (kind == CTF_K_STRUCT)
+	id = ctf_add_struct_sized (target, flag, name,
+				   ctf_type_size (fp, type));
+      else
+	id = ctf_add_union_sized (target, flag, name,
+				  ctf_type_size (fp, type));
+      if (id == CTF_ERR)
+	break;
+
+      /* Note the type as emitted before emitting its members, which may point
+	 back to it.  */
+      if (ctf_dynhash_insert (emitted, rec, (void *) (uintptr_t) id) < 0)
+	return (ctf_set_errno (d->cd_output, ENOMEM));
+
+      s.d = d;
+      s.fp = fp;
+      s.target = target;
+      s.dst_type = id;
+      if (ctf_member_iter (fp, type, ctf_dedup_emit_member, &s) != 0)
+	{
+	  if (ctf_errno (d->cd_output) == 0)
+	    ctf_set_errno (d->cd_output, ctf_errno (fp));
+	  return CTF_ERR;
+	}
+      break;
+    case CTF_K_ENUM:
+      if ((id = ctf_add_enum (target, flag, name)) == CTF_ERR)
+	break;
+
+      if (ctf_dynhash_insert (emitted, rec, (void *) (uintptr_t) id) < 0)
+	return (ctf_set_errno (d->cd_output, ENOMEM));
+
+      s.d = d;
+      s.fp = fp;
+      s.target = target;
+      s.dst_type = id;
+      if (ctf_enum_iter (fp, type, ctf_dedup_emit_enumerator, &s) != 0)
+	{
+	  if (ctf_errno (d->cd_output) == 0)
+	    ctf_set_errno (d->cd_output, ctf_errno (fp));
+	  return CTF_ERR;
+	}
+      break;
+    case CTF_K_FORWARD:
+      if (name == NULL)
+	return (ctf_set_errno (d->cd_output, ECTF_CORRUPT));
+
+      if ((id = ctf_dedup_emit_forward (d, target, flag, tp->ctt_type,
+					name)) == CTF_ERR)
+	return CTF_ERR;				/* errno is set for us.  */
+      break;
+    case CTF_K_UNKNOWN:
+      return (ctf_set_errno (d->cd_output, ECTF_NONREPRESENTABLE));
+    default:
+      return (ctf_set_errno (d->cd_output, ECTF_CORRUPT));
+    }
+
+  if (id == CTF_ERR)
+    return (ctf_set_errno (d->cd_output, ctf_errno (target)));
+
+  if (ctf_dynhash_insert (emitted, rec, (void *) (uintptr_t) id) < 0)
+    return (ctf_set_errno (d->cd_output, ENOMEM));
+
+  return id;
+
+ err:
+  free (args);
+  return CTF_ERR;
+}
+
+/* Emit one type in an input into its placement, and record the mapping from the
+   input type to the output type for the benefit of the variable linker.  */
+
+static int
+ctf_dedup_emit_input_type (ctf_id_t type, int flag _libctf_unused_, void *arg_)
+{
+  ctf_dedup_input_arg_t *arg = (ctf_dedup_input_arg_t *) arg_;
+  ctf_dedup_t *d = arg->d;
+  ctf_dedup_input_t *in = arg->in;
+  ctf_file_t *fp = in->cdi_input->clin_fp;
+  ctf_dedup_type_t *rec;
+  ctf_file_t *target;
+  ctf_id_t id;
+
+  /* Types that could not be hashed have already been reported.  */
+  if ((rec = in->cdi_types[LCTF_TYPE_TO_INDEX (fp, type)]) == NULL)
+    return 0;
+
+  if (ctf_dedup_placement (rec) == CTF_DEDUP_PARENT)
+    target = d->cd_output;
+  else if ((target = ctf_dedup_cu_output (d, in)) == NULL)
+    return -1;					/* errno is set for us.  */
+
+  if ((id = ctf_dedup_emit_type (d, fp, type, target)) == CTF_ERR)
+    {
+      int err = ctf_errno (d->cd_output);
+
+      if (err == ENOMEM)
+	return -1;
+
+      /* As with the non-deduplicating link, we must ignore this problem so as
+	 to link as much as possible.  */
+      if (err != ECTF_NONREPRESENTABLE)
+	ctf_dprintf ("Cannot link type %lx from input file %s, CU %s into "
+		     "output link: %s\n", type, in->cdi_input->clin_filename,
+		     in->cdi_input->clin_cuname, ctf_errmsg (err));
+      ctf_set_errno (d->cd_output, 0);
+      return 0;
+    }
+
+  ctf_add_type_mapping (fp, type, target, id);
+  return 0;
+}
+
+static void
+ctf_dedup_free_type (void *rec_)
+{
+  ctf_dedup_type_t *rec = (ctf_dedup_type_t *) rec_;
+  ctf_dedup_type_t *next;
+
+  for (; rec != NULL; rec = next)
+    {
+      next = rec->cdt_next;
+      free (rec->cdt_edges);
+      free (rec);
+    }
+}
+
+/* Deduplicate the types in all the INPUTS and emit them into OUTPUT and its
+   per-CU children, recording type mappings for every input type emitted.  If
+   DONE is set, it is called with ARG after the types in each input have been
+   emitted, and before those in the next are.  */
+
+int
+ctf_dedup (ctf_file_t *output, ctf_link_input_t *inputs, uint32_t ninputs,
+	   ctf_dedup_done_f *done, void *done_arg)
+{
+  ctf_dedup_t d;
+  ctf_dedup_input_arg_t arg;
+  uint32_t i;
+  int ret = -1;
+
+  memset (&d, 0, sizeof (ctf_dedup_t));
+  d.cd_output = output;
+  d.cd_ninputs = ninputs;
+  d.cd_nthreads = output->ctf_link_threads;
+
+  if ((d.cd_input_by_fp = ctf_dynhash_create (ctf_hash_integer,
+					      ctf_hash_eq_integer,
+					      NULL, NULL)) == NULL)
+    goto oom;
+
+  if ((d.cd_types = ctf_dynhash_create (ctf_hash_uint64, ctf_hash_eq_uint64,
+					NULL, ctf_dedup_free_type)) == NULL)
+    goto oom;
+
+  for (i = 0; i < CTF_DEDUP_NS_MAX; i++)
+    if ((d.cd_names[i] = ctf_dynhash_create (ctf_hash_string,
+					     ctf_hash_eq_string,
+					     NULL, free)) == NULL)
+      goto oom;
+
+  if ((d.cd_emitted = ctf_dynhash_create (ctf_hash_integer,
+					  ctf_hash_eq_integer, NULL,
+					  ctf_dedup_emitted_destroy)) == NULL)
+    goto oom;
+
+  if (ninputs > 0
+      && ((d.cd_inputs = calloc (ninputs, sizeof (ctf_dedup_input_t))) == NULL
+	  || ctf_dynhash_reserve (d.cd_input_by_fp, ninputs) < 0))
+    goto oom;
+
+  for (i = 0; i < ninputs; i++)
+    {
+      ctf_dedup_input_t *in = &d.cd_inputs[i];
+      size_t ntypes = inputs[i].clin_fp->ctf_typemax + 1;
+
+      in->cdi_input = &inputs[i];
+      in->cdi_num = i;
+
+      if ((in->cdi_types = calloc (ntypes, sizeof (ctf_dedup_type_t *))) == NULL
+	  || (in->cdi_hashed = calloc (ntypes,
+				       sizeof (ctf_dedup_hashed_t))) == NULL)
+	goto oom;
+
+      if (ctf_dynhash_insert (d.cd_input_by_fp, inputs[i].clin_fp, in) < 0)
+	goto oom;
+    }
+
+  /* Hash the inputs, parents first, since their children's types refer to
+     them.  */
+
+  for (i = 0; i < ninputs; i++)
+    {
+      ctf_file_t *parent = inputs[i].clin_fp->ctf_parent;
+
+      d.cd_inputs[i].cdi_child = (parent != NULL
+				  && ctf_dynhash_lookup (d.cd_input_by_fp,
+							 parent) != NULL);
+    }
+
+  ctf_dedup_hash_inputs (&d, 0);
+  ctf_dedup_hash_inputs (&d, 1);
+
+  for (i = 0; i < ninputs; i++)
+    if (d.cd_inputs[i].cdi_err != 0)
+      {
+	ctf_set_errno (output, d.cd_inputs[i].cdi_err);
+	goto err;
+      }
+
+  /* Intern the hashes, serially and in input order, so that the result does
+     not depend on the number of threads used or their scheduling.  */
+
+  arg.d = &d;
+  for (i = 0; i < ninputs; i++)
+    {
+      arg.in = &d.cd_inputs[i];
+      if (ctf_type_iter_all (inputs[i].clin_fp, ctf_dedup_count_type,
+			     &arg) != 0)
+	goto err;
+    }
+
+  ctf_dedup_place_all (&d);
+
+  for (i = 0; i < ninputs; i++)
+    {
+      arg.in = &d.cd_inputs[i];
+      if (ctf_type_iter_all (inputs[i].clin_fp, ctf_dedup_emit_input_type,
+			     &arg) != 0)
+	goto err;
+
+      if (done != NULL && done (&inputs[i], done_arg) < 0)
+	goto err;				/* errno is set for us.  */
+    }
+
+  ret = 0;
+  goto err;
+
+ oom:
+  ctf_set_errno (output, ENOMEM);
+ err:
+  if (ret < 0 && ctf_errno (output) == 0)
+    ctf_set_errno (output, ECTF_INTERNAL);
+
+  if (d.cd_inputs)
+    for (i = 0; i < ninputs; i++)
+      {
+	ctf_dedup_input_t *in = &d.cd_inputs[i];
+
+	if (in->cdi_hashed)
+	  {
+	    size_t j;
+
+	    for (j = 0; j <= inputs[i].clin_fp->ctf_typemax; j++)
+	      free (in->cdi_hashed[j].cdh_refs);
+	  }
+	free (in->cdi_hashed);
+	free (in->cdi_types);
+      }
+  free (d.cd_inputs);
+
+  for (i = 0; i < CTF_DEDUP_NS_MAX; i++)
+    if (d.cd_names[i])
+      ctf_dynhash_destroy (d.cd_names[i]);
+
+  if (d.cd_emitted)
+    ctf_dynhash_destroy (d.cd_emitted);
+  if (d.cd_types)
+    ctf_dynhash_destroy (d.cd_types);
+  if (d.cd_input_by_fp)
+    ctf_dynhash_destroy (d.cd_input_by_fp);
+  return ret;
+}
@@ -8,9 +8,11 @@
    COPYING in the top level of this tree.  */
 
 #include <ctf-impl.h>
+#include <stdarg.h>
 #include <string.h>
 
-#define str_append(s, a) ctf_str_append_noerr (s, a)
+/* Size of the output buffer of ctf_dump_stream().  */
+#define CTF_DUMP_BUFSIZ (64 * 1024)
 
 /* One item to be dumped, in string form.  */
 
@@ -20,8 +22,10 @@ typedef struct ctf_dump_item
   char *cdi_item;
 } ctf_dump_item_t;
 
-/* Cross-call state for dumping.  Basically just enough to track the section in
-   use and a list of return strings.  */
+/* Cross-call state for dumping.  Enough to track the section in use, the item
+   being formatted, and either a list of return strings (for ctf_dump()) or
+   the sink and buffered output (for ctf_dump_stream()).  The item buffer is
+   reused for every item.  */
 
 struct ctf_dump_state
 {
@@ -29,16 +33,18 @@ struct ctf_dump_state
   ctf_file_t *cds_fp;
   ctf_dump_item_t *cds_current;
   ctf_list_t cds_items;
+  char *cds_buf;			/* The item being formatted.  */
+  size_t cds_len;			/* Its length.  */
+  size_t cds_size;			/* Size of cds_buf.  */
+  int cds_streaming;			/* Nonzero if in ctf_dump_stream().  */
+  const char *cds_prefix;		/* Prefix for every line.  */
+  ctf_dump_write_f *cds_write;		/* Sink, or NULL for a FILE *.  */
+  void *cds_write_arg;			/* Its argument.  */
+  char *cds_out;			/* Buffered output.  */
+  size_t cds_outlen;			/* Its length.  */
+  int cds_write_err;			/* Error from the sink, if any.  */
 };
 
-/* Cross-call state for ctf_dump_member. */
-
-typedef struct ctf_dump_membstate
-{
-  char **cdm_str;
-  ctf_file_t *cdm_fp;
-} ctf_dump_membstate_t;
-
 static int
 ctf_dump_append (ctf_dump_state_t *state, char *str)
 {
@@ -67,6 +73,175 @@ ctf_dump_free (ctf_dump_state_t *state)
       next_cdi = ctf_list_next (cdi);
       free (cdi);
     }
+  free (state->cds_buf);
+  free (state->cds_out);
+}
+
+/* Make room for at least LEN more bytes (and a trailing \0) in the item
+   buffer.  */
+
+static int
+ctf_dump_reserve (ctf_dump_state_t *state, size_t len)
+{
+  size_t size = state->cds_size ? state->cds_size : 256;
+  char *buf;
+
+  if (state->cds_len + len + 1 <= state->cds_size)
+    return 0;
+
+  while (size < state->cds_len + len + 1)
+    size *= 2;
+
+  if ((buf = realloc (state->cds_buf, size)) == NULL)
+    return (ctf_set_errno (state->cds_fp, ENOMEM));
+
+  state->cds_buf = buf;
+  state->cds_size = size;
+  return 0;
+}
+
+/* Append a string to the item being formatted.  */
+
+static int
+ctf_dump_puts (ctf_dump_state_t *state, const char *str)
+{
+  size_t len = strlen (str);
+
+  if (ctf_dump_reserve (state, len) < 0)
+    return -1;				/* errno is set for us.  */
+
+  memcpy (state->cds_buf + state->cds_len, str, len + 1);
+  state->cds_len += len;
+  return 0;
+}
+
+/* Append formatted output to the item being formatted.  */
+
+_libctf_printflike_ (2, 3)
+static int
+ctf_dump_printf (ctf_dump_state_t *state, const char *format, ...)
+{
+  va_list ap;
+  int n;
+
+  for (;;)
+    {
+      size_t avail = state->cds_size - state->cds_len;
+
+      va_start (ap, format);
+      n = vsnprintf (state->cds_buf ? state->cds_buf + state->cds_len : NULL,
+		     avail, format, ap);
+      va_end (ap);
+
+      if (n < 0)
+	return (ctf_set_errno (state->cds_fp, errno));
+
+      if ((size_t) n < avail)
+	break;
+
+      if (ctf_dump_reserve (state, n) < 0)
+	return -1;			/* errno is set for us.  */
+    }
+
+  state->cds_len += n;
+  return 0;
+}
+
+/* Write LEN bytes straight to the sink.  */
+
+static int
+ctf_dump_sink (ctf_dump_state_t *state, const char *str, size_t len)
+{
+  if (state->cds_write)
+    state->cds_write_err = state->cds_write (str, len, state->cds_write_arg);
+  else if (fwrite (str, 1, len, (FILE *) state->cds_write_arg) < len)
+    state->cds_write_err = errno ? errno : EIO;
+
+  if (state->cds_write_err != 0)
+    return (ctf_set_errno (state->cds_fp, state->cds_write_err));
+  return 0;
+}
+
+/* Write out whatever is in the output buffer.  */
+
+static int
+ctf_dump_flush (ctf_dump_state_t *state)
+{
+  size_t len = state->cds_outlen;
+
+  state->cds_outlen = 0;
+  if (len == 0)
+    return 0;
+
+  return ctf_dump_sink (state, state->cds_out, len);
+}
+
+/* Write LEN bytes of output through the output buffer.  */
+
+static int
+ctf_dump_out (ctf_dump_state_t *state, const char *str, size_t len)
+{
+  if (state->cds_outlen + len > CTF_DUMP_BUFSIZ
+      && ctf_dump_flush (state) < 0)
+    return -1;				/* errno is set for us.  */
+
+  /* Too big to buffer: write it directly.  */
+  if (len > CTF_DUMP_BUFSIZ)
+    return ctf_dump_sink (state, str, len);
+
+  memcpy (state->cds_out + state->cds_outlen, str, len);
+  state->cds_outlen += len;
+  return 0;
+}
+
+/* The item being formatted is complete.  Hand it to the caller of ctf_dump(),
+   or write it out a line at a time, each line prefixed, and start again.  */
+
+static int
+ctf_dump_item_end (ctf_dump_state_t *state)
+{
+  const char *prefix = state->cds_prefix ? state->cds_prefix : "";
+  size_t prefixlen = strlen (prefix);
+  const char *line, *end;
+  char *str;
+
+  if (ctf_dump_reserve (state, 0) < 0)
+    return -1;				/* errno is set for us.  */
+
+  line = state->cds_buf;
+  end = state->cds_buf + state->cds_len;
+
+  if (!state->cds_streaming)
+    {
+      if ((str = malloc (state->cds_len + 1)) == NULL)
+	return (ctf_set_errno (state->cds_fp, ENOMEM));
+
+      memcpy (str, state->cds_buf, state->cds_len + 1);
+      state->cds_len = 0;
+      if (ctf_dump_append (state, str) < 0)
+	{
+	  free (str);
+	  return -1;			/* errno is set for us.  */
+	}
+      return 0;
+    }
+
+  state->cds_len = 0;
+  do
+    {
+      const char *nl = memchr (line, '\n', end - line);
+      size_t len = nl ? (size_t) (nl - line) : (size_t) (end - line);
+
+      if (ctf_dump_out (state, prefix, prefixlen) < 0
+	  || ctf_dump_out (state, line, len) < 0
+	  || ctf_dump_out (state, "\n", 1) < 0)
+	return -1;			/* errno is set for us.  */
+
+      line = nl ? nl + 1 : end;
+    }
+  while (line < end);
+
+  return 0;
 }
 
 /* Slices need special handling to distinguish them from their referenced
@@ -83,14 +258,14 @@ ctf_is_slice (ctf_file_t *fp, ctf_id_t id, ctf_encoding_t *enc)
 	  && ctf_type_encoding (fp, id, enc) == 0);
 }
 
-/* Return a dump for a single type, without member info: but do show the
-   type's references.  */
+/* Append a dump for a single type, without member info, to the item being
+   formatted: but do show the type's references.  */
 
-static char *
-ctf_dump_format_type (ctf_file_t *fp, ctf_id_t id, int flag)
+static int
+ctf_dump_format_type (ctf_dump_state_t *state, ctf_id_t id, int flag)
 {
+  ctf_file_t *fp = state->cds_fp;
   ctf_id_t new_id;
-  char *str = NULL, *bit = NULL, *buf = NULL;
 
   new_id = id;
   do
@@ -98,6 +273,7 @@ ctf_dump_format_type (ctf_file_t *fp, ctf_id_t id, int flag)
       ctf_encoding_t enc;
       const char *nonroot_leader = "";
       const char *nonroot_trailer = "";
+      const char *name;
 
       id = new_id;
       if (flag == CTF_ADD_NONROOT)
@@ -106,17 +282,17 @@ ctf_dump_format_type (ctf_file_t *fp, ctf_id_t id, int flag)
 	  nonroot_trailer = "}";
 	}
 
-      buf = ctf_type_aname (fp, id);
-      if (!buf)
+      if ((name = ctf_type_name_ref (fp, id)) == NULL)
 	{
 	  if (id == 0 || ctf_errno (fp) == ECTF_NONREPRESENTABLE)
 	    {
-	      str = str_append (str, " (type not represented in CTF)");
+	      if (ctf_dump_puts (state, " (type not represented in CTF)") < 0)
+		return -1;		/* errno is set for us.  */
 	      ctf_set_errno (fp, ECTF_NOTREF);
 	      break;
 	    }
 
-	  goto err;
+	  return -1;			/* errno is set for us.  */
 	}
 
       /* Slices get a different print representation.  */
@@ -124,90 +300,69 @@ ctf_dump_format_type (ctf_file_t *fp, ctf_id_t id, int flag)
       if (ctf_is_slice (fp, id, &enc))
 	{
 	  ctf_type_encoding (fp, id, &enc);
-	  if (asprintf (&bit, " %s%lx: [slice 0x%x:0x%x]%s",
-			nonroot_leader, id, enc.cte_offset, enc.cte_bits,
-			nonroot_trailer) < 0)
-	    goto oom;
+	  if (ctf_dump_printf (state, " %s%lx: [slice 0x%x:0x%x]%s",
+			       nonroot_leader, id, enc.cte_offset,
+			       enc.cte_bits, nonroot_trailer) < 0)
+	    return -1;			/* errno is set for us.  */
 	}
       else
 	{
-	  if (asprintf (&bit, " %s%lx: %s (size 0x%lx)%s", nonroot_leader,
-			id, buf[0] == '\0' ? "(nameless)" : buf,
-			(unsigned long) ctf_type_size (fp, id),
-			nonroot_trailer) < 0)
-	    goto oom;
+	  if (ctf_dump_printf (state, " %s%lx: %s (size 0x%lx)%s",
+			       nonroot_leader, id,
+			       name[0] == '\0' ? "(nameless)" : name,
+			       (unsigned long) ctf_type_size (fp, id),
+			       nonroot_trailer) < 0)
+	    return -1;			/* errno is set for us.  */
 	}
-      free (buf);
-      buf = NULL;
-      str = str_append (str, bit);
-      free (bit);
-      bit = NULL;
 
       new_id = ctf_type_reference (fp, id);
-      if (new_id != CTF_ERR)
-	str = str_append (str, " ->");
+      if (new_id != CTF_ERR && ctf_dump_puts (state, " ->") < 0)
+	return -1;			/* errno is set for us.  */
     } while (new_id != CTF_ERR);
 
   if (ctf_errno (fp) != ECTF_NOTREF)
-    {
-      free (str);
-      return NULL;
-    }
-
-  return str;
+    return -1;
 
- oom:
-  ctf_set_errno (fp, errno);
- err:
-  free (buf);
-  free (str);
-  free (bit);
-  return NULL;
+  return 0;
 }
 
-/* Dump one string field from the file header into the cds_items.  */
+/* Dump one string field from the file header.  */
 static int
 ctf_dump_header_strfield (ctf_file_t *fp, ctf_dump_state_t *state,
 			  const char *name, uint32_t value)
 {
-  char *str;
   if (value)
     {
-      if (asprintf (&str, "%s: %s\n", name, ctf_strptr (fp, value)) < 0)
-	goto err;
-      ctf_dump_append (state, str);
+      if (ctf_dump_printf (state, "%s: %s\n", name,
+			   ctf_strptr (fp, value)) < 0)
+	return -1;			/* errno is set for us.  */
+      return ctf_dump_item_end (state);
     }
   return 0;
-
- err:
-  return (ctf_set_errno (fp, errno));
 }
 
-/* Dump one section-offset field from the file header into the cds_items.  */
+/* Dump one section-offset field from the file header.  */
 static int
-ctf_dump_header_sectfield (ctf_file_t *fp, ctf_dump_state_t *state,
+ctf_dump_header_sectfield (ctf_file_t *fp _libctf_unused_,
+			   ctf_dump_state_t *state,
 			   const char *sect, uint32_t off, uint32_t nextoff)
 {
-  char *str;
   if (nextoff - off)
     {
-      if (asprintf (&str, "%s:\t0x%lx -- 0x%lx (0x%lx bytes)\n", sect,
-		    (unsigned long) off, (unsigned long) (nextoff - 1),
-		    (unsigned long) (nextoff - off)) < 0)
-	goto err;
-      ctf_dump_append (state, str);
+      if (ctf_dump_printf (state, "%s:\t0x%lx -- 0x%lx (0x%lx bytes)\n",
+			   sect, (unsigned long) off,
+			   (unsigned long) (nextoff - 1),
+			   (unsigned long) (nextoff - off)) < 0)
+	return -1;			/* errno is set for us.  */
+      return ctf_dump_item_end (state);
     }
   return 0;
-
- err:
-  return (ctf_set_errno (fp, errno));
 }
 
-/* Dump the file header into the cds_items.  */
+/* Dump the file header.  */
 static int
 ctf_dump_header (ctf_file_t *fp, ctf_dump_state_t *state)
 {
-  char *str;
   const ctf_header_t *hp = fp->ctf_header;
   const char *vertab[] =
     {
@@ -215,13 +370,13 @@ ctf_dump_header (ctf_file_t *fp, ctf_dump_state_t *state)
      "CTF_VERSION_1_UPGRADED_3 (latest format, version 1 type "
      "boundaries)",
      "CTF_VERSION_2",
-     "CTF_VERSION_3", NULL
+     "CTF_VERSION_3", "CTF_VERSION_4", NULL
     };
   const char *verstr = NULL;
 
-  if (asprintf (&str, "Magic number: %x\n", hp->cth_magic) < 0)
-      goto err;
-  ctf_dump_append (state, str);
+  if (ctf_dump_printf (state, "Magic number: %x\n", hp->cth_magic) < 0
+      || ctf_dump_item_end (state) < 0)
+    return -1;				/* errno is set for us.  */
 
   if (hp->cth_version <= CTF_VERSION)
     verstr = vertab[hp->cth_version];
@@ -229,10 +384,10 @@ ctf_dump_header (ctf_file_t *fp, ctf_dump_state_t *state)
   if (verstr == NULL)
     verstr = "(not a valid version)";
 
-  if (asprintf (&str, "Version: %i (%s)\n", hp->cth_version,
-		verstr) < 0)
-    goto err;
-  ctf_dump_append (state, str);
+  if (ctf_dump_printf (state, "Version: %i (%s)\n", hp->cth_version,
+		       verstr) < 0
+      || ctf_dump_item_end (state) < 0)
+    return -1;				/* errno is set for us.  */
 
   /* Everything else is only printed if present.  */
 
@@ -243,84 +398,98 @@ ctf_dump_header (ctf_file_t *fp, ctf_dump_state_t *state)
 
   if (fp->ctf_openflags > 0)
     {
-      if (fp->ctf_openflags)
-	if (asprintf (&str, "Flags: 0x%x (%s)", fp->ctf_openflags,
-		      fp->ctf_openflags & CTF_F_COMPRESS ? "CTF_F_COMPRESS"
-							 : "") < 0)
-	goto err;
-      ctf_dump_append (state, str);
+      static const struct
+      {
+	uint32_t flag;
+	const char *name;
+      } flagtab[] =
+	  {
+	    { CTF_F_COMPRESS, "CTF_F_COMPRESS" },
+	    { CTF_F_ZSTD, "CTF_F_ZSTD" },
+	    { CTF_F_LZ4, "CTF_F_LZ4" }
+	  };
+      const char *sep = "";
+      size_t i;
+
+      if (ctf_dump_printf (state, "Flags: 0x%x (", fp->ctf_openflags) < 0)
+	return -1;			/* errno is set for us.  */
+
+      for (i = 0; i < sizeof (flagtab) / sizeof (flagtab[0]); i++)
+	if (fp->ctf_openflags & flagtab[i].flag)
+	  {
+	    if (ctf_dump_printf (state, "%s%s", sep, flagtab[i].name) < 0)
+	      return -1;		/* errno is set for us.  */
+	    sep = ", ";
+	  }
+
+      if (ctf_dump_puts (state, ")") < 0
+	  || ctf_dump_item_end (state) < 0)
+	return -1;			/* errno is set for us.  */
     }
 
   if (ctf_dump_header_strfield (fp, state, "Parent label",
 				hp->cth_parlabel) < 0)
-    goto err;
+    return -1;
 
   if (ctf_dump_header_strfield (fp, state, "Parent name", hp->cth_parname) < 0)
-    goto err;
+    return -1;
 
   if (ctf_dump_header_strfield (fp, state, "Compilation unit name",
 				hp->cth_cuname) < 0)
-    goto err;
+    return -1;
 
   if (ctf_dump_header_sectfield (fp, state, "Label section", hp->cth_lbloff,
 				 hp->cth_objtoff) < 0)
-    goto err;
+    return -1;
 
   if (ctf_dump_header_sectfield (fp, state, "Data object section",
 				 hp->cth_objtoff, hp->cth_funcoff) < 0)
-    goto err;
+    return -1;
 
   if (ctf_dump_header_sectfield (fp, state, "Function info section",
 				 hp->cth_funcoff, hp->cth_varoff) < 0)
-    goto err;
+    return -1;
 
   if (ctf_dump_header_sectfield (fp, state, "Variable section",
 				 hp->cth_varoff, hp->cth_typeoff) < 0)
-    goto err;
+    return -1;
 
   if (ctf_dump_header_sectfield (fp, state, "Type section",
-				 hp->cth_typeoff, hp->cth_stroff) < 0)
-    goto err;
+				 hp->cth_typeoff, hp->cth_nameidxoff) < 0)
+    return -1;
+
+  if (ctf_dump_header_sectfield (fp, state, "Name index section",
+				 hp->cth_nameidxoff, hp->cth_stroff) < 0)
+    return -1;
 
   if (ctf_dump_header_sectfield (fp, state, "String section", hp->cth_stroff,
 				 hp->cth_stroff + hp->cth_strlen + 1) < 0)
-    goto err;
+    return -1;
 
   return 0;
- err:
-  return (ctf_set_errno (fp, errno));
 }
 
-/* Dump a single label into the cds_items.  */
+/* Dump a single label.  */
 
 static int
 ctf_dump_label (const char *name, const ctf_lblinfo_t *info,
 		void *arg)
 {
-  char *str;
-  char *typestr;
   ctf_dump_state_t *state = arg;
 
-  if (asprintf (&str, "%s -> ", name) < 0)
-    return (ctf_set_errno (state->cds_fp, errno));
-
-  if ((typestr = ctf_dump_format_type (state->cds_fp, info->ctb_type,
-				       CTF_ADD_ROOT)) == NULL)
+  if (ctf_dump_printf (state, "%s -> ", name) < 0
+      || ctf_dump_format_type (state, info->ctb_type, CTF_ADD_ROOT) < 0)
     {
-      free (str);
+      state->cds_len = 0;
       return -1;			/* errno is set for us.  */
     }
 
-  str = str_append (str, typestr);
-  free (typestr);
-
-  ctf_dump_append (state, str);
-  return 0;
+  return ctf_dump_item_end (state);
 }
 
-/* Dump all the object entries into the cds_items.  (There is no iterator for
-   this section, so we just do it in a loop, and this function handles all of
-   them, rather than only one.  */
+/* Dump all the object entries.  (There is no iterator for this section, so we
+   just do it in a loop, and this function handles all of them, rather than
+   only one.  */
 
 static int
 ctf_dump_objts (ctf_file_t *fp, ctf_dump_state_t *state)
@@ -329,10 +498,9 @@ ctf_dump_objts (ctf_file_t *fp, ctf_dump_state_t *state)
 
   for (i = 0; i < fp->ctf_nsyms; i++)
     {
-      char *str;
-      char *typestr;
       const char *sym_name;
       ctf_id_t type;
+      int rc;
 
       if ((type = ctf_lookup_by_symbol (state->cds_fp, i)) == CTF_ERR)
 	switch (ctf_errno (state->cds_fp))
@@ -350,34 +518,27 @@ ctf_dump_objts (ctf_file_t *fp, ctf_dump_state_t *state)
       /* Variable name.  */
       sym_name = ctf_lookup_symbol_name (fp, i);
       if (sym_name[0] == '\0')
-	{
-	  if (asprintf (&str, "%lx -> ", (unsigned long) i) < 0)
-	    return (ctf_set_errno (fp, errno));
-	}
+	rc = ctf_dump_printf (state, "%lx -> ", (unsigned long) i);
       else
-	{
-	  if (asprintf (&str, "%s (%lx) -> ", sym_name, (unsigned long) i) < 0)
-	    return (ctf_set_errno (fp, errno));
-	}
+	rc = ctf_dump_printf (state, "%s (%lx) -> ", sym_name,
+			      (unsigned long) i);
 
       /* Variable type.  */
-      if ((typestr = ctf_dump_format_type (state->cds_fp, type,
-					   CTF_ADD_ROOT)) == NULL)
+      if (rc < 0
+	  || ctf_dump_format_type (state, type, CTF_ADD_ROOT) < 0)
 	{
-	  free (str);
+	  state->cds_len = 0;
 	  return -1;			/* errno is set for us.  */
 	}
 
-      str = str_append (str, typestr);
-      free (typestr);
-
-      ctf_dump_append (state, str);
+      if (ctf_dump_item_end (state) < 0)
+	return -1;			/* errno is set for us.  */
     }
   return 0;
 }
 
-/* Dump all the function entries into the cds_items.  (As above, there is no
-   iterator for this section.)  */
+/* Dump all the function entries.  (As above, there is no iterator for this
+   section.)  */
 
 static int
 ctf_dump_funcs (ctf_file_t *fp, ctf_dump_state_t *state)
@@ -386,8 +547,7 @@ ctf_dump_funcs (ctf_file_t *fp, ctf_dump_state_t *state)
 
   for (i = 0; i < fp->ctf_nsyms; i++)
     {
-      char *str;
-      char *bit;
+      const char *name;
       const char *err;
       const char *sym_name;
       ctf_funcinfo_t fi;
@@ -412,30 +572,31 @@ ctf_dump_funcs (ctf_file_t *fp, ctf_dump_state_t *state)
 	return (ctf_set_errno (fp, ENOMEM));
 
       /* Return type.  */
-      if ((str = ctf_type_aname (state->cds_fp, type)) == NULL)
+      if ((name = ctf_type_name_ref (state->cds_fp, type)) == NULL)
 	{
 	  err = "look up return type";
 	  goto err;
 	}
 
-      str = str_append (str, " ");
+      if (ctf_dump_printf (state, "%s ", name) < 0)
+	goto oom;
 
       /* Function name.  */
 
       sym_name = ctf_lookup_symbol_name (fp, i);
       if (sym_name[0] == '\0')
 	{
-	  if (asprintf (&bit, "0x%lx ", (unsigned long) i) < 0)
+	  if (ctf_dump_printf (state, "0x%lx ", (unsigned long) i) < 0)
 	    goto oom;
 	}
       else
 	{
-	  if (asprintf (&bit, "%s (0x%lx) ", sym_name, (unsigned long) i) < 0)
+	  if (ctf_dump_printf (state, "%s (0x%lx) ", sym_name,
+			       (unsigned long) i) < 0)
 	    goto oom;
 	}
-      str = str_append (str, bit);
-      str = str_append (str, " (");
-      free (bit);
+      if (ctf_dump_puts (state, " (") < 0)
+	goto oom;
 
       /* Function arguments.  */
 
@@ -447,172 +608,145 @@ ctf_dump_funcs (ctf_file_t *fp, ctf_dump_state_t *state)
 
       for (j = 0; j < fi.ctc_argc; j++)
 	{
-	  if ((bit = ctf_type_aname (state->cds_fp, args[j])) == NULL)
+	  if ((name = ctf_type_name_ref (state->cds_fp, args[j])) == NULL)
 	    {
 	      err = "look up argument type name";
 	      goto err;
 	    }
-	  str = str_append (str, bit);
-	  if ((j < fi.ctc_argc - 1) || (fi.ctc_flags & CTF_FUNC_VARARG))
-	    str = str_append (str, ", ");
-	  free (bit);
+	  if (ctf_dump_puts (state, name) < 0)
+	    goto oom;
+	  if (((j < fi.ctc_argc - 1) || (fi.ctc_flags & CTF_FUNC_VARARG))
+	      && ctf_dump_puts (state, ", ") < 0)
+	    goto oom;
 	}
 
-      if (fi.ctc_flags & CTF_FUNC_VARARG)
-	str = str_append (str, "...");
-      str = str_append (str, ")");
+      if (fi.ctc_flags & CTF_FUNC_VARARG
+	  && ctf_dump_puts (state, "...") < 0)
+	goto oom;
+      if (ctf_dump_puts (state, ")") < 0)
+	goto oom;
 
       free (args);
-      ctf_dump_append (state, str);
+      if (ctf_dump_item_end (state) < 0)
+	return -1;			/* errno is set for us.  */
       continue;
 
     oom:
       free (args);
-      free (str);
-      return (ctf_set_errno (fp, errno));
+      state->cds_len = 0;
+      return -1;			/* errno is set for us.  */
     err:
       ctf_dprintf ("Cannot %s dumping function type for symbol 0x%li: %s\n",
 		   err, (unsigned long) i,
 		   ctf_errmsg (ctf_errno (state->cds_fp)));
       free (args);
-      free (str);
+      state->cds_len = 0;
       return -1;		/* errno is set for us.  */
     }
   return 0;
 }
 
-/* Dump a single variable into the cds_items.  */
+/* Dump a single variable.  */
 static int
 ctf_dump_var (const char *name, ctf_id_t type, void *arg)
 {
-  char *str;
-  char *typestr;
   ctf_dump_state_t *state = arg;
 
-  if (asprintf (&str, "%s -> ", name) < 0)
-    return (ctf_set_errno (state->cds_fp, errno));
-
-  if ((typestr = ctf_dump_format_type (state->cds_fp, type,
-				       CTF_ADD_ROOT)) == NULL)
+  if (ctf_dump_printf (state, "%s -> ", name) < 0
+      || ctf_dump_format_type (state, type, CTF_ADD_ROOT) < 0)
     {
-      free (str);
+      state->cds_len = 0;
       return -1;			/* errno is set for us.  */
     }
 
-  str = str_append (str, typestr);
-  free (typestr);
-
-  ctf_dump_append (state, str);
-  return 0;
+  return ctf_dump_item_end (state);
 }
 
-/* Dump a single member into the string in the membstate.  */
+/* Dump a single member into the item being formatted.  */
 static int
 ctf_dump_member (const char *name, ctf_id_t id, unsigned long offset,
 		  int depth, void *arg)
 {
-  ctf_dump_membstate_t *state = arg;
-  char *typestr = NULL;
-  char *bit = NULL;
+  ctf_dump_state_t *state = arg;
+  ctf_file_t *fp = state->cds_fp;
+  const char *typestr;
   ctf_encoding_t ep;
   ssize_t i;
 
   for (i = 0; i < depth; i++)
-    *state->cdm_str = str_append (*state->cdm_str, "    ");
+    if (ctf_dump_puts (state, "    ") < 0)
+      return -1;			/* errno is set for us.  */
 
-  if ((typestr = ctf_type_aname (state->cdm_fp, id)) == NULL)
+  if ((typestr = ctf_type_name_ref (fp, id)) == NULL)
     {
-      if (id == 0 || ctf_errno (state->cdm_fp) == ECTF_NONREPRESENTABLE)
-	{
-	  if (asprintf (&bit, "    [0x%lx] (type not represented in CTF)",
-			offset) < 0)
-	    goto oom;
-
-	  *state->cdm_str = str_append (*state->cdm_str, bit);
-	  free (typestr);
-	  free (bit);
-	  return 0;
-	}
+      if (id == 0 || ctf_errno (fp) == ECTF_NONREPRESENTABLE)
+	return ctf_dump_printf (state, "    [0x%lx] (type not represented "
+				"in CTF)", offset);
 
-      goto oom;
+      return -1;			/* errno is set for us.  */
     }
 
-  if (asprintf (&bit, "    [0x%lx] (ID 0x%lx) (kind %i) %s %s (aligned at 0x%lx",
-		offset, id, ctf_type_kind (state->cdm_fp, id), typestr, name,
-		(unsigned long) ctf_type_align (state->cdm_fp, id)) < 0)
-    goto oom;
-  *state->cdm_str = str_append (*state->cdm_str, bit);
-  free (typestr);
-  free (bit);
-  typestr = NULL;
-  bit = NULL;
-
-  if ((ctf_type_kind (state->cdm_fp, id) == CTF_K_INTEGER)
-      || (ctf_type_kind (state->cdm_fp, id) == CTF_K_FLOAT)
-      || (ctf_is_slice (state->cdm_fp, id, &ep) == CTF_K_ENUM))
+  if (ctf_dump_printf (state, "    [0x%lx] (ID 0x%lx) (kind %i) %s %s "
+		       "(aligned at 0x%lx", offset, id,
+		       ctf_type_kind (fp, id), typestr, name,
+		       (unsigned long) ctf_type_align (fp, id)) < 0)
+    return -1;				/* errno is set for us.  */
+
+  if ((ctf_type_kind (fp, id) == CTF_K_INTEGER)
+      || (ctf_type_kind (fp, id) == CTF_K_FLOAT)
+      || (ctf_is_slice (fp, id, &ep) == CTF_K_ENUM))
     {
-      ctf_type_encoding (state->cdm_fp, id, &ep);
-      if (asprintf (&bit, ", format 0x%x, offset:bits 0x%x:0x%x", ep.cte_format,
-		    ep.cte_offset, ep.cte_bits) < 0)
-	goto oom;
-      *state->cdm_str = str_append (*state->cdm_str, bit);
-      free (bit);
-      bit = NULL;
+      ctf_type_encoding (fp, id, &ep);
+      if (ctf_dump_printf (state, ", format 0x%x, offset:bits 0x%x:0x%x",
+			   ep.cte_format, ep.cte_offset, ep.cte_bits) < 0)
+	return -1;			/* errno is set for us.  */
     }
 
-  *state->cdm_str = str_append (*state->cdm_str, ")\n");
-  return 0;
-
- oom:
-  free (typestr);
-  free (bit);
-  return (ctf_set_errno (state->cdm_fp, errno));
+  return ctf_dump_puts (state, ")\n");
 }
 
-/* Dump a single type into the cds_items.  */
+/* Dump a single type.  */
 static int
 ctf_dump_type (ctf_id_t id, int flag, void *arg)
 {
-  char *str;
   const char *err;
   ctf_dump_state_t *state = arg;
-  ctf_dump_membstate_t membstate = { &str, state->cds_fp };
-  size_t len;
 
-  if ((str = ctf_dump_format_type (state->cds_fp, id, flag)) == NULL)
+  if (ctf_dump_format_type (state, id, flag) < 0)
     {
       err = "format type";
       goto err;
     }
 
-  str = str_append (str, "\n");
-  if ((ctf_type_visit (state->cds_fp, id, ctf_dump_member, &membstate)) < 0)
+  if (ctf_dump_puts (state, "\n") < 0)
+    {
+      err = "format type";
+      goto err;
+    }
+
+  if ((ctf_type_visit (state->cds_fp, id, ctf_dump_member, state)) < 0)
     {
       if (id == 0 || ctf_errno (state->cds_fp) == ECTF_NONREPRESENTABLE)
-	{
-	  ctf_dump_append (state, str);
-	  return 0;
-	}
+	return ctf_dump_item_end (state);
+
       err = "visit members";
       goto err;
     }
 
   /* Trim off the last linefeed added by ctf_dump_member().  */
-  len = strlen (str);
-  if (str[len-1] == '\n')
-    str[len-1] = '\0';
+  if (state->cds_len > 0 && state->cds_buf[state->cds_len - 1] == '\n')
+    state->cds_buf[--state->cds_len] = '\0';
 
-  ctf_dump_append (state, str);
-  return 0;
+  return ctf_dump_item_end (state);
 
  err:
   ctf_dprintf ("Cannot %s dumping type 0x%lx: %s\n", err, id,
 	       ctf_errmsg (ctf_errno (state->cds_fp)));
-  free (str);
+  state->cds_len = 0;
   return -1;				/* errno is set for us.  */
 }
 
-/* Dump the string table into the cds_items.  */
+/* Dump the string table.  */
 
 static int
 ctf_dump_str (ctf_file_t *fp, ctf_dump_state_t *state)
@@ -622,18 +756,54 @@ ctf_dump_str (ctf_file_t *fp, ctf_dump_state_t *state)
   for (; s < fp->ctf_str[CTF_STRTAB_0].cts_strs +
 	 fp->ctf_str[CTF_STRTAB_0].cts_len;)
     {
-      char *str;
-      if (asprintf (&str, "%lx: %s",
-		    (unsigned long) (s - fp->ctf_str[CTF_STRTAB_0].cts_strs),
-		    s) < 0)
-	return (ctf_set_errno (fp, errno));
-      ctf_dump_append (state, str);
+      if (ctf_dump_printf (state, "%lx: %s",
+			   (unsigned long) (s - fp->ctf_str[CTF_STRTAB_0].cts_strs),
+			   s) < 0
+	  || ctf_dump_item_end (state) < 0)
+	return -1;			/* errno is set for us.  */
       s += strlen (s) + 1;
     }
 
   return 0;
 }
 
+/* Dump one section of FP, item by item, into STATE.  */
+
+static int
+ctf_dump_sect (ctf_file_t *fp, ctf_dump_state_t *state, ctf_sect_names_t sect)
+{
+  int rc;
+
+  switch (sect)
+    {
+    case CTF_SECT_HEADER:
+      return ctf_dump_header (fp, state);
+    case CTF_SECT_LABEL:
+      if (ctf_label_iter (fp, ctf_dump_label, state) < 0)
+	{
+	  if (ctf_errno (fp) != ECTF_NOLABELDATA)
+	    return -1;			/* errno is set for us.  */
+	  ctf_set_errno (fp, 0);
+	}
+      return 0;
+    case CTF_SECT_OBJT:
+      return ctf_dump_objts (fp, state);
+    case CTF_SECT_FUNC:
+      return ctf_dump_funcs (fp, state);
+    case CTF_SECT_VAR:
+      /* Errors within the iterator itself are returned, not set.  */
+      if ((rc = ctf_variable_iter (fp, ctf_dump_var, state)) > 0)
+	return (ctf_set_errno (fp, rc));
+      return rc;
+    case CTF_SECT_TYPE:
+      return ctf_type_iter_all (fp, ctf_dump_type, state);
+    case CTF_SECT_STR:
+      return ctf_dump_str (fp, state);
+    default:
+      return (ctf_set_errno (fp, ECTF_DUMPSECTUNKNOWN));
+    }
+}
+
 /* Dump a particular section of a CTF file, in textual form.  Call with a
    pointer to a NULL STATE: each call emits a dynamically allocated string
    containing a description of one entity in the specified section, in order.
@@ -658,7 +828,8 @@ ctf_dump (ctf_file_t *fp, ctf_dump_state_t **statep, ctf_sect_names_t sect,
 	 return-at-a-time iterator in a language without call/cc is annoying. It
 	 is easiest to simply collect everything at once and then return it bit
 	 by bit.  The first call will take (much) longer than otherwise, but the
-	 amortized time needed is the same.  */
+	 amortized time needed is the same.  Callers that do not need the items
+	 one at a time should use ctf_dump_stream() instead.  */
 
       if ((*statep = malloc (sizeof (struct ctf_dump_state))) == NULL)
 	{
@@ -671,42 +842,8 @@ ctf_dump (ctf_file_t *fp, ctf_dump_state_t **statep, ctf_sect_names_t sect,
       state->cds_fp = fp;
       state->cds_sect = sect;
 
-      switch (sect)
-	{
-	case CTF_SECT_HEADER:
-	  ctf_dump_header (fp, state);
-	  break;
-	case CTF_SECT_LABEL:
-	  if (ctf_label_iter (fp, ctf_dump_label, state) < 0)
-	    {
-	      if (ctf_errno (fp) != ECTF_NOLABELDATA)
-		goto end;		/* errno is set for us.  */
-	      ctf_set_errno (fp, 0);
-	    }
-	  break;
-	case CTF_SECT_OBJT:
-	  if (ctf_dump_objts (fp, state) < 0)
-	    goto end;			/* errno is set for us.  */
-	  break;
-	case CTF_SECT_FUNC:
-	  if (ctf_dump_funcs (fp, state) < 0)
-	    goto end;			/* errno is set for us.  */
-	  break;
-	case CTF_SECT_VAR:
-	  if (ctf_variable_iter (fp, ctf_dump_var, state) < 0)
-	    goto end;			/* errno is set for us.  */
-	  break;
-	case CTF_SECT_TYPE:
-	  if (ctf_type_iter_all (fp, ctf_dump_type, state) < 0)
-	    goto end;			/* errno is set for us.  */
-	  break;
-	case CTF_SECT_STR:
-	  ctf_dump_str (fp, state);
-	  break;
-	default:
-	  ctf_set_errno (fp, ECTF_DUMPSECTUNKNOWN);
-	  goto end;
-	}
+      if (ctf_dump_sect (fp, state, sect) < 0)
+	goto end;			/* errno is set for us.  */
     }
   else
     {
@@ -744,8 +881,8 @@ ctf_dump (ctf_file_t *fp, ctf_dump_state_t **statep, ctf_sect_names_t sect,
 	    nline[0] = '\0';
 
 	  ret = func (sect, line, arg);
-	  str = str_append (str, ret);
-	  str = str_append (str, "\n");
+	  str = ctf_str_append_noerr (str, ret);
+	  str = ctf_str_append_noerr (str, "\n");
 	  if (ret != line)
 	    free (ret);
 
@@ -783,3 +920,50 @@ ctf_dump (ctf_file_t *fp, ctf_dump_state_t **statep, ctf_sect_names_t sect,
   *statep = NULL;
   return NULL;
 }
+
+/* Dump a particular section of a CTF file, in textual form, straight to a
+   sink.  Each entity in the section is written as one or more lines, each
+   starting with PREFIX (if not NULL) and ending with a linefeed: this is the
+   same text that ctf_dump() returns for each entity, one line at a time.
+
+   Output is buffered, and written by calling WRITE with the buffer, its
+   length, and ARG: WRITE should return 0, or an errno value to stop the dump.
+   If WRITE is NULL, ARG is a FILE * to fwrite() to instead.  Nothing is
+   allocated for each entity, so this is much faster than ctf_dump() for large
+   dicts.
+
+   Returns 0, or -1 and sets the errno on FP (to the value WRITE returned, if
+   it failed).  Output written before an error is not retracted.  */
+
+int
+ctf_dump_stream (ctf_file_t *fp, ctf_sect_names_t sect, const char *prefix,
+		 ctf_dump_write_f *write, void *arg)
+{
+  ctf_dump_state_t state;
+  int rc;
+
+  memset (&state, 0, sizeof (struct ctf_dump_state));
+  state.cds_fp = fp;
+  state.cds_sect = sect;
+  state.cds_streaming = 1;
+  state.cds_prefix = prefix;
+  state.cds_write = write;
+  state.cds_write_arg = arg;
+
+  if ((state.cds_out = malloc (CTF_DUMP_BUFSIZ)) == NULL)
+    return (ctf_set_errno (fp, ENOMEM));
+
+  rc = ctf_dump_sect (fp, &state, sect);
+
+  /* Write out whatever we have, even on error, unless the sink failed.  */
+  if (state.cds_write_err == 0 && ctf_dump_flush (&state) < 0)
+    rc = -1;
+
+  ctf_dump_free (&state);
+
+  if (rc < 0)
+    return -1;				/* errno is set for us.  */
+
+  ctf_set_errno (fp, 0);
+  return 0;
+}
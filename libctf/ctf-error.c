@@ -82,5 +82,7 @@ ctf_errmsg (int error)
 int
 ctf_errno (ctf_file_t * fp)
 {
+  if (fp->ctf_flags & LCTF_CONCURRENT)
+    return _libctf_thread_errno;
   return fp->ctf_errno;
 }
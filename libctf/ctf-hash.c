@@ -11,20 +11,15 @@
 
 #include <ctf-impl.h>
 #include <string.h>
-#include <glib.h>
+#include <assert.h>
 
 /* We have two hashtable implementations: one, ctf_dynhash_*(), is an interface to
    a dynamically-expanding hash with unknown size that should support addition
    of large numbers of items, and removal as well, and is used only at
-   type-insertion time; the other, ctf_dynhash_*(), is an interface to a
+   type-insertion time; the other, ctf_hash_*(), is an interface to a
    fixed-size hash from const char * -> ctf_id_t with number of elements
    specified at creation time, that should support addition of items but need
-   not support removal.  These can be implemented by the same underlying hashmap
-   if you wish.  */
-
-/* ctf_dynhash is a purely-opaque type: it has no definition inside this file,
-   where it is instead universally cast into the type of the *real* hash
-   implementation.  */
+   not support removal.  */
 
 static const uint32_t _CTF_EMPTY[1] = { 0 };
 
@@ -33,116 +28,482 @@ static const uint32_t _CTF_EMPTY[1] = { 0 };
 unsigned int
 ctf_hash_integer (const void *ptr)
 {
-  /* Avoid g_direct_hash() for now: see glib commit dc983d74cc608f.  */
-
-  return GPOINTER_TO_UINT (ptr) * 11;
+  return (unsigned int) (uintptr_t) ptr * 11;
 }
 
 int
 ctf_hash_eq_integer (const void *a, const void *b)
 {
-  return g_direct_equal (a, b);
+  return a == b;
 }
 
+/* This is also the hash used to lay out the serialized name index (see
+   ctf_nameidx_t), so it must not change.  */
+
 unsigned int
 ctf_hash_string (const void *ptr)
 {
-  return g_str_hash (ptr);
+  const unsigned char *p = (const unsigned char *) ptr;
+  unsigned int h = 5381;
+
+  for (; *p != '\0'; p++)
+    h = (h << 5) + h + *p;
+
+  return h;
 }
 
 int
 ctf_hash_eq_string (const void *a, const void *b)
 {
-  return g_str_equal (a, b);
+  return strcmp ((const char *) a, (const char *) b) == 0;
 }
 
-/* Hash a type_mapping_key.  */
+/* Hash a uint64_t, passed by reference.  */
 unsigned int
-ctf_hash_type_mapping_key (const void *ptr)
+ctf_hash_uint64 (const void *ptr)
 {
-  ctf_link_type_mapping_key_t *k = (ctf_link_type_mapping_key_t *) ptr;
-  return GPOINTER_TO_UINT (k->cltm_fp) * 11
-    + 59 * GPOINTER_TO_UINT (k->cltm_idx) * 13;
+  uint64_t val = *(const uint64_t *) ptr;
+
+  return (unsigned int) (val ^ (val >> 32));
 }
 
 int
-ctf_hash_eq_type_mapping_key (const void *a, const void *b)
+ctf_hash_eq_uint64 (const void *a, const void *b)
 {
-  ctf_link_type_mapping_key_t *key_a = (ctf_link_type_mapping_key_t *) a;
-  ctf_link_type_mapping_key_t *key_b = (ctf_link_type_mapping_key_t *) b;
-
-  return (key_a->cltm_fp == key_b->cltm_fp)
-    && (key_a->cltm_idx == key_b->cltm_idx);
+  return *(const uint64_t *) a == *(const uint64_t *) b;
 }
 
 /* The dynhash, used for hashes whose size is not known at creation time.
-   Implemented using GHashTable, an expanding hash.  */
+
+   This is an open-addressing hash using Robin Hood probing: entries live
+   inline in a single power-of-two-sized array of slots, so there is no
+   allocation per element and a lookup is a short linear scan of adjacent
+   memory.  Each slot records the full hash of its key (so most mismatches are
+   rejected without calling the equality function) and its distance from its
+   home slot: on insertion, an entry displaces any entry closer to home than
+   itself, which keeps probe sequences short even at high load factors, and
+   lets lookups stop as soon as they reach an entry closer to home than the key
+   being looked for would be.  Deletion shifts later entries in the same probe
+   sequence back by one, so no tombstones are needed.
+
+   Tables keyed by ctf_hash_integer() (type IDs, string offsets, pointers)
+   hash and compare their keys inline rather than through function
+   pointers.  */
+
+typedef struct ctf_dynhash_slot
+{
+  void *key;
+  void *value;
+  uint32_t hash;		/* Hash of the key.  */
+  uint32_t dist;		/* Distance from home slot, plus one; 0 if empty.  */
+} ctf_dynhash_slot_t;
+
+struct ctf_dynhash
+{
+  ctf_dynhash_slot_t *slots;	/* Slots, or NULL if none allocated yet.  */
+  size_t nslots;		/* Number of slots: zero or a power of two.  */
+  size_t nelems;		/* Number of occupied slots.  */
+  ctf_hash_fun hash_fun;
+  ctf_hash_eq_fun eq_fun;
+  ctf_hash_free_fun key_free;
+  ctf_hash_free_fun value_free;
+  int integer;			/* Keys are integers or pointers.  */
+#ifdef LIBCTF_STATS
+  uint64_t lookups;		/* Statistics: see ctf_dynhash_stats().  */
+  uint64_t probes;
+  uint64_t collisions;
+#endif
+};
+
+/* Never fill more than seven-eighths of the slots.  */
+#define CTF_DYNHASH_MAX_LOAD(nslots) ((nslots) - (nslots) / 8)
+#define CTF_DYNHASH_MIN_SLOTS 16
+
+/* Mix the bits of a hash thoroughly, since the slot index is just the
+   low-order bits of the hash, and pointers and typical string hashes are not
+   very random there.  */
+
+static uint32_t
+ctf_dynhash_mix (uint32_t h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+static uint32_t
+ctf_dynhash_hash (const ctf_dynhash_t *hp, const void *key)
+{
+  if (hp->integer)
+    {
+      uint64_t x = (uint64_t) (uintptr_t) key;
+
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdULL;
+      x ^= x >> 33;
+      return (uint32_t) x;
+    }
+
+  return ctf_dynhash_mix (hp->hash_fun (key));
+}
+
+/* Count a lookup that examined DIST slots.  */
+
+static inline void
+ctf_dynhash_count (ctf_dynhash_t *hp _libctf_unused_,
+		   uint32_t dist _libctf_unused_)
+{
+  ctf_stat_add (hp->lookups, 1);
+  ctf_stat_add (hp->probes, dist);
+  ctf_stat_add (_libctf_stats.cst_hash_lookups, 1);
+  ctf_stat_add (_libctf_stats.cst_hash_probes, dist);
+  if (dist > 1)
+    {
+      ctf_stat_add (hp->collisions, 1);
+      ctf_stat_add (_libctf_stats.cst_hash_collisions, 1);
+    }
+}
+
+static ctf_dynhash_slot_t *
+ctf_dynhash_find (ctf_dynhash_t *hp, const void *key, uint32_t hash)
+{
+  size_t mask, i;
+  uint32_t dist;
+
+  if (hp->nelems == 0)
+    return NULL;
+
+  mask = hp->nslots - 1;
+  for (i = hash & mask, dist = 1;; i = (i + 1) & mask, dist++)
+    {
+      ctf_dynhash_slot_t *slot = &hp->slots[i];
+
+      /* An empty slot, or one closer to home than we would be: no match.  */
+      if (slot->dist < dist)
+	{
+	  ctf_dynhash_count (hp, dist);
+	  return NULL;
+	}
+
+      if (slot->hash == hash
+	  && (hp->integer ? slot->key == key : hp->eq_fun (slot->key, key)))
+	{
+	  ctf_dynhash_count (hp, dist);
+	  return slot;
+	}
+    }
+}
+
+/* Place a new entry known not to be present, displacing entries closer to
+   their home slot than it is.  There must be a free slot.  */
+
+static void
+ctf_dynhash_place (ctf_dynhash_t *hp, void *key, void *value, uint32_t hash)
+{
+  ctf_dynhash_slot_t ins = { key, value, hash, 1 };
+  size_t mask = hp->nslots - 1;
+  size_t i;
+
+  for (i = hash & mask;; i = (i + 1) & mask, ins.dist++)
+    {
+      ctf_dynhash_slot_t *slot = &hp->slots[i];
+
+      if (slot->dist == 0)
+	{
+	  *slot = ins;
+	  hp->nelems++;
+	  return;
+	}
+
+      if (slot->dist < ins.dist)
+	{
+	  ctf_dynhash_slot_t tmp = *slot;
+	  *slot = ins;
+	  ins = tmp;
+	}
+    }
+}
+
+/* Empty the slot at index I, shifting later entries in the same probe sequence
+   back one.  */
+
+static void
+ctf_dynhash_delete_slot (ctf_dynhash_t *hp, size_t i)
+{
+  size_t mask = hp->nslots - 1;
+  size_t next;
+
+  for (next = (i + 1) & mask; hp->slots[next].dist > 1;
+       i = next, next = (next + 1) & mask)
+    {
+      hp->slots[i] = hp->slots[next];
+      hp->slots[i].dist--;
+    }
+
+  memset (&hp->slots[i], 0, sizeof (ctf_dynhash_slot_t));
+  hp->nelems--;
+}
+
+static void
+ctf_dynhash_free_entry (ctf_dynhash_t *hp, void *key, void *value)
+{
+  if (hp->key_free)
+    hp->key_free (key);
+  if (hp->value_free)
+    hp->value_free (value);
+}
 
 ctf_dynhash_t *
 ctf_dynhash_create (ctf_hash_fun hash_fun, ctf_hash_eq_fun eq_fun,
 		    ctf_hash_free_fun key_free,
 		    ctf_hash_free_fun value_free)
 {
-  return (ctf_dynhash_t *) g_hash_table_new_full ((GHashFunc) hash_fun,
-						  (GEqualFunc) eq_fun,
-						  (GDestroyNotify) key_free,
-						  (GDestroyNotify) value_free);
+  ctf_dynhash_t *hp;
+
+  if ((hp = calloc (1, sizeof (ctf_dynhash_t))) == NULL)
+    return NULL;
+
+  hp->hash_fun = hash_fun;
+  hp->eq_fun = eq_fun;
+  hp->key_free = key_free;
+  hp->value_free = value_free;
+  hp->integer = (hash_fun == ctf_hash_integer
+		 && eq_fun == ctf_hash_eq_integer);
+  return hp;
 }
 
+/* Make room for at least NELEMS elements without further reallocation.  */
+
 int
-ctf_dynhash_insert (ctf_dynhash_t *hp, void *key, void *value)
+ctf_dynhash_reserve (ctf_dynhash_t *hp, size_t nelems)
+{
+  ctf_dynhash_slot_t *old_slots = hp->slots;
+  size_t old_nslots = hp->nslots;
+  size_t nslots = CTF_DYNHASH_MIN_SLOTS;
+  size_t i;
+
+  while (CTF_DYNHASH_MAX_LOAD (nslots) < nelems)
+    {
+      if (nslots > SIZE_MAX / 2 / sizeof (ctf_dynhash_slot_t))
+	{
+	  errno = ENOMEM;
+	  return -1;
+	}
+      nslots *= 2;
+    }
+
+  if (nslots <= old_nslots)
+    return 0;
+
+  if ((hp->slots = calloc (nslots, sizeof (ctf_dynhash_slot_t))) == NULL)
+    {
+      hp->slots = old_slots;
+      errno = ENOMEM;
+      return -1;
+    }
+  hp->nslots = nslots;
+  hp->nelems = 0;
+
+  for (i = 0; i < old_nslots; i++)
+    if (old_slots[i].dist != 0)
+      ctf_dynhash_place (hp, old_slots[i].key, old_slots[i].value,
+			 old_slots[i].hash);
+
+  free (old_slots);
+  return 0;
+}
+
+/* Insert a new KEY and VALUE, or replace the value of an existing KEY.  In the
+   latter case, the existing key is retained and the passed-in one is freed, as
+   is the old value.  */
+
+static int
+ctf_dynhash_insert_internal (ctf_dynhash_t *hp, void *key, void *value,
+			     uint32_t hash)
 {
-  g_hash_table_insert ((GHashTable *) hp, (gpointer) key, value);
+  ctf_dynhash_slot_t *slot;
+
+  if ((slot = ctf_dynhash_find (hp, key, hash)) != NULL)
+    {
+      if (hp->key_free && key != slot->key)
+	hp->key_free (key);
+      if (hp->value_free && value != slot->value)
+	hp->value_free (slot->value);
+      slot->value = value;
+      return 0;
+    }
+
+  if (hp->nelems + 1 > CTF_DYNHASH_MAX_LOAD (hp->nslots)
+      && ctf_dynhash_reserve (hp, hp->nelems + 1) < 0)
+    return -1;					/* errno is set for us.  */
+
+  ctf_dynhash_place (hp, key, value, hash);
   return 0;
 }
 
+int
+ctf_dynhash_insert (ctf_dynhash_t *hp, void *key, void *value)
+{
+  return ctf_dynhash_insert_internal (hp, key, value,
+				      ctf_dynhash_hash (hp, key));
+}
+
+/* Like ctf_dynhash_insert(), for callers that already know HASH, the result
+   of calling the hash function of this (non-integer-keyed) hash on KEY.  */
+
+int
+ctf_dynhash_insert_hashed (ctf_dynhash_t *hp, void *key, void *value,
+			   uint32_t hash)
+{
+  assert (!hp->integer);
+  return ctf_dynhash_insert_internal (hp, key, value, ctf_dynhash_mix (hash));
+}
+
 void
 ctf_dynhash_remove (ctf_dynhash_t *hp, const void *key)
 {
-  g_hash_table_remove ((GHashTable *) hp, key);
+  ctf_dynhash_slot_t *slot;
+  void *slot_key, *slot_value;
+
+  if ((slot = ctf_dynhash_find (hp, key, ctf_dynhash_hash (hp, key))) == NULL)
+    return;
+
+  slot_key = slot->key;
+  slot_value = slot->value;
+  ctf_dynhash_delete_slot (hp, slot - hp->slots);
+  ctf_dynhash_free_entry (hp, slot_key, slot_value);
 }
 
 void
 ctf_dynhash_empty (ctf_dynhash_t *hp)
 {
-  g_hash_table_remove_all ((GHashTable *) hp);
+  size_t i;
+
+  if (hp->key_free || hp->value_free)
+    for (i = 0; i < hp->nslots; i++)
+      if (hp->slots[i].dist != 0)
+	ctf_dynhash_free_entry (hp, hp->slots[i].key, hp->slots[i].value);
+
+  if (hp->slots)
+    memset (hp->slots, 0, hp->nslots * sizeof (ctf_dynhash_slot_t));
+  hp->nelems = 0;
 }
 
 void *
 ctf_dynhash_lookup (ctf_dynhash_t *hp, const void *key)
 {
-  return g_hash_table_lookup ((GHashTable *) hp, key);
+  ctf_dynhash_slot_t *slot;
+
+  if ((slot = ctf_dynhash_find (hp, key, ctf_dynhash_hash (hp, key))) == NULL)
+    return NULL;
+
+  return slot->value;
 }
 
+/* Like ctf_dynhash_lookup(), for callers that already know HASH: see
+   ctf_dynhash_insert_hashed().  */
+
+void *
+ctf_dynhash_lookup_hashed (ctf_dynhash_t *hp, const void *key, uint32_t hash)
+{
+  ctf_dynhash_slot_t *slot;
+
+  assert (!hp->integer);
+  if ((slot = ctf_dynhash_find (hp, key, ctf_dynhash_mix (hash))) == NULL)
+    return NULL;
+
+  return slot->value;
+}
+
+/* Call FUN on every element.  FUN must not add or remove elements.  */
+
 void
 ctf_dynhash_iter (ctf_dynhash_t *hp, ctf_hash_iter_f fun, void *arg)
 {
-  g_hash_table_foreach ((GHashTable *)hp, fun, arg);
+  size_t i;
+
+  for (i = 0; i < hp->nslots; i++)
+    if (hp->slots[i].dist != 0)
+      fun (hp->slots[i].key, hp->slots[i].value, arg);
 }
 
+/* Call FUN on every element, removing those for which it returns nonzero.  */
+
 void
 ctf_dynhash_iter_remove (ctf_dynhash_t *hp, ctf_hash_iter_remove_f fun,
 			 void *arg)
 {
-  g_hash_table_foreach_remove ((GHashTable *)hp, fun, arg);
+  size_t mask = hp->nslots - 1;
+  size_t start, n;
+
+  if (hp->nelems == 0)
+    return;
+
+  /* Start at the beginning of a probe sequence: removals only ever shift
+     entries back within one sequence, so no entry is ever shifted into a slot
+     we have already visited, and every entry is seen exactly once.  */
+
+  for (start = 0; hp->slots[start].dist > 1; start++);
+
+  for (n = 0; n < hp->nslots;)
+    {
+      size_t i = (start + n) & mask;
+      ctf_dynhash_slot_t *slot = &hp->slots[i];
+
+      if (slot->dist != 0 && fun (slot->key, slot->value, arg))
+	{
+	  void *slot_key = slot->key;
+	  void *slot_value = slot->value;
+
+	  ctf_dynhash_delete_slot (hp, i);
+	  ctf_dynhash_free_entry (hp, slot_key, slot_value);
+	  continue;
+	}
+      n++;
+    }
+}
+
+/* Add this hash's lookup statistics to STATS.  */
+
+void
+ctf_dynhash_stats (const ctf_dynhash_t *hp _libctf_unused_,
+		   ctf_stats_t *stats _libctf_unused_)
+{
+#ifdef LIBCTF_STATS
+  if (hp == NULL)
+    return;
+
+  stats->cst_hash_lookups += __atomic_load_n (&hp->lookups, __ATOMIC_RELAXED);
+  stats->cst_hash_probes += __atomic_load_n (&hp->probes, __ATOMIC_RELAXED);
+  stats->cst_hash_collisions += __atomic_load_n (&hp->collisions,
+						 __ATOMIC_RELAXED);
+#endif
 }
 
 void
 ctf_dynhash_destroy (ctf_dynhash_t *hp)
 {
-  if (hp != NULL)
-    g_hash_table_destroy ((GHashTable *) hp);
+  if (hp == NULL)
+    return;
+
+  ctf_dynhash_empty (hp);
+  free (hp->slots);
+  free (hp);
 }
 
 /* ctf_hash, used for fixed-size maps from const char * -> ctf_id_t without
-   removal.  TODO: implement one-shot initialization with precomputed bucket
-   distribution.  */
+   removal.  These can either be built up by insertion, or pointed straight at
+   a name index table in the CTF file, laid out by ctf_hash_export(): the
+   layout of the chains is identical in both cases.  */
 
 typedef struct ctf_helem
 {
   uint32_t h_name;		/* Reference to name in string table.  */
   uint32_t h_next;		/* Index of next element in hash chain.  */
-  ctf_id_t h_type;		/* Corresponding type ID number.  */
+  uint32_t h_type;		/* Corresponding type ID number.  */
 } ctf_helem_t;
 
 typedef struct ctf_fixed_hash
@@ -152,6 +513,7 @@ typedef struct ctf_fixed_hash
   uint32_t h_nbuckets;		/* Number of elements in bucket array.  */
   uint32_t h_nelems;		/* Number of elements in hash table.  */
   uint32_t h_free;		/* Index of next free hash element.  */
+  int h_imported;		/* Chains and buckets are in the CTF buffer.  */
 } ctf_hash_t;
 
 /* Table of primes up to almost as high as it's worth going -- there is no point
@@ -222,6 +584,7 @@ ctf_hash_create (unsigned long nelems, ctf_hash_fun hash_fun,
   hp->h_nbuckets = find_prime (nelems);
   hp->h_nelems = nelems + 1;	/* We use index zero as a sentinel.  */
   hp->h_free = 1;		/* First free element is index 1.  */
+  hp->h_imported = 0;
 
   hp->h_buckets = calloc (hp->h_nbuckets, sizeof (uint32_t));
   hp->h_chains = calloc (hp->h_nelems, sizeof (ctf_helem_t));
@@ -253,7 +616,7 @@ ctf_hash_insert_type (ctf_hash_t * hp, ctf_file_t * fp, uint32_t type,
   if (type == 0)
     return EINVAL;
 
-  if (hp->h_free >= hp->h_nelems)
+  if (hp->h_free >= hp->h_nelems || hp->h_imported)
     return EOVERFLOW;
 
   if (str == NULL
@@ -311,18 +674,169 @@ ctf_hash_lookup_type (ctf_hash_t *hp, ctf_file_t *fp, const char *key)
       ctsp = &fp->ctf_str[CTF_NAME_STID (hep->h_name)];
       str = ctsp->cts_strs + CTF_NAME_OFFSET (hep->h_name);
       if (strcmp (key, str) == 0)
-	return hep->h_type;
+	{
+	  j++;
+	  break;
+	}
     }
 
+  ctf_stat_file_add (fp, cst_hash_lookups, 1);
+  ctf_stat_file_add (fp, cst_hash_probes, j);
+  if (j > 1)
+    ctf_stat_file_add (fp, cst_hash_collisions, 1);
+
+  if (i != 0)
+    return hep->h_type;
+
   return 0; 		/* Sentinel value.  */
 }
 
+/* The number of buckets a name index table with NELEMS chain entries
+   (including the sentinel) is written with.  The buckets are sized for a load
+   factor of one, rather than the generous size given by ctf_hash_create(), to
+   keep small dicts small on disk.  */
+
+static uint32_t
+ctf_nameidx_nbuckets (uint32_t nelems)
+{
+  return nelems <= 1 ? 1 : (nelems - 1) | 1;
+}
+
+/* Return the size of the name index table ctf_nameidx_write() will write out
+   for N names.  */
+
+size_t
+ctf_nameidx_size (uint32_t n)
+{
+  uint32_t nelems = n ? n + 1 : 0;
+
+  return sizeof (ctf_nameidx_t) + ctf_nameidx_nbuckets (nelems) * sizeof (uint32_t)
+    + (size_t) nelems * sizeof (ctf_nameidx_ent_t);
+}
+
+/* Write the N names in ELEMS out as a name index table at BUF.  Names are
+   chained in the order given, each in front of those before it.  */
+
+void
+ctf_nameidx_write (const ctf_nameidx_elem_t *elems, uint32_t n,
+		   unsigned char *buf)
+{
+  ctf_nameidx_t idx;
+  uint32_t *buckets;
+  ctf_nameidx_ent_t *chains;
+  uint32_t i;
+
+  idx.cni_nelems = n ? n + 1 : 0;
+  idx.cni_nbuckets = ctf_nameidx_nbuckets (idx.cni_nelems);
+  memcpy (buf, &idx, sizeof (ctf_nameidx_t));
+
+  buckets = (uint32_t *) (buf + sizeof (ctf_nameidx_t));
+  chains = (ctf_nameidx_ent_t *) (buckets + idx.cni_nbuckets);
+  memset (buckets, 0, idx.cni_nbuckets * sizeof (uint32_t));
+
+  if (idx.cni_nelems > 0)
+    memset (&chains[0], 0, sizeof (ctf_nameidx_ent_t));
+
+  for (i = 0; i < n; i++)
+    {
+      uint32_t h = elems[i].cnx_hash % idx.cni_nbuckets;
+
+      chains[i + 1].cne_name = elems[i].cnx_name;
+      chains[i + 1].cne_type = elems[i].cnx_type;
+      chains[i + 1].cne_next = buckets[h];
+      buckets[h] = i + 1;
+    }
+}
+
+/* Create a hash pointing at the name index table at BUF, which has at most LEN
+   bytes available, checking that the table is consistent with FP (whose types
+   must have been counted already), and setting *USED to the size of the table.
+   The hash is only valid as long as BUF is.
+
+   Returns NULL and sets errno to ECTF_CORRUPT if the table is not usable, or
+   ENOMEM on allocation failure.  */
+
+ctf_hash_t *
+ctf_hash_import (ctf_file_t *fp, const unsigned char *buf, size_t len,
+		 size_t *used)
+{
+  ctf_nameidx_t idx;
+  ctf_hash_t *hp;
+  const uint32_t *buckets;
+  const ctf_helem_t *chains;
+  int child = (fp->ctf_flags & LCTF_CHILD) != 0;
+  size_t needed;
+  uint32_t i;
+
+  if (len < sizeof (ctf_nameidx_t))
+    goto corrupt;
+
+  memcpy (&idx, buf, sizeof (ctf_nameidx_t));
+
+  if (idx.cni_nbuckets > len / sizeof (uint32_t)
+      || idx.cni_nelems > len / sizeof (ctf_nameidx_ent_t))
+    goto corrupt;
+
+  needed = sizeof (ctf_nameidx_t) + (size_t) idx.cni_nbuckets * sizeof (uint32_t)
+    + (size_t) idx.cni_nelems * sizeof (ctf_nameidx_ent_t);
+
+  if (idx.cni_nbuckets == 0 || needed > len)
+    goto corrupt;
+
+  buckets = (const uint32_t *) (buf + sizeof (ctf_nameidx_t));
+  chains = (const ctf_helem_t *) (buckets + idx.cni_nbuckets);
+
+  for (i = 0; i < idx.cni_nbuckets; i++)
+    if (buckets[i] >= idx.cni_nelems && buckets[i] != 0)
+      goto corrupt;
+
+  /* Entry zero is the chain terminator, and is never looked at.  */
+
+  for (i = 1; i < idx.cni_nelems; i++)
+    {
+      const ctf_helem_t *hep = &chains[i];
+      const char *str = ctf_strraw (fp, hep->h_name);
+
+      if (hep->h_next >= i || str == NULL || str[0] == '\0'
+	  || LCTF_TYPE_ISCHILD (fp, hep->h_type) != child
+	  || LCTF_TYPE_TO_INDEX (fp, hep->h_type) == 0
+	  || LCTF_TYPE_TO_INDEX (fp, hep->h_type) > fp->ctf_typemax)
+	goto corrupt;
+    }
+
+  if ((hp = malloc (sizeof (ctf_hash_t))) == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  hp->h_buckets = (uint32_t *) buckets;
+  hp->h_chains = (ctf_helem_t *) chains;
+  hp->h_nbuckets = idx.cni_nbuckets;
+  hp->h_nelems = idx.cni_nelems;
+  hp->h_free = idx.cni_nelems;
+  hp->h_imported = 1;
+
+  *used = needed;
+  return hp;
+
+ corrupt:
+  errno = ECTF_CORRUPT;
+  return NULL;
+}
+
 void
 ctf_hash_destroy (ctf_hash_t *hp)
 {
   if (hp == NULL)
     return;
 
+  if (hp->h_imported)
+    {
+      free (hp);
+      return;
+    }
+
   if (hp->h_buckets != NULL && hp->h_nbuckets != 1)
     {
       free (hp->h_buckets);
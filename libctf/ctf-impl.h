@@ -92,6 +92,15 @@ typedef struct ctf_names
   ctf_dynhash_t *ctn_writable;	/* Hash table when writable.  */
 } ctf_names_t;
 
+/* One name to be written out into a name index table by ctf_nameidx_write().  */
+
+typedef struct ctf_nameidx_elem
+{
+  uint32_t cnx_name;		/* Reference to name in string table.  */
+  uint32_t cnx_type;		/* Type ID.  */
+  uint32_t cnx_hash;		/* ctf_hash_string() of the name.  */
+} ctf_nameidx_elem_t;
+
 typedef struct ctf_lookup
 {
   const char *ctl_prefix;	/* String prefix for this lookup.  */
@@ -175,6 +184,30 @@ typedef struct ctf_dvdef
   unsigned long dvd_snapshots;	/* Snapshot count when inserted.  */
 } ctf_dvdef_t;
 
+/* An arena for the dynamic type, member and variable definitions of a
+   writable dict, and their names.  Allocations are carved out of large blocks,
+   which are only returned to the system when the whole arena is freed.
+   Allocations released before then go on free lists by size, and are reused
+   by later allocations of the same size class.  */
+
+#define CTF_ARENA_ALIGN 8		/* Alignment of all allocations.  */
+#define CTF_ARENA_NFREE 16		/* Number of size classes.  */
+#define CTF_ARENA_BLOCK (64 * 1024)	/* Usual size of a block.  */
+
+typedef struct ctf_arena_block
+{
+  struct ctf_arena_block *cab_next; /* Next older block.  */
+  size_t cab_size;		/* Size of cab_data.  */
+  size_t cab_used;		/* Bytes of cab_data in use.  */
+  uint64_t cab_data[];		/* The allocations themselves.  */
+} ctf_arena_block_t;
+
+typedef struct ctf_arena
+{
+  ctf_arena_block_t *ca_blocks;	/* Blocks, most recent first.  */
+  void *ca_free[CTF_ARENA_NFREE]; /* Released allocations, by size class.  */
+} ctf_arena_t;
+
 typedef struct ctf_bundle
 {
   ctf_file_t *ctb_file;		/* CTF container handle.  */
@@ -197,6 +230,7 @@ typedef struct ctf_str_atom
   ctf_list_t csa_refs;		/* This string's refs.  */
   uint32_t csa_offset;		/* Strtab offset, if any.  */
   uint32_t csa_external_offset;	/* External strtab offset, if any.  */
+  uint32_t csa_len;		/* strlen() of csa_str.  */
   unsigned long csa_snapshot_id; /* Snapshot ID at time of creation.  */
 } ctf_str_atom_t;
 
@@ -208,16 +242,53 @@ typedef struct ctf_str_atom_ref
   uint32_t *caf_ref;		/* A single ref to this string.  */
 } ctf_str_atom_ref_t;
 
-/* The structure used as the key in a ctf_link_type_mapping, which lets the
-   linker machinery determine which type IDs on the input side of a link map to
-   which types on the output side.  (The value is a ctf_id_t: another
-   index, not a type.)  */
+/* The value of a ctf_link_type_mapping, which is keyed by source dict and lets
+   the linker machinery determine which type IDs on the input side of a link
+   map to which types on the output side.  It is indexed by source type index,
+   and holds destination type indexes, not types (or 0 if unmapped).  */
+
+typedef struct ctf_link_type_map
+{
+  size_t cltm_len;		/* Number of entries in cltm_dst.  */
+  uint32_t *cltm_dst;		/* Destination type indexes.  */
+} ctf_link_type_map_t;
+
+/* One input dictionary to a deduplicating link, with the names the linker
+   uses to decide which per-CU output dictionary its unshared types go into.  */
+
+typedef struct ctf_link_input
+{
+  ctf_file_t *clin_fp;		/* The input dictionary.  */
+  const char *clin_filename;	/* Input file it came from.  */
+  char *clin_cuname;		/* Archive member name sans any '.ctf.'.  */
+  int clin_shared;		/* All its types go into the shared dict.  */
+} ctf_link_input_t;
+
+/* The memoized results of ctf_type_resolve(), ctf_type_size() and
+   ctf_type_align() for one type.  */
 
-typedef struct ctf_link_type_mapping_key
+typedef struct ctf_type_cache
 {
-  ctf_file_t *cltm_fp;
-  ctf_id_t cltm_idx;
-} ctf_link_type_mapping_key_t;
+  ssize_t ctc_size;		/* Size, or -1 if not yet known.  */
+  ssize_t ctc_align;		/* Alignment, or -1 if not yet known.  */
+  uint32_t ctc_resolved;	/* Resolved type, or 0 if not yet known.  */
+  struct ctf_layout *ctc_layout; /* Layout, if LCTF_CONCURRENT: else NULL.  */
+  char *ctc_name;		/* Name, or NULL if not yet known.  */
+} ctf_type_cache_t;
+
+/* The decoded fixed-size part of every type in a read-only dict, as parallel
+   arrays indexed like ctf_txlate, so that the commonest queries need neither
+   chase ctf_txlate into the type section nor call through ctf_fileops.  All
+   the arrays are one allocation, starting at cti_size.  */
+
+typedef struct ctf_type_index
+{
+  ssize_t *cti_size;		/* Size, as returned by ctf_get_ctt_size().  */
+  uint32_t *cti_ref;		/* ctt_type, or cts_type for slices.  */
+  uint32_t *cti_name;		/* ctt_name.  */
+  uint32_t *cti_vlen;		/* LCTF_INFO_VLEN.  */
+  unsigned char *cti_kind;	/* LCTF_INFO_KIND.  */
+} ctf_type_index_t;
 
 /* The ctf_file is the structure used to represent a CTF container to library
    clients, who see it only as an opaque pointer.  Modifications can therefore
@@ -258,9 +329,14 @@ struct ctf_file
   size_t ctf_size;		  /* Size of CTF header + uncompressed data.  */
   uint32_t *ctf_sxlate;		  /* Translation table for symtab entries.  */
   unsigned long ctf_nsyms;	  /* Number of entries in symtab xlate table.  */
+  ctf_dynhash_t *ctf_objthash;	  /* Data object name -> symtab index + 1.  */
+  ctf_dynhash_t *ctf_funchash;	  /* Function name -> symtab index + 1.  */
   uint32_t *ctf_txlate;		  /* Translation table for type IDs.  */
+  ctf_type_index_t ctf_tindex;	  /* Decoded types (never if writable).  */
   uint32_t *ctf_ptrtab;		  /* Translation table for pointer-to lookups.  */
   size_t ctf_ptrtab_len;	  /* Num types storable in ptrtab currently.  */
+  ctf_type_cache_t *ctf_type_cache; /* Type memo, indexed like ctf_txlate.  */
+  size_t ctf_type_cache_len;	  /* Num types in ctf_type_cache.  */
   struct ctf_varent *ctf_vars;	  /* Sorted variable->type mapping.  */
   unsigned long ctf_nvars;	  /* Number of variables in ctf_vars.  */
   unsigned long ctf_typemax;	  /* Maximum valid type ID number.  */
@@ -280,23 +356,83 @@ struct ctf_file
   ctf_list_t ctf_dtdefs;	  /* List of dynamic type definitions.  */
   ctf_dynhash_t *ctf_dvhash;	  /* Hash of dynamic variable mappings.  */
   ctf_list_t ctf_dvdefs;	  /* List of dynamic variable definitions.  */
+  ctf_arena_t ctf_arena;	  /* Storage for dtds, dmds, dvds and names.  */
   unsigned long ctf_dtoldid;	  /* Oldest id that has been committed.  */
+  unsigned long ctf_inc_typemax;  /* Serialized types ctf_buf can reuse.  */
   unsigned long ctf_snapshots;	  /* ctf_snapshot() plus ctf_update() count.  */
   unsigned long ctf_snapshot_lu;  /* ctf_snapshot() call count at last update.  */
   ctf_archive_t *ctf_archive;	  /* Archive this ctf_file_t came from.  */
   ctf_dynhash_t *ctf_link_inputs; /* Inputs to this link.  */
+  ctf_archive_t *ctf_link_prev;	  /* Output of the link this one updates.  */
   ctf_dynhash_t *ctf_link_outputs; /* Additional outputs from this link.  */
   ctf_dynhash_t *ctf_link_type_mapping; /* Map input types to output types.  */
   ctf_dynhash_t *ctf_link_cu_mapping;	/* Map CU names to CTF dict names.  */
   /* Allow the caller to Change the name of link archive members.  */
   ctf_link_memb_name_changer_f *ctf_link_memb_name_changer;
   void *ctf_link_memb_name_changer_arg; /* Argument for it.  */
+  uint32_t ctf_link_threads;	  /* Maximum threads ctf_link() may use.  */
+  size_t ctf_link_budget;	  /* Memory budget for per-CU link outputs.  */
+  uint32_t ctf_compressor;	  /* CTF_F_COMPRESSOR bits to write with.  */
   ctf_dynhash_t *ctf_add_processing; /* Types ctf_add_type is working on now.  */
+  ctf_dynhash_t *ctf_membidx;	  /* Member name indexes of large types.  */
+  ctf_dynhash_t *ctf_enumvalidx;  /* Enumerator value indexes of large enums.  */
+  ctf_dynhash_t *ctf_layouts;	  /* Flattened layouts of types, by type ID.  */
+  ctf_dynhash_t *ctf_type_names; /* Names of uncacheable types, by type ID.  */
   char *ctf_tmp_typeslice;	  /* Storage for slicing up type names.  */
   size_t ctf_tmp_typeslicelen;	  /* Size of the typeslice.  */
   void *ctf_specific;		  /* Data for ctf_get/setspecific().  */
+  ctf_stats_t ctf_stats;	  /* Statistics, bar those kept in hashes.  */
 };
 
+/* Statistics counting.  When libctf is built without LIBCTF_STATS, these
+   compile to nothing.  Counters are updated atomically, since dicts may be
+   read by many threads at once.  Both the per-dict and process-wide totals are
+   updated.  */
+
+#ifdef LIBCTF_STATS
+#define ctf_stat_add(ctr, n) \
+  ((void) __atomic_fetch_add (&(ctr), (n), __ATOMIC_RELAXED))
+#define ctf_stat_file_add(fp, field, n)					\
+  do									\
+    {									\
+      uint64_t ctf_stat_n_ = (n);					\
+      ctf_stat_add ((fp)->ctf_stats.field, ctf_stat_n_);		\
+      ctf_stat_add (_libctf_stats.field, ctf_stat_n_);			\
+    }									\
+  while (0)
+#define ctf_stat_timer(start) uint64_t start = ctf_stat_now ()
+#define ctf_stat_file_time(fp, field, start) \
+  ctf_stat_file_add (fp, field, ctf_stat_now () - (start))
+#else
+#define ctf_stat_add(ctr, n) do { } while (0)
+#define ctf_stat_file_add(fp, field, n) do { } while (0)
+#define ctf_stat_timer(start) do { } while (0)
+#define ctf_stat_file_time(fp, field, start) do { } while (0)
+#endif
+
+/* An open dict in the cache of an archive's dicts (ctfi_dicts).  The cache
+   holds one reference to cace_fp.  */
+
+typedef struct ctf_arc_cache_ent
+{
+  ctf_list_t cace_list;		/* LRU list pointers: most recent first.  */
+  char *cace_name;		/* Member name (also the ctfi_dicts key).  */
+  ctf_file_t *cace_fp;		/* The open dict.  */
+  size_t cace_size;		/* Its estimated memory use.  */
+} ctf_arc_cache_ent_t;
+
+/* The default memory budget of an archive's dict cache.  */
+#define CTF_ARC_CACHE_BUDGET (64 * 1024 * 1024)
+
+/* Archives with at least this many members are written with a name hash
+   index, if ctf_set_arc_hash() has asked for one.  Smaller ones are always
+   written in the older format and searched by bisection.  */
+#define CTF_ARC_HASH_THRESH 64
+
+/* Nonzero if this (host-endian) magic number is that of an archive.  */
+#define CTF_ARC_MAGIC_P(magic) \
+  ((magic) == CTFA_MAGIC || (magic) == CTFA_MAGIC_HASH)
+
 /* An abstraction over both a ctf_file_t and a ctf_archive_t.  */
 
 struct ctf_archive_internal
@@ -308,6 +444,11 @@ struct ctf_archive_internal
   int ctfi_is_archive;
   ctf_file_t *ctfi_file;
   struct ctf_archive *ctfi_archive;
+  size_t ctfi_archive_size;	/* Size of ctfi_archive mapping, if ours.  */
+  ctf_dynhash_t *ctfi_dicts;	/* Open dicts, by name: ctf_arc_cache_ent_t.  */
+  ctf_list_t ctfi_dicts_lru;	/* ctfi_dicts entries, most recent first.  */
+  size_t ctfi_dicts_size;	/* Estimated memory use of ctfi_dicts.  */
+  size_t ctfi_dicts_budget;	/* Size above which ctfi_dicts are evicted.  */
   ctf_sect_t ctfi_symsect;
   ctf_sect_t ctfi_strsect;
   int ctfi_free_symsect;
@@ -324,6 +465,12 @@ struct ctf_archive_internal
 /* * If an offs is not aligned already then round it up and align it. */
 #define LCTF_ALIGN_OFFS(offs, align) ((offs + (align - 1)) & ~(align - 1))
 
+/* The size of the header HP is written out with: only v4 headers have a
+   cth_nameidxoff.  */
+#define LCTF_HEADER_SIZE(hp) ((hp)->cth_version >= CTF_VERSION_4	\
+			      ? sizeof (ctf_header_t)			\
+			      : CTF_HEADER_NONAMEIDX_SIZE)
+
 #define LCTF_TYPE_ISPARENT(fp, id) ((id) <= fp->ctf_parmax)
 #define LCTF_TYPE_ISCHILD(fp, id) ((id) > fp->ctf_parmax)
 #define LCTF_TYPE_TO_INDEX(fp, id) ((id) & (fp->ctf_parmax))
@@ -336,23 +483,133 @@ struct ctf_archive_internal
 		       (fp, i, fp->ctf_flags & LCTF_CHILD))->dtd_data) : \
      (ctf_type_t *)((uintptr_t)(fp)->ctf_buf + (fp)->ctf_txlate[(i)]))
 
-#define LCTF_INFO_KIND(fp, info)	((fp)->ctf_fileops->ctfo_get_kind(info))
-#define LCTF_INFO_ISROOT(fp, info)	((fp)->ctf_fileops->ctfo_get_root(info))
-#define LCTF_INFO_VLEN(fp, info)	((fp)->ctf_fileops->ctfo_get_vlen(info))
-#define LCTF_VBYTES(fp, kind, size, vlen) \
-  ((fp)->ctf_fileops->ctfo_get_vbytes(kind, size, vlen))
+/* Every dict but an un-upgraded v1 dict has its types in the v3 encoding,
+   which the accessors below decode inline, rather than by indirect calls
+   through the ctf_fileops.  */
+
+#ifndef NO_COMPAT
+#define LCTF_V3_TYPES(fp) \
+  (!_libctf_unlikely_ ((fp)->ctf_version == CTF_VERSION_1))
+#else
+#define LCTF_V3_TYPES(fp) 1
+#endif
+
+#define LCTF_INFO_KIND(fp, info)				\
+  (LCTF_V3_TYPES (fp) ? CTF_V2_INFO_KIND (info)			\
+   : (fp)->ctf_fileops->ctfo_get_kind (info))
+#define LCTF_INFO_ISROOT(fp, info)				\
+  (LCTF_V3_TYPES (fp) ? CTF_V2_INFO_ISROOT (info)		\
+   : (fp)->ctf_fileops->ctfo_get_root (info))
+#define LCTF_INFO_VLEN(fp, info)				\
+  (LCTF_V3_TYPES (fp) ? CTF_V2_INFO_VLEN (info)			\
+   : (fp)->ctf_fileops->ctfo_get_vlen (info))
+#define LCTF_VBYTES(fp, kind, size, vlen)			\
+  (LCTF_V3_TYPES (fp) ? ctf_get_vbytes_v3 (fp, kind, size, vlen)	\
+   : (fp)->ctf_fileops->ctfo_get_vbytes (kind, size, vlen))
+
+static inline ssize_t ctf_get_vbytes_v3 (const ctf_file_t *fp,
+					 unsigned short kind, ssize_t size,
+					 size_t vlen)
+{
+  switch (kind)
+    {
+    case CTF_K_INTEGER:
+    case CTF_K_FLOAT:
+      return (sizeof (uint32_t));
+    case CTF_K_ARRAY:
+      return (sizeof (ctf_array_t));
+    case CTF_K_FUNCTION:
+      return (sizeof (uint32_t) * (vlen + (vlen & 1)));
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+      if (size < CTF_LSTRUCT_THRESH)
+	return (sizeof (ctf_member_t) * vlen);
+      else
+	return (sizeof (ctf_lmember_t) * vlen);
+    case CTF_K_SLICE:
+      return (sizeof (ctf_slice_t));
+    case CTF_K_ENUM:
+      return (sizeof (ctf_enum_t) * vlen);
+    case CTF_K_FORWARD:
+    case CTF_K_UNKNOWN:
+    case CTF_K_POINTER:
+    case CTF_K_TYPEDEF:
+    case CTF_K_VOLATILE:
+    case CTF_K_CONST:
+    case CTF_K_RESTRICT:
+      return 0;
+    default:			/* Diagnosed out of line.  */
+      return (fp->ctf_fileops->ctfo_get_vbytes (kind, size, vlen));
+    }
+}
 
 static inline ssize_t ctf_get_ctt_size (const ctf_file_t *fp,
 					const ctf_type_t *tp,
 					ssize_t *sizep,
 					ssize_t *incrementp)
 {
-  return (fp->ctf_fileops->ctfo_get_ctt_size (fp, tp, sizep, incrementp));
+  ssize_t size, increment;
+
+  if (!LCTF_V3_TYPES (fp))
+    return (fp->ctf_fileops->ctfo_get_ctt_size (fp, tp, sizep, incrementp));
+
+  if (tp->ctt_size == CTF_LSIZE_SENT)
+    {
+      size = CTF_TYPE_LSIZE (tp);
+      increment = sizeof (ctf_type_t);
+    }
+  else
+    {
+      size = tp->ctt_size;
+      increment = sizeof (ctf_stype_t);
+    }
+
+  if (sizep)
+    *sizep = size;
+  if (incrementp)
+    *incrementp = increment;
+
+  return size;
 }
 
 #define LCTF_CHILD	0x0001	/* CTF container is a child */
 #define LCTF_RDWR	0x0002	/* CTF container is writable */
 #define LCTF_DIRTY	0x0004	/* CTF container has been modified */
+#define LCTF_INCREMENTAL 0x0008	/* Serialize incrementally if possible */
+#define LCTF_CONCURRENT	0x0010	/* CTF container may be read concurrently */
+#define LCTF_SPILLED	0x0020	/* Read-only, but serializable, link output */
+#define LCTF_ARC_HASH	0x0040	/* Archives led by this get a name hash index */
+
+/* If TYPE is a type in a dict with a decoded type index, return that dict
+   (FP or its parent) and set *IDXP to the index of TYPE in it.  Otherwise,
+   return NULL: the caller should fall back to ctf_lookup_by_id(), which will
+   diagnose any error.  */
+
+static inline ctf_file_t *ctf_tindex_lookup (ctf_file_t *fp, ctf_id_t type,
+					     uint32_t *idxp)
+{
+  unsigned long idx;
+
+  if ((fp->ctf_flags & LCTF_CHILD) && LCTF_TYPE_ISPARENT (fp, type)
+      && (fp = fp->ctf_parent) == NULL)
+    return NULL;
+
+  idx = LCTF_TYPE_TO_INDEX (fp, type);
+  if (_libctf_unlikely_ (fp->ctf_tindex.cti_size == NULL
+			 || idx == 0 || idx > fp->ctf_typemax))
+    return NULL;
+
+  *idxp = (uint32_t) idx;
+  return fp;
+}
+
+/* Words which may be read and written by concurrent readers of a dict.  All
+   such writes store values computable from the dict, so the only requirement
+   is that the accesses be atomic.  */
+#define ctf_atomic_load(x) __atomic_load_n (&(x), __ATOMIC_RELAXED)
+#define ctf_atomic_store(x, v) __atomic_store_n (&(x), (v), __ATOMIC_RELAXED)
+#define ctf_file_ref(fp) \
+  ((void) __atomic_add_fetch (&(fp)->ctf_refcnt, 1, __ATOMIC_RELAXED))
 
 extern ctf_names_t *ctf_name_table (ctf_file_t *, int);
 extern const ctf_type_t *ctf_lookup_by_id (ctf_file_t **, ctf_id_t);
@@ -363,12 +620,12 @@ extern void ctf_set_ctl_hashes (ctf_file_t *);
 typedef unsigned int (*ctf_hash_fun) (const void *ptr);
 extern unsigned int ctf_hash_integer (const void *ptr);
 extern unsigned int ctf_hash_string (const void *ptr);
-extern unsigned int ctf_hash_type_mapping_key (const void *ptr);
+extern unsigned int ctf_hash_uint64 (const void *ptr);
 
 typedef int (*ctf_hash_eq_fun) (const void *, const void *);
 extern int ctf_hash_eq_integer (const void *, const void *);
 extern int ctf_hash_eq_string (const void *, const void *);
-extern int ctf_hash_eq_type_mapping_key (const void *, const void *);
+extern int ctf_hash_eq_uint64 (const void *, const void *);
 
 typedef void (*ctf_hash_free_fun) (void *);
 
@@ -380,18 +637,29 @@ extern int ctf_hash_insert_type (ctf_hash_t *, ctf_file_t *, uint32_t, uint32_t)
 extern int ctf_hash_define_type (ctf_hash_t *, ctf_file_t *, uint32_t, uint32_t);
 extern ctf_id_t ctf_hash_lookup_type (ctf_hash_t *, ctf_file_t *, const char *);
 extern uint32_t ctf_hash_size (const ctf_hash_t *);
+extern size_t ctf_nameidx_size (uint32_t);
+extern void ctf_nameidx_write (const ctf_nameidx_elem_t *, uint32_t,
+			       unsigned char *);
+extern ctf_hash_t *ctf_hash_import (ctf_file_t *, const unsigned char *,
+				    size_t, size_t *);
 extern void ctf_hash_destroy (ctf_hash_t *);
 
 extern ctf_dynhash_t *ctf_dynhash_create (ctf_hash_fun, ctf_hash_eq_fun,
 					  ctf_hash_free_fun, ctf_hash_free_fun);
 extern int ctf_dynhash_insert (ctf_dynhash_t *, void *, void *);
+extern int ctf_dynhash_insert_hashed (ctf_dynhash_t *, void *, void *,
+				      uint32_t);
+extern int ctf_dynhash_reserve (ctf_dynhash_t *, size_t);
 extern void ctf_dynhash_remove (ctf_dynhash_t *, const void *);
 extern void ctf_dynhash_empty (ctf_dynhash_t *);
 extern void *ctf_dynhash_lookup (ctf_dynhash_t *, const void *);
+extern void *ctf_dynhash_lookup_hashed (ctf_dynhash_t *, const void *,
+					uint32_t);
 extern void ctf_dynhash_destroy (ctf_dynhash_t *);
 extern void ctf_dynhash_iter (ctf_dynhash_t *, ctf_hash_iter_f, void *);
 extern void ctf_dynhash_iter_remove (ctf_dynhash_t *, ctf_hash_iter_remove_f,
 				     void *);
+extern void ctf_dynhash_stats (const ctf_dynhash_t *, ctf_stats_t *);
 
 #define	ctf_list_prev(elem)	((void *)(((ctf_list_t *)(elem))->l_prev))
 #define	ctf_list_next(elem)	((void *)(((ctf_list_t *)(elem))->l_next))
@@ -401,6 +669,12 @@ extern void ctf_list_prepend (ctf_list_t *, void *);
 extern void ctf_list_delete (ctf_list_t *, void *);
 extern int ctf_list_empty_p (ctf_list_t *lp);
 
+extern void *ctf_arena_alloc (ctf_arena_t *, size_t);
+extern char *ctf_arena_strdup (ctf_arena_t *, const char *);
+extern void ctf_arena_release (ctf_arena_t *, void *, size_t);
+extern void ctf_arena_free (ctf_arena_t *);
+extern size_t ctf_arena_size (const ctf_arena_t *);
+
 extern int ctf_dtd_insert (ctf_file_t *, ctf_dtdef_t *, int flag, int kind);
 extern void ctf_dtd_delete (ctf_file_t *, ctf_dtdef_t *);
 extern ctf_dtdef_t *ctf_dtd_lookup (const ctf_file_t *, ctf_id_t);
@@ -414,6 +688,11 @@ extern void ctf_add_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type,
 				  ctf_file_t *dst_fp, ctf_id_t dst_type);
 extern ctf_id_t ctf_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type,
 				  ctf_file_t **dst_fp);
+extern ctf_file_t *ctf_create_per_cu (ctf_file_t *, const char *,
+				      const char *);
+typedef int ctf_dedup_done_f (ctf_link_input_t *, void *);
+extern int ctf_dedup (ctf_file_t *, ctf_link_input_t *, uint32_t,
+		      ctf_dedup_done_f *, void *);
 
 extern void ctf_decl_init (ctf_decl_t *);
 extern void ctf_decl_fini (ctf_decl_t *);
@@ -436,13 +715,17 @@ extern void ctf_str_remove_ref (ctf_file_t *, const char *, uint32_t *ref);
 extern void ctf_str_rollback (ctf_file_t *, ctf_snapshot_id_t);
 extern void ctf_str_purge_refs (ctf_file_t *);
 extern ctf_strs_writable_t ctf_str_write_strtab (ctf_file_t *);
+extern ctf_strs_writable_t ctf_str_append_strtab (ctf_file_t *);
 
 extern struct ctf_archive_internal *ctf_new_archive_internal
-	(int is_archive, struct ctf_archive *arc,
+	(int is_archive, struct ctf_archive *arc, size_t arc_size,
 	 ctf_file_t *fp, const ctf_sect_t *symsect,
 	 const ctf_sect_t *strsect, int *errp);
-extern struct ctf_archive *ctf_arc_open_internal (const char *, int *);
-extern void ctf_arc_close_internal (struct ctf_archive *);
+extern struct ctf_archive *ctf_arc_open_internal (int, const char *, size_t *,
+						  int *);
+extern void ctf_arc_close_internal (struct ctf_archive *, size_t);
+extern int ctf_arc_write_fd_internal (int, ctf_file_t **, size_t,
+				      const char **, size_t, unsigned int);
 extern void *ctf_set_open_errno (int *, int);
 extern unsigned long ctf_set_errno (ctf_file_t *, int);
 
@@ -455,10 +738,19 @@ extern ctf_file_t *ctf_bufopen_internal (const ctf_sect_t *, const ctf_sect_t *,
 					 int, int *);
 extern int ctf_serialize (ctf_file_t *);
 
+typedef int ctf_compress_sink_f (const void *buf, size_t len, void *arg);
+extern int ctf_compressor_available (uint32_t flags);
+extern int ctf_compress_stream (ctf_file_t *, uint32_t flags, const void *src,
+				size_t len, ctf_compress_sink_f *, void *arg);
+extern int ctf_decompress (uint32_t flags, void *dst, size_t dstlen,
+			   const void *src, size_t srclen);
+
 _libctf_malloc_
 extern void *ctf_mmap (size_t length, size_t offset, int fd);
 extern void ctf_munmap (void *, size_t);
 extern ssize_t ctf_pread (int fd, void *buf, ssize_t count, off_t offset);
+extern ssize_t ctf_pwrite (int fd, const void *buf, ssize_t count,
+			   off_t offset);
 
 extern void *ctf_realloc (ctf_file_t *, void *, size_t);
 extern char *ctf_str_append (char *, const char *);
@@ -466,11 +758,15 @@ extern char *ctf_str_append_noerr (char *, const char *);
 extern const char *ctf_strerror (int);
 
 extern ctf_id_t ctf_type_resolve_unsliced (ctf_file_t *, ctf_id_t);
+extern void ctf_type_cache_flush (ctf_file_t *);
+extern int ctf_type_caches_prepare (ctf_file_t *);
+extern int ctf_init_symhash (ctf_file_t *);
 extern int ctf_type_kind_unsliced (ctf_file_t *, ctf_id_t);
 
 _libctf_printflike_ (1, 2)
 extern void ctf_dprintf (const char *, ...);
 extern void libctf_init_debug (void);
+extern uint64_t ctf_stat_now (void);
 
 extern Elf64_Sym *ctf_sym_to_elf64 (const Elf32_Sym *src, Elf64_Sym *dst);
 extern const char *ctf_lookup_symbol_name (ctf_file_t *fp, unsigned long symidx);
@@ -482,6 +778,8 @@ extern const char _CTF_NULLSTR[];	/* empty string */
 
 extern int _libctf_version;	/* library client version */
 extern int _libctf_debug;	/* debugging messages enabled */
+extern __thread int _libctf_thread_errno; /* errno of LCTF_CONCURRENT dicts */
+extern ctf_stats_t _libctf_stats; /* process-wide statistics */
 
 #ifdef	__cplusplus
 }
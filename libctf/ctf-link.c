@@ -23,10 +23,21 @@
    enough in the call stack that doing anything useful is painfully difficult:
    the worst consequence if we do OOM is a bit of type duplication anyway.  */
 
+static void
+ctf_link_type_map_free (void *map_)
+{
+  ctf_link_type_map_t *map = (ctf_link_type_map_t *) map_;
+
+  free (map->cltm_dst);
+  free (map);
+}
+
 void
 ctf_add_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type,
 		      ctf_file_t *dst_fp, ctf_id_t dst_type)
 {
+  ctf_link_type_map_t *map;
+
   if (LCTF_TYPE_ISPARENT (src_fp, src_type) && src_fp->ctf_parent)
     src_fp = src_fp->ctf_parent;
 
@@ -37,30 +48,73 @@ ctf_add_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type,
 
   dst_type = LCTF_TYPE_TO_INDEX(dst_fp, dst_type);
 
-  /* This dynhash is a bit tricky: it has a multivalued (structural) key, so we
-     need to use the sized-hash machinery to generate key hashing and equality
-     functions.  */
+  /* The mapping is a hash from source dict to an array indexed by source type
+     index, so looking up one type is cheap and no keys need allocating.  */
 
   if (dst_fp->ctf_link_type_mapping == NULL)
     {
-      ctf_hash_fun f = ctf_hash_type_mapping_key;
-      ctf_hash_eq_fun e = ctf_hash_eq_type_mapping_key;
+      if ((dst_fp->ctf_link_type_mapping
+	   = ctf_dynhash_create (ctf_hash_integer, ctf_hash_eq_integer,
+				 NULL, ctf_link_type_map_free)) == NULL)
+	return;
+    }
 
-      if ((dst_fp->ctf_link_type_mapping = ctf_dynhash_create (f, e, free,
-							       NULL)) == NULL)
+  if ((map = ctf_dynhash_lookup (dst_fp->ctf_link_type_mapping,
+				 src_fp)) == NULL)
+    {
+      if ((map = calloc (1, sizeof (ctf_link_type_map_t))) == NULL)
 	return;
+
+      if (ctf_dynhash_insert (dst_fp->ctf_link_type_mapping, src_fp,
+			      map) < 0)
+	{
+	  free (map);
+	  return;
+	}
     }
 
-  ctf_link_type_mapping_key_t *key;
-  key = calloc (1, sizeof (struct ctf_link_type_mapping_key));
-  if (!key)
-    return;
+  if ((size_t) src_type >= map->cltm_len)
+    {
+      size_t len = map->cltm_len;
+      uint32_t *dst;
+
+      /* Size the array to cover every type in the source dict, or failing
+	 that (for writable source dicts) grow it geometrically.  */
+
+      if (len < src_fp->ctf_typemax + 1)
+	len = src_fp->ctf_typemax + 1;
+      if (len < 64)
+	len = 64;
+      while (len <= (size_t) src_type)
+	len *= 2;
+
+      if ((dst = realloc (map->cltm_dst, len * sizeof (uint32_t))) == NULL)
+	return;
 
-  key->cltm_fp = src_fp;
-  key->cltm_idx = src_type;
+      memset (dst + map->cltm_len, 0,
+	      (len - map->cltm_len) * sizeof (uint32_t));
+      map->cltm_dst = dst;
+      map->cltm_len = len;
+    }
 
-  ctf_dynhash_insert (dst_fp->ctf_link_type_mapping, key,
-		      (void *) (uintptr_t) dst_type);
+  map->cltm_dst[src_type] = dst_type;
+}
+
+/* Return the index of the type in DST_FP that type index SRC_IDX in SRC_FP is
+   mapped to, or 0 if none.  */
+static ctf_id_t
+ctf_type_mapping_lookup (ctf_file_t *dst_fp, ctf_file_t *src_fp,
+			 ctf_id_t src_idx)
+{
+  ctf_link_type_map_t *map;
+
+  if (dst_fp->ctf_link_type_mapping == NULL
+      || (map = ctf_dynhash_lookup (dst_fp->ctf_link_type_mapping,
+				    src_fp)) == NULL
+      || (size_t) src_idx >= map->cltm_len)
+    return 0;
+
+  return map->cltm_dst[src_idx];
 }
 
 /* Look up a type mapping: return 0 if none.  The DST_FP is modified to point to
@@ -68,7 +122,6 @@ ctf_add_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type,
 ctf_id_t
 ctf_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type, ctf_file_t **dst_fp)
 {
-  ctf_link_type_mapping_key_t key;
   ctf_file_t *target_fp = *dst_fp;
   ctf_id_t dst_type = 0;
 
@@ -76,12 +129,8 @@ ctf_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type, ctf_file_t **dst_fp)
     src_fp = src_fp->ctf_parent;
 
   src_type = LCTF_TYPE_TO_INDEX(src_fp, src_type);
-  key.cltm_fp = src_fp;
-  key.cltm_idx = src_type;
 
-  if (target_fp->ctf_link_type_mapping)
-    dst_type = (uintptr_t) ctf_dynhash_lookup (target_fp->ctf_link_type_mapping,
-					       &key);
+  dst_type = ctf_type_mapping_lookup (target_fp, src_fp, src_type);
 
   if (dst_type != 0)
     {
@@ -96,9 +145,7 @@ ctf_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type, ctf_file_t **dst_fp)
   else
     return 0;
 
-  if (target_fp->ctf_link_type_mapping)
-    dst_type = (uintptr_t) ctf_dynhash_lookup (target_fp->ctf_link_type_mapping,
-					       &key);
+  dst_type = ctf_type_mapping_lookup (target_fp, src_fp, src_type);
 
   if (dst_type)
     dst_type = LCTF_INDEX_TO_TYPE (target_fp, dst_type,
@@ -122,7 +169,8 @@ ctf_type_mapping (ctf_file_t *src_fp, ctf_id_t src_type, ctf_file_t **dst_fp)
    data sections to match; and ctf_link_write() emits a CTF file (if there are
    no conflicts requiring per-compilation-unit sub-CTF files) or CTF archives
    (otherwise) and returns it, suitable for addition in the .ctf section of the
-   output.  */
+   output.  Adding the output of a previous link with ctf_link_add_previous()
+   turns ctf_link() into an incremental relink of it.  */
 
 /* Add a file to a link.  */
 
@@ -165,21 +213,47 @@ ctf_link_add_ctf (ctf_file_t *fp, ctf_archive_t *ctf, const char *name)
   return (ctf_set_errno (fp, ENOMEM));
 }
 
-/* Return a per-CU output CTF dictionary suitable for the given CU, creating and
-   interning it if need be.  */
+/* Add the output of a previous link of this dict, for an incremental relink.
+   The previous shared dict and every per-CU dict in PREV are linked in as if
+   they were inputs, except for the per-CU dicts that inputs added with
+   ctf_link_add_ctf() would go into: those inputs replace them.  Every type in
+   the previous shared dict stays in the shared dict, and per-CU dicts keep
+   their names.
+
+   So an incremental relink adds the previous output and just the inputs that
+   have changed since.  This is much cheaper than a full link, because the
+   previous output contains each shared type once, where the inputs it was
+   made from contain it once per CU.  Types that only the replaced dicts used
+   to share may be left behind in the shared dict, and CUs that have gone away
+   cannot be removed: a full link tidies both up.  PREV must have been written
+   without a member name changer, and if ctf_link_add_cu_mapping() sends
+   several inputs to one dict, all of them must be added again if any is.
+
+   Like the inputs, PREV is closed when FP is.  */
+int
+ctf_link_add_previous (ctf_file_t *fp, ctf_archive_t *prev)
+{
+  if (fp->ctf_link_outputs)
+    return (ctf_set_errno (fp, ECTF_LINKADDEDLATE));
 
-static ctf_file_t *
-ctf_create_per_cu (ctf_file_t *fp, const char *filename, const char *cuname)
+  ctf_arc_close (fp->ctf_link_prev);
+  fp->ctf_link_prev = prev;
+  return 0;
+}
+
+/* Return the name of the per-CU output dictionary for the given CU.
+
+   We check the mapping table and translate the per-CU name we use accordingly.
+   We check both the input filename and the CU name.  Only if neither are set
+   do we fall back to the input filename as the per-CU dictionary name.  We
+   prefer the filename because this is easier for likely callers to
+   determine.  */
+
+static const char *
+ctf_link_per_cu_name (ctf_file_t *fp, const char *filename,
+		      const char *cuname)
 {
-  ctf_file_t *cu_fp;
   const char *ctf_name = NULL;
-  char *dynname = NULL;
-
-  /* First, check the mapping table and translate the per-CU name we use
-     accordingly.  We check both the input filename and the CU name.  Only if
-     neither are set do we fall back to the input filename as the per-CU
-     dictionary name.  We prefer the filename because this is easier for likely
-     callers to determine.  */
 
   if (fp->ctf_link_cu_mapping)
     {
@@ -191,6 +265,21 @@ ctf_create_per_cu (ctf_file_t *fp, const char *filename, const char *cuname)
   if (ctf_name == NULL)
     ctf_name = filename;
 
+  return ctf_name;
+}
+
+/* Return a per-CU output CTF dictionary suitable for the given CU, creating and
+   interning it if need be.  */
+
+ctf_file_t *
+ctf_create_per_cu (ctf_file_t *fp, const char *filename, const char *cuname)
+{
+  ctf_file_t *cu_fp;
+  const char *ctf_name;
+  char *dynname = NULL;
+
+  ctf_name = ctf_link_per_cu_name (fp, filename, cuname);
+
   if ((cu_fp = ctf_dynhash_lookup (fp->ctf_link_outputs, ctf_name)) == NULL)
     {
       int err;
@@ -295,6 +384,175 @@ ctf_link_set_memb_name_changer (ctf_file_t *fp,
   fp->ctf_link_memb_name_changer_arg = arg;
 }
 
+/* Set the maximum number of threads ctf_link() may use.  Only deduplicating
+   links are parallelized, and only across input dicts: the output is the same
+   whatever the number of threads.  Zero or one mean a serial link.  The same
+   number of threads serialize and compress the members of archives written
+   by ctf_link_write(), or by ctf_arc_write() with FP as first member.  */
+int
+ctf_link_set_threads (ctf_file_t *fp, unsigned int nthreads)
+{
+  fp->ctf_link_threads = nthreads;
+  return 0;
+}
+
+/* Set the approximate number of bytes that completed per-CU output dicts may
+   take up while ctf_link() is still working on others.  Beyond that, they are
+   spilled: serialized, and replaced with read-only dicts holding nothing but
+   their serialized form.  Zero, the default, means no limit.
+
+   A per-CU dict is complete once all the input files that go into it have been
+   linked.  Dicts that ctf_link_add_cu_mapping() sends inputs to are never
+   spilled, and no dicts at all are spilled if a member name changer has been
+   set, since it may rename their parent.  Spilled dicts do not share strings
+   with the external string table added by ctf_link_add_strtab().  */
+int
+ctf_link_set_memory_budget (ctf_file_t *fp, size_t budget)
+{
+  fp->ctf_link_budget = budget;
+  return 0;
+}
+
+/* Spilling per-CU outputs.  */
+
+typedef struct ctf_link_spill
+{
+  ctf_dynhash_t *cls_mapped;	/* Per-CU outputs CU mappings go into.  */
+  ctf_file_t **cls_done;	/* Completed outputs not yet spilled.  */
+  size_t cls_ndone;		/* Number of them.  */
+  size_t cls_done_size;		/* Their approximate total size.  */
+  int cls_err;			/* Error spilling, if any.  */
+} ctf_link_spill_t;
+
+/* Note the per-CU output one CU mapping goes into.  */
+static void
+ctf_link_spill_note_mapped (void *key _libctf_unused_, void *value,
+			    void *arg_)
+{
+  ctf_link_spill_t *spill = (ctf_link_spill_t *) arg_;
+
+  if (ctf_dynhash_insert (spill->cls_mapped, value, value) < 0)
+    spill->cls_err = ENOMEM;
+}
+
+static int
+ctf_link_spill_init (ctf_file_t *fp, ctf_link_spill_t *spill)
+{
+  memset (spill, 0, sizeof (ctf_link_spill_t));
+
+  if (fp->ctf_link_budget == 0 || fp->ctf_link_memb_name_changer != NULL)
+    return 0;
+
+  if ((spill->cls_mapped = ctf_dynhash_create (ctf_hash_string,
+					       ctf_hash_eq_string,
+					       NULL, NULL)) == NULL)
+    return (ctf_set_errno (fp, ENOMEM));
+
+  if (fp->ctf_link_cu_mapping)
+    ctf_dynhash_iter (fp->ctf_link_cu_mapping, ctf_link_spill_note_mapped,
+		      spill);
+
+  if (spill->cls_err != 0)
+    {
+      ctf_dynhash_destroy (spill->cls_mapped);
+      return (ctf_set_errno (fp, spill->cls_err));
+    }
+  return 0;
+}
+
+static void
+ctf_link_spill_fini (ctf_link_spill_t *spill)
+{
+  ctf_dynhash_destroy (spill->cls_mapped);
+  free (spill->cls_done);
+}
+
+/* Replace the writable per-CU output CU_FP with a read-only dict opened on its
+   serialized form.  This is done in place, as ctf_serialize() does it, so that
+   pointers to CU_FP remain valid.  */
+static int
+ctf_link_spill_one (ctf_file_t *fp, ctf_file_t *cu_fp)
+{
+  ctf_file_t ofp, *nfp;
+  unsigned char *buf;
+  size_t size;
+  int err;
+
+  if ((buf = ctf_write_mem (cu_fp, &size, (size_t) -1)) == NULL)
+    return (ctf_set_errno (fp, ctf_errno (cu_fp)));
+
+  if ((nfp = ctf_simple_open_internal ((char *) buf, size, NULL, 0, 0, NULL,
+				       0, NULL, 0, &err)) == NULL)
+    {
+      free (buf);
+      return (ctf_set_errno (fp, err));
+    }
+
+  if (nfp->ctf_dynbase == NULL)
+    nfp->ctf_dynbase = buf;		/* Make sure buf is freed on close.  */
+  else
+    free (buf);
+
+  (void) ctf_setmodel (nfp, ctf_getmodel (cu_fp));
+  (void) ctf_import (nfp, cu_fp->ctf_parent);
+
+  nfp->ctf_refcnt = cu_fp->ctf_refcnt;
+  nfp->ctf_flags |= LCTF_SPILLED;
+  nfp->ctf_compressor = cu_fp->ctf_compressor;
+  nfp->ctf_stats = cu_fp->ctf_stats;
+
+  memcpy (&ofp, cu_fp, sizeof (ctf_file_t));
+  memcpy (cu_fp, nfp, sizeof (ctf_file_t));
+  memcpy (nfp, &ofp, sizeof (ctf_file_t));
+  ctf_set_ctl_hashes (cu_fp);
+
+  nfp->ctf_refcnt = 1;			/* Force nfp to be freed.  */
+  ctf_file_close (nfp);
+  return 0;
+}
+
+/* Note that the input file NAME has been linked.  Unless a CU mapping goes
+   into it, this completes the per-CU output named after it, if any: spill
+   every completed output if together they now exceed the memory budget.  */
+static int
+ctf_link_spill_done (ctf_file_t *fp, ctf_link_spill_t *spill, const char *name)
+{
+  ctf_file_t *cu_fp;
+  ctf_file_t **done;
+  size_t i;
+
+  if (spill->cls_mapped == NULL
+      || ctf_dynhash_lookup (spill->cls_mapped, name) != NULL
+      || (cu_fp = ctf_dynhash_lookup (fp->ctf_link_outputs, name)) == NULL
+      || !(cu_fp->ctf_flags & LCTF_RDWR))
+    return 0;
+
+  if ((done = realloc (spill->cls_done, sizeof (ctf_file_t *)
+		       * (spill->cls_ndone + 1))) == NULL)
+    {
+      spill->cls_err = ENOMEM;
+      return (ctf_set_errno (fp, ENOMEM));
+    }
+  spill->cls_done = done;
+  spill->cls_done[spill->cls_ndone++] = cu_fp;
+  spill->cls_done_size += ctf_arena_size (&cu_fp->ctf_arena)
+    + cu_fp->ctf_size;
+
+  if (spill->cls_done_size <= fp->ctf_link_budget)
+    return 0;
+
+  for (i = 0; i < spill->cls_ndone; i++)
+    if (ctf_link_spill_one (fp, spill->cls_done[i]) < 0)
+      {
+	spill->cls_err = ctf_errno (fp);
+	return -1;				/* errno is set for us.  */
+      }
+
+  spill->cls_ndone = 0;
+  spill->cls_done_size = 0;
+  return 0;
+}
+
 typedef struct ctf_link_in_member_cb_arg
 {
   ctf_file_t *out_fp;
@@ -306,6 +564,8 @@ typedef struct ctf_link_in_member_cb_arg
   int done_main_member;
   int share_mode;
   int in_input_cu_file;
+  ctf_dynhash_t *replaced;
+  ctf_link_spill_t *spill;
 } ctf_link_in_member_cb_arg_t;
 
 /* Link one type into the link.  We rely on ctf_add_type() to detect
@@ -319,12 +579,6 @@ ctf_link_one_type (ctf_id_t type, int isroot _libctf_unused_, void *arg_)
   ctf_file_t *per_cu_out_fp;
   int err;
 
-  if (arg->share_mode != CTF_LINK_SHARE_UNCONFLICTED)
-    {
-      ctf_dprintf ("Share-duplicated mode not yet implemented.\n");
-      return ctf_set_errno (arg->out_fp, ECTF_NOTYET);
-    }
-
   /* Simply call ctf_add_type: if it reports a conflict and we're adding to the
      main CTF file, add to the per-CU archive member instead, creating it if
      necessary.  If we got this type from a per-CU archive member, add it
@@ -428,7 +682,7 @@ ctf_link_one_variable (const char *name, ctf_id_t type, void *arg_)
 	    }
 
 	  /* Already present?  Nothing to do.  */
-	  if (dvd && dvd->dvd_type == type)
+	  if (dvd && dvd->dvd_type == dst_type)
 	    return 0;
 	}
     }
@@ -500,6 +754,15 @@ ctf_link_one_input_archive_member (ctf_file_t *in_fp, const char *name, void *ar
     }
   else
     {
+      /* Per-CU dicts in the output of a previous link go back into the per-CU
+	 dicts they came from, unless an input replaces them.  */
+      if (arg->replaced)
+	{
+	  if (ctf_dynhash_lookup (arg->replaced, name) != NULL)
+	    return 0;
+	  arg->file_name = name;
+	}
+
       arg->arcname = strdup (name);
 
       /* Get ambiguous types from our parent.  */
@@ -524,6 +787,10 @@ ctf_link_one_input_archive_member (ctf_file_t *in_fp, const char *name, void *ar
   if (err < 0)
       return -1;				/* Errno is set for us.  */
 
+  /* Each per-CU dict from a previous link is an input file of its own.  */
+  if (arg->replaced && arg->spill && strcmp (name, _CTF_SECTION) != 0)
+    return ctf_link_spill_done (arg->out_fp, arg->spill, name);
+
   return 0;
 }
 
@@ -581,20 +848,315 @@ ctf_link_one_input_archive (void *key, void *value, void *arg_)
   if (arg->out_fp->ctf_link_type_mapping)
     ctf_dynhash_empty (arg->out_fp->ctf_link_type_mapping);
   ctf_dynhash_iter (arg->out_fp->ctf_link_outputs, empty_link_type_mapping, NULL);
+
+  if (arg->spill && !arg->replaced)
+    ctf_link_spill_done (arg->out_fp, arg->spill, file_name);
 }
 
-/* Merge types and variable sections in all files added to the link
+/* Incremental links.  */
+
+typedef struct ctf_link_replaced_cb_arg
+{
+  ctf_file_t *fp;
+  ctf_dynhash_t *replaced;
+  int err;
+} ctf_link_replaced_cb_arg_t;
+
+/* Note the name of the per-CU dict one input goes into.  */
+static void
+ctf_link_note_replaced (void *key, void *value _libctf_unused_, void *arg_)
+{
+  ctf_link_replaced_cb_arg_t *arg = (ctf_link_replaced_cb_arg_t *) arg_;
+  const char *name;
+
+  if (arg->err)
+    return;
+
+  name = ctf_link_per_cu_name (arg->fp, (const char *) key,
+			       (const char *) key);
+  if (ctf_dynhash_insert (arg->replaced, (char *) name, (char *) name) < 0)
+    arg->err = ENOMEM;
+}
+
+/* Return a hash of the names of the per-CU dicts that the inputs to this link
+   go into, which replace the per-CU dicts of the same names in the output of
+   the previous link.  */
+static ctf_dynhash_t *
+ctf_link_replaced_cus (ctf_file_t *fp)
+{
+  ctf_link_replaced_cb_arg_t arg;
+
+  arg.fp = fp;
+  arg.err = 0;
+  if ((arg.replaced = ctf_dynhash_create (ctf_hash_string, ctf_hash_eq_string,
+					  NULL, NULL)) == NULL)
+    {
+      ctf_set_errno (fp, ENOMEM);
+      return NULL;
+    }
+
+  if (fp->ctf_link_inputs)
+    ctf_dynhash_iter (fp->ctf_link_inputs, ctf_link_note_replaced, &arg);
+
+  if (arg.err != 0)
+    {
+      ctf_dynhash_destroy (arg.replaced);
+      ctf_set_errno (fp, arg.err);
+      return NULL;
+    }
+  return arg.replaced;
+}
+
+/* Deduplicating links.  */
+
+typedef struct ctf_link_gather_cb_arg
+{
+  ctf_file_t *out_fp;
+  const char *file_name;
+  ctf_file_t *main_input_fp;
+  ctf_link_input_t *inputs;
+  uint32_t ninputs;
+  ctf_dynhash_t *replaced;
+  int err;
+} ctf_link_gather_cb_arg_t;
+
+/* Add one dict to the array of deduplicating link inputs.  */
+static int
+ctf_link_add_input (ctf_link_gather_cb_arg_t *arg, ctf_file_t *in_fp,
+		    const char *cu_name)
+{
+  ctf_link_input_t *inputs;
+  char *dupname;
+
+  if (strncmp (cu_name, ".ctf.", strlen (".ctf.")) == 0)
+    cu_name += strlen (".ctf.");
+
+  if ((dupname = strdup (cu_name)) == NULL)
+    return (ctf_set_errno (arg->out_fp, ENOMEM));
+
+  if ((inputs = realloc (arg->inputs, sizeof (ctf_link_input_t)
+			 * (arg->ninputs + 1))) == NULL)
+    {
+      free (dupname);
+      return (ctf_set_errno (arg->out_fp, ENOMEM));
+    }
+
+  arg->inputs = inputs;
+  inputs[arg->ninputs].clin_fp = in_fp;
+  inputs[arg->ninputs].clin_filename = arg->file_name;
+  inputs[arg->ninputs].clin_cuname = dupname;
+  inputs[arg->ninputs].clin_shared = 0;
+  arg->ninputs++;
+  return 0;
+}
+
+/* Add one non-default archive member to the link inputs.  The deduplicator
+   needs to see all the inputs at once, so we keep the member open until the
+   link is done.  */
+static int
+ctf_link_gather_input_archive_member (ctf_file_t *in_fp, const char *name,
+				      void *arg_)
+{
+  ctf_link_gather_cb_arg_t *arg = (ctf_link_gather_cb_arg_t *) arg_;
+
+  /* The default member has already been added.  */
+  if (strcmp (name, _CTF_SECTION) == 0)
+    return 0;
+
+  /* As in the non-deduplicating link, per-CU dicts in the output of a previous
+     link keep their names, unless an input replaces them.  */
+  if (arg->replaced)
+    {
+      if (ctf_dynhash_lookup (arg->replaced, name) != NULL)
+	return 0;
+      arg->file_name = name;
+    }
+
+  /* Get ambiguous types from our parent.  */
+  ctf_import (in_fp, arg->main_input_fp);
+
+  ctf_file_ref (in_fp);
+  if (ctf_link_add_input (arg, in_fp, name) < 0)
+    {
+      ctf_file_close (in_fp);
+      return -1;				/* errno is set for us.  */
+    }
+  return 0;
+}
+
+/* Add every dict in one input file to the link inputs.  */
+static void
+ctf_link_gather_input_archive (void *key, void *value, void *arg_)
+{
+  const char *file_name = (const char *) key;
+  ctf_archive_t *arc = (ctf_archive_t *) value;
+  ctf_link_gather_cb_arg_t *arg = (ctf_link_gather_cb_arg_t *) arg_;
+  int err;
+
+  if (arg->err)
+    return;
+
+  arg->file_name = file_name;
+  if ((arg->main_input_fp = ctf_arc_open_by_name (arc, NULL, &err)) == NULL)
+    {
+      ctf_dprintf ("Cannot open main archive member in input file %s in the "
+		   "link: skipping: %s.\n", arg->file_name, ctf_errmsg (err));
+      return;
+    }
+
+  if (ctf_link_add_input (arg, arg->main_input_fp, _CTF_SECTION) < 0)
+    {
+      ctf_file_close (arg->main_input_fp);
+      arg->err = ctf_errno (arg->out_fp);
+      return;
+    }
+
+  /* The shared dict of a previous link stays shared.  */
+  if (arg->replaced)
+    arg->inputs[arg->ninputs - 1].clin_shared = 1;
+
+  if ((err = ctf_archive_iter (arc, ctf_link_gather_input_archive_member,
+			       arg)) != 0)
+    {
+      if (err < 0)
+	err = ctf_errno (arg->out_fp);
+      ctf_dprintf ("Cannot traverse archive in input file %s: link "
+		   "cannot continue: %s.\n", arg->file_name,
+		   ctf_errmsg (err));
+      arg->err = err;
+    }
+}
+
+typedef struct ctf_link_dedup_done_cb_arg
+{
+  ctf_link_in_member_cb_arg_t arg;
+  ctf_link_input_t *inputs;
+  uint32_t ninputs;
+  ctf_link_spill_t spill;
+} ctf_link_dedup_done_cb_arg_t;
+
+/* Called by the deduplicator once all the types in one input are emitted: link
+   its variables in, drop the type mappings nothing later needs, and spill the
+   per-CU output it went into if it is now complete.  Children immediately
+   follow their parent in the inputs, and all the inputs from one file are
    together.  */
-int
-ctf_link (ctf_file_t *fp, int share_mode)
+static int
+ctf_link_deduplicated_input (ctf_link_input_t *input, void *arg_)
+{
+  ctf_link_dedup_done_cb_arg_t *done = (ctf_link_dedup_done_cb_arg_t *) arg_;
+  ctf_link_in_member_cb_arg_t *arg = &done->arg;
+  ctf_file_t *fp = arg->out_fp;
+  ctf_file_t *in_fp = input->clin_fp;
+  ctf_link_input_t *next = NULL;
+
+  arg->in_fp = in_fp;
+  arg->file_name = input->clin_filename;
+  arg->cu_name = input->clin_cuname;
+  arg->arcname = input->clin_cuname;
+
+  if (ctf_variable_iter (in_fp, ctf_link_one_variable, arg) < 0)
+    return -1;					/* errno is set for us.  */
+
+  if ((uint32_t) (input - done->inputs) + 1 < done->ninputs)
+    next = input + 1;
+
+  /* Mappings into the per-CU outputs go when those outputs are spilled.  */
+  if (fp->ctf_link_type_mapping)
+    {
+      if (next == NULL || next->clin_fp->ctf_parent != in_fp)
+	ctf_dynhash_remove (fp->ctf_link_type_mapping, in_fp);
+      if (in_fp->ctf_parent
+	  && (next == NULL || next->clin_fp->ctf_parent != in_fp->ctf_parent))
+	ctf_dynhash_remove (fp->ctf_link_type_mapping, in_fp->ctf_parent);
+    }
+
+  if (next == NULL || strcmp (next->clin_filename, input->clin_filename) != 0)
+    return ctf_link_spill_done (fp, &done->spill, input->clin_filename);
+
+  return 0;
+}
+
+/* Link all the inputs using the type deduplicator, which shares only types that
+   appear in more than one input, linking the variables in as it goes.  */
+static int
+ctf_link_deduplicating (ctf_file_t *fp)
+{
+  ctf_link_gather_cb_arg_t gather;
+  ctf_link_dedup_done_cb_arg_t done;
+  uint32_t i;
+  int ret = -1;
+
+  memset (&gather, 0, sizeof (struct ctf_link_gather_cb_arg));
+  gather.out_fp = fp;
+
+  if (ctf_link_spill_init (fp, &done.spill) < 0)
+    return -1;					/* errno is set for us.  */
+
+  /* The output of the previous link goes first, so that its shared types keep
+     their names if the new inputs conflict with them.  */
+
+  if (fp->ctf_link_prev)
+    {
+      if ((gather.replaced = ctf_link_replaced_cus (fp)) == NULL)
+	goto err;				/* errno is set for us.  */
+
+      ctf_link_gather_input_archive ((void *) _CTF_SECTION, fp->ctf_link_prev,
+				     &gather);
+      ctf_dynhash_destroy (gather.replaced);
+      gather.replaced = NULL;
+    }
+
+  if (fp->ctf_link_inputs && gather.err == 0)
+    ctf_dynhash_iter (fp->ctf_link_inputs, ctf_link_gather_input_archive,
+		      &gather);
+  if (gather.err != 0)
+    {
+      ctf_set_errno (fp, gather.err);
+      goto err;
+    }
+
+  memset (&done.arg, 0, sizeof (struct ctf_link_in_member_cb_arg));
+  done.arg.out_fp = fp;
+  done.arg.share_mode = CTF_LINK_SHARE_DUPLICATED;
+  done.inputs = gather.inputs;
+  done.ninputs = gather.ninputs;
+
+  if (ctf_dedup (fp, gather.inputs, gather.ninputs,
+		 ctf_link_deduplicated_input, &done) < 0)
+    goto err;					/* errno is set for us.  */
+
+  ctf_set_errno (fp, 0);
+  ret = 0;
+
+ err:
+  for (i = gather.ninputs; i > 0; i--)
+    {
+      ctf_file_close (gather.inputs[i - 1].clin_fp);
+      free (gather.inputs[i - 1].clin_cuname);
+    }
+  free (gather.inputs);
+  ctf_link_spill_fini (&done.spill);
+
+  /* Discard the now-unnecessary mapping table data.  */
+  if (fp->ctf_link_type_mapping)
+    ctf_dynhash_empty (fp->ctf_link_type_mapping);
+  ctf_dynhash_iter (fp->ctf_link_outputs, empty_link_type_mapping, NULL);
+
+  return ret;
+}
+
+static int
+ctf_link_internal (ctf_file_t *fp, int share_mode)
 {
   ctf_link_in_member_cb_arg_t arg;
+  ctf_link_spill_t spill;
+  int ret = -1;
 
   memset (&arg, 0, sizeof (struct ctf_link_in_member_cb_arg));
   arg.out_fp = fp;
   arg.share_mode = share_mode;
 
-  if (fp->ctf_link_inputs == NULL)
+  if (fp->ctf_link_inputs == NULL && fp->ctf_link_prev == NULL)
     return 0;					/* Nothing to do. */
 
   if (fp->ctf_link_outputs == NULL)
@@ -605,12 +1167,53 @@ ctf_link (ctf_file_t *fp, int share_mode)
   if (fp->ctf_link_outputs == NULL)
     return ctf_set_errno (fp, ENOMEM);
 
-  ctf_dynhash_iter (fp->ctf_link_inputs, ctf_link_one_input_archive,
-		    &arg);
+  if (share_mode & CTF_LINK_SHARE_DUPLICATED)
+    return ctf_link_deduplicating (fp);
 
-  if (ctf_errno (fp) != 0)
-    return -1;
-  return 0;
+  if (ctf_link_spill_init (fp, &spill) < 0)
+    return -1;					/* errno is set for us.  */
+  arg.spill = &spill;
+
+  if (fp->ctf_link_prev)
+    {
+      if ((arg.replaced = ctf_link_replaced_cus (fp)) == NULL)
+	goto err;				/* errno is set for us.  */
+
+      ctf_link_one_input_archive ((void *) _CTF_SECTION, fp->ctf_link_prev,
+				  &arg);
+      ctf_dynhash_destroy (arg.replaced);
+      arg.replaced = NULL;
+
+      if (ctf_errno (fp) != 0)
+	goto err;
+    }
+
+  if (fp->ctf_link_inputs)
+    ctf_dynhash_iter (fp->ctf_link_inputs, ctf_link_one_input_archive,
+		      &arg);
+
+  if (spill.cls_err != 0)
+    ctf_set_errno (fp, spill.cls_err);
+
+  if (ctf_errno (fp) == 0)
+    ret = 0;
+
+ err:
+  ctf_link_spill_fini (&spill);
+  return ret;
+}
+
+/* Merge types and variable sections in all files added to the link
+   together.  */
+int
+ctf_link (ctf_file_t *fp, int share_mode)
+{
+  int ret;
+  ctf_stat_timer (start);
+
+  ret = ctf_link_internal (fp, share_mode);
+  ctf_stat_file_time (fp, cst_link_ns, start);
+  return ret;
 }
 
 typedef struct ctf_link_out_string_cb_arg
@@ -628,6 +1231,10 @@ ctf_link_intern_extern_string (void *key _libctf_unused_, void *value,
   ctf_file_t *fp = (ctf_file_t *) value;
   ctf_link_out_string_cb_arg_t *arg = (ctf_link_out_string_cb_arg_t *) arg_;
 
+  /* Per-CU outputs spilled by the link keep their own strings.  */
+  if (fp->ctf_flags & LCTF_SPILLED)
+    return;
+
   fp->ctf_flags |= LCTF_DIRTY;
   if (!ctf_str_add_external (fp, arg->str, arg->offset))
     arg->err = ENOMEM;
@@ -766,6 +1373,7 @@ ctf_link_write (ctf_file_t *fp, size_t *size, size_t threshold)
   long fsize;
   const char *errloc;
   unsigned char *buf = NULL;
+  size_t i;
 
   memset (&arg, 0, sizeof (ctf_name_list_accum_cb_arg_t));
   arg.fp = fp;
@@ -820,15 +1428,19 @@ ctf_link_write (ctf_file_t *fp, size_t *size, size_t threshold)
   memmove (&(arg.files[1]), arg.files, sizeof (ctf_file_t *) * (arg.i));
   arg.files[0] = fp;
 
+  /* The per-CU dicts are compressed the same way as their parent.  */
+  for (i = 1; i <= arg.i; i++)
+    arg.files[i]->ctf_compressor = fp->ctf_compressor;
+
   if ((f = tmpfile ()) == NULL)
     {
       errloc = "tempfile creation";
       goto err_no;
     }
 
-  if ((err = ctf_arc_write_fd (fileno (f), arg.files, arg.i + 1,
-			       (const char **) arg.names,
-			       threshold)) < 0)
+  if ((err = ctf_arc_write_fd_internal (fileno (f), arg.files, arg.i + 1,
+					(const char **) arg.names, threshold,
+					fp->ctf_link_threads)) != 0)
     {
       errloc = "archive writing";
       ctf_set_errno (fp, err);
@@ -56,20 +56,23 @@ isqualifier (const char *s, size_t len)
    have arguments that are function pointers, and fun stuff like that.
    Instead, this function implements a very simple conversion algorithm that
    finds the things that we actually care about: structs, unions, enums,
-   integers, floats, typedefs, and pointers to any of these named types.  */
+   integers, floats, typedefs, and pointers to any of these named types.
 
-ctf_id_t
-ctf_lookup_by_name (ctf_file_t *fp, const char *name)
+   This does not look in the parent: on error, it returns CTF_ERR and sets
+   *ERRP, to ECTF_NOTYPE if the name might be found in the parent.  */
+
+static ctf_id_t
+ctf_lookup_by_name_internal (ctf_file_t *fp, const char *name, int *errp)
 {
   static const char delimiters[] = " \t\n\r\v\f*";
 
   const ctf_lookup_t *lp;
   const char *p, *q, *end;
   ctf_id_t type = 0;
-  ctf_id_t ntype, ptype;
-
-  if (name == NULL)
-    return (ctf_set_errno (fp, EINVAL));
+  ctf_id_t ntype;
+  char slicebuf[128];
+  char *slice;
+  size_t slicelen;
 
   for (p = name, end = name + strlen (name); *p != '\0'; p = q)
     {
@@ -101,10 +104,7 @@ ctf_lookup_by_name (ctf_file_t *fp, const char *name)
 	      if (ntype == CTF_ERR
 		  || (ntype =
 		      fp->ctf_ptrtab[LCTF_TYPE_TO_INDEX (fp, ntype)]) == 0)
-		{
-		  (void) ctf_set_errno (fp, ECTF_NOTYPE);
-		  goto err;
-		}
+		goto notype;
 	    }
 
 	  type = LCTF_INDEX_TO_TYPE (fp, ntype, (fp->ctf_flags & LCTF_CHILD));
@@ -118,7 +118,6 @@ ctf_lookup_by_name (ctf_file_t *fp, const char *name)
 
       for (lp = fp->ctf_lookups; lp->ctl_prefix != NULL; lp++)
 	{
-	  /* TODO: This is not MT-safe.  */
 	  if ((lp->ctl_prefix[0] == '\0' ||
 	       strncmp (p, lp->ctl_prefix, (size_t) (q - p)) == 0) &&
 	      (size_t) (q - p) >= lp->ctl_len)
@@ -133,55 +132,225 @@ ctf_lookup_by_name (ctf_file_t *fp, const char *name)
 		q--;		/* Exclude trailing whitespace.  */
 
 	      /* Expand and/or allocate storage for a slice of the name, then
-		 copy it in.  */
+		 copy it in.  Concurrently-readable dicts cannot share the
+		 storage in the dict, so slice into the stack, or into a
+		 temporary allocation if the name is too long.  */
 
-	      if (fp->ctf_tmp_typeslicelen >= (size_t) (q - p) + 1)
+	      slicelen = (size_t) (q - p);
+	      if (fp->ctf_flags & LCTF_CONCURRENT)
+		{
+		  if (slicelen < sizeof (slicebuf))
+		    slice = slicebuf;
+		  else if ((slice = malloc (slicelen + 1)) == NULL)
+		    {
+		      *errp = ENOMEM;
+		      return CTF_ERR;
+		    }
+		  memcpy (slice, p, slicelen);
+		  slice[slicelen] = '\0';
+		}
+	      else if (fp->ctf_tmp_typeslicelen >= slicelen + 1)
 		{
-		  memcpy (fp->ctf_tmp_typeslice, p, (size_t) (q - p));
-		  fp->ctf_tmp_typeslice[(size_t) (q - p)] = '\0';
+		  slice = fp->ctf_tmp_typeslice;
+		  memcpy (slice, p, slicelen);
+		  slice[slicelen] = '\0';
 		}
 	      else
 		{
 		  free (fp->ctf_tmp_typeslice);
-		  fp->ctf_tmp_typeslice = xstrndup (p, (size_t) (q - p));
+		  fp->ctf_tmp_typeslicelen = 0;
+		  fp->ctf_tmp_typeslice = xstrndup (p, slicelen);
 		  if (fp->ctf_tmp_typeslice == NULL)
 		    {
-		      (void) ctf_set_errno (fp, ENOMEM);
+		      *errp = ENOMEM;
 		      return CTF_ERR;
 		    }
+		  fp->ctf_tmp_typeslicelen = slicelen + 1;
+		  slice = fp->ctf_tmp_typeslice;
 		}
 
-	      if ((type = ctf_lookup_by_rawhash (fp, lp->ctl_hash,
-						 fp->ctf_tmp_typeslice)) == 0)
-		{
-		  (void) ctf_set_errno (fp, ECTF_NOTYPE);
-		  goto err;
-		}
+	      type = ctf_lookup_by_rawhash (fp, lp->ctl_hash, slice);
+
+	      if (slice != slicebuf && slice != fp->ctf_tmp_typeslice)
+		free (slice);
+
+	      if (type == 0)
+		goto notype;
 
 	      break;
 	    }
 	}
 
       if (lp->ctl_prefix == NULL)
-	{
-	  (void) ctf_set_errno (fp, ECTF_NOTYPE);
-	  goto err;
-	}
+	goto notype;
     }
 
   if (*p != '\0' || type == 0)
-    return (ctf_set_errno (fp, ECTF_SYNTAX));
+    {
+      *errp = ECTF_SYNTAX;
+      return CTF_ERR;
+    }
 
   return type;
 
-err:
-  if (fp->ctf_parent != NULL
+ notype:
+  *errp = ECTF_NOTYPE;
+  return CTF_ERR;
+}
+
+ctf_id_t
+ctf_lookup_by_name (ctf_file_t *fp, const char *name)
+{
+  ctf_id_t type, ptype;
+  int err;
+
+  if (name == NULL)
+    return (ctf_set_errno (fp, EINVAL));
+
+  if ((type = ctf_lookup_by_name_internal (fp, name, &err)) != CTF_ERR)
+    return type;
+
+  (void) ctf_set_errno (fp, err);
+
+  if (err == ECTF_NOTYPE && fp->ctf_parent != NULL
       && (ptype = ctf_lookup_by_name (fp->ctf_parent, name)) != CTF_ERR)
     return ptype;
 
   return CTF_ERR;
 }
 
+/* Look up the N type NAMES at once, as if by ctf_lookup_by_name(), putting
+   their IDs, or CTF_ERR for those not found, in TYPES.  Names that appear more
+   than once are only looked up once, and all the names not found in FP are
+   then looked up in its parent together.  Return 0 if all the names were found,
+   or -1 with the errno of the last name not found otherwise.  */
+
+int
+ctf_lookup_by_names (ctf_file_t *fp, const char **names, size_t n,
+		     ctf_id_t *types)
+{
+  ctf_dynhash_t *seen;
+  size_t *firsts = NULL;
+  int *errs = NULL;
+  const char **pnames = NULL;
+  ctf_id_t *ptypes = NULL;
+  size_t nparent = 0;
+  size_t i;
+  int err = 0;
+
+  if (n == 0)
+    return 0;
+
+  if (names == NULL || types == NULL)
+    return (ctf_set_errno (fp, EINVAL));
+
+  if ((seen = ctf_dynhash_create (ctf_hash_string, ctf_hash_eq_string,
+				  NULL, NULL)) == NULL)
+    return (ctf_set_errno (fp, ENOMEM));
+
+  /* FIRSTS[i] is one more than the index of the first occurrence of NAMES[i],
+     or 0 if this is its first occurrence; later it is also used to record the
+     names to look up in the parent.  */
+
+  if ((firsts = calloc (n, sizeof (size_t))) == NULL
+      || (errs = calloc (n, sizeof (int))) == NULL)
+    {
+      err = ENOMEM;
+      goto out;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      void *first;
+
+      types[i] = CTF_ERR;
+      if (names[i] == NULL)
+	{
+	  errs[i] = EINVAL;
+	  continue;
+	}
+
+      if ((first = ctf_dynhash_lookup (seen, names[i])) != NULL)
+	{
+	  firsts[i] = (size_t) (uintptr_t) first;
+	  continue;
+	}
+
+      if (ctf_dynhash_insert (seen, (char *) names[i],
+			      (void *) (uintptr_t) (i + 1)) < 0)
+	{
+	  err = ENOMEM;
+	  goto out;
+	}
+
+      types[i] = ctf_lookup_by_name_internal (fp, names[i], &errs[i]);
+      if (types[i] != CTF_ERR)
+	errs[i] = 0;
+      else if (errs[i] == ECTF_NOTYPE && fp->ctf_parent != NULL)
+	nparent++;
+    }
+
+  /* Look up the names not found here in the parent in one go.  */
+
+  if (nparent > 0)
+    {
+      size_t j = 0;
+
+      if ((pnames = malloc (nparent * sizeof (const char *))) == NULL
+	  || (ptypes = malloc (nparent * sizeof (ctf_id_t))) == NULL)
+	{
+	  err = ENOMEM;
+	  goto out;
+	}
+
+      for (i = 0; i < n; i++)
+	if (firsts[i] == 0 && types[i] == CTF_ERR && errs[i] == ECTF_NOTYPE)
+	  pnames[j++] = names[i];
+
+      for (j = 0; j < nparent; j++)
+	ptypes[j] = CTF_ERR;
+
+      /* Failure to find some of the names in the parent is expected: anything
+	 else means the lookup itself failed, and PTYPES is not to be trusted.  */
+
+      if (ctf_lookup_by_names (fp->ctf_parent, pnames, nparent, ptypes) < 0
+	  && ctf_errno (fp->ctf_parent) == ENOMEM)
+	{
+	  err = ENOMEM;
+	  goto out;
+	}
+
+      for (i = 0, j = 0; i < n; i++)
+	if (firsts[i] == 0 && types[i] == CTF_ERR && errs[i] == ECTF_NOTYPE)
+	  {
+	    if ((types[i] = ptypes[j++]) != CTF_ERR)
+	      errs[i] = 0;
+	  }
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (firsts[i] != 0)
+	{
+	  types[i] = types[firsts[i] - 1];
+	  errs[i] = errs[firsts[i] - 1];
+	}
+      if (errs[i] != 0)
+	err = errs[i];
+    }
+
+ out:
+  free (pnames);
+  free (ptypes);
+  free (errs);
+  free (firsts);
+  ctf_dynhash_destroy (seen);
+
+  if (err != 0)
+    return (ctf_set_errno (fp, err));
+  return 0;
+}
+
 typedef struct ctf_lookup_var_key
 {
   ctf_file_t *clvk_fp;
@@ -420,3 +589,144 @@ ctf_func_args (ctf_file_t * fp, unsigned long symidx, uint32_t argc,
 
   return 0;
 }
+
+/* Build the hashes from symbol names to symbol table indexes used by the
+   lookups by symbol name: one for data objects and one for functions, so that
+   a function and a data object with the same name do not hide each other.
+   Only symbols with CTF data are entered: if more than one symbol of the same
+   type has the same name, the first one wins.  */
+
+int
+ctf_init_symhash (ctf_file_t *fp)
+{
+  const ctf_sect_t *sp = &fp->ctf_symtab;
+  const ctf_strs_t *strtab = &fp->ctf_str[CTF_STRTAB_1];
+  ctf_dynhash_t *objthash, *funchash;
+  unsigned long i;
+
+  if ((objthash = ctf_dynhash_create (ctf_hash_string, ctf_hash_eq_string,
+				      NULL, NULL)) == NULL)
+    return (ctf_set_errno (fp, ENOMEM));
+
+  if ((funchash = ctf_dynhash_create (ctf_hash_string, ctf_hash_eq_string,
+				      NULL, NULL)) == NULL)
+    {
+      ctf_dynhash_destroy (objthash);
+      return (ctf_set_errno (fp, ENOMEM));
+    }
+
+  for (i = 0; i < fp->ctf_nsyms; i++)
+    {
+      Elf64_Sym sym, *gsp;
+      ctf_dynhash_t *symhash;
+      const char *name;
+
+      if (fp->ctf_sxlate[i] == -1u)
+	continue;
+
+      if (sp->cts_entsize == sizeof (Elf32_Sym))
+	gsp = ctf_sym_to_elf64 ((Elf32_Sym *) sp->cts_data + i, &sym);
+      else
+	gsp = (Elf64_Sym *) sp->cts_data + i;
+
+      switch (ELF64_ST_TYPE (gsp->st_info))
+	{
+	case STT_OBJECT:
+	  symhash = objthash;
+	  break;
+	case STT_FUNC:
+	  symhash = funchash;
+	  break;
+	default:
+	  continue;
+	}
+
+      if (gsp->st_name >= strtab->cts_len)
+	continue;
+      name = strtab->cts_strs + gsp->st_name;
+
+      if (ctf_dynhash_lookup (symhash, name) != NULL)
+	continue;
+
+      if (ctf_dynhash_insert (symhash, (char *) name,
+			      (void *) (uintptr_t) (i + 1)) < 0)
+	{
+	  ctf_dynhash_destroy (objthash);
+	  ctf_dynhash_destroy (funchash);
+	  return (ctf_set_errno (fp, ENOMEM));
+	}
+    }
+
+  fp->ctf_objthash = objthash;
+  fp->ctf_funchash = funchash;
+  return 0;
+}
+
+/* Return the symbol table index of the function (if FUNC) or data object with
+   CTF data with the given NAME, or -1 with errno set to NOTFOUND if there is
+   none.  */
+
+static long
+ctf_lookup_symbol_idx (ctf_file_t *fp, const char *name, int func,
+		       int notfound)
+{
+  void *idx;
+
+  if (fp->ctf_symtab.cts_data == NULL)
+    return (ctf_set_errno (fp, ECTF_NOSYMTAB));
+
+  if (name == NULL)
+    return (ctf_set_errno (fp, EINVAL));
+
+  if (fp->ctf_objthash == NULL && ctf_init_symhash (fp) < 0)
+    return -1;				/* errno is set for us.  */
+
+  if ((idx = ctf_dynhash_lookup (func ? fp->ctf_funchash : fp->ctf_objthash,
+				 name)) == NULL)
+    return (ctf_set_errno (fp, notfound));
+
+  return (long) (uintptr_t) idx - 1;
+}
+
+/* Given a symbol name, return the type of the data object with that name in
+   the symbol table.  */
+
+ctf_id_t
+ctf_lookup_by_symbol_name (ctf_file_t *fp, const char *name)
+{
+  long symidx;
+
+  if ((symidx = ctf_lookup_symbol_idx (fp, name, 0, ECTF_NOTYPEDAT)) < 0)
+    return CTF_ERR;			/* errno is set for us.  */
+
+  return ctf_lookup_by_symbol (fp, symidx);
+}
+
+/* Given a symbol name, return the info for the function with that name in the
+   symbol table.  */
+
+int
+ctf_func_info_by_name (ctf_file_t *fp, const char *name, ctf_funcinfo_t *fip)
+{
+  long symidx;
+
+  if ((symidx = ctf_lookup_symbol_idx (fp, name, 1, ECTF_NOFUNCDAT)) < 0)
+    return -1;				/* errno is set for us.  */
+
+  return ctf_func_info (fp, symidx, fip);
+}
+
+/* Given a symbol name, return the arguments for the function with that name in
+   the symbol table.  */
+
+int
+ctf_func_args_by_name (ctf_file_t *fp, const char *name, uint32_t argc,
+		       ctf_id_t *argv)
+{
+  long symidx;
+
+  if ((symidx = ctf_lookup_symbol_idx (fp, name, 1, ECTF_NOFUNCDAT)) < 0)
+    return -1;				/* errno is set for us.  */
+
+  return ctf_func_args (fp, symidx, argc, argv);
+}
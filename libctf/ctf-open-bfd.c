@@ -224,20 +224,24 @@ ctf_fdopen (int fd, const char *filename, const char *target, int *errp)
       fp->ctf_data_mmapped = data;
       fp->ctf_data_mmapped_len = (size_t) st.st_size;
 
-      return ctf_new_archive_internal (0, NULL, fp, NULL, NULL, errp);
+      return ctf_new_archive_internal (0, NULL, 0, fp, NULL, NULL, errp);
     }
 
   if ((nbytes = ctf_pread (fd, &arc_magic, sizeof (arc_magic), 0)) <= 0)
     return (ctf_set_open_errno (errp, nbytes < 0 ? errno : ECTF_FMT));
 
-  if ((size_t) nbytes >= sizeof (uint64_t) && le64toh (arc_magic) == CTFA_MAGIC)
+  if ((size_t) nbytes >= sizeof (uint64_t)
+      && CTF_ARC_MAGIC_P (le64toh (arc_magic)))
     {
       struct ctf_archive *arc;
+      size_t arc_size;
 
-      if ((arc = ctf_arc_open_internal (filename, errp)) == NULL)
+      if ((arc = ctf_arc_open_internal (fd, filename, &arc_size,
+					errp)) == NULL)
 	return NULL;			/* errno is set for us.  */
 
-      return ctf_new_archive_internal (1, arc, NULL, NULL, NULL, errp);
+      return ctf_new_archive_internal (1, arc, arc_size, NULL, NULL, NULL,
+				       errp);
     }
 
   /* Attempt to open the file with BFD.  We must dup the fd first, since bfd
@@ -13,9 +13,14 @@
 #include <sys/types.h>
 #include <elf.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "swap.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <bfd.h>
-#include <zlib.h>
 
 #ifdef BFD_ONLY
 #include "elf-bfd.h"
@@ -226,6 +231,8 @@ static const ctf_fileops_t ctf_fileops[] = {
 #endif /* !NO_COMPAT */
   /* CTF_VERSION_3, identical to 2: only new type kinds */
   {get_kind_v2, get_root_v2, get_vlen_v2, get_ctt_size_v2, get_vbytes_v2},
+  /* CTF_VERSION_4, identical to 3: only a new section */
+  {get_kind_v2, get_root_v2, get_vlen_v2, get_ctt_size_v2, get_vbytes_v2},
 };
 
 /* Initialize the symtab translation table by filling each entry with the
@@ -474,6 +481,7 @@ upgrade_types_v1 (ctf_file_t *fp, ctf_header_t *cth)
 	  + increase);
 
   cth->cth_stroff += increase;
+  cth->cth_nameidxoff = cth->cth_stroff;	/* No name index in v1.  */
   fp->ctf_size += increase;
   assert (cth->cth_stroff >= cth->cth_typeoff);
   fp->ctf_base = ctf_base;
@@ -657,6 +665,278 @@ upgrade_types (ctf_file_t *fp, ctf_header_t *cth)
 }
 #endif /* !NO_COMPAT */
 
+/* Add the names of all the types in FP to those of its name hashes that are in
+   TABLES, a mask of (1 << CTF_NAMEIDX_*) bits.  The order in which types are
+   added to each hash matters, but the hashes are independent of each other,
+   so they can be filled in concurrently by calls with disjoint TABLES.  The
+   type translation table must be filled in already.  */
+
+static int
+init_types_names (ctf_file_t *fp, int child, uint32_t tables)
+{
+  uint32_t id;
+  int err;
+
+  for (id = 1; id <= fp->ctf_typemax; id++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, id);
+      unsigned short kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      unsigned short isroot = LCTF_INFO_ISROOT (fp, tp->ctt_info);
+      uint32_t table;
+      const char *name;
+
+      switch (kind)
+	{
+	case CTF_K_STRUCT:
+	  table = CTF_NAMEIDX_STRUCT;
+	  break;
+	case CTF_K_UNION:
+	  table = CTF_NAMEIDX_UNION;
+	  break;
+	case CTF_K_ENUM:
+	  table = CTF_NAMEIDX_ENUM;
+	  break;
+	case CTF_K_FORWARD:
+	  if (tp->ctt_type == CTF_K_UNION)
+	    table = CTF_NAMEIDX_UNION;
+	  else if (tp->ctt_type == CTF_K_ENUM)
+	    table = CTF_NAMEIDX_ENUM;
+	  else if (tp->ctt_type == CTF_K_STRUCT)
+	    table = CTF_NAMEIDX_STRUCT;
+	  else
+	    table = CTF_NAMEIDX_NAMES;
+	  break;
+	default:
+	  table = CTF_NAMEIDX_NAMES;
+	}
+
+      if (!(tables & (1 << table)))
+	continue;
+
+      name = ctf_strptr (fp, tp->ctt_name);
+
+      switch (kind)
+	{
+	case CTF_K_INTEGER:
+	case CTF_K_FLOAT:
+	  /* Names are reused by bit-fields, which are differentiated by their
+	     encodings, and so typically we'd record only the first instance of
+	     a given intrinsic.  However, we replace an existing type with a
+	     root-visible version so that we can be sure to find it when
+	     checking for conflicting definitions in ctf_add_type().  */
+
+	  if (((ctf_hash_lookup_type (fp->ctf_names.ctn_readonly,
+				      fp, name)) == 0)
+	      || isroot)
+	    {
+	      err = ctf_hash_define_type (fp->ctf_names.ctn_readonly, fp,
+					  LCTF_INDEX_TO_TYPE (fp, id, child),
+					  tp->ctt_name);
+	      if (err != 0)
+		return err;
+	    }
+	  break;
+
+	  /* These kinds have no name, so do not need interning into any
+	     hashtables.  */
+	case CTF_K_ARRAY:
+	case CTF_K_SLICE:
+	  break;
+
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
+	case CTF_K_ENUM:
+	  if (!isroot)
+	    break;
+
+	  err = ctf_hash_define_type (ctf_name_table (fp, kind)->ctn_readonly,
+				      fp, LCTF_INDEX_TO_TYPE (fp, id, child),
+				      tp->ctt_name);
+
+	  if (err != 0)
+	    return err;
+	  break;
+
+	case CTF_K_FORWARD:
+	  {
+	    ctf_names_t *np = ctf_name_table (fp, tp->ctt_type);
+
+	    if (!isroot)
+	      break;
+
+	    /* Only insert forward tags into the given hash if the type or tag
+	       name is not already present.  */
+	    if (ctf_hash_lookup_type (np->ctn_readonly, fp, name) == 0)
+	      {
+		err = ctf_hash_insert_type (np->ctn_readonly, fp,
+					    LCTF_INDEX_TO_TYPE (fp, id, child),
+					    tp->ctt_name);
+		if (err != 0)
+		  return err;
+	      }
+	    break;
+	  }
+
+	default:
+	  if (!isroot)
+	    break;
+
+	  err = ctf_hash_insert_type (fp->ctf_names.ctn_readonly, fp,
+				      LCTF_INDEX_TO_TYPE (fp, id, child),
+				      tp->ctt_name);
+	  if (err != 0)
+	    return err;
+	  break;
+	}
+    }
+
+  return 0;
+}
+
+#ifdef HAVE_PTHREAD_H
+/* Dicts with fewer types than this are not worth starting threads for.  */
+#define CTF_OPEN_PARALLEL_MIN 4096
+
+typedef struct init_types_job
+{
+  ctf_file_t *itj_fp;
+  int itj_child;
+  uint32_t itj_tables;		/* Name hashes to fill in.  */
+  int itj_err;			/* Result.  */
+} init_types_job_t;
+
+static void *
+init_types_names_worker (void *arg)
+{
+  init_types_job_t *job = (init_types_job_t *) arg;
+
+  job->itj_err = init_types_names (job->itj_fp, job->itj_child,
+				   job->itj_tables);
+  return NULL;
+}
+#endif
+
+/* Add the names of all the types in FP to its name hashes, filling in the
+   hashes in parallel if this is a large dict and we may use threads (see
+   ctf_set_open_threads).  The hashes are the same whatever the number of
+   threads.  */
+
+static int
+init_types_names_all (ctf_file_t *fp, int child)
+{
+#ifdef HAVE_PTHREAD_H
+  unsigned int nthreads = ctf_get_open_threads ();
+
+  if (nthreads > CTF_NAMEIDX_MAX)
+    nthreads = CTF_NAMEIDX_MAX;
+
+  if (nthreads > 1 && fp->ctf_typemax >= CTF_OPEN_PARALLEL_MIN)
+    {
+      /* The names hash is usually the biggest, so give it a job of its
+	 own.  */
+      static const uint32_t order[CTF_NAMEIDX_MAX]
+	= { CTF_NAMEIDX_NAMES, CTF_NAMEIDX_STRUCT, CTF_NAMEIDX_UNION,
+	    CTF_NAMEIDX_ENUM };
+      init_types_job_t jobs[CTF_NAMEIDX_MAX];
+      pthread_t threads[CTF_NAMEIDX_MAX];
+      unsigned int i, nstarted;
+      int err = 0;
+
+      for (i = 0; i < nthreads; i++)
+	{
+	  jobs[i].itj_fp = fp;
+	  jobs[i].itj_child = child;
+	  jobs[i].itj_tables = 0;
+	  jobs[i].itj_err = 0;
+	}
+      for (i = 0; i < CTF_NAMEIDX_MAX; i++)
+	jobs[i % nthreads].itj_tables |= 1 << order[i];
+
+      /* This thread does the first job.  Jobs for threads that cannot be
+	 started are done here too.  */
+
+      for (nstarted = 1; nstarted < nthreads; nstarted++)
+	if (pthread_create (&threads[nstarted], NULL, init_types_names_worker,
+			    &jobs[nstarted]) != 0)
+	  break;
+
+      for (i = nstarted; i < nthreads; i++)
+	jobs[0].itj_tables |= jobs[i].itj_tables;
+      init_types_names_worker (&jobs[0]);
+
+      for (i = 1; i < nstarted; i++)
+	pthread_join (threads[i], NULL);
+
+      for (i = 0; i < nstarted && err == 0; i++)
+	err = jobs[i].itj_err;
+
+      return err;
+    }
+#endif
+
+  return init_types_names (fp, child, (1 << CTF_NAMEIDX_MAX) - 1);
+}
+
+/* Point the name hashes at the name index section, if there is one and it is
+   consistent with the type section, which must have been counted already.
+   Returns nonzero if it was used: otherwise, the caller must build the hashes
+   by hand.  */
+
+static int
+init_nameidx (ctf_file_t *fp, ctf_header_t *cth)
+{
+  ctf_names_t *tables[CTF_NAMEIDX_MAX] = { &fp->ctf_structs, &fp->ctf_unions,
+					   &fp->ctf_enums, &fp->ctf_names };
+  const unsigned char *buf = fp->ctf_buf + cth->cth_nameidxoff;
+  size_t len = cth->cth_stroff - cth->cth_nameidxoff;
+  size_t used;
+  int i;
+
+  if (len == 0)
+    return 0;
+
+  for (i = 0; i < CTF_NAMEIDX_MAX; i++)
+    {
+      if ((tables[i]->ctn_readonly = ctf_hash_import (fp, buf, len,
+						      &used)) == NULL)
+	{
+	  ctf_dprintf ("Name index table %i unusable (%s): rebuilding\n", i,
+		       ctf_errmsg (errno));
+	  goto fail;
+	}
+      buf += used;
+      len -= used;
+    }
+
+  return 1;
+
+ fail:
+  for (i = 0; i < CTF_NAMEIDX_MAX; i++)
+    {
+      ctf_hash_destroy (tables[i]->ctn_readonly);
+      tables[i]->ctn_readonly = NULL;
+    }
+  return 0;
+}
+
+/* Allocate the decoded type index of FP, zeroed: see ctf_type_index_t.  */
+
+static void
+init_tindex (ctf_file_t *fp)
+{
+  ctf_type_index_t *ti = &fp->ctf_tindex;
+  size_t n = fp->ctf_typemax + 1;
+
+  if ((ti->cti_size = calloc (n, sizeof (ssize_t) + 3 * sizeof (uint32_t)
+			      + 1)) == NULL)
+    return;
+
+  ti->cti_ref = (uint32_t *) (ti->cti_size + n);
+  ti->cti_name = ti->cti_ref + n;
+  ti->cti_vlen = ti->cti_name + n;
+  ti->cti_kind = (unsigned char *) (ti->cti_vlen + n);
+}
+
 /* Initialize the type ID translation table with the byte offset of each type,
    and initialize the hash tables of each named type.  Upgrade the type table to
    the latest supported representation in the process, if needed, and if this
@@ -678,6 +958,7 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
 
   int child = cth->cth_parname != 0;
   int nlstructs = 0, nlunions = 0;
+  int nameidx;
   int err;
 
   assert (!(fp->ctf_flags & LCTF_RDWR));
@@ -692,7 +973,7 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
 #endif /* !NO_COMPAT */
 
   tbuf = (ctf_type_t *) (fp->ctf_buf + cth->cth_typeoff);
-  tend = (ctf_type_t *) (fp->ctf_buf + cth->cth_stroff);
+  tend = (ctf_type_t *) (fp->ctf_buf + cth->cth_nameidxoff);
 
   /* We make two passes through the entire type section.  In this first
      pass, we count the number of each type and the total number of types.  */
@@ -733,35 +1014,44 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
     ctf_dprintf ("CTF container %p is a parent\n", (void *) fp);
 
   /* Now that we've counted up the number of each type, we can allocate
-     the hash tables, type translation table, and pointer table.  */
-
-  if ((fp->ctf_structs.ctn_readonly
-       = ctf_hash_create (pop[CTF_K_STRUCT], ctf_hash_string,
-			  ctf_hash_eq_string)) == NULL)
-    return ENOMEM;
-
-  if ((fp->ctf_unions.ctn_readonly
-       = ctf_hash_create (pop[CTF_K_UNION], ctf_hash_string,
-			  ctf_hash_eq_string)) == NULL)
-    return ENOMEM;
-
-  if ((fp->ctf_enums.ctn_readonly
-       = ctf_hash_create (pop[CTF_K_ENUM], ctf_hash_string,
-			  ctf_hash_eq_string)) == NULL)
-    return ENOMEM;
-
-  if ((fp->ctf_names.ctn_readonly
-       = ctf_hash_create (pop[CTF_K_INTEGER] +
-			  pop[CTF_K_FLOAT] +
-			  pop[CTF_K_FUNCTION] +
-			  pop[CTF_K_TYPEDEF] +
-			  pop[CTF_K_POINTER] +
-			  pop[CTF_K_VOLATILE] +
-			  pop[CTF_K_CONST] +
-			  pop[CTF_K_RESTRICT],
-			  ctf_hash_string,
-			  ctf_hash_eq_string)) == NULL)
-    return ENOMEM;
+     the hash tables, type translation table, and pointer table.  If the
+     writer left us a name index, we can use it as the hash tables, and
+     do not need to touch the names at all.  */
+
+  nameidx = init_nameidx (fp, cth);
+
+  if (nameidx)
+    ctf_dprintf ("Using name index\n");
+  else
+    {
+      if ((fp->ctf_structs.ctn_readonly
+	   = ctf_hash_create (pop[CTF_K_STRUCT], ctf_hash_string,
+			      ctf_hash_eq_string)) == NULL)
+	return ENOMEM;
+
+      if ((fp->ctf_unions.ctn_readonly
+	   = ctf_hash_create (pop[CTF_K_UNION], ctf_hash_string,
+			      ctf_hash_eq_string)) == NULL)
+	return ENOMEM;
+
+      if ((fp->ctf_enums.ctn_readonly
+	   = ctf_hash_create (pop[CTF_K_ENUM], ctf_hash_string,
+			      ctf_hash_eq_string)) == NULL)
+	return ENOMEM;
+
+      if ((fp->ctf_names.ctn_readonly
+	   = ctf_hash_create (pop[CTF_K_INTEGER] +
+			      pop[CTF_K_FLOAT] +
+			      pop[CTF_K_FUNCTION] +
+			      pop[CTF_K_TYPEDEF] +
+			      pop[CTF_K_POINTER] +
+			      pop[CTF_K_VOLATILE] +
+			      pop[CTF_K_CONST] +
+			      pop[CTF_K_RESTRICT],
+			      ctf_hash_string,
+			      ctf_hash_eq_string)) == NULL)
+	return ENOMEM;
+    }
 
   fp->ctf_txlate = malloc (sizeof (uint32_t) * (fp->ctf_typemax + 1));
   fp->ctf_ptrtab_len = fp->ctf_typemax + 1;
@@ -776,135 +1066,47 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
   memset (fp->ctf_txlate, 0, sizeof (uint32_t) * (fp->ctf_typemax + 1));
   memset (fp->ctf_ptrtab, 0, sizeof (uint32_t) * (fp->ctf_typemax + 1));
 
+  /* The decoded type index is only an accelerator: if there is no room for
+     it, do without.  */
+  init_tindex (fp);
+
   /* In the second pass through the types, we fill in each entry of the
-     type and pointer tables and add names to the appropriate hashes.  */
+     type and pointer tables.  */
 
   for (id = 1, tp = tbuf; tp < tend; xp++, id++)
     {
       unsigned short kind = LCTF_INFO_KIND (fp, tp->ctt_info);
-      unsigned short isroot = LCTF_INFO_ISROOT (fp, tp->ctt_info);
       unsigned long vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
       ssize_t size, increment, vbytes;
 
-      const char *name;
-
       (void) ctf_get_ctt_size (fp, tp, &size, &increment);
-      name = ctf_strptr (fp, tp->ctt_name);
       vbytes = LCTF_VBYTES (fp, kind, size, vlen);
 
       switch (kind)
 	{
 	case CTF_K_INTEGER:
 	case CTF_K_FLOAT:
-	  /* Names are reused by bit-fields, which are differentiated by their
-	     encodings, and so typically we'd record only the first instance of
-	     a given intrinsic.  However, we replace an existing type with a
-	     root-visible version so that we can be sure to find it when
-	     checking for conflicting definitions in ctf_add_type().  */
-
-	  if (((ctf_hash_lookup_type (fp->ctf_names.ctn_readonly,
-				      fp, name)) == 0)
-	      || isroot)
-	    {
-	      err = ctf_hash_define_type (fp->ctf_names.ctn_readonly, fp,
-					  LCTF_INDEX_TO_TYPE (fp, id, child),
-					  tp->ctt_name);
-	      if (err != 0)
-		return err;
-	    }
-	  break;
-
-	  /* These kinds have no name, so do not need interning into any
-	     hashtables.  */
 	case CTF_K_ARRAY:
 	case CTF_K_SLICE:
-	  break;
-
 	case CTF_K_FUNCTION:
-	  if (!isroot)
-	    break;
-
-	  err = ctf_hash_insert_type (fp->ctf_names.ctn_readonly, fp,
-				      LCTF_INDEX_TO_TYPE (fp, id, child),
-				      tp->ctt_name);
-	  if (err != 0)
-	    return err;
+	case CTF_K_ENUM:
+	case CTF_K_TYPEDEF:
+	case CTF_K_FORWARD:
+	case CTF_K_VOLATILE:
+	case CTF_K_CONST:
+	case CTF_K_RESTRICT:
 	  break;
 
 	case CTF_K_STRUCT:
 	  if (size >= CTF_LSTRUCT_THRESH)
 	    nlstructs++;
-
-	  if (!isroot)
-	    break;
-
-	  err = ctf_hash_define_type (fp->ctf_structs.ctn_readonly, fp,
-				      LCTF_INDEX_TO_TYPE (fp, id, child),
-				      tp->ctt_name);
-
-	  if (err != 0)
-	    return err;
-
 	  break;
 
 	case CTF_K_UNION:
 	  if (size >= CTF_LSTRUCT_THRESH)
 	    nlunions++;
-
-	  if (!isroot)
-	    break;
-
-	  err = ctf_hash_define_type (fp->ctf_unions.ctn_readonly, fp,
-				      LCTF_INDEX_TO_TYPE (fp, id, child),
-				      tp->ctt_name);
-
-	  if (err != 0)
-	    return err;
-	  break;
-
-	case CTF_K_ENUM:
-	  if (!isroot)
-	    break;
-
-	  err = ctf_hash_define_type (fp->ctf_enums.ctn_readonly, fp,
-				      LCTF_INDEX_TO_TYPE (fp, id, child),
-				      tp->ctt_name);
-
-	  if (err != 0)
-	    return err;
-	  break;
-
-	case CTF_K_TYPEDEF:
-	  if (!isroot)
-	    break;
-
-	  err = ctf_hash_insert_type (fp->ctf_names.ctn_readonly, fp,
-				      LCTF_INDEX_TO_TYPE (fp, id, child),
-				      tp->ctt_name);
-	  if (err != 0)
-	    return err;
 	  break;
 
-	case CTF_K_FORWARD:
-	  {
-	    ctf_names_t *np = ctf_name_table (fp, tp->ctt_type);
-
-	    if (!isroot)
-	      break;
-
-	    /* Only insert forward tags into the given hash if the type or tag
-	       name is not already present.  */
-	    if (ctf_hash_lookup_type (np->ctn_readonly, fp, name) == 0)
-	      {
-		err = ctf_hash_insert_type (np->ctn_readonly, fp,
-					    LCTF_INDEX_TO_TYPE (fp, id, child),
-					    tp->ctt_name);
-		if (err != 0)
-		  return err;
-	      }
-	    break;
-	  }
-
 	case CTF_K_POINTER:
 	  /* If the type referenced by the pointer is in this CTF container,
 	     then store the index of the pointer type in
@@ -913,20 +1115,8 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
 	  if (LCTF_TYPE_ISCHILD (fp, tp->ctt_type) == child
 	      && LCTF_TYPE_TO_INDEX (fp, tp->ctt_type) <= fp->ctf_typemax)
 	    fp->ctf_ptrtab[LCTF_TYPE_TO_INDEX (fp, tp->ctt_type)] = id;
-	 /*FALLTHRU*/
-
-	case CTF_K_VOLATILE:
-	case CTF_K_CONST:
-	case CTF_K_RESTRICT:
-	  if (!isroot)
-	    break;
-
-	  err = ctf_hash_insert_type (fp->ctf_names.ctn_readonly, fp,
-				      LCTF_INDEX_TO_TYPE (fp, id, child),
-				      tp->ctt_name);
-	  if (err != 0)
-	    return err;
 	  break;
+
 	default:
 	  ctf_dprintf ("unhandled CTF kind in endianness conversion -- %x\n",
 		       kind);
@@ -934,9 +1124,31 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
 	}
 
       *xp = (uint32_t) ((uintptr_t) tp - (uintptr_t) fp->ctf_buf);
+
+      if (fp->ctf_tindex.cti_size != NULL)
+	{
+	  ctf_type_index_t *ti = &fp->ctf_tindex;
+
+	  ti->cti_size[id] = size;
+	  ti->cti_name[id] = tp->ctt_name;
+	  ti->cti_vlen[id] = vlen;
+	  ti->cti_kind[id] = kind;
+	  if (kind == CTF_K_SLICE)
+	    ti->cti_ref[id] = ((const ctf_slice_t *)
+			       ((uintptr_t) tp + increment))->cts_type;
+	  else
+	    ti->cti_ref[id] = tp->ctt_type;
+	}
+
       tp = (ctf_type_t *) ((uintptr_t) tp + increment + vbytes);
     }
 
+  /* Finally, add names to the appropriate hashes, if the name index did not
+     save us the trouble.  */
+
+  if (!nameidx && (err = init_types_names_all (fp, child)) != 0)
+    return err;
+
   ctf_dprintf ("%lu total types processed\n", fp->ctf_typemax);
   ctf_dprintf ("%u enum names hashed\n",
 	       ctf_hash_size (fp->ctf_enums.ctn_readonly));
@@ -996,6 +1208,45 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
     }									\
   } while (0);
 
+/* Swap the endianness of an array of N uint32_t's, four at a time where we
+   can.  Almost everything in a CTF dict is made of uint32_t's, so this does
+   most of the work.  */
+
+static void
+flip_words (uint32_t *w, size_t n)
+{
+  size_t i = 0;
+
+#ifdef __SSE2__
+  /* Swap the halves of each word, then the bytes of each half.  */
+  for (; i + 4 <= n; i += 4)
+    {
+      __m128i x = _mm_loadu_si128 ((__m128i *) (w + i));
+
+      x = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (x, 0xb1), 0xb1);
+      x = _mm_or_si128 (_mm_slli_epi16 (x, 8), _mm_srli_epi16 (x, 8));
+      _mm_storeu_si128 ((__m128i *) (w + i), x);
+    }
+#endif
+
+  for (; i < n; i++)
+    w[i] = bswap_32 (w[i]);
+}
+
+/* All these structures consist of nothing but uint32_t's, so arrays of them
+   can be flipped with flip_words().  */
+
+#define assert_words(type, n)						\
+  _Static_assert (sizeof (type) == (n) * sizeof (uint32_t),		\
+		  "Not a uint32_t array, update endianness code")
+
+assert_words (ctf_lblent_t, 2);
+assert_words (ctf_varent_t, 2);
+assert_words (ctf_array_t, 3);
+assert_words (ctf_member_t, 3);
+assert_words (ctf_lmember_t, 4);
+assert_words (ctf_enum_t, 2);
+
 /* Flip the endianness of the CTF header.  */
 
 static void
@@ -1007,6 +1258,7 @@ flip_header (ctf_header_t *cth)
   swap_thing (cth->cth_parlabel);
   swap_thing (cth->cth_parname);
   swap_thing (cth->cth_cuname);
+  swap_thing (cth->cth_lbloff);
   swap_thing (cth->cth_objtoff);
   swap_thing (cth->cth_funcoff);
   swap_thing (cth->cth_objtidxoff);
@@ -1015,6 +1267,7 @@ flip_header (ctf_header_t *cth)
   swap_thing (cth->cth_typeoff);
   swap_thing (cth->cth_stroff);
   swap_thing (cth->cth_strlen);
+  swap_thing (cth->cth_nameidxoff);
 }
 
 /* Flip the endianness of the label section, an array of ctf_lblent_t.  */
@@ -1022,14 +1275,7 @@ flip_header (ctf_header_t *cth)
 static void
 flip_lbls (void *start, size_t len)
 {
-  ctf_lblent_t *lbl = start;
-  ssize_t i;
-
-  for (i = len / sizeof (struct ctf_lblent); i > 0; lbl++, i--)
-    {
-      swap_thing (lbl->ctl_label);
-      swap_thing (lbl->ctl_type);
-    }
+  flip_words (start, (len / sizeof (ctf_lblent_t)) * 2);
 }
 
 /* Flip the endianness of the data-object or function sections or their indexes,
@@ -1040,11 +1286,7 @@ flip_lbls (void *start, size_t len)
 static void
 flip_objts (void *start, size_t len)
 {
-  uint32_t *obj = start;
-  ssize_t i;
-
-  for (i = len / sizeof (uint32_t); i > 0; obj++, i--)
-      swap_thing (*obj);
+  flip_words (start, len / sizeof (uint32_t));
 }
 
 /* Flip the endianness of the variable section, an array of ctf_varent_t.  */
@@ -1052,14 +1294,16 @@ flip_objts (void *start, size_t len)
 static void
 flip_vars (void *start, size_t len)
 {
-  ctf_varent_t *var = start;
-  ssize_t i;
+  flip_words (start, (len / sizeof (ctf_varent_t)) * 2);
+}
 
-  for (i = len / sizeof (struct ctf_varent); i > 0; var++, i--)
-    {
-      swap_thing (var->ctv_name);
-      swap_thing (var->ctv_type);
-    }
+/* Flip the endianness of the name index section, which consists entirely of
+   uint32_t's.  */
+
+static void
+flip_nameidx (void *start, size_t len)
+{
+  flip_words (start, len / sizeof (uint32_t));
 }
 
 /* Flip the endianness of the type section, a tagged array of ctf_type or
@@ -1116,30 +1360,17 @@ flip_types (void *start, size_t len)
 	  }
 
 	case CTF_K_FUNCTION:
-	  {
-	    /* This type has a bunch of uint32_ts.  */
-
-	    uint32_t *item = (uint32_t *) t;
-	    ssize_t i;
+	  /* This type has a bunch of uint32_ts.  */
 
-	    for (i = vlen; i > 0; item++, i--)
-	      swap_thing (*item);
-	    break;
-	  }
+	  flip_words ((uint32_t *) t, vlen);
+	  break;
 
 	case CTF_K_ARRAY:
-	  {
-	    /* This has a single ctf_array_t.  */
-
-	    ctf_array_t *a = (ctf_array_t *) t;
-
-	    assert (vbytes == sizeof (ctf_array_t));
-	    swap_thing (a->cta_contents);
-	    swap_thing (a->cta_index);
-	    swap_thing (a->cta_nelems);
+	  /* This has a single ctf_array_t.  */
 
-	    break;
-	  }
+	  assert (vbytes == sizeof (ctf_array_t));
+	  flip_words ((uint32_t *) t, 3);
+	  break;
 
 	case CTF_K_SLICE:
 	  {
@@ -1157,52 +1388,21 @@ flip_types (void *start, size_t len)
 
 	case CTF_K_STRUCT:
 	case CTF_K_UNION:
-	  {
-	    /* This has an array of ctf_member or ctf_lmember, depending on
-	       size.  We could consider it to be a simple array of uint32_t,
-	       but for safety's sake in case these structures ever acquire
-	       non-uint32_t members, do it member by member.  */
+	  /* This has an array of ctf_member or ctf_lmember, depending on
+	     size: both are simple arrays of uint32_t, so the whole run of
+	     members can be flipped at once.  */
 
-	    if (_libctf_unlikely_ (size >= CTF_LSTRUCT_THRESH))
-	      {
-		ctf_lmember_t *lm = (ctf_lmember_t *) t;
-		ssize_t i;
-		for (i = vlen; i > 0; i--, lm++)
-		  {
-		    swap_thing (lm->ctlm_name);
-		    swap_thing (lm->ctlm_offsethi);
-		    swap_thing (lm->ctlm_type);
-		    swap_thing (lm->ctlm_offsetlo);
-		  }
-	      }
-	    else
-	      {
-		ctf_member_t *m = (ctf_member_t *) t;
-		ssize_t i;
-		for (i = vlen; i > 0; i--, m++)
-		  {
-		    swap_thing (m->ctm_name);
-		    swap_thing (m->ctm_offset);
-		    swap_thing (m->ctm_type);
-		  }
-	      }
-	    break;
-	  }
+	  if (_libctf_unlikely_ (size >= CTF_LSTRUCT_THRESH))
+	    flip_words ((uint32_t *) t, vlen * 4);
+	  else
+	    flip_words ((uint32_t *) t, vlen * 3);
+	  break;
 
 	case CTF_K_ENUM:
-	  {
-	    /* This has an array of ctf_enum_t.  */
-
-	    ctf_enum_t *item = (ctf_enum_t *) t;
-	    ssize_t i;
+	  /* This has an array of ctf_enum_t.  */
 
-	    for (i = vlen; i > 0; item++, i--)
-	      {
-		swap_thing (item->cte_name);
-		swap_thing (item->cte_value);
-	      }
-	    break;
-	  }
+	  flip_words ((uint32_t *) t, vlen * 2);
+	  break;
 	default:
 	  ctf_dprintf ("unhandled CTF kind in endianness conversion -- %x\n",
 		       kind);
@@ -1231,7 +1431,10 @@ flip_ctf (ctf_header_t *cth, unsigned char *buf)
   flip_objts (buf + cth->cth_objtidxoff, cth->cth_funcidxoff - cth->cth_objtidxoff);
   flip_objts (buf + cth->cth_funcidxoff, cth->cth_varoff - cth->cth_funcidxoff);
   flip_vars (buf + cth->cth_varoff, cth->cth_typeoff - cth->cth_varoff);
-  return flip_types (buf + cth->cth_typeoff, cth->cth_stroff - cth->cth_typeoff);
+  flip_nameidx (buf + cth->cth_nameidxoff,
+		cth->cth_stroff - cth->cth_nameidxoff);
+  return flip_types (buf + cth->cth_typeoff,
+		     cth->cth_nameidxoff - cth->cth_typeoff);
 }
 
 /* Set up the ctl hashes in a ctf_file_t.  Called by both writable and
@@ -1381,7 +1584,8 @@ ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
     {
       if (pp->ctp_magic == bswap_16 (CTF_MAGIC))
 	{
-	  if (pp->ctp_version != CTF_VERSION_3)
+	  if (pp->ctp_version != CTF_VERSION_3
+	      && pp->ctp_version != CTF_VERSION_4)
 	    return (ctf_set_open_errno (errp, ECTF_CTFVERS));
 	  foreign_endian = 1;
 	}
@@ -1390,11 +1594,12 @@ ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
     }
 
 #ifdef NO_COMPAT
-  if (_libctf_unlikely_ (pp->ctp_version != CTF_VERSION_3))
+  if (_libctf_unlikely_ (pp->ctp_version != CTF_VERSION_3
+			 && pp->ctp_version != CTF_VERSION_4))
     return (ctf_set_open_errno (errp, ECTF_CTFVERS));
 #else
   if (_libctf_unlikely_ ((pp->ctp_version < CTF_VERSION_1)
-			 || (pp->ctp_version > CTF_VERSION_3)))
+			 || (pp->ctp_version > CTF_VERSION_4)))
     return (ctf_set_open_errno (errp, ECTF_CTFVERS));
 
   if ((symsect != NULL) && (pp->ctp_version < CTF_VERSION_2))
@@ -1411,6 +1616,8 @@ ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
 
   if (pp->ctp_version < CTF_VERSION_3)
     hdrsz = sizeof (ctf_header_v2_t);
+  else if (pp->ctp_version == CTF_VERSION_3)
+    hdrsz = CTF_HEADER_NONAMEIDX_SIZE;
 
   if (ctfsect->cts_size < hdrsz)
     return (ctf_set_open_errno (errp, ECTF_NOCTFBUF));
@@ -1440,13 +1647,17 @@ ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
   fp->ctf_openflags = hp->cth_flags;
   fp->ctf_size = hp->cth_stroff + hp->cth_strlen;
 
+  /* The in-memory header always has a (possibly empty) name index.  */
+  if (hdrsz < sizeof (ctf_header_t))
+    hp->cth_nameidxoff = hp->cth_stroff;
+
   ctf_dprintf ("ctf_bufopen: uncompressed size=%lu\n",
 	       (unsigned long) fp->ctf_size);
 
   if (hp->cth_lbloff > fp->ctf_size || hp->cth_objtoff > fp->ctf_size
       || hp->cth_funcoff > fp->ctf_size || hp->cth_objtidxoff > fp->ctf_size
       || hp->cth_funcidxoff > fp->ctf_size || hp->cth_typeoff > fp->ctf_size
-      || hp->cth_stroff > fp->ctf_size)
+      || hp->cth_nameidxoff > fp->ctf_size || hp->cth_stroff > fp->ctf_size)
     return (ctf_set_open_errno (errp, ECTF_CORRUPT));
 
   if (hp->cth_lbloff > hp->cth_objtoff
@@ -1455,31 +1666,45 @@ ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
       || hp->cth_funcoff > hp->cth_objtidxoff
       || hp->cth_objtidxoff > hp->cth_funcidxoff
       || hp->cth_funcidxoff > hp->cth_varoff
-      || hp->cth_varoff > hp->cth_typeoff || hp->cth_typeoff > hp->cth_stroff)
+      || hp->cth_varoff > hp->cth_typeoff
+      || hp->cth_typeoff > hp->cth_nameidxoff
+      || hp->cth_nameidxoff > hp->cth_stroff)
     return (ctf_set_open_errno (errp, ECTF_CORRUPT));
 
   if ((hp->cth_lbloff & 3) || (hp->cth_objtoff & 2)
       || (hp->cth_funcoff & 2) || (hp->cth_objtidxoff & 2)
       || (hp->cth_funcidxoff & 2) || (hp->cth_varoff & 3)
-      || (hp->cth_typeoff & 3))
+      || (hp->cth_typeoff & 3) || (hp->cth_nameidxoff & 3))
     return (ctf_set_open_errno (errp, ECTF_CORRUPT));
 
   /* Once everything is determined to be valid, attempt to decompress the CTF
      data buffer if it is compressed, or copy it into new storage if it is not
      compressed but needs endian-flipping.  Otherwise we just put the data
-     section's buffer pointer into ctf_buf, below.  */
+     section's buffer pointer into ctf_buf, below.
+
+     In that last case, neither this function nor anything else in libctf
+     ever copies or writes to the data section: it may be in read-only memory,
+     such as the shared mapping of a CTF archive, and all the types, variables
+     and strings are used in place.  (Only for CTF_VERSION_1 is it copied
+     anyway, by upgrade_types().)  */
 
 #ifndef NO_COMPAT
   /* Note: if this is a v1 buffer, it will be reallocated and expanded by
      init_types().  */
 #endif /* !NO_COMPAT */
 
+  if ((hp->cth_flags & CTF_F_COMPRESSOR)
+      && (!(hp->cth_flags & CTF_F_COMPRESS)
+	  || (hp->cth_flags & CTF_F_COMPRESSOR) == CTF_F_COMPRESSOR))
+    {
+      err = ECTF_CORRUPT;
+      goto bad;
+    }
+
   if (hp->cth_flags & CTF_F_COMPRESS)
     {
-      size_t srclen;
-      uLongf dstlen;
       const void *src;
-      int rc = Z_OK;
+      size_t srclen;
 
       /* We are allocating this ourselves, so we can drop the ctf header
 	 copy in favour of ctf->ctf_header.  */
@@ -1490,31 +1715,24 @@ ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
 	  goto bad;
 	}
       fp->ctf_dynbase = fp->ctf_base;
-      hp->cth_flags &= ~CTF_F_COMPRESS;
+      fp->ctf_buf = fp->ctf_base;
+
+      /* Rewriting this dict will recompress it the same way.  */
+      fp->ctf_compressor = hp->cth_flags & CTF_F_COMPRESSOR;
+      hp->cth_flags &= ~(CTF_F_COMPRESS | CTF_F_COMPRESSOR);
 
       src = (unsigned char *) ctfsect->cts_data + hdrsz;
       srclen = ctfsect->cts_size - hdrsz;
-      dstlen = fp->ctf_size;
-      fp->ctf_buf = fp->ctf_base;
 
-      if ((rc = uncompress (fp->ctf_base, &dstlen, src, srclen)) != Z_OK)
-	{
-	  ctf_dprintf ("zlib inflate err: %s\n", zError (rc));
-	  err = ECTF_DECOMPRESS;
-	  goto bad;
-	}
-
-      if ((size_t) dstlen != fp->ctf_size)
-	{
-	  ctf_dprintf ("zlib inflate short -- got %lu of %lu "
-		       "bytes\n", (unsigned long) dstlen,
-		       (unsigned long) fp->ctf_size);
-	  err = ECTF_CORRUPT;
-	  goto bad;
-	}
+      if ((err = ctf_decompress (fp->ctf_compressor, fp->ctf_base,
+				 fp->ctf_size, src, srclen)) != 0)
+	goto bad;
+      ctf_stat_file_add (fp, cst_bytes_decompressed, fp->ctf_size);
     }
   else if (foreign_endian)
     {
+      ctf_dprintf ("ctf_bufopen: copying foreign-endian data\n");
+
       if ((fp->ctf_base = malloc (fp->ctf_size)) == NULL)
 	{
 	  err = ECTF_ZALLOC;
@@ -1608,8 +1826,14 @@ ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
       return fp;
     }
 
-  if ((err = init_types (fp, hp)) != 0)
-    goto bad;
+  {
+    ctf_stat_timer (start);
+
+    err = init_types (fp, hp);
+    ctf_stat_file_time (fp, cst_init_types_ns, start);
+    if (err != 0)
+      goto bad;
+  }
 
   /* If we have a symbol table section, allocate and initialize
      the symtab translation table, pointed to by ctf_sxlate.  This table may be
@@ -1660,29 +1884,22 @@ bad:
 void
 ctf_file_close (ctf_file_t *fp)
 {
-  ctf_dtdef_t *dtd, *ntd;
-  ctf_dvdef_t *dvd, *nvd;
-
   if (fp == NULL)
     return;		   /* Allow ctf_file_close(NULL) to simplify caller code.  */
 
-  ctf_dprintf ("ctf_file_close(%p) refcnt=%u\n", (void *) fp, fp->ctf_refcnt);
+  ctf_dprintf ("ctf_file_close(%p) refcnt=%u\n", (void *) fp,
+	       __atomic_load_n (&fp->ctf_refcnt, __ATOMIC_RELAXED));
 
-  if (fp->ctf_refcnt > 1)
-    {
-      fp->ctf_refcnt--;
-      return;
-    }
+  if (__atomic_fetch_sub (&fp->ctf_refcnt, 1, __ATOMIC_ACQ_REL) > 1)
+    return;
 
   free (fp->ctf_dyncuname);
   free (fp->ctf_dynparname);
   ctf_file_close (fp->ctf_parent);
 
-  for (dtd = ctf_list_next (&fp->ctf_dtdefs); dtd != NULL; dtd = ntd)
-    {
-      ntd = ctf_list_next (dtd);
-      ctf_dtd_delete (fp, dtd);
-    }
+  /* The dynamic type and variable definitions all live in the arena, so
+     there is no need to delete them one by one.  */
+
   ctf_dynhash_destroy (fp->ctf_dthash);
   if (fp->ctf_flags & LCTF_RDWR)
     {
@@ -1699,12 +1916,11 @@ ctf_file_close (ctf_file_t *fp)
       ctf_hash_destroy (fp->ctf_names.ctn_readonly);
     }
 
-  for (dvd = ctf_list_next (&fp->ctf_dvdefs); dvd != NULL; dvd = nvd)
-    {
-      nvd = ctf_list_next (dvd);
-      ctf_dvd_delete (fp, dvd);
-    }
   ctf_dynhash_destroy (fp->ctf_dvhash);
+  ctf_arena_free (&fp->ctf_arena);
+  ctf_dynhash_destroy (fp->ctf_membidx);
+  ctf_type_cache_flush (fp);
+  ctf_dynhash_destroy (fp->ctf_enumvalidx);
   ctf_str_free_atoms (fp);
   free (fp->ctf_tmp_typeslice);
 
@@ -1723,13 +1939,17 @@ ctf_file_close (ctf_file_t *fp)
 
   ctf_dynhash_destroy (fp->ctf_syn_ext_strtab);
   ctf_dynhash_destroy (fp->ctf_link_inputs);
+  ctf_arc_close (fp->ctf_link_prev);
   ctf_dynhash_destroy (fp->ctf_link_outputs);
   ctf_dynhash_destroy (fp->ctf_link_type_mapping);
   ctf_dynhash_destroy (fp->ctf_link_cu_mapping);
   ctf_dynhash_destroy (fp->ctf_add_processing);
 
+  ctf_dynhash_destroy (fp->ctf_objthash);
+  ctf_dynhash_destroy (fp->ctf_funchash);
   free (fp->ctf_sxlate);
   free (fp->ctf_txlate);
+  free (fp->ctf_tindex.cti_size);
   free (fp->ctf_ptrtab);
 
   free (fp->ctf_header);
@@ -1835,7 +2055,14 @@ ctf_cuname_set (ctf_file_t *fp, const char *name)
 int
 ctf_import (ctf_file_t *fp, ctf_file_t *pfp)
 {
-  if (fp == NULL || fp == pfp || (pfp != NULL && pfp->ctf_refcnt == 0))
+  if (fp == NULL || fp == pfp
+      || (pfp != NULL && __atomic_load_n (&pfp->ctf_refcnt,
+					  __ATOMIC_ACQUIRE) == 0))
+    return (ctf_set_errno (fp, EINVAL));
+
+  /* Importing changes FP's type cache, which concurrent readers may be
+     using: a parent, though, may be shared among many concurrent importers.  */
+  if (fp->ctf_flags & LCTF_CONCURRENT)
     return (ctf_set_errno (fp, EINVAL));
 
   if (pfp != NULL && pfp->ctf_dmodel != fp->ctf_dmodel)
@@ -1843,7 +2070,6 @@ ctf_import (ctf_file_t *fp, ctf_file_t *pfp)
 
   if (fp->ctf_parent != NULL)
     {
-      fp->ctf_parent->ctf_refcnt--;
       ctf_file_close (fp->ctf_parent);
       fp->ctf_parent = NULL;
     }
@@ -1857,10 +2083,52 @@ ctf_import (ctf_file_t *fp, ctf_file_t *pfp)
 	  return err;
 
       fp->ctf_flags |= LCTF_CHILD;
-      pfp->ctf_refcnt++;
+      ctf_file_ref (pfp);
     }
 
   fp->ctf_parent = pfp;
+  ctf_type_cache_flush (fp);
+  return 0;
+}
+
+/* Make a read-only container safe (or, if CONCURRENT is zero, no longer safe)
+   for concurrent readers in many threads without locking.  All the lazily-built
+   caches and indexes in FP and its parent are built in advance, so call this
+   after ctf_import(); thereafter, ctf_errno() returns the error of the last
+   failed operation of the calling thread on any concurrent container, and
+   ctf_import() on FP itself fails.  Closing FP, and opening and closing other
+   children of its parent, remain safe: the archive dict cache does not, and
+   archive members should be opened before concurrent use begins.  */
+
+int
+ctf_set_concurrent (ctf_file_t *fp, int concurrent)
+{
+  ctf_file_t *pfp = fp->ctf_parent;
+
+  if (!concurrent)
+    {
+      fp->ctf_flags &= ~LCTF_CONCURRENT;
+      return 0;
+    }
+
+  if ((fp->ctf_flags | (pfp ? pfp->ctf_flags : 0)) & LCTF_RDWR)
+    return (ctf_set_errno (fp, EINVAL));
+
+  if (pfp != NULL && !(pfp->ctf_flags & LCTF_CONCURRENT))
+    {
+      if (ctf_type_caches_prepare (pfp) < 0
+	  || (pfp->ctf_symtab.cts_data != NULL && pfp->ctf_objthash == NULL
+	      && ctf_init_symhash (pfp) < 0))
+	return (ctf_set_errno (fp, ctf_errno (pfp)));
+      pfp->ctf_flags |= LCTF_CONCURRENT;
+    }
+
+  if (ctf_type_caches_prepare (fp) < 0
+      || (fp->ctf_symtab.cts_data != NULL && fp->ctf_objthash == NULL
+	  && ctf_init_symhash (fp) < 0))
+    return -1;					/* errno is set for us.  */
+
+  fp->ctf_flags |= LCTF_CONCURRENT;
   return 0;
 }
 
@@ -1875,6 +2143,7 @@ ctf_setmodel (ctf_file_t *fp, int model)
       if (dp->ctd_code == model)
 	{
 	  fp->ctf_dmodel = dp;
+	  ctf_type_cache_flush (fp);
 	  return 0;
 	}
     }
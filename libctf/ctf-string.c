@@ -139,8 +139,9 @@ ctf_str_add_ref_internal (ctf_file_t *fp, const char *str,
   char *newstr = NULL;
   ctf_str_atom_t *atom = NULL;
   ctf_str_atom_ref_t *aref = NULL;
+  uint32_t hash = ctf_hash_string (str);
 
-  atom = ctf_dynhash_lookup (fp->ctf_str_atoms, str);
+  atom = ctf_dynhash_lookup_hashed (fp->ctf_str_atoms, str, hash);
 
   if (add_ref)
     {
@@ -166,11 +167,13 @@ ctf_str_add_ref_internal (ctf_file_t *fp, const char *str,
   if ((newstr = strdup (str)) == NULL)
     goto oom;
 
-  if (ctf_dynhash_insert (fp->ctf_str_atoms, newstr, atom) < 0)
+  if (ctf_dynhash_insert_hashed (fp->ctf_str_atoms, newstr, atom, hash) < 0)
     goto oom;
 
   atom->csa_str = newstr;
+  atom->csa_len = strlen (newstr);
   atom->csa_snapshot_id = fp->ctf_snapshots;
+  ctf_stat_file_add (fp, cst_str_atoms, 1);
 
   if (make_provisional)
     {
@@ -180,7 +183,7 @@ ctf_str_add_ref_internal (ctf_file_t *fp, const char *str,
 			      atom->csa_offset, (void *) atom->csa_str) < 0)
 	goto oom;
 
-      fp->ctf_str_prov_offset += strlen (atom->csa_str) + 1;
+      fp->ctf_str_prov_offset += atom->csa_len + 1;
     }
 
   if (add_ref)
@@ -362,7 +365,7 @@ ctf_str_count_strtab (void *key _libctf_unused_, void *value,
   if (!ctf_list_empty_p (&atom->csa_refs))
     {
       if (!atom->csa_external_offset)
-	s->strtab->cts_len += strlen (atom->csa_str) + 1;
+	s->strtab->cts_len += atom->csa_len + 1;
       s->strtab_count++;
     }
 }
@@ -384,18 +387,69 @@ ctf_str_populate_sorttab (void *key _libctf_unused_, void *value,
     s->sorttab[s->i++] = atom;
 }
 
-/* Sort the strtab.  */
+/* Sort the strtab by reversed string, so that every string immediately
+   precedes those of which it is a suffix.  */
 static int
 ctf_str_sort_strtab (const void *a, const void *b)
 {
-  ctf_str_atom_t **one = (ctf_str_atom_t **) a;
-  ctf_str_atom_t **two = (ctf_str_atom_t **) b;
+  const ctf_str_atom_t *one = *(const ctf_str_atom_t **) a;
+  const ctf_str_atom_t *two = *(const ctf_str_atom_t **) b;
+  const unsigned char *p1 = (const unsigned char *) one->csa_str + one->csa_len;
+  const unsigned char *p2 = (const unsigned char *) two->csa_str + two->csa_len;
+
+  while (p1 > (const unsigned char *) one->csa_str
+	 && p2 > (const unsigned char *) two->csa_str)
+    {
+      p1--;
+      p2--;
+      if (*p1 != *p2)
+	return *p1 < *p2 ? -1 : 1;
+    }
 
-  return (strcmp ((*one)->csa_str, (*two)->csa_str));
+  return (one->csa_len > two->csa_len) - (one->csa_len < two->csa_len);
+}
+
+/* Lay out the N internal strtab atoms in TAB in STRS, starting at offset
+   STROFF, and update their refs.  Strings that are suffixes of other strings
+   are not written out separately, but point into the tail of the longer
+   string.  Return the offset just past the last string written.  */
+static uint32_t
+ctf_str_layout_strtab (ctf_str_atom_t **tab, size_t n, char *strs,
+		       uint32_t stroff)
+{
+  ctf_str_atom_t *owner = NULL;
+  size_t i;
+
+  qsort (tab, n, sizeof (ctf_str_atom_t *), ctf_str_sort_strtab);
+
+  /* Walk backwards, so that every string is seen after all of those of which
+     it is a suffix.  If it is a suffix of any of them, it is a suffix of the
+     last string written out.  */
+
+  for (i = n; i > 0; i--)
+    {
+      ctf_str_atom_t *atom = tab[i - 1];
+
+      if (owner && atom->csa_len <= owner->csa_len
+	  && memcmp (owner->csa_str + owner->csa_len - atom->csa_len,
+		     atom->csa_str, atom->csa_len) == 0)
+	atom->csa_offset = owner->csa_offset + owner->csa_len - atom->csa_len;
+      else
+	{
+	  atom->csa_offset = stroff;
+	  memcpy (&strs[stroff], atom->csa_str, atom->csa_len + 1);
+	  stroff += atom->csa_len + 1;
+	  owner = atom;
+	}
+      ctf_str_update_refs (atom, atom->csa_offset);
+    }
+
+  return stroff;
 }
 
 /* Write out and return a strtab containing all strings with recorded refs,
-   adjusting the refs to refer to the corresponding string.  The returned strtab
+   adjusting the refs to refer to the corresponding string, which may be the
+   tail of a longer one.  The returned strtab
    may be NULL on error.  Also populate the synthetic strtab with mappings from
    external strtab offsets to names, so we can look them up with ctf_strptr().
    Only external strtab offsets with references are added.  */
@@ -404,10 +458,10 @@ ctf_str_write_strtab (ctf_file_t *fp)
 {
   ctf_strs_writable_t strtab;
   ctf_str_atom_t *nullstr;
-  uint32_t cur_stroff = 0;
+  uint32_t cur_stroff = 1;
   ctf_strtab_write_state_t s;
   ctf_str_atom_t **sorttab;
-  size_t i;
+  size_t i, nsorted = 0;
   int any_external = 0;
 
   memset (&strtab, 0, sizeof (struct ctf_strs_writable));
@@ -429,7 +483,7 @@ ctf_str_write_strtab (ctf_file_t *fp)
   ctf_dprintf ("%lu bytes of strings in strtab.\n",
 	       (unsigned long) strtab.cts_len);
 
-  /* Sort the strtab.  Force the null string to be first.  */
+  /* Collect the atoms.  Force the null string to be first.  */
   sorttab = calloc (s.strtab_count, sizeof (ctf_str_atom_t *));
   if (!sorttab)
     goto oom;
@@ -439,9 +493,6 @@ ctf_str_write_strtab (ctf_file_t *fp)
   s.sorttab = sorttab;
   ctf_dynhash_iter (fp->ctf_str_atoms, ctf_str_populate_sorttab, &s);
 
-  qsort (&sorttab[1], s.strtab_count - 1, sizeof (ctf_str_atom_t *),
-	 ctf_str_sort_strtab);
-
   if ((strtab.cts_strs = malloc (strtab.cts_len)) == NULL)
     goto oom_sorttab;
 
@@ -452,7 +503,9 @@ ctf_str_write_strtab (ctf_file_t *fp)
   if (!fp->ctf_syn_ext_strtab)
     goto oom_strtab;
 
-  /* Update all refs: also update the strtab appropriately.  */
+  /* Update all refs to external strings, and gather up the internal strings
+     other than the null string at the start of the sorttab.  */
+  strtab.cts_strs[0] = '\0';
   for (i = 0; i < s.strtab_count; i++)
     {
       if (sorttab[i]->csa_external_offset)
@@ -473,19 +526,25 @@ ctf_str_write_strtab (ctf_file_t *fp)
 	    goto oom_strtab;
 	  sorttab[i]->csa_offset = sorttab[i]->csa_external_offset;
 	}
-      else
+      else if (i == 0)
 	{
-	  /* Internal strtab entry with refs: actually add to the string
-	     table.  */
-
-	  ctf_str_update_refs (sorttab[i], cur_stroff);
-	  sorttab[i]->csa_offset = cur_stroff;
-	  strcpy (&strtab.cts_strs[cur_stroff], sorttab[i]->csa_str);
-	  cur_stroff += strlen (sorttab[i]->csa_str) + 1;
+	  ctf_str_update_refs (sorttab[i], 0);
+	  sorttab[i]->csa_offset = 0;
 	}
+      else
+	sorttab[nsorted++] = sorttab[i];
     }
+
+  /* Internal strtab entries with refs: actually add to the string table.  */
+
+  cur_stroff = ctf_str_layout_strtab (sorttab, nsorted, strtab.cts_strs,
+				      cur_stroff);
   free (sorttab);
 
+  ctf_dprintf ("%lu bytes of strings saved by suffix sharing.\n",
+	       (unsigned long) (strtab.cts_len - cur_stroff));
+  strtab.cts_len = cur_stroff;
+
   if (!any_external)
     {
       ctf_dynhash_destroy (fp->ctf_syn_ext_strtab);
@@ -508,3 +567,131 @@ ctf_str_write_strtab (ctf_file_t *fp)
  oom:
   return strtab;
 }
+
+/* Return nonzero if ATOM is already at its csa_offset in STRTAB.  */
+static int
+ctf_str_in_strtab (const ctf_str_atom_t *atom, const ctf_strs_t *strtab)
+{
+  return (atom->csa_offset < strtab->cts_len
+	  && strcmp (strtab->cts_strs + atom->csa_offset, atom->csa_str) == 0);
+}
+
+/* State shared across the strtab append process.  */
+typedef struct ctf_strtab_append_state
+{
+  /* The strtab being appended to.  */
+  ctf_file_t *fp;
+  const ctf_strs_t *old;
+
+  /* Atoms not yet in the old strtab, their number, and their total length.  */
+  ctf_str_atom_t **newtab;
+  size_t new_count;
+  size_t new_len;
+
+  /* Set on out-of-memory.  */
+  int enomem;
+} ctf_strtab_append_state_t;
+
+/* Count and, if the newtab is allocated, collect the atoms with refs that are
+   neither external nor in the old strtab.  */
+static void
+ctf_str_collect_append (void *key _libctf_unused_, void *value, void *arg)
+{
+  ctf_str_atom_t *atom = (ctf_str_atom_t *) value;
+  ctf_strtab_append_state_t *s = (ctf_strtab_append_state_t *) arg;
+
+  if (ctf_list_empty_p (&atom->csa_refs) || atom->csa_external_offset
+      || ctf_str_in_strtab (atom, s->old))
+    return;
+
+  if (s->newtab)
+    s->newtab[s->new_count] = atom;
+  else
+    s->new_len += atom->csa_len + 1;
+  s->new_count++;
+}
+
+/* Update the refs of atoms in the old strtab or the external strtab.  */
+static void
+ctf_str_update_append (void *key _libctf_unused_, void *value, void *arg)
+{
+  ctf_str_atom_t *atom = (ctf_str_atom_t *) value;
+  ctf_strtab_append_state_t *s = (ctf_strtab_append_state_t *) arg;
+  ctf_file_t *fp = s->fp;
+
+  if (ctf_list_empty_p (&atom->csa_refs))
+    return;
+
+  if (atom->csa_external_offset)
+    {
+      if (!fp->ctf_syn_ext_strtab)
+	fp->ctf_syn_ext_strtab = ctf_dynhash_create (ctf_hash_integer,
+						     ctf_hash_eq_integer,
+						     NULL, NULL);
+      if (!fp->ctf_syn_ext_strtab
+	  || ctf_dynhash_insert (fp->ctf_syn_ext_strtab,
+				 (void *) (uintptr_t) atom->csa_external_offset,
+				 (void *) atom->csa_str) < 0)
+	{
+	  s->enomem = 1;
+	  return;
+	}
+      ctf_str_update_refs (atom, atom->csa_external_offset);
+      atom->csa_offset = atom->csa_external_offset;
+    }
+  else if (ctf_str_in_strtab (atom, s->old))
+    ctf_str_update_refs (atom, atom->csa_offset);
+}
+
+/* Like ctf_str_write_strtab, but rather than laying out every string with refs
+   afresh, keep FP's existing internal strtab unchanged at the start of the new
+   one and append only the strings that are not already in it, so that every
+   offset into the old strtab remains valid.  */
+ctf_strs_writable_t
+ctf_str_append_strtab (ctf_file_t *fp)
+{
+  ctf_strs_writable_t strtab;
+  ctf_strtab_append_state_t s;
+  uint32_t cur_stroff;
+
+  memset (&strtab, 0, sizeof (struct ctf_strs_writable));
+  memset (&s, 0, sizeof (struct ctf_strtab_append_state));
+  s.fp = fp;
+  s.old = &fp->ctf_str[CTF_STRTAB_0];
+
+  ctf_dynhash_iter (fp->ctf_str_atoms, ctf_str_collect_append, &s);
+  strtab.cts_len = s.old->cts_len + s.new_len;
+
+  ctf_dprintf ("%lu bytes of strings appended to %lu-byte strtab.\n",
+	       (unsigned long) s.new_len, (unsigned long) s.old->cts_len);
+
+  if ((s.newtab = calloc (s.new_count + 1, sizeof (ctf_str_atom_t *))) == NULL)
+    return strtab;
+
+  s.new_count = 0;
+  ctf_dynhash_iter (fp->ctf_str_atoms, ctf_str_collect_append, &s);
+
+  if ((strtab.cts_strs = malloc (strtab.cts_len)) == NULL)
+    goto oom;
+
+  ctf_dynhash_iter (fp->ctf_str_atoms, ctf_str_update_append, &s);
+  if (s.enomem)
+    goto oom_strtab;
+
+  memcpy (strtab.cts_strs, s.old->cts_strs, s.old->cts_len);
+  cur_stroff = ctf_str_layout_strtab (s.newtab, s.new_count, strtab.cts_strs,
+				      s.old->cts_len);
+  strtab.cts_len = cur_stroff;
+  free (s.newtab);
+
+  ctf_dynhash_empty (fp->ctf_prov_strtab);
+  fp->ctf_str_prov_offset = strtab.cts_len + 1;
+  return strtab;
+
+ oom_strtab:
+  free (strtab.cts_strs);
+  strtab.cts_strs = NULL;
+ oom:
+  free (s.newtab);
+  return strtab;
+}
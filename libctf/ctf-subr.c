@@ -14,10 +14,13 @@
 #include <sys/types.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 int _libctf_version = CTF_VERSION;	      /* Library client version.  */
 int _libctf_debug = 0;			      /* Debugging messages enabled.  */
+ctf_stats_t _libctf_stats;		      /* Process-wide statistics.  */
+static unsigned int _libctf_open_threads = 1;	/* Threads ctf_bufopen() uses.  */
 
 /* Private, read-only mmap from a file, with fallback to copying.
 
@@ -112,6 +115,53 @@ ctf_pread (int fd, void *buf, ssize_t count, off_t offset)
   return acc;
 }
 
+/* Write COUNT bytes of BUF to FD at OFFSET, without disturbing the file
+   position (where pwrite() is available).  Returns -1 on error.  */
+
+ssize_t
+ctf_pwrite (int fd, const void *buf, ssize_t count, off_t offset)
+{
+  ssize_t len;
+  size_t acc = 0;
+  const char *data = (const char *) buf;
+
+#ifdef HAVE_PWRITE
+  while (count > 0)
+    {
+      errno = 0;
+      if (((len = pwrite (fd, data, count, offset)) < 0) &&
+	  errno != EINTR)
+	  return len;
+      if (errno == EINTR)
+	continue;
+
+      acc += len;
+      count -= len;
+      offset += len;
+      data += len;
+    }
+#else
+  if ((lseek (fd, offset, SEEK_SET)) < 0)
+    return -1;
+
+  while (count > 0)
+    {
+      errno = 0;
+      if (((len = write (fd, data, count)) < 0) &&
+	  errno != EINTR)
+	  return len;
+      if (errno == EINTR)
+	continue;
+
+      acc += len;
+      count -= len;
+      data += len;
+    }
+#endif
+
+  return acc;
+}
+
 const char *
 ctf_strerror (int err)
 {
@@ -131,8 +181,9 @@ ctf_version (int version)
 
   if (version > 0)
     {
-      /*  Dynamic version switching is not presently supported. */
-      if (version != CTF_VERSION)
+      /*  Dynamic version switching is not presently supported.  v3 differs
+	  from the current version only on disk, so its clients are fine.  */
+      if (version != CTF_VERSION && version != CTF_VERSION_3)
 	{
 	  errno = ENOTSUP;
 	  return -1;
@@ -170,6 +221,121 @@ int ctf_getdebug (void)
   return _libctf_debug;
 }
 
+static void
+libctf_init_open_threads (void)
+{
+  static int inited;
+  if (!inited)
+    {
+      const char *env = getenv ("LIBCTF_OPEN_THREADS");
+
+      if (env != NULL && atoi (env) > 0)
+	_libctf_open_threads = atoi (env);
+      inited = 1;
+    }
+}
+
+/* Set the number of threads that may be used to index the types of large
+   dicts as they are opened.  The default is 1, or the value of the
+   LIBCTF_OPEN_THREADS environment variable, if set.  0 is treated as 1.  */
+
+void ctf_set_open_threads (unsigned int threads)
+{
+  libctf_init_open_threads ();
+  _libctf_open_threads = threads > 0 ? threads : 1;
+  ctf_dprintf ("CTF open threads set to %u\n", _libctf_open_threads);
+}
+
+unsigned int ctf_get_open_threads (void)
+{
+  libctf_init_open_threads ();
+  return _libctf_open_threads;
+}
+
+/* The current time, for statistics, in nanoseconds.  */
+
+uint64_t
+ctf_stat_now (void)
+{
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0)
+    return 0;
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef LIBCTF_STATS
+/* Copy statistics which may be being updated concurrently.  */
+
+static void
+ctf_stats_copy (ctf_stats_t *dst, const ctf_stats_t *src)
+{
+#define ctf_stat_load(field) \
+  dst->field = __atomic_load_n (&src->field, __ATOMIC_RELAXED)
+
+  ctf_stat_load (cst_hash_lookups);
+  ctf_stat_load (cst_hash_probes);
+  ctf_stat_load (cst_hash_collisions);
+  ctf_stat_load (cst_bytes_decompressed);
+  ctf_stat_load (cst_init_types_ns);
+  ctf_stat_load (cst_serialize_ns);
+  ctf_stat_load (cst_link_ns);
+  ctf_stat_load (cst_add_type_conflicts);
+  ctf_stat_load (cst_str_atoms);
+
+#undef ctf_stat_load
+}
+#endif
+
+/* Return statistics for this dict since it was opened or created, including
+   the lookups in all the hash tables it owns.  Fails with ECTF_NOTSUP if
+   libctf was not built with statistics.  */
+
+int
+ctf_file_stats (ctf_file_t *fp, ctf_stats_t *stats)
+{
+#ifdef LIBCTF_STATS
+  ctf_dynhash_t *hashes[] = { fp->ctf_structs.ctn_writable,
+			      fp->ctf_unions.ctn_writable,
+			      fp->ctf_enums.ctn_writable,
+			      fp->ctf_names.ctn_writable,
+			      fp->ctf_prov_strtab, fp->ctf_syn_ext_strtab,
+			      fp->ctf_str_atoms, fp->ctf_objthash,
+			      fp->ctf_funchash, fp->ctf_dthash, fp->ctf_dvhash,
+			      fp->ctf_link_inputs, fp->ctf_link_outputs,
+			      fp->ctf_link_type_mapping,
+			      fp->ctf_link_cu_mapping, fp->ctf_add_processing,
+			      fp->ctf_membidx, fp->ctf_enumvalidx,
+			      fp->ctf_layouts, fp->ctf_type_names };
+  size_t i;
+
+  ctf_stats_copy (stats, &fp->ctf_stats);
+
+  for (i = 0; i < sizeof (hashes) / sizeof (hashes[0]); i++)
+    ctf_dynhash_stats (hashes[i], stats);
+
+  return 0;
+#else
+  memset (stats, 0, sizeof (ctf_stats_t));
+  return (ctf_set_errno (fp, ECTF_NOTSUP));
+#endif
+}
+
+/* Return statistics for all dicts in this process, open or closed.  Returns
+   ECTF_NOTSUP if libctf was not built with statistics.  */
+
+int
+ctf_process_stats (ctf_stats_t *stats)
+{
+#ifdef LIBCTF_STATS
+  ctf_stats_copy (stats, &_libctf_stats);
+  return 0;
+#else
+  memset (stats, 0, sizeof (ctf_stats_t));
+  return ECTF_NOTSUP;
+#endif
+}
+
 _libctf_printflike_ (1, 2)
 void ctf_dprintf (const char *format, ...)
 {
@@ -24,6 +24,107 @@ ctf_type_ischild (ctf_file_t * fp, ctf_id_t id)
   return (LCTF_TYPE_ISCHILD (fp, id));
 }
 
+static ssize_t ctf_type_size_uncached (ctf_file_t *, ctf_id_t);
+static ssize_t ctf_type_align_uncached (ctf_file_t *, ctf_id_t);
+
+/* Return the dict whose caches hold the results for TYPE, or NULL if the
+   results for TYPE cannot be cached.
+
+   Writable dicts are only cached while they are clean: once modified, they are
+   not consulted again until they are serialized (which gets them a new, empty
+   cache), or rolled back to a clean state (which flushes it).  Children's
+   results can depend on their parent's types, so children of writable parents
+   are never cached.  */
+
+static ctf_file_t *
+ctf_type_cache_owner (ctf_file_t *fp, ctf_id_t type)
+{
+  if ((fp->ctf_flags & LCTF_CHILD) && LCTF_TYPE_ISPARENT (fp, type))
+    fp = fp->ctf_parent;
+  else if (fp->ctf_parent != NULL && (fp->ctf_parent->ctf_flags & LCTF_RDWR))
+    return NULL;
+
+  if (fp == NULL || (fp->ctf_flags & LCTF_DIRTY))
+    return NULL;
+
+  return fp;
+}
+
+/* Allocate FP's type cache.  */
+
+static int
+ctf_type_cache_alloc (ctf_file_t *fp)
+{
+  size_t i;
+
+  fp->ctf_type_cache_len = fp->ctf_typemax + 1;
+  if ((fp->ctf_type_cache = malloc (fp->ctf_type_cache_len
+				    * sizeof (ctf_type_cache_t))) == NULL)
+    {
+      fp->ctf_type_cache_len = 0;
+      return -1;
+    }
+
+  for (i = 0; i < fp->ctf_type_cache_len; i++)
+    {
+      fp->ctf_type_cache[i].ctc_size = -1;
+      fp->ctf_type_cache[i].ctc_align = -1;
+      fp->ctf_type_cache[i].ctc_resolved = 0;
+      fp->ctf_type_cache[i].ctc_layout = NULL;
+      fp->ctf_type_cache[i].ctc_name = NULL;
+    }
+  return 0;
+}
+
+/* Return the cache entry for TYPE, allocating the cache of the dict TYPE is in
+   if need be, or NULL if the results for TYPE cannot be cached.
+
+   The caches of LCTF_CONCURRENT dicts are allocated in advance, by
+   ctf_type_caches_prepare(), and their entries are only accessed atomically:
+   racing readers can at worst compute the same result more than once.  */
+
+static ctf_type_cache_t *
+ctf_type_cache (ctf_file_t *fp, ctf_id_t type)
+{
+  ctf_id_t idx;
+
+  if ((fp = ctf_type_cache_owner (fp, type)) == NULL)
+    return NULL;
+
+  idx = LCTF_TYPE_TO_INDEX (fp, type);
+
+  if (fp->ctf_type_cache == NULL
+      && ((fp->ctf_flags & LCTF_CONCURRENT) || ctf_type_cache_alloc (fp) < 0))
+    return NULL;
+
+  if (idx <= 0 || (size_t) idx >= fp->ctf_type_cache_len)
+    return NULL;
+
+  return &fp->ctf_type_cache[idx];
+}
+
+/* Throw away FP's type cache and cached type layouts and names.  */
+
+void
+ctf_type_cache_flush (ctf_file_t *fp)
+{
+  size_t i;
+
+  for (i = 0; i < fp->ctf_type_cache_len; i++)
+    {
+      free (fp->ctf_type_cache[i].ctc_layout);
+      free (fp->ctf_type_cache[i].ctc_name);
+    }
+
+  free (fp->ctf_type_cache);
+  fp->ctf_type_cache = NULL;
+  fp->ctf_type_cache_len = 0;
+  ctf_dynhash_destroy (fp->ctf_layouts);
+  fp->ctf_layouts = NULL;
+  ctf_dynhash_destroy (fp->ctf_type_names);
+  fp->ctf_type_names = NULL;
+}
+
 /* Iterate over the members of a STRUCT or UNION.  We pass the name, member
    type, and offset of each member to the specified callback function.  */
 
@@ -178,7 +279,7 @@ ctf_type_iter_all (ctf_file_t *fp, ctf_type_all_f *func, void *arg)
       const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, id);
       if ((rc = func (LCTF_INDEX_TO_TYPE (fp, id, child),
 		      LCTF_INFO_ISROOT(fp, tp->ctt_info)
-		      ? CTF_ADD_ROOT : CTF_ADD_NONROOT, arg) != 0))
+		      ? CTF_ADD_ROOT : CTF_ADD_NONROOT, arg)) != 0)
 	return rc;
     }
 
@@ -233,28 +334,53 @@ ctf_type_resolve (ctf_file_t *fp, ctf_id_t type)
   ctf_id_t prev = type, otype = type;
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
+  ctf_type_cache_t *tc;
 
   if (type == 0)
     return (ctf_set_errno (ofp, ECTF_NONREPRESENTABLE));
 
-  while ((tp = ctf_lookup_by_id (&fp, type)) != NULL)
+  if ((tc = ctf_type_cache (fp, type)) != NULL
+      && ctf_atomic_load (tc->ctc_resolved) != 0)
+    return ctf_atomic_load (tc->ctc_resolved);
+
+  for (;;)
     {
-      switch (LCTF_INFO_KIND (fp, tp->ctt_info))
+      ctf_file_t *tfp;
+      uint32_t idx;
+      int kind;
+      ctf_id_t ref;
+
+      if ((tfp = ctf_tindex_lookup (fp, type, &idx)) != NULL)
+	{
+	  kind = tfp->ctf_tindex.cti_kind[idx];
+	  ref = tfp->ctf_tindex.cti_ref[idx];
+	  fp = tfp;
+	}
+      else if ((tp = ctf_lookup_by_id (&fp, type)) != NULL)
+	{
+	  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+	  ref = tp->ctt_type;
+	}
+      else
+	break;
+
+      switch (kind)
 	{
 	case CTF_K_TYPEDEF:
 	case CTF_K_VOLATILE:
 	case CTF_K_CONST:
 	case CTF_K_RESTRICT:
-	  if (tp->ctt_type == type || tp->ctt_type == otype
-	      || tp->ctt_type == prev)
+	  if (ref == type || ref == otype || ref == prev)
 	    {
 	      ctf_dprintf ("type %ld cycle detected\n", otype);
 	      return (ctf_set_errno (ofp, ECTF_CORRUPT));
 	    }
 	  prev = type;
-	  type = tp->ctt_type;
+	  type = ref;
 	  break;
 	default:
+	  if (tc != NULL)
+	    ctf_atomic_store (tc->ctc_resolved, type);
 	  return type;
 	}
       if (type == 0)
@@ -270,15 +396,15 @@ ctf_type_resolve (ctf_file_t *fp, ctf_id_t type)
 ctf_id_t
 ctf_type_resolve_unsliced (ctf_file_t *fp, ctf_id_t type)
 {
-  const ctf_type_t *tp;
+  int kind;
 
   if ((type = ctf_type_resolve (fp, type)) == CTF_ERR)
     return -1;
 
-  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
+  if ((kind = ctf_type_kind_unsliced (fp, type)) < 0)
     return CTF_ERR;		/* errno is set for us.  */
 
-  if ((LCTF_INFO_KIND (fp, tp->ctt_info)) == CTF_K_SLICE)
+  if (kind == CTF_K_SLICE)
     return ctf_type_reference (fp, type);
   return type;
 }
@@ -307,10 +433,11 @@ ctf_id_t ctf_lookup_by_rawhash (ctf_file_t *fp, ctf_names_t *np, const char *nam
 }
 
 /* Lookup the given type ID and return its name as a new dynamcally-allocated
-   string.  */
+   string.  If we ran out of memory part-way, return what we have, and set
+   *ENOMEMP.  */
 
-char *
-ctf_type_aname (ctf_file_t *fp, ctf_id_t type)
+static char *
+ctf_type_aname_internal (ctf_file_t *fp, ctf_id_t type, int *enomemp)
 {
   ctf_decl_t cd;
   ctf_decl_node_t *cdp;
@@ -414,6 +541,7 @@ ctf_type_aname (ctf_file_t *fp, ctf_id_t type)
 
   if (cd.cd_enomem)
     (void) ctf_set_errno (fp, ENOMEM);
+  *enomemp = cd.cd_enomem;
 
   buf = ctf_decl_buf (&cd);
 
@@ -421,13 +549,101 @@ ctf_type_aname (ctf_file_t *fp, ctf_id_t type)
   return buf;
 }
 
+/* Lookup the given type ID and return its name as a new dynamcally-allocated
+   string.  */
+
+char *
+ctf_type_aname (ctf_file_t *fp, ctf_id_t type)
+{
+  int enomem;
+
+  return ctf_type_aname_internal (fp, type, &enomem);
+}
+
+/* Lookup the given type ID and return its name, as by ctf_type_aname(), but
+   without allocating a new string for each call: the string belongs to FP, and
+   callers must not free it.
+
+   Names are built once per type and kept in the type cache, so they remain
+   valid only as long as it does: the cache, and every name returned so far, is
+   thrown away when the dict is closed, and also by ctf_import() (including the
+   imports done by ctf_arc_open_cached() and by ctf_link() on its inputs) and
+   ctf_setmodel().  Writable dicts also throw it away on ctf_serialize(),
+   ctf_rollback() and ctf_discard(); and once modified, every call builds the
+   name again, and if it has changed, frees the one from the last call for the
+   same type.  Callers that need a name to outlive any of these should copy it,
+   or use ctf_type_aname().  */
+
+const char *
+ctf_type_name_ref (ctf_file_t *fp, ctf_id_t type)
+{
+  ctf_type_cache_t *tc;
+  char *name, *old;
+  int enomem;
+
+  if ((tc = ctf_type_cache (fp, type)) != NULL
+      && (name = __atomic_load_n (&tc->ctc_name, __ATOMIC_ACQUIRE)) != NULL)
+    return name;
+
+  if ((name = ctf_type_aname_internal (fp, type, &enomem)) == NULL)
+    return NULL;				/* errno is set for us.  */
+
+  /* Never keep a truncated name.  */
+  if (enomem)
+    {
+      free (name);
+      return NULL;
+    }
+
+  if (tc != NULL)
+    {
+      char *expected = NULL;
+
+      /* Another reader may have got there first: use its name.  */
+      if (!__atomic_compare_exchange_n (&tc->ctc_name, &expected, name,
+					0, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE))
+	{
+	  free (name);
+	  name = expected;
+	}
+      return name;
+    }
+
+  if (fp->ctf_type_names == NULL
+      && (fp->ctf_type_names = ctf_dynhash_create (ctf_hash_integer,
+						   ctf_hash_eq_integer,
+						   NULL, free)) == NULL)
+    {
+      free (name);
+      ctf_set_errno (fp, ENOMEM);
+      return NULL;
+    }
+
+  if ((old = ctf_dynhash_lookup (fp->ctf_type_names, (void *) type)) != NULL
+      && strcmp (old, name) == 0)
+    {
+      free (name);
+      return old;
+    }
+
+  if (ctf_dynhash_insert (fp->ctf_type_names, (void *) type, name) < 0)
+    {
+      free (name);
+      ctf_set_errno (fp, ENOMEM);
+      return NULL;
+    }
+
+  return name;
+}
+
 /* Lookup the given type ID and print a string name for it into buf.  Return
    the actual number of bytes (not including \0) needed to format the name.  */
 
 ssize_t
 ctf_type_lname (ctf_file_t *fp, ctf_id_t type, char *buf, size_t len)
 {
-  char *str = ctf_type_aname (fp, type);
+  const char *str = ctf_type_name_ref (fp, type);
   size_t slen;
 
   if (str == NULL)
@@ -435,7 +651,6 @@ ctf_type_lname (ctf_file_t *fp, ctf_id_t type, char *buf, size_t len)
 
   slen = strlen (str);
   snprintf (buf, len, "%s", str);
-  free (str);
 
   if (slen >= len)
     (void) ctf_set_errno (fp, ECTF_NAMELEN);
@@ -476,17 +691,49 @@ ctf_type_aname_raw (ctf_file_t *fp, ctf_id_t type)
 ssize_t
 ctf_type_size (ctf_file_t *fp, ctf_id_t type)
 {
-  const ctf_type_t *tp;
+  ctf_type_cache_t *tc;
   ssize_t size;
-  ctf_arinfo_t ar;
 
   if ((type = ctf_type_resolve (fp, type)) == CTF_ERR)
     return -1;			/* errno is set for us.  */
 
-  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
-    return -1;			/* errno is set for us.  */
+  if ((tc = ctf_type_cache (fp, type)) != NULL
+      && (size = ctf_atomic_load (tc->ctc_size)) >= 0)
+    return size;
 
-  switch (LCTF_INFO_KIND (fp, tp->ctt_info))
+  if ((size = ctf_type_size_uncached (fp, type)) >= 0 && tc != NULL)
+    ctf_atomic_store (tc->ctc_size, size);
+
+  return size;
+}
+
+/* Return the size of the resolved type TYPE, bypassing the type cache.  */
+
+static ssize_t
+ctf_type_size_uncached (ctf_file_t *fp, ctf_id_t type)
+{
+  const ctf_type_t *tp = NULL;
+  ctf_file_t *tfp;
+  uint32_t idx;
+  ssize_t size;
+  ctf_arinfo_t ar;
+  int kind;
+
+  if ((tfp = ctf_tindex_lookup (fp, type, &idx)) != NULL)
+    {
+      fp = tfp;
+      kind = fp->ctf_tindex.cti_kind[idx];
+      size = fp->ctf_tindex.cti_size[idx];
+    }
+  else
+    {
+      if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
+	return -1;		/* errno is set for us.  */
+      kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      size = ctf_get_ctt_size (fp, tp, NULL, NULL);
+    }
+
+  switch (kind)
     {
     case CTF_K_POINTER:
       return fp->ctf_dmodel->ctd_pointer;
@@ -504,7 +751,7 @@ ctf_type_size (ctf_file_t *fp, ctf_id_t type)
 	 If ctf_get_ctt_size() returns nonzero, then use the recorded
 	 size instead.  */
 
-      if ((size = ctf_get_ctt_size (fp, tp, NULL, NULL)) > 0)
+      if (size > 0)
 	return size;
 
       if (ctf_array_info (fp, type, &ar) < 0
@@ -514,7 +761,7 @@ ctf_type_size (ctf_file_t *fp, ctf_id_t type)
       return size * ar.ctr_nelems;
 
     default: /* including slices of enums, etc */
-      return (ctf_get_ctt_size (fp, tp, NULL, NULL));
+      return size;
     }
 }
 
@@ -526,13 +773,32 @@ ctf_type_size (ctf_file_t *fp, ctf_id_t type)
 ssize_t
 ctf_type_align (ctf_file_t *fp, ctf_id_t type)
 {
-  const ctf_type_t *tp;
-  ctf_file_t *ofp = fp;
-  int kind;
+  ctf_type_cache_t *tc;
+  ssize_t align;
 
   if ((type = ctf_type_resolve (fp, type)) == CTF_ERR)
     return -1;			/* errno is set for us.  */
 
+  if ((tc = ctf_type_cache (fp, type)) != NULL
+      && (align = ctf_atomic_load (tc->ctc_align)) >= 0)
+    return align;
+
+  if ((align = ctf_type_align_uncached (fp, type)) >= 0 && tc != NULL)
+    ctf_atomic_store (tc->ctc_align, align);
+
+  return align;
+}
+
+/* Return the alignment of the resolved type TYPE, bypassing the type
+   cache.  */
+
+static ssize_t
+ctf_type_align_uncached (ctf_file_t *fp, ctf_id_t type)
+{
+  const ctf_type_t *tp;
+  ctf_file_t *ofp = fp;
+  int kind;
+
   if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
     return -1;			/* errno is set for us.  */
 
@@ -619,6 +885,11 @@ int
 ctf_type_kind_unsliced (ctf_file_t *fp, ctf_id_t type)
 {
   const ctf_type_t *tp;
+  ctf_file_t *tfp;
+  uint32_t idx;
+
+  if ((tfp = ctf_tindex_lookup (fp, type, &idx)) != NULL)
+    return tfp->ctf_tindex.cti_kind[idx];
 
   if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
     return -1;			/* errno is set for us.  */
@@ -655,6 +926,24 @@ ctf_type_reference (ctf_file_t *fp, ctf_id_t type)
 {
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
+  ctf_file_t *tfp;
+  uint32_t idx;
+
+  if ((tfp = ctf_tindex_lookup (fp, type, &idx)) != NULL)
+    {
+      switch (tfp->ctf_tindex.cti_kind[idx])
+	{
+	case CTF_K_POINTER:
+	case CTF_K_TYPEDEF:
+	case CTF_K_VOLATILE:
+	case CTF_K_CONST:
+	case CTF_K_RESTRICT:
+	case CTF_K_SLICE:
+	  return tfp->ctf_tindex.cti_ref[idx];
+	default:
+	  return (ctf_set_errno (ofp, ECTF_NOTREF));
+	}
+    }
 
   if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
     return CTF_ERR;		/* errno is set for us.  */
@@ -899,6 +1188,152 @@ ctf_type_compat (ctf_file_t *lfp, ctf_id_t ltype,
     }
 }
 
+/* Static structs, unions and enums with at least this many members have their
+   members looked up via an index, built on first lookup, rather than by a
+   linear scan.  */
+
+#define CTF_MEMBIDX_THRESH 16
+
+static void
+ctf_member_index_free (void *idx)
+{
+  ctf_dynhash_destroy ((ctf_dynhash_t *) idx);
+}
+
+/* Return the index of the members of the static struct, union or enum TYPE,
+   whose ctf_type_t is TP, building it if need be.  If BYVALUE, the index
+   maps enumerator values rather than member names to one more than the
+   position of the first member with that name or value.
+
+   Returns NULL if the type is too small to be worth indexing, or if building
+   the index fails: either way, the caller falls back to a linear scan.  */
+
+static ctf_dynhash_t *
+ctf_member_index (ctf_file_t *fp, ctf_id_t type, const ctf_type_t *tp,
+		  int byvalue)
+{
+  ctf_dynhash_t **idxp = byvalue ? &fp->ctf_enumvalidx : &fp->ctf_membidx;
+  ctf_dynhash_t *idx;
+  ssize_t size, increment;
+  uint32_t kind, vlen, i;
+
+  vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
+  if (vlen < CTF_MEMBIDX_THRESH)
+    return NULL;
+
+  /* The indexes of concurrently-readable dicts are all built in advance, and
+     then never changed.  */
+  if (fp->ctf_flags & LCTF_CONCURRENT)
+    return *idxp ? ctf_dynhash_lookup (*idxp, (void *) type) : NULL;
+
+  if (*idxp == NULL
+      && (*idxp = ctf_dynhash_create (ctf_hash_integer, ctf_hash_eq_integer,
+				      NULL, ctf_member_index_free)) == NULL)
+    return NULL;
+
+  if ((idx = ctf_dynhash_lookup (*idxp, (void *) type)) != NULL)
+    return idx;
+
+  if (byvalue)
+    idx = ctf_dynhash_create (ctf_hash_integer, ctf_hash_eq_integer,
+			      NULL, NULL);
+  else
+    idx = ctf_dynhash_create (ctf_hash_string, ctf_hash_eq_string,
+			      NULL, NULL);
+
+  if (idx == NULL || ctf_dynhash_reserve (idx, vlen) < 0)
+    goto oom;
+
+  (void) ctf_get_ctt_size (fp, tp, &size, &increment);
+  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+
+  for (i = 0; i < vlen; i++)
+    {
+      void *key;
+
+      if (kind == CTF_K_ENUM)
+	{
+	  const ctf_enum_t *ep = (const ctf_enum_t *) ((uintptr_t) tp
+						       + increment) + i;
+	  if (byvalue)
+	    key = (void *) (intptr_t) ep->cte_value;
+	  else
+	    key = (void *) ctf_strptr (fp, ep->cte_name);
+	}
+      else if (size < CTF_LSTRUCT_THRESH)
+	{
+	  const ctf_member_t *mp = (const ctf_member_t *) ((uintptr_t) tp
+							   + increment) + i;
+	  key = (void *) ctf_strptr (fp, mp->ctm_name);
+	}
+      else
+	{
+	  const ctf_lmember_t *lmp = (const ctf_lmember_t *) ((uintptr_t) tp
+							      + increment) + i;
+	  key = (void *) ctf_strptr (fp, lmp->ctlm_name);
+	}
+
+      /* Linear scans find the first match, so the index must too.  */
+      if (ctf_dynhash_lookup (idx, key) == NULL
+	  && ctf_dynhash_insert (idx, key, (void *) (uintptr_t) (i + 1)) < 0)
+	goto oom;
+    }
+
+  if (ctf_dynhash_insert (*idxp, (void *) type, idx) < 0)
+    goto oom;
+
+  return idx;
+
+ oom:
+  ctf_dynhash_destroy (idx);
+  return NULL;
+}
+
+/* Allocate FP's type cache and build the member indexes of all its types that
+   need them, so that neither need ever change while FP is LCTF_CONCURRENT.  */
+
+int
+ctf_type_caches_prepare (ctf_file_t *fp)
+{
+  uint32_t id;
+
+  if (fp->ctf_type_cache == NULL && ctf_type_cache_alloc (fp) < 0)
+    return (ctf_set_errno (fp, ENOMEM));
+
+  for (id = 1; id <= fp->ctf_typemax; id++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, id);
+      uint32_t kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      ctf_id_t type = LCTF_INDEX_TO_TYPE (fp, id, fp->ctf_flags & LCTF_CHILD);
+
+      if ((kind != CTF_K_STRUCT && kind != CTF_K_UNION && kind != CTF_K_ENUM)
+	  || LCTF_INFO_VLEN (fp, tp->ctt_info) < CTF_MEMBIDX_THRESH)
+	continue;
+
+      if (ctf_member_index (fp, type, tp, 0) == NULL
+	  || (kind == CTF_K_ENUM && ctf_member_index (fp, type, tp, 1) == NULL))
+	return (ctf_set_errno (fp, ENOMEM));
+    }
+
+  return 0;
+}
+
+/* Look KEY up in the member index of TYPE, returning one more than the
+   position of the matching member, zero if there is none, or -1 if there is
+   no index.  */
+
+static ssize_t
+ctf_member_index_lookup (ctf_file_t *fp, ctf_id_t type, const ctf_type_t *tp,
+			 int byvalue, const void *key)
+{
+  ctf_dynhash_t *idx;
+
+  if ((idx = ctf_member_index (fp, type, tp, byvalue)) == NULL)
+    return -1;
+
+  return (ssize_t) (uintptr_t) ctf_dynhash_lookup (idx, key);
+}
+
 /* Return the type and offset for a given member of a STRUCT or UNION.  */
 
 int
@@ -925,11 +1360,23 @@ ctf_member_info (ctf_file_t *fp, ctf_id_t type, const char *name,
 
   if ((dtd = ctf_dynamic_type (fp, type)) == NULL)
     {
+      ssize_t i = ctf_member_index_lookup (fp, type, tp, 0, name);
+
+      if (i == 0)
+	return (ctf_set_errno (ofp, ECTF_NOMEMBNAM));
+
       if (size < CTF_LSTRUCT_THRESH)
 	{
 	  const ctf_member_t *mp = (const ctf_member_t *) ((uintptr_t) tp +
 							   increment);
 
+	  if (i > 0)
+	    {
+	      mip->ctm_type = mp[i - 1].ctm_type;
+	      mip->ctm_offset = mp[i - 1].ctm_offset;
+	      return 0;
+	    }
+
 	  for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, mp++)
 	    {
 	      if (strcmp (ctf_strptr (fp, mp->ctm_name), name) == 0)
@@ -945,6 +1392,13 @@ ctf_member_info (ctf_file_t *fp, ctf_id_t type, const char *name,
 	  const ctf_lmember_t *lmp = (const ctf_lmember_t *) ((uintptr_t) tp +
 							      increment);
 
+	  if (i > 0)
+	    {
+	      mip->ctm_type = lmp[i - 1].ctlm_type;
+	      mip->ctm_offset = (unsigned long) CTF_LMEM_OFFSET (&lmp[i - 1]);
+	      return 0;
+	    }
+
 	  for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, lmp++)
 	    {
 	      if (strcmp (ctf_strptr (fp, lmp->ctlm_name), name) == 0)
@@ -1037,9 +1491,17 @@ ctf_enum_name (ctf_file_t *fp, ctf_id_t type, int value)
 
   if ((dtd = ctf_dynamic_type (ofp, type)) == NULL)
     {
+      ssize_t i;
+
       ep = (const ctf_enum_t *) ((uintptr_t) tp + increment);
 
-      for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, ep++)
+      i = ctf_member_index_lookup (fp, type, tp, 1,
+				   (const void *) (intptr_t) value);
+      if (i > 0)
+	return (ctf_strptr (fp, ep[i - 1].cte_name));
+
+      for (n = i < 0 ? LCTF_INFO_VLEN (fp, tp->ctt_info) : 0; n != 0;
+	   n--, ep++)
 	{
 	  if (ep->cte_value == value)
 	    return (ctf_strptr (fp, ep->cte_name));
@@ -1092,7 +1554,17 @@ ctf_enum_value (ctf_file_t * fp, ctf_id_t type, const char *name, int *valp)
 
   if ((dtd = ctf_dynamic_type (ofp, type)) == NULL)
     {
-      for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, ep++)
+      ssize_t i = ctf_member_index_lookup (fp, type, tp, 0, name);
+
+      if (i > 0)
+	{
+	  if (valp != NULL)
+	    *valp = ep[i - 1].cte_value;
+	  return 0;
+	}
+
+      for (n = i < 0 ? LCTF_INFO_VLEN (fp, tp->ctt_info) : 0; n != 0;
+	   n--, ep++)
 	{
 	  if (strcmp (ctf_strptr (fp, ep->cte_name), name) == 0)
 	    {
@@ -1198,93 +1670,289 @@ ctf_func_type_args (ctf_file_t *fp, ctf_id_t type, uint32_t argc, ctf_id_t *argv
   return 0;
 }
 
-/* Recursively visit the members of any type.  This function is used as the
-   engine for ctf_type_visit, below.  We resolve the input type, recursively
-   invoke ourself for each type member if the type is a struct or union, and
-   then invoke the callback function on the current type.  If any callback
-   returns non-zero, we abort and percolate the error code back up to the top.  */
+/* One struct or union in the middle of being visited by ctf_type_visit.
+   Static types step CVF_MEMBERS through an array of ctf_member_t (or, if
+   CVF_LARGE, ctf_lmember_t), CVF_NLEFT of which remain; dynamic types step
+   CVF_DMD through the list of members instead.  */
+
+typedef struct ctf_visit_frame
+{
+  ctf_file_t *cvf_fp;		/* Dict the type's members are in.  */
+  const unsigned char *cvf_members; /* Next static member.  */
+  ctf_dmdef_t *cvf_dmd;		/* Next dynamic member.  */
+  uint32_t cvf_nleft;		/* Number of static members left.  */
+  int cvf_large;		/* Members are ctf_lmember_t.  */
+  unsigned long cvf_offset;	/* Offset of the type itself.  */
+} ctf_visit_frame_t;
+
+/* Visit the members of any type: the engine for ctf_type_visit and
+   ctf_type_layout, below.  We resolve each type, invoke the callback on it,
+   and if it is a struct or union push a frame on to an explicit stack and
+   descend into its members, so deeply-nested types use heap rather than
+   machine stack.  If any callback returns non-zero, we abort and return that
+   value.  */
 
 static int
-ctf_type_rvisit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func,
-		 void *arg, const char *name, unsigned long offset, int depth)
+ctf_type_visit_internal (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func,
+			 void *arg)
 {
-  ctf_id_t otype = type;
-  const ctf_type_t *tp;
-  const ctf_dtdef_t *dtd;
-  ssize_t size, increment;
-  uint32_t kind, n;
+  ctf_visit_frame_t *stack = NULL;
+  size_t nframes = 0, maxframes = 0;
+  const char *name = "";
+  unsigned long offset = 0;
   int rc;
 
-  if ((type = ctf_type_resolve (fp, type)) == CTF_ERR)
-    return -1;			/* errno is set for us.  */
+  for (;;)
+    {
+      ctf_file_t *tfp = fp;
+      ctf_visit_frame_t *fr;
+      const ctf_type_t *tp;
+      const ctf_dtdef_t *dtd;
+      ctf_id_t rtype;
+      ssize_t size, increment;
+      uint32_t kind;
+
+      if ((rtype = ctf_type_resolve (fp, type)) == CTF_ERR)
+	{
+	  rc = -1;			/* errno is set for us.  */
+	  break;
+	}
 
-  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
-    return -1;			/* errno is set for us.  */
+      if ((tp = ctf_lookup_by_id (&tfp, rtype)) == NULL)
+	{
+	  rc = -1;			/* errno is set for us.  */
+	  break;
+	}
 
-  if ((rc = func (name, otype, offset, depth, arg)) != 0)
-    return rc;
+      if ((rc = func (name, type, offset, (int) nframes, arg)) != 0)
+	break;
 
-  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      kind = LCTF_INFO_KIND (tfp, tp->ctt_info);
 
-  if (kind != CTF_K_STRUCT && kind != CTF_K_UNION)
-    return 0;
+      if (kind == CTF_K_STRUCT || kind == CTF_K_UNION)
+	{
+	  if (nframes == maxframes)
+	    {
+	      size_t newmax = maxframes ? maxframes * 2 : 16;
+	      ctf_visit_frame_t *newstack;
 
-  (void) ctf_get_ctt_size (fp, tp, &size, &increment);
+	      if ((newstack = realloc (stack, newmax * sizeof (*stack))) == NULL)
+		{
+		  rc = ctf_set_errno (tfp, ENOMEM);
+		  break;
+		}
+	      stack = newstack;
+	      maxframes = newmax;
+	    }
 
-  if ((dtd = ctf_dynamic_type (fp, type)) == NULL)
-    {
-      if (size < CTF_LSTRUCT_THRESH)
+	  fr = &stack[nframes++];
+	  (void) ctf_get_ctt_size (tfp, tp, &size, &increment);
+
+	  fr->cvf_fp = tfp;
+	  fr->cvf_offset = offset;
+	  fr->cvf_members = (const unsigned char *) tp + increment;
+	  fr->cvf_large = size >= CTF_LSTRUCT_THRESH;
+	  fr->cvf_dmd = NULL;
+	  fr->cvf_nleft = 0;
+
+	  if ((dtd = ctf_dynamic_type (tfp, rtype)) != NULL)
+	    fr->cvf_dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
+	  else
+	    fr->cvf_nleft = LCTF_INFO_VLEN (tfp, tp->ctt_info);
+	}
+
+      /* Pop every exhausted frame: the innermost remaining one has the
+	 member to visit next.  */
+
+      while (nframes > 0 && stack[nframes - 1].cvf_nleft == 0
+	     && stack[nframes - 1].cvf_dmd == NULL)
+	nframes--;
+
+      if (nframes == 0)
+	break;
+
+      fr = &stack[nframes - 1];
+      fp = fr->cvf_fp;
+
+      if (fr->cvf_dmd != NULL)
 	{
-	  const ctf_member_t *mp = (const ctf_member_t *) ((uintptr_t) tp +
-							   increment);
+	  name = fr->cvf_dmd->dmd_name;
+	  type = fr->cvf_dmd->dmd_type;
+	  offset = fr->cvf_offset + fr->cvf_dmd->dmd_offset;
+	  fr->cvf_dmd = ctf_list_next (fr->cvf_dmd);
+	}
+      else if (!fr->cvf_large)
+	{
+	  const ctf_member_t *mp = (const ctf_member_t *) fr->cvf_members;
 
-	  for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, mp++)
-	    {
-	      if ((rc = ctf_type_rvisit (fp, mp->ctm_type,
-					 func, arg, ctf_strptr (fp,
-								mp->ctm_name),
-					 offset + mp->ctm_offset,
-					 depth + 1)) != 0)
-		return rc;
-	    }
+	  name = ctf_strptr (fp, mp->ctm_name);
+	  type = mp->ctm_type;
+	  offset = fr->cvf_offset + mp->ctm_offset;
+	  fr->cvf_members += sizeof (ctf_member_t);
+	  fr->cvf_nleft--;
 	}
       else
 	{
-	  const ctf_lmember_t *lmp = (const ctf_lmember_t *) ((uintptr_t) tp +
-							      increment);
+	  const ctf_lmember_t *lmp = (const ctf_lmember_t *) fr->cvf_members;
 
-	  for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, lmp++)
-	    {
-	      if ((rc = ctf_type_rvisit (fp, lmp->ctlm_type,
-					 func, arg, ctf_strptr (fp,
-								lmp->ctlm_name),
-					 offset + (unsigned long) CTF_LMEM_OFFSET (lmp),
-					 depth + 1)) != 0)
-		return rc;
-	    }
+	  name = ctf_strptr (fp, lmp->ctlm_name);
+	  type = lmp->ctlm_type;
+	  offset = fr->cvf_offset + (unsigned long) CTF_LMEM_OFFSET (lmp);
+	  fr->cvf_members += sizeof (ctf_lmember_t);
+	  fr->cvf_nleft--;
 	}
     }
-  else
+
+  free (stack);
+  return rc;
+}
+
+/* Visit the members of any type, recursively.  We pass the name, member
+   type, offset and nesting depth of the type itself and then each member, in
+   depth-first order, to the specified callback function.  */
+
+int
+ctf_type_visit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func, void *arg)
+{
+  return ctf_type_visit_internal (fp, type, func, arg);
+}
+
+/* A flattened type layout, as cached in ctf_layouts.  */
+
+typedef struct ctf_layout
+{
+  size_t cly_nents;
+  ctf_layout_ent_t cly_ents[];
+} ctf_layout_t;
+
+typedef struct ctf_layout_arg
+{
+  ctf_layout_t *cla_layout;
+  size_t cla_size;
+} ctf_layout_arg_t;
+
+static int
+ctf_type_layout_add (const char *name, ctf_id_t type, unsigned long offset,
+		     int depth, void *arg_)
+{
+  ctf_layout_arg_t *arg = (ctf_layout_arg_t *) arg_;
+  ctf_layout_t *layout = arg->cla_layout;
+  ctf_layout_ent_t *ent;
+
+  if (layout == NULL || layout->cly_nents == arg->cla_size)
     {
-      ctf_dmdef_t *dmd;
+      size_t newsize = arg->cla_size ? arg->cla_size * 2 : 16;
 
-      for (dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
-	   dmd != NULL; dmd = ctf_list_next (dmd))
-	{
-	  if ((rc = ctf_type_rvisit (fp, dmd->dmd_type, func, arg,
-				     dmd->dmd_name, dmd->dmd_offset,
-				     depth + 1)) != 0)
-	    return rc;
-	}
+      if ((layout = realloc (layout, sizeof (ctf_layout_t)
+			     + newsize * sizeof (ctf_layout_ent_t))) == NULL)
+	return ENOMEM;
+
+      if (arg->cla_layout == NULL)
+	layout->cly_nents = 0;
+      arg->cla_layout = layout;
+      arg->cla_size = newsize;
     }
 
+  ent = &layout->cly_ents[layout->cly_nents++];
+  ent->ctl_name = name;
+  ent->ctl_type = type;
+  ent->ctl_offset = offset;
+  ent->ctl_depth = depth;
+
   return 0;
 }
 
-/* Recursively visit the members of any type.  We pass the name, member
- type, and offset of each member to the specified callback function.  */
-int
-ctf_type_visit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func, void *arg)
+/* Return the layout of TYPE: an array of one entry for it and one entry
+   for every member of it, recursively, in the order ctf_type_visit would
+   visit them, and with the same name, type, offset and depth.  The number of
+   entries is returned in *NENTSP.
+
+   The array belongs to FP.  Layouts of read-only dicts are built once and
+   remain valid until the dict is closed.  Writable dicts are treated as by
+   the type cache: once modified, every call builds a new layout, freeing the
+   one from the last call for the same type.  */
+
+const ctf_layout_ent_t *
+ctf_type_layout (ctf_file_t *fp, ctf_id_t type, size_t *nentsp)
 {
-  return (ctf_type_rvisit (fp, type, func, arg, "", 0, 0));
+  ctf_file_t *ofp = fp;
+  ctf_file_t *cfp;
+  ctf_layout_arg_t arg = { NULL, 0 };
+  ctf_layout_t *layout;
+  ctf_type_cache_t *tc;
+  int rc;
+
+  /* Parent types are cached in the parent, if it can be cached.  Other types
+     are cached in FP, but only so they can be freed: they are never looked
+     up.  Concurrently-readable dicts keep layouts in their type cache instead,
+     so that one can be added without disturbing other readers: types with
+     no cache entry there have no layout either, since they do not exist.  */
+
+  tc = NULL;
+  if ((cfp = ctf_type_cache_owner (fp, type)) != NULL
+      && (cfp->ctf_flags & LCTF_CONCURRENT))
+    {
+      if ((tc = ctf_type_cache (fp, type)) == NULL)
+	{
+	  ctf_set_errno (ofp, ECTF_BADID);
+	  return NULL;
+	}
+
+      if ((layout = __atomic_load_n (&tc->ctc_layout,
+				     __ATOMIC_ACQUIRE)) != NULL)
+	goto found;
+    }
+  else if (cfp == NULL)
+    cfp = fp;
+  else if (cfp->ctf_layouts != NULL
+	   && (layout = ctf_dynhash_lookup (cfp->ctf_layouts,
+					    (void *) type)) != NULL)
+    goto found;
+
+  if (tc == NULL && cfp->ctf_layouts == NULL
+      && (cfp->ctf_layouts = ctf_dynhash_create (ctf_hash_integer,
+						 ctf_hash_eq_integer,
+						 NULL, free)) == NULL)
+    {
+      ctf_set_errno (ofp, ENOMEM);
+      return NULL;
+    }
+
+  if ((rc = ctf_type_visit_internal (fp, type, ctf_type_layout_add,
+				     &arg)) != 0)
+    {
+      free (arg.cla_layout);
+
+      /* Visitor failures have set the errno already.  */
+      if (rc > 0)
+	ctf_set_errno (ofp, rc);
+      return NULL;
+    }
+
+  layout = arg.cla_layout;
+
+  if (tc != NULL)
+    {
+      ctf_layout_t *expected = NULL;
+
+      /* Another reader may have got there first: use its layout.  */
+      if (!__atomic_compare_exchange_n (&tc->ctc_layout, &expected, layout,
+					0, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE))
+	{
+	  free (layout);
+	  layout = expected;
+	}
+    }
+  else if (ctf_dynhash_insert (cfp->ctf_layouts, (void *) type, layout) < 0)
+    {
+      free (layout);
+      ctf_set_errno (ofp, ENOMEM);
+      return NULL;
+    }
+
+ found:
+  if (nentsp)
+    *nentsp = layout->cly_nents;
+  return layout->cly_ents;
 }
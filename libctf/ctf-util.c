@@ -78,6 +78,131 @@ ctf_list_empty_p (ctf_list_t *lp)
   return (lp->l_next == NULL && lp->l_prev == NULL);
 }
 
+/* Return the size class of an arena allocation of SIZE bytes, or
+   CTF_ARENA_NFREE if allocations of that size are never put on free lists.  */
+
+static size_t
+ctf_arena_class (size_t size)
+{
+  size_t class = (size + CTF_ARENA_ALIGN - 1) / CTF_ARENA_ALIGN;
+
+  return class < CTF_ARENA_NFREE ? class : CTF_ARENA_NFREE;
+}
+
+/* Allocate SIZE bytes from the arena, reusing a released allocation of the
+   same size class if there is one.  Returns NULL if out of memory.  */
+
+void *
+ctf_arena_alloc (ctf_arena_t *arena, size_t size)
+{
+  ctf_arena_block_t *block = arena->ca_blocks;
+  size_t class;
+  void *ret;
+
+  if (size == 0)
+    size = 1;
+
+  class = ctf_arena_class (size);
+  if (class < CTF_ARENA_NFREE && arena->ca_free[class] != NULL)
+    {
+      ret = arena->ca_free[class];
+      arena->ca_free[class] = *(void **) ret;
+      return ret;
+    }
+
+  size = (size + CTF_ARENA_ALIGN - 1) & ~(size_t) (CTF_ARENA_ALIGN - 1);
+
+  if (block == NULL || block->cab_size - block->cab_used < size)
+    {
+      size_t block_size = CTF_ARENA_BLOCK;
+
+      /* Big allocations get a block of their own, behind the current one so
+	 that the rest of the current block is not wasted.  */
+
+      if (size > CTF_ARENA_BLOCK / 4)
+	block_size = size;
+
+      if ((block = malloc (sizeof (ctf_arena_block_t) + block_size)) == NULL)
+	return NULL;
+
+      block->cab_size = block_size;
+      block->cab_used = 0;
+
+      if (block_size != CTF_ARENA_BLOCK && arena->ca_blocks != NULL)
+	{
+	  block->cab_next = arena->ca_blocks->cab_next;
+	  arena->ca_blocks->cab_next = block;
+	}
+      else
+	{
+	  block->cab_next = arena->ca_blocks;
+	  arena->ca_blocks = block;
+	}
+    }
+
+  ret = (char *) block->cab_data + block->cab_used;
+  block->cab_used += size;
+  return ret;
+}
+
+/* Copy a string into the arena.  */
+
+char *
+ctf_arena_strdup (ctf_arena_t *arena, const char *str)
+{
+  size_t len = strlen (str) + 1;
+  char *ret;
+
+  if ((ret = ctf_arena_alloc (arena, len)) == NULL)
+    return NULL;
+
+  memcpy (ret, str, len);
+  return ret;
+}
+
+/* Release an allocation of SIZE bytes for reuse.  Allocations too large for
+   any size class are simply forgotten until the arena is freed.  */
+
+void
+ctf_arena_release (ctf_arena_t *arena, void *ptr, size_t size)
+{
+  size_t class = ctf_arena_class (size);
+
+  if (ptr == NULL || class >= CTF_ARENA_NFREE || class == 0)
+    return;
+
+  *(void **) ptr = arena->ca_free[class];
+  arena->ca_free[class] = ptr;
+}
+
+/* Free everything in the arena, leaving it empty.  */
+
+void
+ctf_arena_free (ctf_arena_t *arena)
+{
+  ctf_arena_block_t *block, *next;
+
+  for (block = arena->ca_blocks; block != NULL; block = next)
+    {
+      next = block->cab_next;
+      free (block);
+    }
+  memset (arena, 0, sizeof (ctf_arena_t));
+}
+
+/* Return the number of bytes of memory the arena holds.  */
+
+size_t
+ctf_arena_size (const ctf_arena_t *arena)
+{
+  const ctf_arena_block_t *block;
+  size_t size = 0;
+
+  for (block = arena->ca_blocks; block != NULL; block = block->cab_next)
+    size += sizeof (ctf_arena_block_t) + block->cab_size;
+  return size;
+}
+
 /* Convert a 32-bit ELF symbol into Elf64 and return a pointer to it.  */
 
 Elf64_Sym *
@@ -154,12 +279,21 @@ ctf_set_open_errno (int *errp, int error)
   return NULL;
 }
 
-/* Store the specified error code into the CTF container, and then return
-   CTF_ERR / -1 for the benefit of the caller. */
+/* The error code of the last failed operation of this thread on any
+   concurrently-readable container.  */
+
+__thread int _libctf_thread_errno;
+
+/* Store the specified error code into the CTF container (or into the
+   per-thread slot, if the container is being read concurrently), and then
+   return CTF_ERR / -1 for the benefit of the caller. */
 
 unsigned long
 ctf_set_errno (ctf_file_t * fp, int err)
 {
-  fp->ctf_errno = err;
+  if (fp->ctf_flags & LCTF_CONCURRENT)
+    _libctf_thread_errno = err;
+  else
+    fp->ctf_errno = err;
   return CTF_ERR;
 }
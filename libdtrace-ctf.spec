@@ -12,8 +12,8 @@ BuildRequires: rpm
 Name:         libdtrace-ctf
 License:      GPLv2
 Group:        Development/Libraries
-Requires:     gcc binutils zlib glib2
-BuildRequires: binutils-devel kernel-headers glibc-headers glib2-devel zlib-devel
+Requires:     gcc binutils zlib
+BuildRequires: binutils-devel kernel-headers glibc-headers zlib-devel
 Summary:      Compact Type Format library.
 Version:      1.2.0
 Release:      0.2%{?dist}
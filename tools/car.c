@@ -21,11 +21,14 @@
 #include <string.h>
 
 #include <ctf-impl.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 static void
 usage (int argc _libctf_unused_, char *argv[])
 {
-  fprintf (stderr, "Syntax: %s {-x|-t} [-vu] -i parent-ctf] "
+  fprintf (stderr, "Syntax: %s {-x|-t} [-vu] [-j jobs] -i parent-ctf] "
 	   "archive...\n\n", argv[0]);
   fprintf (stderr, "-x: Extract archive contents.\n");
   fprintf (stderr, "-t: List archive contents without extraction "
@@ -33,12 +36,15 @@ usage (int argc _libctf_unused_, char *argv[])
   fprintf (stderr, "-u: Upgrade the archive to the latest version while "
 	   "extracting.\n");
   fprintf (stderr, "-v: List archive contents while extracting.\n");
+  fprintf (stderr, "-j: Open, list and upgrade this many archive members "
+	   "in parallel.\n");
 }
 
 static int extraction = 0;
 static int listing_explicit = 0;
 static int quiet = 0;
 static int upgrade = 0;
+static long jobs = 1;
 
 struct visit_data
 {
@@ -81,23 +87,26 @@ ctf_strptr (ctf_file_t *fp, uint32_t name)
   return (s != NULL ? s : "(?)");
 }
 
-static int
-print_extract_ctf (ctf_file_t* fp, const char *name, void *data)
+static void
+print_header (struct visit_data *d)
 {
-  struct visit_data *d = data;
+  printf ("\n%s:\n\n", d->name);
+  printf ("%-*s %-10s %-8s %-8s\n\n",
+	  (int) d->colsize, "Name", "Size", "Types", "Vars");
+  d->printed_header = 1;
+}
 
+/*
+ * List and/or upgrade one archive member, printing the listing to OUT.  On
+ * error, return -1 and an error message in *ERRMSG.
+ */
+static int
+list_upgrade_ctf (ctf_file_t *fp, const char *name, struct visit_data *d,
+		  FILE *out, char **errmsg)
+{
   if (!quiet)
-    {
-      if (!d->printed_header)
-	{
-	  printf ("\n%s:\n\n", d->name);
-	  printf ("%-*s %-10s %-8s %-8s\n\n",
-		  (int) d->colsize, "Name", "Size", "Types", "Vars");
-	  d->printed_header = 1;
-	}
-      printf ("%-*s %-10zi %-8zi %-8zi\n", (int) d->colsize, name,
-	      fp->ctf_size, fp->ctf_typemax, fp->ctf_nvars);
-    }
+    fprintf (out, "%-*s %-10zi %-8zi %-8zi\n", (int) d->colsize, name,
+	     fp->ctf_size, fp->ctf_typemax, fp->ctf_nvars);
 
   if (extraction && upgrade)
     {
@@ -108,20 +117,224 @@ print_extract_ctf (ctf_file_t* fp, const char *name, void *data)
       if ((fd = open (fn, O_WRONLY | O_CREAT | O_TRUNC |
 		      O_CLOEXEC, 0666)) < 0)
 	{
-	  fprintf (stderr, "Cannot open %s: %s\n", fn, strerror (errno));
-	  exit (1);
+	  if (asprintf (errmsg, "Cannot open %s: %s\n", fn,
+			strerror (errno)) < 0)
+	    *errmsg = NULL;
+	  return -1;
 	}
       if (ctf_compress_write (fp, fd) < 0)
 	{
-	  fprintf (stderr, "Cannot write to %s: %s\n",
-		   fn, ctf_errmsg (ctf_errno (fp)));
-	  exit (1);
+	  if (asprintf (errmsg, "Cannot write to %s: %s\n",
+			fn, ctf_errmsg (ctf_errno (fp))) < 0)
+	    *errmsg = NULL;
+	  close (fd);
+	  return -1;
 	}
       close (fd);
     }
   return (0);
 }
 
+static int
+print_extract_ctf (ctf_file_t* fp, const char *name, void *data)
+{
+  struct visit_data *d = data;
+  char *errmsg = NULL;
+
+  if (!quiet && !d->printed_header)
+    print_header (d);
+
+  if (list_upgrade_ctf (fp, name, d, stdout, &errmsg) < 0)
+    {
+      fprintf (stderr, "%s", errmsg ? errmsg : "Out of memory\n");
+      exit (1);
+    }
+  return (0);
+}
+
+/*
+ * Parallel listing and upgrading.  The members are opened and processed on a
+ * pool of threads, each writing to its own buffer, and the buffers are then
+ * printed in member order, so the output is the same as with one job.
+ */
+
+struct member_job
+{
+  const char *name;
+  const void *content;
+  size_t size;
+  int model;
+  char *out;
+  size_t outlen;
+  char *errmsg;
+  int failed;
+};
+
+struct member_jobs
+{
+  struct visit_data *d;
+  struct member_job *jobs;
+  size_t njobs;
+  size_t alloc;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;
+#endif
+  size_t next;
+};
+
+static int
+collect_member (const char *name, const void *content, size_t size,
+		void *data)
+{
+  struct member_jobs *j = data;
+
+  if (j->njobs == j->alloc)
+    {
+      size_t alloc = j->alloc ? j->alloc * 2 : 64;
+      struct member_job *new_jobs;
+
+      if ((new_jobs = realloc (j->jobs, alloc * sizeof (struct member_job)))
+	  == NULL)
+	{
+	  fprintf (stderr, "Out of memory collecting archive members\n");
+	  exit (1);
+	}
+      j->jobs = new_jobs;
+      j->alloc = alloc;
+    }
+
+  memset (&j->jobs[j->njobs], 0, sizeof (struct member_job));
+  j->jobs[j->njobs].name = name;
+  j->jobs[j->njobs].content = content;
+  j->jobs[j->njobs].size = size;
+  j->njobs++;
+
+  if (strlen (name) > j->d->colsize)
+    j->d->colsize = strlen (name);
+
+  return (0);
+}
+
+static void
+process_member (struct visit_data *d, struct member_job *job)
+{
+  ctf_file_t *fp;
+  FILE *out;
+  int err;
+
+  if ((out = open_memstream (&job->out, &job->outlen)) == NULL)
+    {
+      job->failed = 1;
+      return;
+    }
+
+  if ((fp = ctf_simple_open (job->content, job->size, NULL, 0, 0,
+			     NULL, 0, &err)) == NULL)
+    {
+      if (asprintf (&job->errmsg, "Cannot open archive member %s: %s\n",
+		    job->name, ctf_errmsg (err)) < 0)
+	job->errmsg = NULL;
+      job->failed = 1;
+    }
+  else
+    {
+      ctf_setmodel (fp, job->model);
+      if (list_upgrade_ctf (fp, job->name, d, out, &job->errmsg) < 0)
+	job->failed = 1;
+      ctf_file_close (fp);
+    }
+
+  fclose (out);
+}
+
+static void *
+member_worker (void *data)
+{
+  struct member_jobs *j = data;
+
+  for (;;)
+    {
+      size_t i;
+
+#ifdef HAVE_PTHREAD_H
+      pthread_mutex_lock (&j->lock);
+#endif
+      i = j->next++;
+#ifdef HAVE_PTHREAD_H
+      pthread_mutex_unlock (&j->lock);
+#endif
+      if (i >= j->njobs)
+	break;
+
+      process_member (j->d, &j->jobs[i]);
+    }
+  return NULL;
+}
+
+/*
+ * List and/or upgrade all the members of ARC on JOBS threads.  Return 0, or -1
+ * if ARC is not an archive, in which case nothing is done.
+ */
+static int
+parallel_list_upgrade (ctf_archive_t *arc, struct visit_data *d)
+{
+  struct member_jobs j;
+  size_t i;
+#ifdef HAVE_PTHREAD_H
+  pthread_t *threads;
+  long nthreads = 0;
+#endif
+
+  memset (&j, 0, sizeof (struct member_jobs));
+  j.d = d;
+
+  if (ctf_archive_raw_iter (arc, collect_member, &j) < 0)
+    return -1;
+  d->colsize += 2;
+
+  for (i = 0; i < j.njobs; i++)
+    j.jobs[i].model = le64toh (arc->ctfi_archive->ctfa_model);
+
+  if (!quiet && j.njobs > 0)
+    print_header (d);
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init (&j.lock, NULL);
+
+  /* This thread is also a worker.  */
+  if ((threads = calloc (jobs - 1, sizeof (pthread_t))) != NULL)
+    for (nthreads = 0; nthreads < jobs - 1; nthreads++)
+      if (pthread_create (&threads[nthreads], NULL, member_worker, &j) != 0)
+	break;
+#endif
+
+  member_worker (&j);
+
+#ifdef HAVE_PTHREAD_H
+  for (; nthreads > 0; nthreads--)
+    pthread_join (threads[nthreads - 1], NULL);
+  free (threads);
+  pthread_mutex_destroy (&j.lock);
+#endif
+
+  for (i = 0; i < j.njobs; i++)
+    {
+      if (j.jobs[i].out)
+	fwrite (j.jobs[i].out, 1, j.jobs[i].outlen, stdout);
+      if (j.jobs[i].failed)
+	{
+	  fflush (stdout);
+	  fprintf (stderr, "%s", j.jobs[i].errmsg ? j.jobs[i].errmsg
+		   : "Out of memory\n");
+	  exit (1);
+	}
+      free (j.jobs[i].out);
+    }
+  free (j.jobs);
+
+  return 0;
+}
+
 static int
 extract_raw_ctf (const char *name, const void *content, size_t size,
 		 void *unused _libctf_unused_)
@@ -159,7 +372,7 @@ main (int argc, char *argv[])
   char **name;
   int opt;
 
-  while ((opt = getopt (argc, argv, "hxtuvi:")) != -1)
+  while ((opt = getopt (argc, argv, "hxtuvi:j:")) != -1)
     {
       switch (opt)
 	{
@@ -189,6 +402,13 @@ main (int argc, char *argv[])
 	case 'u':
 	  upgrade = 1;
 	  break;
+	case 'j':
+	  if ((jobs = strtol (optarg, NULL, 10)) < 1)
+	    {
+	      fprintf (stderr, "-j needs a positive number of jobs.\n");
+	      exit (1);
+	    }
+	  break;
 	}
     }
 
@@ -208,22 +428,31 @@ main (int argc, char *argv[])
 	  fprintf (stderr, "Cannot open %s: %s\n", *name, ctf_errmsg (err));
 	  continue;
 	}
-      if (!quiet
-	  && (err = ctf_archive_iter (arc, compute_colsize, &visit_data)) < 0)
-	{
-	  fprintf (stderr, "Error reading archive %s for colsize "
-		   "computation: %s\n", *name, ctf_errmsg (err));
-	  exit (1);
-	}
-      visit_data.colsize += 2;
 
-      if ((!quiet || upgrade)
-	  && (err = ctf_archive_iter (arc, print_extract_ctf, &visit_data)) < 0)
+      /* Parallel processing is only possible for real archives.  */
+      if (jobs == 1 || (quiet && !upgrade)
+	  || parallel_list_upgrade (arc, &visit_data) < 0)
 	{
-	  fprintf (stderr, "Error reading archive %s: %s\n", *name,
-		   ctf_errmsg (err));
-	  exit (1);
+	  if (!quiet
+	      && (err = ctf_archive_iter (arc, compute_colsize,
+					  &visit_data)) < 0)
+	    {
+	      fprintf (stderr, "Error reading archive %s for colsize "
+		       "computation: %s\n", *name, ctf_errmsg (err));
+	      exit (1);
+	    }
+	  visit_data.colsize += 2;
+
+	  if ((!quiet || upgrade)
+	      && (err = ctf_archive_iter (arc, print_extract_ctf,
+					  &visit_data)) < 0)
+	    {
+	      fprintf (stderr, "Error reading archive %s: %s\n", *name,
+		       ctf_errmsg (err));
+	      exit (1);
+	    }
 	}
+
       if (extraction && !upgrade
 	  && (err = ctf_archive_raw_iter (arc, extract_raw_ctf, &visit_data)) < 0)
 	{
@@ -0,0 +1,523 @@
+/* A libctf benchmark.
+
+   Copyright (c) 2020, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+/*
+ * Generates synthetic dicts of configurable size and times the main libctf
+ * entry points over them: opening, lookup by name, member lookup, type
+ * visiting, linking and serialization.  Results are printed one line per
+ * benchmark, as tab-separated fields under a header line, for easy comparison
+ * between libctf versions:
+ *
+ *   benchmark ops seconds ops_per_sec bytes_per_sec peak_rss_kb
+ *
+ * bytes_per_sec is 0 for benchmarks which are not naturally measured in bytes.
+ * peak_rss_kb is the peak RSS of the process so far, so it never decreases.
+ */
+
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <ctf-impl.h>
+#include <sys/ctf-api.h>
+
+struct bench_params
+{
+  long structs;				/* Number of structs.  */
+  long members;				/* Members per struct.  */
+  long typedef_depth;			/* Typedefs in each chain.  */
+  long enums;				/* Number of enums.  */
+  long cus;				/* Number of link inputs.  */
+  long iterations;			/* Iterations of each benchmark.  */
+  long threads;				/* Link threads.  */
+};
+
+static const char *prog;
+
+static void
+usage (int argc _libctf_unused_, char *argv[])
+{
+  fprintf (stderr, "Syntax: %s [-s structs] [-m members] [-t typedef-depth] "
+	   "[-e enums]\n               [-c cus] [-i iterations] "
+	   "[-j link-threads]\n\n", argv[0]);
+  fprintf (stderr, "-s: Number of structs in the generated dict (default "
+	   "10000).\n");
+  fprintf (stderr, "-m: Number of members in each struct (default 8).\n");
+  fprintf (stderr, "-t: Length of the typedef chain naming each struct "
+	   "(default 3).\n");
+  fprintf (stderr, "-e: Number of enums (default 100).\n");
+  fprintf (stderr, "-c: Number of CUs to link together (default 16).\n");
+  fprintf (stderr, "-i: Number of iterations of each benchmark (default "
+	   "5).\n");
+  fprintf (stderr, "-j: Number of threads to link with (default 1).\n");
+}
+
+static void
+die (const char *what, int err)
+{
+  fprintf (stderr, "%s: %s failed: %s\n", prog, what, ctf_errmsg (err));
+  exit (1);
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *name, unsigned long ops, size_t bytes, double seconds)
+{
+  struct rusage ru;
+
+  if (getrusage (RUSAGE_SELF, &ru) < 0)
+    ru.ru_maxrss = 0;
+
+  if (seconds <= 0)
+    seconds = 1e-9;
+
+  printf ("%s\t%lu\t%.6f\t%.1f\t%.1f\t%ld\n", name, ops, seconds,
+	  ops / seconds, bytes / seconds, ru.ru_maxrss);
+  fflush (stdout);
+}
+
+/*
+ * Generate a dict.  With CU -1, generate every struct; otherwise, generate the
+ * structs for one CU of a link: every fourth struct appears in all CUs (as if
+ * from a widely-included header), and the rest are spread across them.
+ *
+ * Each struct has a chain of typedefs naming it, a variable of the last
+ * typedef's type, and members of a mixture of integral, pointer, array, enum
+ * and typedef types.
+ */
+static ctf_file_t *
+generate (const struct bench_params *p, long cu)
+{
+  ctf_file_t *fp;
+  ctf_encoding_t enc_char = { CTF_INT_SIGNED | CTF_INT_CHAR, 0, 8 };
+  ctf_encoding_t enc_int = { CTF_INT_SIGNED, 0, 32 };
+  ctf_encoding_t enc_long = { CTF_INT_SIGNED, 0, 64 };
+  ctf_encoding_t enc_uint = { 0, 0, 32 };
+  ctf_id_t base[4];
+  ctf_id_t *enums;
+  ctf_arinfo_t ar;
+  char name[64];
+  long i, j;
+  int err;
+
+  if ((fp = ctf_create (&err)) == NULL)
+    die ("ctf_create", err);
+
+  if ((base[0] = ctf_add_integer (fp, CTF_ADD_ROOT, "char",
+				  &enc_char)) == CTF_ERR
+      || (base[1] = ctf_add_integer (fp, CTF_ADD_ROOT, "int",
+				     &enc_int)) == CTF_ERR
+      || (base[2] = ctf_add_integer (fp, CTF_ADD_ROOT, "long",
+				     &enc_long)) == CTF_ERR
+      || (base[3] = ctf_add_integer (fp, CTF_ADD_ROOT, "unsigned int",
+				     &enc_uint)) == CTF_ERR)
+    die ("ctf_add_integer", ctf_errno (fp));
+
+  ar.ctr_contents = base[0];
+  ar.ctr_index = base[1];
+
+  if ((enums = calloc (p->enums ? p->enums : 1, sizeof (ctf_id_t))) == NULL)
+    die ("calloc", ENOMEM);
+
+  for (i = 0; i < p->enums; i++)
+    {
+      snprintf (name, sizeof (name), "e%li", i);
+      if ((enums[i] = ctf_add_enum (fp, CTF_ADD_ROOT, name)) == CTF_ERR)
+	die ("ctf_add_enum", ctf_errno (fp));
+
+      for (j = 0; j < 8; j++)
+	{
+	  snprintf (name, sizeof (name), "E%li_%li", i, j);
+	  if (ctf_add_enumerator (fp, enums[i], name, j) < 0)
+	    die ("ctf_add_enumerator", ctf_errno (fp));
+	}
+    }
+
+  for (i = 0; i < p->structs; i++)
+    {
+      ctf_id_t sid, tid, ptr, tptr;
+
+      if (cu >= 0 && i % 4 != 0 && i % p->cus != cu)
+	continue;
+
+      snprintf (name, sizeof (name), "s%li", i);
+      if ((sid = ctf_add_struct (fp, CTF_ADD_ROOT, name)) == CTF_ERR)
+	die ("ctf_add_struct", ctf_errno (fp));
+
+      for (tid = sid, j = 0; j < p->typedef_depth; j++)
+	{
+	  snprintf (name, sizeof (name), "t%li_%li", i, j);
+	  if ((tid = ctf_add_typedef (fp, CTF_ADD_ROOT, name, tid)) == CTF_ERR)
+	    die ("ctf_add_typedef", ctf_errno (fp));
+	}
+
+      if ((ptr = ctf_add_pointer (fp, CTF_ADD_ROOT, sid)) == CTF_ERR
+	  || (tptr = ctf_add_pointer (fp, CTF_ADD_ROOT, tid)) == CTF_ERR)
+	die ("ctf_add_pointer", ctf_errno (fp));
+
+      for (j = 0; j < p->members; j++)
+	{
+	  ctf_id_t mtype;
+
+	  switch (j % 5)
+	    {
+	    case 0:
+	      mtype = base[(i + j) % 4];
+	      break;
+	    case 1:
+	      mtype = ptr;
+	      break;
+	    case 2:
+	      ar.ctr_nelems = j + 1;
+	      if ((mtype = ctf_add_array (fp, CTF_ADD_NONROOT,
+					  &ar)) == CTF_ERR)
+		die ("ctf_add_array", ctf_errno (fp));
+	      break;
+	    case 3:
+	      mtype = p->enums ? enums[(i + j) % p->enums] : base[1];
+	      break;
+	    default:
+	      mtype = tptr;
+	    }
+
+	  snprintf (name, sizeof (name), "m%li", j);
+	  if (ctf_add_member (fp, sid, name, mtype) < 0)
+	    die ("ctf_add_member", ctf_errno (fp));
+	}
+
+      snprintf (name, sizeof (name), "v%li", i);
+      if (ctf_add_variable (fp, name, tid) < 0)
+	die ("ctf_add_variable", ctf_errno (fp));
+    }
+
+  free (enums);
+  return fp;
+}
+
+static ctf_file_t *
+open_buf (unsigned char *buf, size_t size)
+{
+  ctf_file_t *fp;
+  int err;
+
+  if ((fp = ctf_simple_open ((const char *) buf, size, NULL, 0, 0, NULL, 0,
+			     &err)) == NULL)
+    die ("ctf_simple_open", err);
+  return fp;
+}
+
+static int
+count_visit (const char *name _libctf_unused_, ctf_id_t type _libctf_unused_,
+	     unsigned long offset _libctf_unused_, int depth _libctf_unused_,
+	     void *arg)
+{
+  unsigned long *count = arg;
+
+  (*count)++;
+  return 0;
+}
+
+static void
+bench_write_mem (const struct bench_params *p)
+{
+  double total = 0;
+  size_t bytes = 0;
+  long i;
+
+  for (i = 0; i < p->iterations; i++)
+    {
+      ctf_file_t *fp = generate (p, -1);
+      unsigned char *buf;
+      size_t size;
+      double start = now ();
+
+      if ((buf = ctf_write_mem (fp, &size, (size_t) -1)) == NULL)
+	die ("ctf_write_mem", ctf_errno (fp));
+      total += now () - start;
+      bytes += size;
+
+      free (buf);
+      ctf_file_close (fp);
+    }
+  report ("write_mem", p->iterations, bytes, total);
+}
+
+static void
+bench_bufopen (const struct bench_params *p, unsigned char *buf, size_t size)
+{
+  double start = now ();
+  long i;
+
+  for (i = 0; i < p->iterations; i++)
+    ctf_file_close (open_buf (buf, size));
+
+  report ("bufopen", p->iterations, size * p->iterations, now () - start);
+}
+
+static void
+bench_lookup_by_name (const struct bench_params *p, ctf_file_t *fp)
+{
+  unsigned long ops = 0;
+  char name[64];
+  double start = now ();
+  long i, j;
+
+  for (i = 0; i < p->iterations; i++)
+    {
+      for (j = 0; j < p->structs; j++)
+	{
+	  snprintf (name, sizeof (name), "struct s%li", j);
+	  if (ctf_lookup_by_name (fp, name) == CTF_ERR)
+	    die ("ctf_lookup_by_name", ctf_errno (fp));
+
+	  if (p->typedef_depth > 0)
+	    {
+	      snprintf (name, sizeof (name), "t%li_%li", j,
+			p->typedef_depth - 1);
+	      if (ctf_lookup_by_name (fp, name) == CTF_ERR)
+		die ("ctf_lookup_by_name", ctf_errno (fp));
+	      ops++;
+	    }
+	  ops++;
+	}
+      for (j = 0; j < p->enums; j++)
+	{
+	  snprintf (name, sizeof (name), "enum e%li", j);
+	  if (ctf_lookup_by_name (fp, name) == CTF_ERR)
+	    die ("ctf_lookup_by_name", ctf_errno (fp));
+	  ops++;
+	}
+    }
+  report ("lookup_by_name", ops, 0, now () - start);
+}
+
+static ctf_id_t *
+lookup_structs (const struct bench_params *p, ctf_file_t *fp)
+{
+  ctf_id_t *ids;
+  char name[64];
+  long i;
+
+  if ((ids = calloc (p->structs ? p->structs : 1, sizeof (ctf_id_t))) == NULL)
+    die ("calloc", ENOMEM);
+
+  for (i = 0; i < p->structs; i++)
+    {
+      snprintf (name, sizeof (name), "struct s%li", i);
+      if ((ids[i] = ctf_lookup_by_name (fp, name)) == CTF_ERR)
+	die ("ctf_lookup_by_name", ctf_errno (fp));
+    }
+  return ids;
+}
+
+static void
+bench_member_info (const struct bench_params *p, ctf_file_t *fp,
+		   const ctf_id_t *ids)
+{
+  unsigned long ops = 0;
+  ctf_membinfo_t mi;
+  char name[64];
+  double start = now ();
+  long i, j, k;
+
+  for (i = 0; i < p->iterations; i++)
+    for (j = 0; j < p->structs; j++)
+      for (k = 0; k < p->members; k++)
+	{
+	  snprintf (name, sizeof (name), "m%li", k);
+	  if (ctf_member_info (fp, ids[j], name, &mi) < 0)
+	    die ("ctf_member_info", ctf_errno (fp));
+	  ops++;
+	}
+  report ("member_info", ops, 0, now () - start);
+}
+
+static void
+bench_type_visit (const struct bench_params *p, ctf_file_t *fp,
+		  const ctf_id_t *ids)
+{
+  unsigned long ops = 0;
+  unsigned long visited = 0;
+  double start = now ();
+  long i, j;
+
+  for (i = 0; i < p->iterations; i++)
+    for (j = 0; j < p->structs; j++)
+      {
+	if (ctf_type_visit (fp, ids[j], count_visit, &visited) < 0)
+	  die ("ctf_type_visit", ctf_errno (fp));
+	ops++;
+      }
+  report ("type_visit", ops, 0, now () - start);
+}
+
+/*
+ * Link P->cus CU dicts together.  Only the link and the writeout are timed,
+ * not generation of the inputs.
+ */
+static void
+bench_link (const struct bench_params *p)
+{
+  double total = 0;
+  size_t bytes = 0;
+  long i, cu;
+
+  for (i = 0; i < p->iterations; i++)
+    {
+      ctf_file_t *out;
+      unsigned char *buf;
+      size_t size;
+      double start;
+      int err;
+
+      if ((out = ctf_create (&err)) == NULL)
+	die ("ctf_create", err);
+
+      if (p->threads > 1 && ctf_link_set_threads (out, p->threads) < 0)
+	die ("ctf_link_set_threads", ctf_errno (out));
+
+      for (cu = 0; cu < p->cus; cu++)
+	{
+	  ctf_file_t *fp = generate (p, cu);
+	  ctf_archive_t *arc;
+	  ctf_sect_t sect;
+	  char name[64];
+
+	  memset (&sect, 0, sizeof (ctf_sect_t));
+	  sect.cts_name = ".ctf";
+	  sect.cts_entsize = 1;
+	  if ((sect.cts_data = ctf_write_mem (fp, &sect.cts_size,
+					      (size_t) -1)) == NULL)
+	    die ("ctf_write_mem", ctf_errno (fp));
+	  ctf_file_close (fp);
+
+	  if ((arc = ctf_arc_bufopen (&sect, NULL, NULL, &err)) == NULL)
+	    die ("ctf_arc_bufopen", err);
+
+	  snprintf (name, sizeof (name), "cu%li.o", cu);
+	  if (ctf_link_add_ctf (out, arc, name) < 0)
+	    die ("ctf_link_add_ctf", ctf_errno (out));
+	}
+
+      start = now ();
+      if (ctf_link (out, CTF_LINK_SHARE_UNCONFLICTED) < 0)
+	die ("ctf_link", ctf_errno (out));
+      if ((buf = ctf_link_write (out, &size, (size_t) -1)) == NULL)
+	die ("ctf_link_write", ctf_errno (out));
+      total += now () - start;
+      bytes += size;
+
+      free (buf);
+      ctf_file_close (out);
+    }
+  report ("link", p->iterations, bytes, total);
+}
+
+static long
+number (const char *arg, long min)
+{
+  char *end;
+  long n = strtol (arg, &end, 10);
+
+  if (*end != '\0' || n < min)
+    {
+      fprintf (stderr, "%s: invalid number %s\n", prog, arg);
+      exit (1);
+    }
+  return n;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct bench_params p = { 10000, 8, 3, 100, 16, 5, 1 };
+  ctf_file_t *fp;
+  ctf_id_t *ids;
+  unsigned char *buf;
+  size_t size;
+  double start;
+  int opt;
+
+  prog = argv[0];
+
+  while ((opt = getopt (argc, argv, "hs:m:t:e:c:i:j:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'h':
+	  usage (argc, argv);
+	  exit (1);
+	case 's':
+	  p.structs = number (optarg, 0);
+	  break;
+	case 'm':
+	  p.members = number (optarg, 0);
+	  break;
+	case 't':
+	  p.typedef_depth = number (optarg, 0);
+	  break;
+	case 'e':
+	  p.enums = number (optarg, 0);
+	  break;
+	case 'c':
+	  p.cus = number (optarg, 1);
+	  break;
+	case 'i':
+	  p.iterations = number (optarg, 1);
+	  break;
+	case 'j':
+	  p.threads = number (optarg, 1);
+	  break;
+	default:
+	  usage (argc, argv);
+	  exit (1);
+	}
+    }
+
+  printf ("benchmark\tops\tseconds\tops_per_sec\tbytes_per_sec\t"
+	  "peak_rss_kb\n");
+
+  start = now ();
+  fp = generate (&p, -1);
+  report ("create", 1, 0, now () - start);
+
+  if ((buf = ctf_write_mem (fp, &size, (size_t) -1)) == NULL)
+    die ("ctf_write_mem", ctf_errno (fp));
+  ctf_file_close (fp);
+
+  bench_write_mem (&p);
+  bench_bufopen (&p, buf, size);
+
+  fp = open_buf (buf, size);
+  bench_lookup_by_name (&p, fp);
+
+  ids = lookup_structs (&p, fp);
+  bench_member_info (&p, fp, ids);
+  bench_type_visit (&p, fp, ids);
+  free (ids);
+  ctf_file_close (fp);
+  free (buf);
+
+  bench_link (&p);
+
+  return 0;
+}
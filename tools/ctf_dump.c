@@ -12,47 +12,110 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <ctf-impl.h>
 #include <sys/ctf-api.h>
 #include <zlib.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #define GZCHUNKSIZE (1024*512)	/* gzip uncompression chunk size.  */
 
+/*
+ * Guess the uncompressed size of the possibly-gzipped file open on FD, so that
+ * it can usually be read in one go.  The last four bytes of a gzip file are its
+ * uncompressed length, modulo 2^32.
+ */
+static size_t
+ctf_size_hint (int fd)
+{
+  struct stat st;
+  unsigned char magic[2];
+  unsigned char isize[4];
+
+  if (fstat (fd, &st) < 0 || st.st_size <= 0)
+    return GZCHUNKSIZE;
+
+  if (st.st_size < 18 || pread (fd, magic, 2, 0) != 2
+      || magic[0] != 0x1f || magic[1] != 0x8b
+      || pread (fd, isize, 4, st.st_size - 4) != 4)
+    return st.st_size;
+
+  return ((size_t) isize[0] | ((size_t) isize[1] << 8)
+	  | ((size_t) isize[2] << 16) | ((size_t) isize[3] << 24));
+}
+
+/*
+ * Read and uncompress NAME, returning an empty section if it cannot be opened
+ * and setting *ERRMSG on other errors.
+ */
 static ctf_sect_t
-ctf_uncompress (const char *name)
+ctf_uncompress (const char *name, char **errmsg)
 {
   gzFile f;
-  size_t chunklen;
-  char buf[8192];
+  int fd;
+  int chunklen;
   const char *errstr;
   int err;
 
   size_t len = 0;
+  size_t alloc;
   char *result = NULL;
   ctf_sect_t sect = { 0 };
 
-  f = gzopen (name, "r");
-  if (!f)
+  if ((fd = open (name, O_RDONLY | O_CLOEXEC)) < 0)
     return sect;
 
-  while ((chunklen = gzread (f, buf, 8192)) > 0)
+  /* One more byte than the hint, so that EOF is seen with no reallocation.  */
+  alloc = ctf_size_hint (fd) + 1;
+
+  f = gzdopen (fd, "r");
+  if (!f)
     {
-      result = realloc (result, len + chunklen);
-      if (result == NULL)
+      close (fd);
+      return sect;
+    }
+
+  if ((result = malloc (alloc)) == NULL)
+    goto oom;
+
+  for (;;)
+    {
+      size_t want;
+
+      if (len == alloc)
 	{
-	  fprintf (stderr, "Cannot reallocate: OOM\n");
-	  exit (1);
+	  char *new_result;
+
+	  alloc *= 2;
+	  if ((new_result = realloc (result, alloc)) == NULL)
+	    goto oom;
+	  result = new_result;
 	}
-      memcpy (result + len, buf, chunklen);
+
+      want = alloc - len;
+      if (want > INT_MAX)
+	want = INT_MAX;
+
+      if ((chunklen = gzread (f, result + len, want)) <= 0)
+	break;
       len += chunklen;
     }
 
   errstr = gzerror (f, &err);
   if ((err != Z_OK) && (err != Z_STREAM_END))
     {
-      fprintf (stderr, "zlib error: %s\n", errstr);
-      exit (2);
+      if (asprintf (errmsg, "zlib error: %s\n", errstr) < 0)
+	*errmsg = NULL;
+      gzclose (f);
+      free (result);
+      return sect;
     }
 
   gzclose (f);
@@ -61,51 +124,88 @@ ctf_uncompress (const char *name)
   sect.cts_size = len;
 
   return sect;
+
+ oom:
+  *errmsg = strdup ("Cannot reallocate: OOM\n");
+  gzclose (f);
+  free (result);
+  return sect;
 }
 
-static ctf_file_t *
-read_ctf (const char *file)
+/*
+ * Open FILE as a CTF file.  Return 0 and the file in *FPP, which is NULL if
+ * FILE contains no CTF data; on error, return -1 and a message in *ERRMSG.
+ */
+static int
+read_ctf_1 (const char *file, ctf_file_t **fpp, char **errmsg)
 {
-  ctf_sect_t sect = ctf_uncompress (file);
-  ctf_file_t *ctfp;
+  ctf_sect_t sect = ctf_uncompress (file, errmsg);
   int err = 0;
 
+  *fpp = NULL;
+
   if (sect.cts_data == NULL)
     {
-      fprintf (stderr, "%s open failure\n", file);
-      exit (1);
+      if (*errmsg == NULL && asprintf (errmsg, "%s open failure\n",
+				       file) < 0)
+	*errmsg = NULL;
+      return -1;
     }
 
   /* Skip 'CTF' files with no CTF data in them (there to placate the
      kernel's build system).  */
 
   if ((sect.cts_size == 0) || (sect.cts_size == 1))
-    return (NULL);
+    {
+      free ((void *) sect.cts_data);
+      return 0;
+    }
 
-  ctfp = ctf_bufopen (&sect, NULL, NULL, &err);
+  *fpp = ctf_bufopen (&sect, NULL, NULL, &err);
 
   if (err != 0)
     {
-      fprintf (stderr, "%s bufopen failure: %s\n", file, ctf_errmsg (err));
+      if (asprintf (errmsg, "%s bufopen failure: %s\n", file,
+		    ctf_errmsg (err)) < 0)
+	*errmsg = NULL;
+      free ((void *) sect.cts_data);
+      return -1;
+    }
+
+  return 0;
+}
+
+static ctf_file_t *
+read_ctf (const char *file)
+{
+  ctf_file_t *ctfp;
+  char *errmsg = NULL;
+
+  if (read_ctf_1 (file, &ctfp, &errmsg) < 0)
+    {
+      fprintf (stderr, "%s", errmsg ? errmsg : "Out of memory\n");
       exit (1);
     }
 
   return (ctfp);
 }
 
-static char *indent_lines (ctf_sect_names_t sect _libctf_unused_,
-			   char *line, void *arg)
+static void
+close_ctf (ctf_file_t *fp)
 {
-  char *spaces = arg;
-  char *new_str;
+  ctf_sect_t sect;
 
-  if (asprintf (&new_str, "%s%s", spaces, line) < 0)
-    return line;
-  return new_str;
+  sect = ctf_getdatasect (fp);
+  ctf_close (fp);
+  free ((void *) sect.cts_data);
 }
 
-static void
-dump_ctf (const char *file, ctf_file_t *fp, int quiet, const char *one_section)
+/*
+ * Dump FP to OUT.  On error, return -1 and a message in *ERRMSG.
+ */
+static int
+dump_ctf_1 (const char *file, ctf_file_t *fp, int quiet,
+	    const char *one_section, FILE *out, char **errmsg)
 {
   const char *things[] = {"Header", "Labels", "Data objects", "Function objects",
 			  "Variables", "Types", "Strings", ""};
@@ -113,13 +213,10 @@ dump_ctf (const char *file, ctf_file_t *fp, int quiet, const char *one_section)
   const char **thing;
 
   if (!quiet)
-    printf ("\nCTF file: %s\n", file);
+    fprintf (out, "\nCTF file: %s\n", file);
 
   for (i = 0, thing = things; *thing[0] ; thing++, i++)
     {
-      ctf_dump_state_t *s = NULL;
-      char *item;
-
       if (one_section && strcmp (one_section, *thing) != 0)
 	continue;
 
@@ -127,31 +224,192 @@ dump_ctf (const char *file, ctf_file_t *fp, int quiet, const char *one_section)
       if (!one_section && strcmp (*thing, "Header") == 0)
 	continue;
 
-      printf ("\n  %s:\n", *thing);
-      while ((item = ctf_dump (fp, &s, i, indent_lines,
-			       (void *) "    ")) != NULL)
+      fprintf (out, "\n  %s:\n", *thing);
+      if (ctf_dump_stream (fp, i, "    ", NULL, out) < 0)
+	goto err;
+    }
+
+  return 0;
+
+err:
+  if (asprintf (errmsg, "%s %s iteration failed: %s\n", file, *thing,
+		ctf_errmsg (ctf_errno (fp))) < 0)
+    *errmsg = NULL;
+  return -1;
+}
+
+static void
+dump_ctf (const char *file, ctf_file_t *fp, int quiet, const char *one_section)
+{
+  char *errmsg = NULL;
+
+  if (dump_ctf_1 (file, fp, quiet, one_section, stdout, &errmsg) < 0)
+    {
+      fflush (stdout);
+      fprintf (stderr, "%s", errmsg ? errmsg : "Out of memory\n");
+      exit (1);
+    }
+}
+
+/*
+ * Parallel dumping.  Each file is dumped into its own buffer by a pool of
+ * threads, and the buffers are printed in command-line order afterwards.
+ * Dicts sharing a parent cannot be used from more than one thread at once, so
+ * each thread opens its own copy of the parent.
+ */
+
+struct dump_job
+{
+  const char *name;
+  char *out;
+  size_t outlen;
+  char *errmsg;
+  int failed;
+};
+
+struct dump_jobs
+{
+  struct dump_job *jobs;
+  size_t njobs;
+  const char *parent;
+  int quiet;
+  const char *one_section;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;
+#endif
+  size_t next;
+};
+
+static void
+dump_one (struct dump_jobs *j, struct dump_job *job, ctf_file_t *pfp)
+{
+  ctf_file_t *fp;
+  FILE *out;
+
+  if ((out = open_memstream (&job->out, &job->outlen)) == NULL)
+    {
+      job->failed = 1;
+      return;
+    }
+
+  if (read_ctf_1 (job->name, &fp, &job->errmsg) < 0)
+    job->failed = 1;
+  else if (fp)
+    {
+      if (pfp)
+	ctf_import (fp, pfp);
+
+      if (dump_ctf_1 (job->name, fp, j->quiet, j->one_section, out,
+		      &job->errmsg) < 0)
+	job->failed = 1;
+      close_ctf (fp);
+    }
+
+  fclose (out);
+}
+
+static void *
+dump_worker (void *data)
+{
+  struct dump_jobs *j = data;
+  ctf_file_t *pfp = NULL;
+
+  for (;;)
+    {
+      size_t i;
+
+#ifdef HAVE_PTHREAD_H
+      pthread_mutex_lock (&j->lock);
+#endif
+      i = j->next++;
+#ifdef HAVE_PTHREAD_H
+      pthread_mutex_unlock (&j->lock);
+#endif
+      if (i >= j->njobs)
+	break;
+
+      /* The parent was already opened successfully once, so this should not
+	 fail.  */
+      if (j->parent && !pfp
+	  && read_ctf_1 (j->parent, &pfp, &j->jobs[i].errmsg) < 0)
 	{
-	  printf ("%s\n", item);
-	  free (item);
+	  j->jobs[i].failed = 1;
+	  continue;
 	}
 
-      if (ctf_errno (fp))
-	goto err;
+      dump_one (j, &j->jobs[i], pfp);
     }
 
-  return;
+  if (pfp)
+    close_ctf (pfp);
 
-err:
-  fflush (stdout);
-  fprintf (stderr, "%s %s iteration failed: %s\n", file, *thing,
-	   ctf_errmsg (ctf_errno (fp)));
-  exit (1);
+  return NULL;
+}
+
+static void
+parallel_dump (char **names, long jobs, const char *parent, int quiet,
+	       const char *one_section)
+{
+  struct dump_jobs j;
+  size_t i;
+#ifdef HAVE_PTHREAD_H
+  pthread_t *threads;
+  long nthreads = 0;
+#endif
+
+  memset (&j, 0, sizeof (struct dump_jobs));
+  for (j.njobs = 0; names[j.njobs]; j.njobs++);
+
+  if ((j.jobs = calloc (j.njobs, sizeof (struct dump_job))) == NULL)
+    {
+      fprintf (stderr, "Cannot allocate: OOM\n");
+      exit (1);
+    }
+  for (i = 0; i < j.njobs; i++)
+    j.jobs[i].name = names[i];
+  j.parent = parent;
+  j.quiet = quiet;
+  j.one_section = one_section;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init (&j.lock, NULL);
+
+  /* This thread is also a worker.  */
+  if ((threads = calloc (jobs - 1, sizeof (pthread_t))) != NULL)
+    for (nthreads = 0; nthreads < jobs - 1; nthreads++)
+      if (pthread_create (&threads[nthreads], NULL, dump_worker, &j) != 0)
+	break;
+#endif
+
+  dump_worker (&j);
+
+#ifdef HAVE_PTHREAD_H
+  for (; nthreads > 0; nthreads--)
+    pthread_join (threads[nthreads - 1], NULL);
+  free (threads);
+  pthread_mutex_destroy (&j.lock);
+#endif
+
+  for (i = 0; i < j.njobs; i++)
+    {
+      if (j.jobs[i].out)
+	fwrite (j.jobs[i].out, 1, j.jobs[i].outlen, stdout);
+      if (j.jobs[i].failed)
+	{
+	  fflush (stdout);
+	  fprintf (stderr, "%s", j.jobs[i].errmsg ? j.jobs[i].errmsg
+		   : "Out of memory\n");
+	  exit (1);
+	}
+      free (j.jobs[i].out);
+    }
+  free (j.jobs);
 }
 
 static void
 usage (int argc _libctf_unused_, char *argv[])
 {
-  fprintf (stderr, "Syntax: %s [-p parent-ctf] [-s section] q -n ctf...\n\n", argv[0]);
+  fprintf (stderr, "Syntax: %s [-p parent-ctf] [-s section] [-j jobs] q -n ctf...\n\n", argv[0]);
   fprintf (stderr, "-n: Do not dump parent's contents after loading.\n\n");
   fprintf (stderr, "-q: Quiet: do not dump the CTF filename.\n\n");
   fprintf (stderr, "-p is mandatory if any CTF files have parents.\n");
@@ -159,6 +417,7 @@ usage (int argc _libctf_unused_, char *argv[])
 	   "the same parent.\n");
   fprintf (stderr, "-s NAME: only dump one section (names are the same as in the full output\n");
   fprintf (stderr, "         e.g. \"Types\" or \"Data objects\".\n");
+  fprintf (stderr, "-j JOBS: dump this many CTF files in parallel.\n");
 }
 
 int
@@ -170,8 +429,9 @@ main (int argc, char *argv[])
   int opt;
   int skip_parent = 0;
   int quiet = 0;
+  long jobs = 1;
 
-  while ((opt = getopt (argc, argv, "hnqp:s:")) != -1)
+  while ((opt = getopt (argc, argv, "hnqp:s:j:")) != -1)
     {
       switch (opt)
 	{
@@ -191,6 +451,13 @@ main (int argc, char *argv[])
 	case 'n':
 	  skip_parent = 1;
 	  break;
+	case 'j':
+	  if ((jobs = strtol (optarg, NULL, 10)) < 1)
+	    {
+	      fprintf (stderr, "-j needs a positive number of jobs.\n");
+	      exit (1);
+	    }
+	  break;
 	}
     }
 
@@ -199,31 +466,26 @@ main (int argc, char *argv[])
   if (pfp && !skip_parent)
     dump_ctf (parent, pfp, quiet, one_section);
 
-  for (name = &argv[optind]; *name; name++)
-    {
-      ctf_file_t *fp = read_ctf (*name);
-      ctf_sect_t sect;
+  if (jobs > 1)
+    parallel_dump (&argv[optind], jobs, pfp ? parent : NULL, quiet,
+		   one_section);
+  else
+    for (name = &argv[optind]; *name; name++)
+      {
+	ctf_file_t *fp = read_ctf (*name);
 
-      if (!fp)
-	continue;
+	if (!fp)
+	  continue;
 
-      if (parent)
-	ctf_import (fp, pfp);
+	if (parent)
+	  ctf_import (fp, pfp);
 
-      dump_ctf (*name, fp, quiet, one_section);
-
-      sect = ctf_getdatasect (fp);
-      ctf_close (fp);
-      free ((void *) sect.cts_data);
-    }
+	dump_ctf (*name, fp, quiet, one_section);
+	close_ctf (fp);
+      }
 
   if (pfp)
-    {
-      ctf_sect_t sect;
-      sect = ctf_getdatasect (pfp);
-      ctf_close (pfp);
-      free ((void *) sect.cts_data);
-    }
+    close_ctf (pfp);
 
   return 0;
 }